@@ -0,0 +1,515 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <eigen3/Eigen/Dense>
+
+#include "../includes/allocation_counter.hpp"
+#include "../includes/ensemble.hpp"
+#include "../includes/mlp.hpp"
+#include "../includes/static_mlp.hpp"
+
+// ---------------------------------------- harness ----------------------------------------
+/**
+ * @brief Measurement of one benchmark.
+ */
+struct Result {
+    std::string name;
+    double ns_per_op;
+    double gflops; // 0 when the benchmark does not define a FLOP count
+    double allocs_per_op; // -1 when allocations cannot be counted
+    long iterations; // per repetition
+};
+
+/**
+ * @brief Options of a run.
+ */
+struct Options {
+    std::string out = "bench.json";
+    std::string filter;
+    double min_time = 0.05; // seconds per repetition
+    int repetitions = 5;
+    std::vector<std::string> compare; // two json files
+    double threshold = 0.10; // relative slowdown reported as a regression
+};
+
+/**
+ * @brief Time fn: warm up, find an iteration count lasting at least min_time, then keep the median over the repetitions.
+ * 
+ * @param name Benchmark name
+ * @param flops Floating point operations per call of fn (0 if not meaningful)
+ * @param fn Operation to measure
+ * @param options Run options
+ * @return Result The measurement
+ */
+Result measure(const std::string& name, double flops, const std::function<void()>& fn, const Options& options){
+    using clock = std::chrono::steady_clock;
+    fn(); // warm-up: first-touch allocations, caches, thread pool start
+
+    long iterations = 1;
+    while(true){
+        auto start = clock::now();
+        for(long i = 0; i < iterations; i++) fn();
+        double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+        if(elapsed >= options.min_time || iterations >= (1L << 30)) break;
+        iterations = elapsed > 0 ? std::max(iterations * 2, long(iterations * options.min_time / elapsed * 1.2)) : iterations * 10;
+    }
+
+    std::vector<double> samples;
+    long allocs = 0;
+    for(int r = 0; r < options.repetitions; r++){
+        long allocs_before = process_allocations();
+        auto start = clock::now();
+        for(long i = 0; i < iterations; i++) fn();
+        double elapsed = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+        allocs += process_allocations() - allocs_before;
+        samples.push_back(elapsed / iterations);
+    }
+
+    std::sort(samples.begin(), samples.end());
+    double ns = samples[samples.size() / 2];
+
+    Result result;
+    result.name = name;
+    result.ns_per_op = ns;
+    result.gflops = flops > 0 ? flops / ns : 0; // flop/ns = GFLOP/s
+    result.allocs_per_op = counts_allocations() ? double(allocs) / (iterations * options.repetitions) : -1;
+    result.iterations = iterations;
+    return result;
+}
+
+/**
+ * @brief Registered benchmarks, run in order and filtered by name.
+ */
+class Suite {
+private:
+    const Options& options;
+    std::vector<Result> results;
+
+public:
+    explicit Suite(const Options& options) : options(options) {};
+
+    /**
+     * @brief Measure fn if its name matches the filter. setup runs only for selected benchmarks.
+     */
+    void add(const std::string& name, double flops, const std::function<std::function<void()>()>& setup){
+        if(!options.filter.empty() && name.find(options.filter) == std::string::npos) return;
+
+        Result r = measure(name, flops, setup(), options);
+        std::printf("%-48s %14.1f ns/op %9.2f GFLOP/s %8.1f allocs/op\n", r.name.c_str(), r.ns_per_op, r.gflops, r.allocs_per_op);
+        std::fflush(stdout);
+        results.push_back(r);
+    }
+
+    const std::vector<Result>& get_results() const {return results;};
+};
+
+// ---------------------------------------- benchmarks ----------------------------------------
+const int WIDTHS[] = {64, 256, 1024};
+const int BATCH_SIZES[] = {32, 256};
+const int FIT_WIDTHS[] = {64, 256};
+const int THREADS[] = {1, 2, 4};
+const ActivationType ACTIVATIONS[] = {ActivationType::Linear, ActivationType::ReLU, ActivationType::Sigmoid, ActivationType::Tanh,
+        ActivationType::LeakyReLU, ActivationType::GELU, ActivationType::SiLU, ActivationType::FastSigmoid, ActivationType::FastTanh,
+        ActivationType::FastGELU, ActivationType::FastSiLU};
+
+const char* activation_name(ActivationType type){
+    switch(type){
+        case ActivationType::Linear: return "linear";
+        case ActivationType::ReLU: return "relu";
+        case ActivationType::Sigmoid: return "sigmoid";
+        case ActivationType::Tanh: return "tanh";
+        case ActivationType::LeakyReLU: return "leaky_relu";
+        case ActivationType::GELU: return "gelu";
+        case ActivationType::SiLU: return "silu";
+        case ActivationType::FastSigmoid: return "fast_sigmoid";
+        case ActivationType::FastTanh: return "fast_tanh";
+        case ActivationType::FastGELU: return "fast_gelu";
+        case ActivationType::FastSiLU: return "fast_silu";
+        default: return "custom";
+    }
+}
+
+template <typename T>
+const char* scalar_name(){
+    return sizeof(T) == sizeof(float) ? "f32" : "f64";
+}
+
+template <typename T>
+void layer_benchmarks(Suite& suite){
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+
+    for(int width : WIDTHS){
+        for(int batch : BATCH_SIZES){
+            std::string shape = std::string(scalar_name<T>()) + "/w" + std::to_string(width) + "/b" + std::to_string(batch);
+            double gemm = 2.0 * batch * width * width;
+
+            // the layer, its workspace and the data are shared by the three phases of this shape
+            auto layer = std::shared_ptr<BasicFCLayer<T>>(make_fc_layer<T>(width, width, make_activation<T>(ActivationType::Tanh)));
+            auto ws = std::make_shared<BasicLayerWorkspace<T>>();
+            auto x = std::make_shared<Matrix>(Matrix::Random(batch, width));
+            auto grad = std::make_shared<Matrix>(Matrix::Random(batch, width));
+            ws->resize(batch, width, width);
+            layer->forward(*x, *ws);
+            layer->backward(*grad, *ws);
+
+            suite.add("fc_forward/tanh/" + shape, gemm + batch * width, [=]{
+                return [=]{ layer->forward(*x, *ws); };
+            });
+            suite.add("fc_backward/tanh/" + shape, 2 * gemm + 2.0 * batch * width, [=]{
+                return [=]{ layer->backward(*grad, *ws); };
+            });
+            // tiny steps keep the weights stable across iterations
+            std::pair<std::string, std::shared_ptr<BasicOptimizer<T>>> optimizers[] = {
+                {"sgd", std::make_shared<BasicSGD<T>>(1e-9, 0.9)},
+                {"adam", std::make_shared<BasicAdam<T>>(1e-9)},
+                {"adamw", std::make_shared<BasicAdamW<T>>(1e-9)},
+                {"rmsprop", std::make_shared<BasicRMSProp<T>>(1e-9)}};
+            for(const auto& [optimizer_name, optimizer] : optimizers){
+                suite.add("fc_update/" + optimizer_name + "/" + shape, 6.0 * width * (width + 1), [=]{
+                    return [=]{
+                        optimizer->begin_step();
+                        layer->update(*ws, *optimizer, 0);
+                    };
+                });
+            }
+        }
+    }
+}
+
+template <typename T>
+void activation_benchmarks(Suite& suite){
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+    int batch = 256;
+
+    for(ActivationType type : ACTIVATIONS){
+        for(int width : WIDTHS){
+            std::string shape = std::string(activation_name(type)) + "/" + scalar_name<T>() + "/w" + std::to_string(width) + "/b" + std::to_string(batch);
+            auto func = std::shared_ptr<BasicActivationFunction<T>>(make_activation<T>(type));
+            auto z = std::make_shared<Matrix>(Matrix::Random(batch, width));
+            auto out = std::make_shared<Matrix>(batch, width);
+            double elements = double(batch) * width; // elementwise kernels count one operation per element
+
+            suite.add("activate/" + shape, elements, [=]{
+                return [=]{ *out = func->activate(*z); };
+            });
+            suite.add("derivative/" + shape, elements, [=]{
+                return [=]{ *out = func->derivative(*z); };
+            });
+        }
+    }
+}
+
+template <typename T>
+void loss_benchmarks(Suite& suite){
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+    int batch = 256;
+
+    for(int width : WIDTHS){
+        std::string shape = std::string(scalar_name<T>()) + "/w" + std::to_string(width) + "/b" + std::to_string(batch);
+        auto mse = std::make_shared<BasicMSE<T>>();
+        auto y = std::make_shared<Matrix>(Matrix::Random(batch, width));
+        auto y_pred = std::make_shared<Matrix>(Matrix::Random(batch, width));
+        auto grad = std::make_shared<Matrix>(batch, width);
+        auto sink = std::make_shared<double>(0);
+        double elements = double(batch) * width;
+
+        suite.add("mse_loss/" + shape, 3 * elements, [=]{
+            return [=]{ *sink += mse->loss(*y, *y_pred); };
+        });
+        suite.add("mse_backward/" + shape, 2 * elements, [=]{
+            return [=]{ mse->backward_into(*y, *y_pred, *grad); };
+        });
+        suite.add("mse_loss_and_gradient/" + shape, 4 * elements, [=]{
+            return [=]{ *sink += mse->loss_and_gradient(*y, *y_pred, *grad); };
+        });
+
+        // classification losses on logits, one-hot targets
+        auto softmax = std::make_shared<BasicSoftmaxCrossEntropy<T>>();
+        auto sigmoid = std::make_shared<BasicSigmoidCrossEntropy<T>>();
+        auto labels = std::make_shared<Matrix>(Matrix::Zero(batch, width));
+        for(int i = 0; i < batch; i++) (*labels)(i, i % width) = 1;
+
+        suite.add("softmax_ce_loss_and_gradient/" + shape, 6 * elements, [=]{
+            return [=]{ *sink += softmax->loss_and_gradient(*labels, *y_pred, *grad); };
+        });
+        suite.add("sigmoid_ce_loss_and_gradient/" + shape, 8 * elements, [=]{
+            return [=]{ *sink += sigmoid->loss_and_gradient(*labels, *y_pred, *grad); };
+        });
+    }
+}
+
+template <typename T>
+void fit_benchmarks(Suite& suite){
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+    int rows = 2048, features = 32, outputs = 4;
+
+    for(int width : FIT_WIDTHS){
+        for(int batch : BATCH_SIZES){
+            for(int threads : THREADS){
+                for(bool shuffle : {false, true}){
+                    std::string name = std::string("fit_epoch/") + scalar_name<T>() + "/w" + std::to_string(width) + "/b" + std::to_string(batch) + "/t" + std::to_string(threads)
+                            + (shuffle ? "/shuffled" : "");
+                    // 32 -> width (tanh) -> width (relu) -> 4 (linear), forward + backward ~ 6 flop per weight and sample
+                    double weights = double(features) * width + double(width) * width + double(width) * outputs;
+                    double flops = 6.0 * rows * weights + 6.0 * weights * (rows / batch);
+
+                    suite.add(name, flops, [=]{
+                        std::srand(42);
+                        auto model = std::make_shared<BasicMLP<T>>(features, std::vector<std::pair<int, BasicActivationFunction<T>*>>{
+                                {width, new BasicTanh<T>()}, {width, new BasicReLU<T>()}, {outputs, new BasicLinear<T>()}});
+                        model->set_num_threads(threads);
+                        auto x = std::make_shared<Matrix>(Matrix::Random(rows, features));
+                        auto y = std::make_shared<Matrix>(Matrix::Random(rows, outputs));
+                        auto x_test = std::make_shared<Matrix>(Matrix::Random(batch, features));
+                        auto y_test = std::make_shared<Matrix>(Matrix::Random(batch, outputs));
+                        auto mse = std::make_shared<BasicMSE<T>>();
+
+                        return [=]{ model->fit(*x, *y, *x_test, *y_test, 1, MinibatchOptions{batch, shuffle}, 1e-4, 0, 0.9, mse.get()); };
+                    });
+                }
+            }
+        }
+    }
+}
+
+template <typename T>
+void ensemble_benchmarks(Suite& suite){
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+    int rows = 2048, features = 5, width = 50, outputs = 3, batch = 64;
+
+    for(int num_members : {1, 16}){
+        for(int threads : THREADS){
+            if(threads > num_members) continue;
+            std::string name = std::string("ensemble_epoch/") + scalar_name<T>() + "/m" + std::to_string(num_members) + "/t" + std::to_string(threads);
+            // M models of the example topology 5 -> 50 (tanh) -> 50 (tanh) -> 3 (linear)
+            double weights = num_members * (double(features) * width + double(width) * width + double(width) * outputs);
+            double flops = 6.0 * rows * weights + 6.0 * weights * (rows / batch);
+
+            suite.add(name, flops, [=]{
+                std::vector<EnsembleMember> members;
+                for(int m = 0; m < num_members; m++) members.push_back({(unsigned)m, 1e-4, 0.9, 0});
+                auto ensemble = std::make_shared<BasicEnsemble<T>>(features, std::vector<std::pair<int, ActivationType>>{
+                        {width, ActivationType::Tanh}, {width, ActivationType::Tanh}, {outputs, ActivationType::Linear}}, members);
+                ensemble->set_num_threads(threads);
+                auto x = std::make_shared<Matrix>(Matrix::Random(rows, features));
+                auto y = std::make_shared<Matrix>(Matrix::Random(rows, outputs));
+                auto x_test = std::make_shared<Matrix>(Matrix::Random(batch, features));
+                auto y_test = std::make_shared<Matrix>(Matrix::Random(batch, outputs));
+                auto mse = std::make_shared<BasicMSE<T>>();
+
+                return [=]{ ensemble->fit(*x, *y, *x_test, *y_test, 1, MinibatchOptions{batch, false}, mse.get()); };
+            });
+        }
+    }
+}
+
+template <typename T>
+void lbfgs_benchmarks(Suite& suite){
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+    int rows = 2048, features = 5, width = 50, outputs = 3;
+
+    for(int threads : THREADS){
+        std::string name = std::string("lbfgs_iteration/") + scalar_name<T>() + "/t" + std::to_string(threads);
+        // the example topology 5 -> 50 (tanh) -> 50 (tanh) -> 3 (linear), full batch: the initial evaluation and
+        // usually a single line search step, forward + backward over every row each
+        double weights = double(features) * width + double(width) * width + double(width) * outputs;
+        double flops = 2 * 6.0 * rows * weights;
+
+        suite.add(name, flops, [=]{
+            std::srand(42);
+            auto model = std::make_shared<BasicMLP<T>>(features, std::vector<std::pair<int, BasicActivationFunction<T>*>>{
+                    {width, new BasicTanh<T>()}, {width, new BasicTanh<T>()}, {outputs, new BasicLinear<T>()}});
+            model->set_num_threads(threads);
+            auto x = std::make_shared<Matrix>(Matrix::Random(rows, features));
+            auto y = std::make_shared<Matrix>(Matrix::Random(rows, outputs));
+            auto x_test = std::make_shared<Matrix>(Matrix::Random(64, features));
+            auto y_test = std::make_shared<Matrix>(Matrix::Random(64, outputs));
+            auto mse = std::make_shared<BasicMSE<T>>();
+
+            return [=]{ model->fit_lbfgs(*x, *y, *x_test, *y_test, 1, LBFGSOptions(), mse.get()); };
+        });
+    }
+}
+
+template <typename T>
+void row_predict_benchmarks(Suite& suite){
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+    using Net = StaticMLP<5, StaticLayer<50, BasicSigmoid<T>>, StaticLayer<50, BasicSigmoid<T>>, StaticLayer<3, BasicLinear<T>>>;
+
+    // one row through the example topology 5 -> 50 (sigmoid) -> 50 (sigmoid) -> 3 (linear)
+    std::string shape = std::string(scalar_name<T>()) + "/5-50-50-3";
+    double flops = 2.0 * (5 * 50 + 50 * 50 + 50 * 3);
+    auto mlp = std::make_shared<BasicMLP<T>>(5, std::vector<std::pair<int, BasicActivationFunction<T>*>>{
+            {50, new BasicSigmoid<T>()}, {50, new BasicSigmoid<T>()}, {3, new BasicLinear<T>()}});
+    auto x = std::make_shared<Matrix>(Matrix::Random(1, 5));
+
+    suite.add("row_predict/dynamic/" + shape, flops, [=]{
+        auto scratch = std::make_shared<BasicInferenceScratch<T>>();
+        auto out = std::make_shared<Matrix>();
+        return [=]{ mlp->infer(*x, *out, *scratch); };
+    });
+    suite.add("row_predict/static/" + shape, flops, [=]{
+        auto net = std::make_shared<Net>(*mlp);
+        auto out = std::make_shared<typename Net::OutputRow>();
+        return [=]{ *out = net->predict_row(*x); };
+    });
+}
+
+template <typename T>
+void pruned_infer_benchmarks(Suite& suite){
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+    int inputs = 512, width = 1024, outputs = 10;
+    double weights = double(inputs) * width + double(width) * width + double(width) * outputs;
+
+    // the same topology magnitude pruned to several sparsities, dense GEMMs up to 80% then CSR products
+    for(double sparsity : {0.0, 0.8, 0.9, 0.95}){
+        for(int batch : {1, 64}){
+            std::string name = std::string("pruned_infer/") + scalar_name<T>() + "/s" + std::to_string(int(sparsity * 100)) + "/b" + std::to_string(batch);
+            suite.add(name, 2.0 * batch * weights * (1 - sparsity), [=]{
+                auto mlp = std::make_shared<BasicMLP<T>>(inputs, std::vector<std::pair<int, BasicActivationFunction<T>*>>{
+                        {width, new BasicReLU<T>()}, {width, new BasicReLU<T>()}, {outputs, new BasicLinear<T>()}});
+                if(sparsity > 0) mlp->prune_magnitude(sparsity);
+                auto x = std::make_shared<Matrix>(Matrix::Random(batch, inputs));
+                auto out = std::make_shared<Matrix>();
+                return [=]{ mlp->infer(*x, *out); };
+            });
+        }
+    }
+}
+
+// ---------------------------------------- output and comparison ----------------------------------------
+void write_json(const std::string& path, const std::vector<Result>& results, const Options& options){
+    std::ofstream file(path);
+    if(!file) throw std::runtime_error("cannot write " + path);
+
+    file << "{\n";
+    file << "  \"context\": {\"compiler\": \"" << __VERSION__ << "\", \"hardware_threads\": " << std::thread::hardware_concurrency()
+         << ", \"eigen_simd\": \"" << Eigen::SimdInstructionSetsInUse() << "\", \"min_time\": " << options.min_time
+         << ", \"repetitions\": " << options.repetitions << "},\n";
+    file << "  \"benchmarks\": [\n";
+    for(int i = 0; i < results.size(); i++){
+        const Result& r = results[i];
+        file << "    {\"name\": \"" << r.name << "\", \"ns_per_op\": " << r.ns_per_op << ", \"gflops\": " << r.gflops
+             << ", \"allocs_per_op\": " << r.allocs_per_op << ", \"iterations\": " << r.iterations << "}"
+             << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    file << "  ]\n}\n";
+}
+
+/**
+ * @brief Read the name -> ns_per_op pairs of a file written by write_json (one benchmark per line).
+ */
+std::map<std::string, double> read_json(const std::string& path){
+    std::ifstream file(path);
+    if(!file) throw std::runtime_error("cannot read " + path);
+
+    std::map<std::string, double> timings;
+    std::string line;
+    while(std::getline(file, line)){
+        std::size_t name = line.find("\"name\": \"");
+        std::size_t ns = line.find("\"ns_per_op\": ");
+        if(name == std::string::npos || ns == std::string::npos) continue;
+
+        name += 9;
+        timings[line.substr(name, line.find('"', name) - name)] = std::strtod(line.c_str() + ns + 13, nullptr);
+    }
+    return timings;
+}
+
+/**
+ * @brief Print the relative change of every benchmark of two runs.
+ * 
+ * @return int Number of benchmarks slower than the threshold
+ */
+int compare(const std::string& base_path, const std::string& new_path, double threshold){
+    std::map<std::string, double> base = read_json(base_path);
+    std::map<std::string, double> current = read_json(new_path);
+    int regressions = 0;
+
+    std::printf("%-48s %14s %14s %9s\n", "benchmark", "base ns/op", "new ns/op", "change");
+    for(const auto& [name, ns] : current){
+        auto it = base.find(name);
+        if(it == base.end()){
+            std::printf("%-48s %14s %14.1f %9s\n", name.c_str(), "-", ns, "new");
+            continue;
+        }
+
+        double change = ns / it->second - 1;
+        const char* flag = change > threshold ? "  REGRESSION" : (change < -threshold ? "  improved" : "");
+        regressions += change > threshold;
+        std::printf("%-48s %14.1f %14.1f %+8.1f%%%s\n", name.c_str(), it->second, ns, 100 * change, flag);
+    }
+    for(const auto& [name, ns] : base){
+        if(!current.count(name)) std::printf("%-48s %14.1f %14s %9s\n", name.c_str(), ns, "-", "removed");
+    }
+
+    std::printf("%d regression(s) above %.0f%%\n", regressions, 100 * threshold);
+    return regressions;
+}
+
+void usage(){
+    std::cout << "usage: bench [--out FILE] [--filter SUBSTRING] [--min-time SECONDS] [--repetitions N]\n"
+                 "       bench --compare BASE.json NEW.json [--threshold FRACTION]\n";
+}
+
+int main(int argc, char* argv[]){
+    Options options;
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if(arg == "--out" && has_value) options.out = argv[++i];
+        else if(arg == "--filter" && has_value) options.filter = argv[++i];
+        else if(arg == "--min-time" && has_value) options.min_time = std::atof(argv[++i]);
+        else if(arg == "--repetitions" && has_value) options.repetitions = std::max(1, std::atoi(argv[++i]));
+        else if(arg == "--threshold" && has_value) options.threshold = std::atof(argv[++i]);
+        else if(arg == "--compare" && i + 2 < argc){
+            options.compare = {argv[i + 1], argv[i + 2]};
+            i += 2;
+        }else{
+            usage();
+            return 2;
+        }
+    }
+
+    try{
+        if(!options.compare.empty()) return compare(options.compare[0], options.compare[1], options.threshold) > 0 ? 1 : 0;
+
+        Suite suite(options);
+        layer_benchmarks<double>(suite);
+        layer_benchmarks<float>(suite);
+        activation_benchmarks<double>(suite);
+        activation_benchmarks<float>(suite);
+        loss_benchmarks<double>(suite);
+        loss_benchmarks<float>(suite);
+        fit_benchmarks<double>(suite);
+        fit_benchmarks<float>(suite);
+        ensemble_benchmarks<double>(suite);
+        ensemble_benchmarks<float>(suite);
+        lbfgs_benchmarks<double>(suite);
+        lbfgs_benchmarks<float>(suite);
+        row_predict_benchmarks<double>(suite);
+        row_predict_benchmarks<float>(suite);
+        pruned_infer_benchmarks<double>(suite);
+        pruned_infer_benchmarks<float>(suite);
+
+        write_json(options.out, suite.get_results(), options);
+        std::cout << "results written to " << options.out << "\n";
+    }catch(const std::exception& e){
+        std::cerr << "bench: " << e.what() << "\n";
+        return 2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <eigen3/Eigen/Dense>
+
+#include "../includes/mlp.hpp"
+#include "../includes/batch_scorer.hpp"
+
+/**
+ * @brief Value following a flag in the arguments, or a default
+ */
+std::string argument(int argc, char* argv[], const std::string& flag, const std::string& fallback){
+    for(int i = 2; i + 1 < argc; i++){
+        if(argv[i] == flag) return argv[i + 1];
+    }
+    return fallback;
+}
+
+bool has_flag(int argc, char* argv[], const std::string& flag){
+    for(int i = 2; i < argc; i++){
+        if(argv[i] == flag) return true;
+    }
+    return false;
+}
+
+void print(const ScoringStats& stats){
+    std::cout << stats.rows << " rows in " << stats.seconds << " s: " << stats.rows_per_second() << " rows/s\n"
+              << "  busy: read " << stats.read_seconds << " s, parse " << stats.parse_seconds << " s, infer "
+              << stats.infer_seconds << " s, format " << stats.format_seconds << " s, write " << stats.write_seconds << " s\n";
+}
+
+/**
+ * @brief Score a file with a checkpoint
+ */
+int score(int argc, char* argv[]){
+    MLP mlp(argv[2]);
+    ScoringOptions options;
+    options.input_format = has_flag(argc, argv, "--binary-in") ? ScoreFormat::Binary : ScoreFormat::CSV;
+    options.output_format = has_flag(argc, argv, "--binary-out") ? ScoreFormat::Binary : ScoreFormat::CSV;
+    options.chunk_rows = std::stoi(argument(argc, argv, "--chunk-rows", "4096"));
+    options.num_workers = std::stoi(argument(argc, argv, "--workers", "0"));
+    options.depth = std::stoi(argument(argc, argv, "--depth", "0"));
+    options.delimiter = argument(argc, argv, "--delimiter", ",")[0];
+    options.skip_header = has_flag(argc, argv, "--skip-header");
+
+    ScoringStats stats = BatchScorer(mlp, options).score(argv[3], argv[4]);
+    if(std::string(argv[4]) != "-") print(stats); // the predictions go to the standard output otherwise
+    return 0;
+}
+
+/**
+ * @brief Write rows of random inputs as CSV and as a binary dataset, then score both with one worker and with
+ * one per hardware thread, and compare with loading the whole CSV into a matrix before predicting
+ */
+int demo(){
+    int num_features = 32, rows = 500000;
+    std::vector<std::pair<int, ActivationFunction*>> layers;
+    layers.push_back(std::make_pair(64, new ReLU()));
+    layers.push_back(std::make_pair(64, new ReLU()));
+    layers.push_back(std::make_pair(4, new Linear()));
+    MLP mlp(num_features, layers);
+
+    Eigen::MatrixXd x = Eigen::MatrixXd::Random(rows, num_features);
+    {
+        std::ofstream csv("inputs.csv");
+        csv.precision(17);
+        for(int i = 0; i < rows; i++){
+            for(int j = 0; j < num_features; j++) csv << x(i, j) << (j + 1 < num_features ? ',' : '\n');
+        }
+        MappedDataset::write("inputs.bin", x, Eigen::MatrixXd(rows, 0));
+    }
+
+    // baseline: parse everything into one matrix, then one predict call
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::ifstream csv("inputs.csv");
+        Eigen::MatrixXd loaded(rows, num_features);
+        char comma;
+        for(int i = 0; i < rows; i++){
+            for(int j = 0; j < num_features; j++){
+                csv >> loaded(i, j);
+                if(j + 1 < num_features) csv >> comma;
+            }
+        }
+        Eigen::MatrixXd y = mlp.predict(loaded);
+        std::ofstream out("predictions.csv");
+        out.precision(17);
+        for(int i = 0; i < rows; i++){
+            for(int j = 0; j < y.cols(); j++) out << y(i, j) << (j + 1 < y.cols() ? ',' : '\n');
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "load + predict: " << rows << " rows in " << seconds << " s: " << rows / seconds << " rows/s\n";
+
+    int hardware = std::max(1u, std::thread::hardware_concurrency());
+    for(int workers : {1, hardware}){
+        ScoringOptions options;
+        options.num_workers = workers;
+        std::cout << "csv -> csv, " << workers << " workers: ";
+        print(BatchScorer(mlp, options).score("inputs.csv", "predictions.csv"));
+
+        options.input_format = options.output_format = ScoreFormat::Binary;
+        std::cout << "binary -> binary, " << workers << " workers: ";
+        print(BatchScorer(mlp, options).score("inputs.bin", "predictions.bin"));
+        if(workers == hardware) break;
+    }
+
+    // the streamed predictions are the ones of predict
+    MappedDataset predictions("predictions.bin", false);
+    Eigen::MatrixXd features, y;
+    predictions.gather_range(0, rows, features, y);
+    std::cout << "max difference with predict: " << (y - mlp.predict(x)).cwiseAbs().maxCoeff() << "\n";
+    return 0;
+}
+
+int main(int argc, char* argv[]){
+    std::string mode = argc > 1 ? argv[1] : "demo";
+    if(mode == "score" && argc > 4) return score(argc, argv);
+    if(mode == "demo") return demo();
+
+    std::cerr << "usage: " << argv[0] << " score CHECKPOINT INPUT OUTPUT [--binary-in] [--binary-out] [--workers N] [--chunk-rows N]\n"
+              << "                 [--depth N] [--delimiter C] [--skip-header]   (\"-\" for the standard input or output, CSV only)\n"
+              << "       " << argv[0] << " demo\n";
+    return 1;
+}
@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <csignal>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <eigen3/Eigen/Dense>
+
+#include "../includes/mlp.hpp"
+#include "../includes/inference_server.hpp"
+
+/**
+ * @brief Where the server listens: a Unix domain socket path or a loopback TCP port
+ */
+struct Endpoint {
+    std::string path;
+    int port = -1; // 0 lets serve pick a free port
+};
+
+/**
+ * @brief Result of a load run
+ */
+struct LoadReport {
+    double requests_per_second;
+    double p50_latency_us;
+    double p99_latency_us;
+    std::string server_stats;
+};
+
+/**
+ * @brief Value following a flag in the arguments, or a default
+ */
+std::string argument(int argc, char* argv[], const std::string& flag, const std::string& fallback){
+    for(int i = 2; i + 1 < argc; i++){
+        if(argv[i] == flag) return argv[i + 1];
+    }
+    return fallback;
+}
+
+Endpoint endpoint(int argc, char* argv[]){
+    Endpoint where;
+    where.path = argument(argc, argv, "--unix", "");
+    where.port = std::stoi(argument(argc, argv, "--tcp", "-1"));
+    if(where.path.empty() && where.port < 0) throw std::invalid_argument("--unix PATH or --tcp PORT is required");
+    return where;
+}
+
+InferenceClient connect(const Endpoint& where){
+    return where.path.empty() ? InferenceClient(where.port) : InferenceClient(where.path);
+}
+
+/**
+ * @brief Load generator: every client thread keeps window requests in flight until it has sent its share
+ *
+ * @param where Server to load
+ * @param clients Number of client threads (and connections)
+ * @param window Requests in flight per client
+ * @param requests Total number of requests
+ *
+ * @return LoadReport throughput, latencies seen by the clients and the stats of the server
+ */
+LoadReport generate_load(const Endpoint& where, int clients, int window, int requests){
+    using Clock = std::chrono::steady_clock;
+    std::vector<std::vector<float>> latencies(clients);
+
+    auto start = Clock::now();
+    std::vector<std::thread> threads;
+    for(int c = 0; c < clients; c++){
+        threads.emplace_back([&, c]{
+            InferenceClient client = connect(where);
+            Eigen::MatrixXd x = Eigen::MatrixXd::Random(256, client.get_input_size());
+            Eigen::RowVectorXd y(client.get_output_size());
+            std::deque<Clock::time_point> in_flight;
+
+            int share = requests / clients + (c < requests % clients);
+            for(int sent = 0, received = 0; received < share;){
+                if(sent < share && (int)in_flight.size() < window){
+                    client.send(x.row(sent % x.rows()));
+                    in_flight.push_back(Clock::now());
+                    sent++;
+                }else{
+                    client.receive(y);
+                    latencies[c].push_back(std::chrono::duration<float, std::micro>(Clock::now() - in_flight.front()).count());
+                    in_flight.pop_front();
+                    received++;
+                }
+            }
+        });
+    }
+    for(std::thread& thread : threads) thread.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<float> all;
+    for(auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+    std::sort(all.begin(), all.end());
+
+    return {requests / seconds, all[all.size() / 2], all[std::min(all.size() - 1, all.size() * 99 / 100)], connect(where).get_stats()};
+}
+
+void print(const LoadReport& report){
+    std::cout << "throughput: " << (long)report.requests_per_second << " requests/s, client latency p50 "
+              << report.p50_latency_us << " us, p99 " << report.p99_latency_us << " us\n"
+              << "server: " << report.server_stats << "\n";
+}
+
+BatchingOptions batching(int argc, char* argv[]){
+    BatchingOptions options;
+    options.max_batch_size = std::stoi(argument(argc, argv, "--max-batch", "64"));
+    options.max_delay = std::chrono::microseconds(std::stoi(argument(argc, argv, "--max-delay-us", "500")));
+    return options;
+}
+
+/**
+ * @brief Serve a checkpoint until SIGINT or SIGTERM
+ */
+int serve(int argc, char* argv[]){
+    // blocked before the server threads start so that they inherit the mask and only sigwait gets the signal
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    MLP mlp(argv[2]);
+    Endpoint where = endpoint(argc, argv);
+    InferenceServer server(mlp, batching(argc, argv));
+    if(where.path.empty()){
+        server.listen_tcp(where.port);
+        std::cout << "serving on 127.0.0.1:" << server.get_port() << std::endl;
+    }else{
+        server.listen_unix(where.path);
+        std::cout << "serving on " << where.path << std::endl;
+    }
+
+    int signal;
+    sigwait(&signals, &signal);
+    server.stop();
+    std::cout << to_json(server.get_stats()) << "\n";
+    return 0;
+}
+
+int load(int argc, char* argv[]){
+    print(generate_load(endpoint(argc, argv), std::stoi(argument(argc, argv, "--clients", "8")),
+                        std::stoi(argument(argc, argv, "--window", "16")), std::stoi(argument(argc, argv, "--requests", "200000"))));
+    return 0;
+}
+
+/**
+ * @brief Train a small model, then serve it without and with batching under the same load
+ */
+int demo(){
+    int num_features = 64;
+    Eigen::MatrixXd x = Eigen::MatrixXd::Random(4096, num_features);
+    Eigen::MatrixXd y = x.leftCols(4) * 2;
+
+    std::vector<std::pair<int, ActivationFunction*>> layers;
+    layers.push_back(std::make_pair(512, new ReLU()));
+    layers.push_back(std::make_pair(512, new ReLU()));
+    layers.push_back(std::make_pair(4, new Linear()));
+    MLP mlp(num_features, layers);
+
+    MSE mse;
+    mlp.fit(x, y, x, y, 2, MinibatchOptions{64}, 0.01, 0.0, 0.9, &mse);
+    mlp.save("model.ckpt");
+
+    MLP served("model.ckpt");
+    for(int max_batch_size : {1, 64}){
+        BatchingOptions options;
+        options.max_batch_size = max_batch_size;
+        InferenceServer server(served, options);
+        server.listen_unix("inference.sock");
+
+        std::cout << "max_batch_size " << max_batch_size << "\n";
+        print(generate_load({"inference.sock"}, 8, 16, 50000));
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]){
+    std::string mode = argc > 1 ? argv[1] : "demo";
+    if(mode == "serve" && argc > 2) return serve(argc, argv);
+    if(mode == "load") return load(argc, argv);
+    if(mode == "demo") return demo();
+
+    std::cerr << "usage: " << argv[0] << " serve CHECKPOINT (--unix PATH | --tcp PORT) [--max-batch N] [--max-delay-us US]\n"
+              << "       " << argv[0] << " load (--unix PATH | --tcp PORT) [--clients C] [--window W] [--requests N]\n"
+              << "       " << argv[0] << " demo\n";
+    return 1;
+}
@@ -0,0 +1,64 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <eigen3/Eigen/Dense>
+
+#include "../includes/mlp.hpp"
+#include "../includes/communicator.hpp"
+
+constexpr int NUM_FEATURES = 64;
+constexpr int EPOCHS = 5;
+constexpr int BATCH_SIZE = 64; // rows of a minibatch of every rank
+
+MLP build(){
+    std::srand(42);
+    std::vector<std::pair<int, ActivationFunction*>> layers;
+    layers.push_back(std::make_pair(256, new ReLU()));
+    layers.push_back(std::make_pair(256, new ReLU()));
+    layers.push_back(std::make_pair(4, new Linear()));
+    return MLP(NUM_FEATURES, layers);
+}
+
+/**
+ * @brief Fit the same model on one process, then on ranks processes splitting the data, with the same total
+ * minibatch size, and print the losses and the wall time of both
+ * 
+ * Usage: multiprocess_training [RANKS] [shm|socket]
+ */
+int main(int argc, char* argv[]){
+    int ranks = argc > 1 ? std::stoi(argv[1]) : 2;
+    LaunchOptions options;
+    if(argc > 2 && std::string(argv[2]) == "socket") options.transport = LaunchOptions::Transport::Socket;
+
+    // loaded before launch_local: the ranks share it copy-on-write
+    Eigen::MatrixXd x = Eigen::MatrixXd::Random(16384, NUM_FEATURES);
+    Eigen::MatrixXd y = (x.leftCols(4).array().sin() * 2).matrix();
+    Eigen::MatrixXd x_test = Eigen::MatrixXd::Random(2048, NUM_FEATURES);
+    Eigen::MatrixXd y_test = (x_test.leftCols(4).array().sin() * 2).matrix();
+    MSE mse;
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        MLP mlp = build();
+        auto history = mlp.fit(x, y, x_test, y_test, EPOCHS, MinibatchOptions{BATCH_SIZE * ranks}, 0.002, 0.0, 0.9, &mse);
+        std::cout << "1 process: train loss " << history.back().first << ", test loss " << history.back().second << ", "
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+    }
+
+    start = std::chrono::steady_clock::now();
+    launch_local<double>(ranks, [&](Communicator& communicator){
+        auto [begin, rows] = shard_range(x.rows(), communicator.get_rank(), communicator.get_size());
+        MLP mlp = build();
+        mlp.set_communicator(&communicator);
+        auto history = mlp.fit(x.middleRows(begin, rows), y.middleRows(begin, rows), x_test, y_test, EPOCHS,
+                MinibatchOptions{BATCH_SIZE, true, (unsigned)communicator.get_rank()}, 0.002, 0.0, 0.9, &mse);
+
+        if(communicator.get_rank() == 0){
+            std::cout << ranks << " processes: train loss " << history.back().first << ", test loss " << history.back().second << ", "
+                      << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+            mlp.save("model.ckpt");
+        }
+    }, options);
+    return 0;
+}
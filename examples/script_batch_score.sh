@@ -0,0 +1,8 @@
+#!/bin/bash
+
+g++ -O3 -std=c++23 -c batch_score.cpp -o batch_score.o
+g++ -pthread batch_score.o ../build/*.o -o batch_score
+
+./batch_score demo
+
+rm batch_score.o batch_score inputs.csv inputs.bin predictions.csv predictions.bin
@@ -0,0 +1,8 @@
+#!/bin/bash
+
+g++ -O3 -std=c++23 -c inference_server.cpp -o inference_server.o
+g++ -pthread inference_server.o ../build/*.o -o inference_server
+
+./inference_server demo
+
+rm inference_server.o inference_server model.ckpt
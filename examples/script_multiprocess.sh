@@ -0,0 +1,9 @@
+#!/bin/bash
+
+g++ -O3 -std=c++23 -c multiprocess_training.cpp -o multiprocess_training.o
+g++ -pthread multiprocess_training.o ../build/*.o -o multiprocess_training
+
+./multiprocess_training 2 shm
+./multiprocess_training 2 socket
+
+rm multiprocess_training.o multiprocess_training model.ckpt
@@ -1,7 +1,7 @@
 #!/bin/bash
 
-g++ -c train_example.cpp -o train_example.o
-g++ train_example.o ../build/*.o -o train_example
+g++ -O3 -std=c++23 -c train_example.cpp -o train_example.o
+g++ -pthread train_example.o ../build/*.o -o train_example
 
 ./train_example 
 
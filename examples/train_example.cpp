@@ -51,14 +51,12 @@ int main(int argc, char* argv[]){
     Eigen::MatrixXd test_x = Eigen::MatrixXd::Random(num_samples, num_features);
     Eigen::MatrixXd test_y = synthetic_target(test_x);
 
-    ActivationFunction* activation = new Sigmoid();
-    ActivationFunction* output_activation = new Linear(); 
-
     std::vector<std::pair<int, ActivationFunction*>> layers;
 
-    layers.push_back(std::make_pair(50, activation));
-    layers.push_back(std::make_pair(50, activation));
-    layers.push_back(std::make_pair(3, output_activation));
+    // every layer takes ownership of its activation function, so each one gets its own
+    layers.push_back(std::make_pair(50, new Sigmoid()));
+    layers.push_back(std::make_pair(50, new Sigmoid()));
+    layers.push_back(std::make_pair(3, new Linear()));
 
     // simple MLP with 2 hidden layers (50 neuron each and Sigmoid activation) and a linear output layer (3 neurons)
     MLP mlp(num_features, layers); 
@@ -68,9 +66,9 @@ int main(int argc, char* argv[]){
     double lr = 0.01;
     double weight_decay = 0.0000001;
     double momentum = 0.9;
-    int num_minibatches = 10;
+    MinibatchOptions batching = {64}; // reshuffled every epoch, the last minibatch has the remaining 1000 % 64 rows
 
-    std::vector<std::pair<double, double>> loss_history = mlp.fit(train_x, train_y, test_x, test_y, epochs, num_minibatches, lr, weight_decay, momentum, &mse);
+    std::vector<std::pair<double, double>> loss_history = mlp.fit(train_x, train_y, test_x, test_y, epochs, batching, lr, weight_decay, momentum, &mse);
 
     write_to_file(loss_history, epochs, "loss.txt");
 
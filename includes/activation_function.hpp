@@ -2,15 +2,23 @@
 #define ACTIVATION_FUNCTION_HPP
 
 #include <eigen3/Eigen/Dense>
+#include <cmath>
+#include <memory>
 
 /**
  * @brief Abstract base class for activation functions.
  * 
  * This class defines the interface for all activation functions that can be applied element-wise
  * to vectors, such as ReLU, Sigmoid, etc.
+ * 
+ * @tparam T Scalar type (float or double).
  */
-class ActivationFunction {
+template <typename T>
+class BasicActivationFunction {
 public:
+    using Scalar = T;
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+    using Array = Eigen::Array<T, Eigen::Dynamic, Eigen::Dynamic>;
 
     /**
      * @brief Virtual function to apply an activation function to a vector.
@@ -18,9 +26,9 @@ public:
      * This method must be implemented by any derived class to apply a specific activation function.
      * 
      * @param x Input matrix (batch) on which the activation function will be applied.
-     * @return Eigen::MatrixXd The vector after applying the activation function element-wise.
+     * @return Matrix The vector after applying the activation function element-wise.
      */
-    virtual Eigen::MatrixXd activate(const Eigen::MatrixXd& x) = 0;
+    virtual Matrix activate(const Matrix& x) const = 0;
 
     /**
      * @brief Virtual function to compute the derivative of the activation function.
@@ -29,21 +37,154 @@ public:
      * of the specific activation function.
      * 
      * @param x Input matrix (batch) for which the derivative is computed.
-     * @return Eigen::MatrixXd The derivative of the activation function applied element-wise.
+     * @return Matrix The derivative of the activation function applied element-wise.
+     */
+    virtual Matrix derivative(const Matrix& x) const = 0;
+
+    /**
+     * @brief Apply the activation function into a preallocated matrix.
+     * 
+     * The default goes through activate, so it allocates the result. The built-in activations override it to write
+     * into out directly, which does not allocate once out has the shape of x (the generic layers rely on it).
+     * 
+     * @param x Input matrix (batch), may be out itself.
+     * @param out Output matrix, resized to the shape of x.
+     */
+    virtual void activate_into(const Matrix& x, Matrix& out) const {out = activate(x);};
+
+    /**
+     * @brief Compute the derivative of the activation function into a preallocated matrix (see activate_into).
+     * 
+     * @param x Input matrix (batch), may be out itself.
+     * @param out Derivative, resized to the shape of x.
      */
-    virtual Eigen::MatrixXd derivative(const Eigen::MatrixXd& x) = 0;
+    virtual void derivative_into(const Matrix& x, Matrix& out) const {out = derivative(x);};
 
-    virtual ~ActivationFunction() = default;
+    virtual ~BasicActivationFunction() = default;
 };
 
 
+// ---------------------------------------- Elementwise kernels ----------------------------------------
+/**
+ * @brief Rational approximation of tanh on a packet (or a scalar), the one Eigen uses for float.
+ * 
+ * Odd degree 13 numerator over even degree 6 denominator, with the input clamped to [-7.9988, 7.9988] where tanh
+ * rounds to +-1 in float. Only multiply-adds, min/max and one division, so it vectorizes for float and double alike
+ * (Eigen's double tanh is a scalar loop). Max error: 7 ULP in float (6.9 over every float), 2.2e-7 absolute in
+ * double. The coefficients are fitted for float precision, so in double the error is about 1e9 ULP and only the
+ * absolute figure is meaningful.
+ */
+template <typename Packet>
+EIGEN_STRONG_INLINE Packet fast_tanh_kernel(const Packet& z){
+    using namespace Eigen::internal;
+    using T = typename unpacket_traits<Packet>::type;
+
+    const Packet bound = pset1<Packet>(T(7.99881172180175781));
+    Packet x = pmax(pmin(z, bound), pnegate(bound));
+    Packet x2 = pmul(x, x);
+
+    Packet p = pset1<Packet>(T(-2.76076847742355e-16));
+    p = pmadd(x2, p, pset1<Packet>(T(2.00018790482477e-13)));
+    p = pmadd(x2, p, pset1<Packet>(T(-8.60467152213735e-11)));
+    p = pmadd(x2, p, pset1<Packet>(T(5.12229709037114e-08)));
+    p = pmadd(x2, p, pset1<Packet>(T(1.48572235717979e-05)));
+    p = pmadd(x2, p, pset1<Packet>(T(6.37261928875436e-04)));
+    p = pmadd(x2, p, pset1<Packet>(T(4.89352455891786e-03)));
+    p = pmul(x, p);
+
+    Packet q = pset1<Packet>(T(1.19825839466702e-06));
+    q = pmadd(x2, q, pset1<Packet>(T(1.18534705686654e-04)));
+    q = pmadd(x2, q, pset1<Packet>(T(2.26843463243900e-03)));
+    q = pmadd(x2, q, pset1<Packet>(T(4.89352518554385e-03)));
+    return pdiv(p, q);
+}
+
+/**
+ * @brief sigmoid(z) = (1 + tanh(z/2)) / 2 with the rational tanh. Max error 2.3e-7 absolute in float and 1.1e-7 in
+ * double: it is bounded absolutely, not relatively, so outputs far below 1e-7 (z < -16) come out as 0 and there is
+ * no ULP bound for z < 0. Outputs of at least 1/2 (z >= 0) are within 4 ULP in float.
+ */
+template <typename Packet>
+EIGEN_STRONG_INLINE Packet fast_sigmoid_kernel(const Packet& z){
+    using namespace Eigen::internal;
+    using T = typename unpacket_traits<Packet>::type;
+
+    const Packet half = pset1<Packet>(T(0.5));
+    return pmadd(half, fast_tanh_kernel(pmul(half, z)), half);
+}
+
+/**
+ * @brief Exact sigmoid 1 / (1 + exp(-z)) on a packet, with Eigen's vectorized exp.
+ */
+template <typename Packet>
+EIGEN_STRONG_INLINE Packet sigmoid_kernel(const Packet& z){
+    using namespace Eigen::internal;
+    using T = typename unpacket_traits<Packet>::type;
+
+    const Packet one = pset1<Packet>(T(1));
+    return pdiv(one, padd(one, pexp(pnegate(z))));
+}
+
+/**
+ * @brief Argument 2u of the tanh form of GELU, 0.5 z (1 + tanh(u)) = z sigmoid(2u) with u = sqrt(2/pi) (z + 0.044715 z^3).
+ */
+template <typename Packet>
+EIGEN_STRONG_INLINE Packet gelu_tanh_argument(const Packet& z){
+    using namespace Eigen::internal;
+    using T = typename unpacket_traits<Packet>::type;
+
+    Packet z2 = pmul(z, z);
+    return pmul(pmul(pset1<Packet>(T(1.5957691216057308)), z), pmadd(pset1<Packet>(T(0.044715)), z2, pset1<Packet>(T(1))));
+}
+
+/**
+ * @brief Eigen functor wrapping a kernel usable on packets and scalars, so that unaryExpr vectorizes it.
+ * 
+ * @tparam T Scalar type.
+ * @tparam Kernel Class with a static template eval(const Packet&).
+ */
+template <typename T, typename Kernel>
+struct PacketFunctor {
+    EIGEN_STRONG_INLINE T operator()(const T& z) const {return Kernel::eval(z);};
+
+    template <typename Packet>
+    EIGEN_STRONG_INLINE Packet packetOp(const Packet& z) const {return Kernel::eval(z);};
+};
+
+namespace Eigen::internal {
+template <typename T, typename Kernel>
+struct functor_traits<PacketFunctor<T, Kernel>> {
+    enum { Cost = 30 * NumTraits<T>::MulCost, PacketAccess = packet_traits<T>::HasDiv && packet_traits<T>::HasExp };
+};
+}
+
+/**
+ * @brief Apply a kernel elementwise to an array expression (see PacketFunctor).
+ */
+template <typename Kernel, typename Derived>
+auto packet_map(const Eigen::ArrayBase<Derived>& z){
+    return z.derived().unaryExpr(PacketFunctor<typename Derived::Scalar, Kernel>());
+}
+
+/**
+ * @brief Activation whose derivative needs the pre-activation z, not only the output f(z) (GELU, SiLU): it provides
+ * a static derivative_from_input(z) kernel instead of derivative_from_output(a), and the fused layers keep z.
+ */
+template <typename Act>
+concept DerivativeFromInput = requires(const Eigen::Array<typename Act::Scalar, Eigen::Dynamic, Eigen::Dynamic>& z) {
+    Act::derivative_from_input(z);
+};
+
 /**
  * @brief Linear activation function.
  * 
  * The Linear activation function is defined as f(x) = x.
  */
-class Linear : public ActivationFunction {
+template <typename T>
+class BasicLinear : public BasicActivationFunction<T> {
 public:
+    using typename BasicActivationFunction<T>::Matrix;
+    using typename BasicActivationFunction<T>::Array;
 
     /**
      * @brief Apply the Linear activation function to a vector.
@@ -51,9 +192,9 @@ public:
      * This method applies the Linear activation function element-wise to a vector.
      * 
      * @param x Input matrix (batch) on which the Linear activation function will be applied.
-     * @return Eigen::MatrixXd The vector after applying the Linear activation function element-wise.
+     * @return Matrix The vector after applying the Linear activation function element-wise.
      */
-    Eigen::MatrixXd activate(const Eigen::MatrixXd& x) override;
+    Matrix activate(const Matrix& x) const override;
 
     /**
      * @brief Compute the derivative of the Linear activation function.
@@ -61,9 +202,31 @@ public:
      * This method computes the derivative of the Linear activation function element-wise.
      * 
      * @param x Input matrix (batch) for which the derivative is computed.
-     * @return Eigen::MatrixXd The derivative of the Linear activation function applied element-wise.
+     * @return Matrix The derivative of the Linear activation function applied element-wise.
      */
-    Eigen::MatrixXd derivative(const Eigen::MatrixXd& x) override;
+    Matrix derivative(const Matrix& x) const override;
+
+    void activate_into(const Matrix& x, Matrix& out) const override;
+
+    void derivative_into(const Matrix& x, Matrix& out) const override;
+
+    /**
+     * @brief Element-wise kernel used by the compile-time specialized layers (FusedFCLayer).
+     * 
+     * @param z Pre-activation array expression.
+     * @return An Eigen expression evaluating f(z), fused into the caller's assignment.
+     */
+    template <typename Derived>
+    static auto apply(const Eigen::ArrayBase<Derived>& z) { return z.derived(); }
+
+    /**
+     * @brief Derivative expressed in terms of the cached output a = f(z).
+     * 
+     * @param a Post-activation array expression.
+     * @return An Eigen expression evaluating f'(z) without recomputing f.
+     */
+    template <typename Derived>
+    static auto derivative_from_output(const Eigen::ArrayBase<Derived>& a) { return Array::Constant(a.rows(), a.cols(), T(1)); }
 };
 
 
@@ -72,8 +235,11 @@ public:
  * 
  * The ReLU activation function is defined as f(x) = max(0, x).
  */
-class ReLU : public ActivationFunction {
+template <typename T>
+class BasicReLU : public BasicActivationFunction<T> {
 public:
+    using typename BasicActivationFunction<T>::Matrix;
+    using typename BasicActivationFunction<T>::Array;
 
     /**
      * @brief Apply the ReLU activation function to a vector.
@@ -81,9 +247,9 @@ public:
      * This method applies the ReLU activation function element-wise to a vector.
      * 
      * @param x Input matrix (batch) on which the ReLU activation function will be applied.
-     * @return Eigen::MatrixXd The vector after applying the ReLU activation function element-wise.
+     * @return Matrix The vector after applying the ReLU activation function element-wise.
      */
-    Eigen::MatrixXd activate(const Eigen::MatrixXd& x) override;
+    Matrix activate(const Matrix& x) const override;
 
     /**
      * @brief Compute the derivative of the ReLU activation function.
@@ -91,9 +257,31 @@ public:
      * This method computes the derivative of the ReLU activation function element-wise.
      * 
      * @param x Input matrix (batch) for which the derivative is computed.
-     * @return Eigen::MatrixXd The derivative of the ReLU activation function applied element-wise.
+     * @return Matrix The derivative of the ReLU activation function applied element-wise.
+     */
+    Matrix derivative(const Matrix& x) const override;
+
+    void activate_into(const Matrix& x, Matrix& out) const override;
+
+    void derivative_into(const Matrix& x, Matrix& out) const override;
+
+    /**
+     * @brief Element-wise kernel used by the compile-time specialized layers (FusedFCLayer).
+     * 
+     * @param z Pre-activation array expression.
+     * @return An Eigen expression evaluating max(0, z).
+     */
+    template <typename Derived>
+    static auto apply(const Eigen::ArrayBase<Derived>& z) { return z.cwiseMax(T(0)); }
+
+    /**
+     * @brief Derivative expressed in terms of the cached output a = max(0, z).
+     * 
+     * @param a Post-activation array expression.
+     * @return An Eigen expression evaluating 1 where a > 0, 0 elsewhere.
      */
-    Eigen::MatrixXd derivative(const Eigen::MatrixXd& x) override;
+    template <typename Derived>
+    static auto derivative_from_output(const Eigen::ArrayBase<Derived>& a) { return (a > T(0)).template cast<T>(); }
 };
 
 
@@ -102,8 +290,11 @@ public:
  * 
  * The Sigmoid activation function is defined as f(x) = 1 / (1 + exp(-x)).
  */
-class Sigmoid : public ActivationFunction {
+template <typename T>
+class BasicSigmoid : public BasicActivationFunction<T> {
 public:
+    using typename BasicActivationFunction<T>::Matrix;
+    using typename BasicActivationFunction<T>::Array;
 
     /**
      * @brief Apply the Sigmoid activation function to a vector.
@@ -111,9 +302,9 @@ public:
      * This method applies the Sigmoid activation function element-wise to a vector.
      * 
      * @param x Input matrix (batch) on which the Sigmoid activation function will be applied.
-     * @return Eigen::MatrixXd The vector after applying the Sigmoid activation function element-wise.
+     * @return Matrix The vector after applying the Sigmoid activation function element-wise.
      */
-    Eigen::MatrixXd activate(const Eigen::MatrixXd& x) override;
+    Matrix activate(const Matrix& x) const override;
 
     /**
      * @brief Compute the derivative of the Sigmoid activation function.
@@ -121,9 +312,31 @@ public:
      * This method computes the derivative of the Sigmoid activation function element-wise.
      * 
      * @param x Input matrix (batch) for which the derivative is computed.
-     * @return Eigen::MatrixXd The derivative of the Sigmoid activation function applied element-wise.
+     * @return Matrix The derivative of the Sigmoid activation function applied element-wise.
+     */
+    Matrix derivative(const Matrix& x) const override;
+
+    void activate_into(const Matrix& x, Matrix& out) const override;
+
+    void derivative_into(const Matrix& x, Matrix& out) const override;
+
+    /**
+     * @brief Element-wise kernel used by the compile-time specialized layers (FusedFCLayer).
+     * 
+     * @param z Pre-activation array expression.
+     * @return An Eigen expression evaluating 1 / (1 + exp(-z)).
      */
-    Eigen::MatrixXd derivative(const Eigen::MatrixXd& x) override;
+    template <typename Derived>
+    static auto apply(const Eigen::ArrayBase<Derived>& z) { return (T(1) + (-z).exp()).inverse(); }
+
+    /**
+     * @brief Derivative expressed in terms of the cached output a = sigmoid(z), i.e. a * (1 - a).
+     * 
+     * @param a Post-activation array expression.
+     * @return An Eigen expression evaluating the derivative without any exp().
+     */
+    template <typename Derived>
+    static auto derivative_from_output(const Eigen::ArrayBase<Derived>& a) { return a * (T(1) - a); }
 };
 
 
@@ -132,8 +345,11 @@ public:
  * 
  * The Tanh activation function is defined as f(x) = tanh(x).
  */
-class Tanh : public ActivationFunction {
+template <typename T>
+class BasicTanh : public BasicActivationFunction<T> {
 public:
+    using typename BasicActivationFunction<T>::Matrix;
+    using typename BasicActivationFunction<T>::Array;
 
     /**
      * @brief Apply the Tanh activation function to a vector.
@@ -141,9 +357,9 @@ public:
      * This method applies the Tanh activation function element-wise to a vector.
      * 
      * @param x Input matrix (batch) on which the Tanh activation function will be applied.
-     * @return Eigen::MatrixXd The vector after applying the Tanh activation function element-wise.
+     * @return Matrix The vector after applying the Tanh activation function element-wise.
      */
-    Eigen::MatrixXd activate(const Eigen::MatrixXd& x) override;
+    Matrix activate(const Matrix& x) const override;
 
     /**
      * @brief Compute the derivative of the Tanh activation function.
@@ -151,9 +367,379 @@ public:
      * This method computes the derivative of the Tanh activation function element-wise.
      * 
      * @param x Input matrix (batch) for which the derivative is computed.
-     * @return Eigen::MatrixXd The derivative of the Tanh activation function applied element-wise.
+     * @return Matrix The derivative of the Tanh activation function applied element-wise.
+     */
+    Matrix derivative(const Matrix& x) const override;
+
+    void activate_into(const Matrix& x, Matrix& out) const override;
+
+    void derivative_into(const Matrix& x, Matrix& out) const override;
+
+    /**
+     * @brief Element-wise kernel used by the compile-time specialized layers (FusedFCLayer).
+     * 
+     * @param z Pre-activation array expression.
+     * @return An Eigen expression evaluating tanh(z).
      */
-    Eigen::MatrixXd derivative(const Eigen::MatrixXd& x) override;
+    template <typename Derived>
+    static auto apply(const Eigen::ArrayBase<Derived>& z) { return z.tanh(); }
+
+    /**
+     * @brief Derivative expressed in terms of the cached output a = tanh(z), i.e. 1 - a^2.
+     * 
+     * @param a Post-activation array expression.
+     * @return An Eigen expression evaluating the derivative without any tanh().
+     */
+    template <typename Derived>
+    static auto derivative_from_output(const Eigen::ArrayBase<Derived>& a) { return T(1) - a.square(); }
 };
 
+
+/**
+ * @brief Leaky Rectified Linear Unit activation function.
+ * 
+ * The LeakyReLU activation function is defined as f(x) = x for x > 0, slope * x otherwise, with slope = 0.01.
+ */
+template <typename T>
+class BasicLeakyReLU : public BasicActivationFunction<T> {
+public:
+    using typename BasicActivationFunction<T>::Matrix;
+    using typename BasicActivationFunction<T>::Array;
+
+    static constexpr T slope = T(0.01);
+
+    Matrix activate(const Matrix& x) const override;
+
+    Matrix derivative(const Matrix& x) const override;
+
+    void activate_into(const Matrix& x, Matrix& out) const override;
+
+    void derivative_into(const Matrix& x, Matrix& out) const override;
+
+    /**
+     * @brief Element-wise kernel used by the compile-time specialized layers (FusedFCLayer).
+     * 
+     * @param z Pre-activation array expression.
+     * @return An Eigen expression evaluating max(z, slope * z).
+     */
+    template <typename Derived>
+    static auto apply(const Eigen::ArrayBase<Derived>& z) { return z.cwiseMax(slope * z); }
+
+    /**
+     * @brief Derivative expressed in terms of the cached output a = f(z), which has the sign of z.
+     * 
+     * @param a Post-activation array expression.
+     * @return An Eigen expression evaluating 1 where a > 0, slope elsewhere.
+     */
+    template <typename Derived>
+    static auto derivative_from_output(const Eigen::ArrayBase<Derived>& a) { return slope + (T(1) - slope) * (a > T(0)).template cast<T>(); }
+};
+
+
+/**
+ * @brief Fast approximate Sigmoid activation function.
+ * 
+ * sigmoid(x) = (1 + tanh(x/2)) / 2 with a vectorized rational tanh instead of exp (see fast_sigmoid_kernel): max
+ * absolute error 2.3e-7 in float, 1.1e-7 in double, 4 ULP in float for x >= 0 (the absolute error admits no ULP
+ * bound where the output vanishes). The derivative is computed from the output like Sigmoid.
+ */
+template <typename T>
+class BasicFastSigmoid : public BasicActivationFunction<T> {
+public:
+    using typename BasicActivationFunction<T>::Matrix;
+    using typename BasicActivationFunction<T>::Array;
+
+    struct Kernel { template <typename Packet> static Packet eval(const Packet& z) {return fast_sigmoid_kernel(z);}; };
+
+    Matrix activate(const Matrix& x) const override;
+
+    Matrix derivative(const Matrix& x) const override;
+
+    void activate_into(const Matrix& x, Matrix& out) const override;
+
+    void derivative_into(const Matrix& x, Matrix& out) const override;
+
+    template <typename Derived>
+    static auto apply(const Eigen::ArrayBase<Derived>& z) { return packet_map<Kernel>(z); }
+
+    template <typename Derived>
+    static auto derivative_from_output(const Eigen::ArrayBase<Derived>& a) { return a * (T(1) - a); }
+};
+
+
+/**
+ * @brief Fast approximate Tanh activation function.
+ * 
+ * Vectorized rational approximation (see fast_tanh_kernel): max error 7 ULP in float, 2.2e-7 absolute in double
+ * (fitted for float, so not a few ULP of double). In float it is the approximation Eigen already uses for tanh, the
+ * gain is in double, where Eigen's tanh is scalar.
+ */
+template <typename T>
+class BasicFastTanh : public BasicActivationFunction<T> {
+public:
+    using typename BasicActivationFunction<T>::Matrix;
+    using typename BasicActivationFunction<T>::Array;
+
+    struct Kernel { template <typename Packet> static Packet eval(const Packet& z) {return fast_tanh_kernel(z);}; };
+
+    Matrix activate(const Matrix& x) const override;
+
+    Matrix derivative(const Matrix& x) const override;
+
+    void activate_into(const Matrix& x, Matrix& out) const override;
+
+    void derivative_into(const Matrix& x, Matrix& out) const override;
+
+    template <typename Derived>
+    static auto apply(const Eigen::ArrayBase<Derived>& z) { return packet_map<Kernel>(z); }
+
+    template <typename Derived>
+    static auto derivative_from_output(const Eigen::ArrayBase<Derived>& a) { return T(1) - a.square(); }
+};
+
+
+/**
+ * @brief Gaussian Error Linear Unit (GELU) activation function.
+ * 
+ * The GELU activation function is defined as f(x) = x * Phi(x) = 0.5 * x * (1 + erf(x / sqrt(2))). erf is
+ * evaluated one element at a time, see FastGELU for the vectorized approximation.
+ */
+template <typename T>
+class BasicGELU : public BasicActivationFunction<T> {
+public:
+    using typename BasicActivationFunction<T>::Matrix;
+    using typename BasicActivationFunction<T>::Array;
+
+    Matrix activate(const Matrix& x) const override;
+
+    Matrix derivative(const Matrix& x) const override;
+
+    void activate_into(const Matrix& x, Matrix& out) const override;
+
+    void derivative_into(const Matrix& x, Matrix& out) const override;
+
+    /**
+     * @brief Element-wise kernel used by the compile-time specialized layers (FusedFCLayer).
+     */
+    template <typename Derived>
+    static auto apply(const Eigen::ArrayBase<Derived>& z) {
+        return z.derived().unaryExpr([](T x) { return T(0.5) * x * (T(1) + std::erf(x * T(0.70710678118654752))); });
+    }
+
+    /**
+     * @brief Derivative Phi(z) + z * phi(z), from the pre-activation.
+     * 
+     * @param z Pre-activation array expression.
+     */
+    template <typename Derived>
+    static auto derivative_from_input(const Eigen::ArrayBase<Derived>& z) {
+        return z.derived().unaryExpr([](T x) {
+            return T(0.5) * (T(1) + std::erf(x * T(0.70710678118654752))) + x * T(0.39894228040143268) * std::exp(T(-0.5) * x * x);
+        });
+    }
+};
+
+
+/**
+ * @brief Fast approximate GELU activation function.
+ * 
+ * The tanh form 0.5 * x * (1 + tanh(sqrt(2/pi) * (x + 0.044715 * x^3))) with the vectorized rational tanh. Its max
+ * absolute difference with the exact GELU is 4.74e-4 (the tanh form itself), the rational tanh adds at most
+ * 1.1e-7 * |x|. The difference is that of another function, not a rounding error, so it is given in absolute terms
+ * rather than in ULP. The derivative multiplies the sigmoid error by z du/dz: it is within 1.1e-7 * (1 + |x|)^3 of
+ * the derivative of the tanh form.
+ */
+template <typename T>
+class BasicFastGELU : public BasicActivationFunction<T> {
+public:
+    using typename BasicActivationFunction<T>::Matrix;
+    using typename BasicActivationFunction<T>::Array;
+
+    struct Kernel {
+        template <typename Packet>
+        static Packet eval(const Packet& z) {return Eigen::internal::pmul(z, fast_sigmoid_kernel(gelu_tanh_argument(z)));};
+    };
+
+    /**
+     * @brief Derivative of the tanh form: s + 2 z s (1 - s) sqrt(2/pi) (1 + 3 * 0.044715 z^2), s = sigmoid(2u).
+     */
+    struct DerivativeKernel {
+        template <typename Packet>
+        static Packet eval(const Packet& z){
+            using namespace Eigen::internal;
+            using S = typename unpacket_traits<Packet>::type;
+
+            Packet s = fast_sigmoid_kernel(gelu_tanh_argument(z));
+            Packet slope = pmadd(pset1<Packet>(S(0.21406873432301053)), pmul(z, z), pset1<Packet>(S(1.5957691216057308))); // 2 du/dz
+            return pmadd(pmul(pmul(z, s), psub(pset1<Packet>(S(1)), s)), slope, s);
+        };
+    };
+
+    Matrix activate(const Matrix& x) const override;
+
+    Matrix derivative(const Matrix& x) const override;
+
+    void activate_into(const Matrix& x, Matrix& out) const override;
+
+    void derivative_into(const Matrix& x, Matrix& out) const override;
+
+    template <typename Derived>
+    static auto apply(const Eigen::ArrayBase<Derived>& z) { return packet_map<Kernel>(z); }
+
+    template <typename Derived>
+    static auto derivative_from_input(const Eigen::ArrayBase<Derived>& z) { return packet_map<DerivativeKernel>(z); }
+};
+
+
+/**
+ * @brief Sigmoid Linear Unit (SiLU, or Swish) activation function.
+ * 
+ * The SiLU activation function is defined as f(x) = x * sigmoid(x).
+ */
+template <typename T>
+class BasicSiLU : public BasicActivationFunction<T> {
+public:
+    using typename BasicActivationFunction<T>::Matrix;
+    using typename BasicActivationFunction<T>::Array;
+
+    struct Kernel {
+        template <typename Packet>
+        static Packet eval(const Packet& z) {return Eigen::internal::pmul(z, sigmoid_kernel(z));};
+    };
+
+    /**
+     * @brief Derivative s + z s (1 - s), s = sigmoid(z), with a single exp.
+     */
+    struct DerivativeKernel {
+        template <typename Packet>
+        static Packet eval(const Packet& z){
+            using namespace Eigen::internal;
+            using S = typename unpacket_traits<Packet>::type;
+
+            Packet s = sigmoid_kernel(z);
+            return pmadd(pmul(z, s), psub(pset1<Packet>(S(1)), s), s);
+        };
+    };
+
+    Matrix activate(const Matrix& x) const override;
+
+    Matrix derivative(const Matrix& x) const override;
+
+    void activate_into(const Matrix& x, Matrix& out) const override;
+
+    void derivative_into(const Matrix& x, Matrix& out) const override;
+
+    template <typename Derived>
+    static auto apply(const Eigen::ArrayBase<Derived>& z) { return packet_map<Kernel>(z); }
+
+    template <typename Derived>
+    static auto derivative_from_input(const Eigen::ArrayBase<Derived>& z) { return packet_map<DerivativeKernel>(z); }
+};
+
+
+/**
+ * @brief Fast approximate SiLU activation function.
+ * 
+ * x * sigmoid(x) with the sigmoid of FastSigmoid: max absolute error 2.4e-7 * |x| in float, 1.1e-7 * |x| in double,
+ * 4 ULP in float for outputs of at least 1/2. Like the sigmoid's, the error is absolute for x < 0, where the output
+ * vanishes, so there is no ULP bound there.
+ */
+template <typename T>
+class BasicFastSiLU : public BasicActivationFunction<T> {
+public:
+    using typename BasicActivationFunction<T>::Matrix;
+    using typename BasicActivationFunction<T>::Array;
+
+    struct Kernel {
+        template <typename Packet>
+        static Packet eval(const Packet& z) {return Eigen::internal::pmul(z, fast_sigmoid_kernel(z));};
+    };
+
+    struct DerivativeKernel {
+        template <typename Packet>
+        static Packet eval(const Packet& z){
+            using namespace Eigen::internal;
+            using S = typename unpacket_traits<Packet>::type;
+
+            Packet s = fast_sigmoid_kernel(z);
+            return pmadd(pmul(z, s), psub(pset1<Packet>(S(1)), s), s);
+        };
+    };
+
+    Matrix activate(const Matrix& x) const override;
+
+    Matrix derivative(const Matrix& x) const override;
+
+    void activate_into(const Matrix& x, Matrix& out) const override;
+
+    void derivative_into(const Matrix& x, Matrix& out) const override;
+
+    template <typename Derived>
+    static auto apply(const Eigen::ArrayBase<Derived>& z) { return packet_map<Kernel>(z); }
+
+    template <typename Derived>
+    static auto derivative_from_input(const Eigen::ArrayBase<Derived>& z) { return packet_map<DerivativeKernel>(z); }
+};
+
+/**
+ * @brief Identifier of the built-in activation functions, Custom for any user-defined one.
+ */
+enum class ActivationType { Linear, ReLU, Sigmoid, Tanh, LeakyReLU, GELU, SiLU, FastSigmoid, FastTanh, FastGELU, FastSiLU, Custom };
+
+/**
+ * @brief Identify the activation function (exact type match, subclasses of built-ins are Custom).
+ * 
+ * @param func Activation function.
+ * @return ActivationType The type of the activation function.
+ */
+template <typename T>
+ActivationType activation_type(const BasicActivationFunction<T>& func);
+
+/**
+ * @brief Build a built-in activation function from its identifier.
+ * 
+ * @param type Activation type, Custom is not accepted.
+ * @return std::unique_ptr<BasicActivationFunction<T>> The new activation function.
+ * @throws std::invalid_argument If type is Custom.
+ */
+template <typename T>
+std::unique_ptr<BasicActivationFunction<T>> make_activation(ActivationType type);
+
+/**
+ * @brief Apply a built-in activation in place with its static kernel, without an activation object.
+ * 
+ * @param type Activation type, Custom is not accepted.
+ * @param x Pre-activation, overwritten with the activation.
+ * @throws std::invalid_argument If type is Custom.
+ */
+template <typename T>
+void apply_activation(ActivationType type, Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>& x);
+
+// double precision (default) and single precision names
+using ActivationFunction = BasicActivationFunction<double>;
+using Linear = BasicLinear<double>;
+using ReLU = BasicReLU<double>;
+using Sigmoid = BasicSigmoid<double>;
+using Tanh = BasicTanh<double>;
+using LeakyReLU = BasicLeakyReLU<double>;
+using GELU = BasicGELU<double>;
+using SiLU = BasicSiLU<double>;
+using FastSigmoid = BasicFastSigmoid<double>;
+using FastTanh = BasicFastTanh<double>;
+using FastGELU = BasicFastGELU<double>;
+using FastSiLU = BasicFastSiLU<double>;
+
+using ActivationFunctionf = BasicActivationFunction<float>;
+using Linearf = BasicLinear<float>;
+using ReLUf = BasicReLU<float>;
+using Sigmoidf = BasicSigmoid<float>;
+using Tanhf = BasicTanh<float>;
+using LeakyReLUf = BasicLeakyReLU<float>;
+using GELUf = BasicGELU<float>;
+using SiLUf = BasicSiLU<float>;
+using FastSigmoidf = BasicFastSigmoid<float>;
+using FastTanhf = BasicFastTanh<float>;
+using FastGELUf = BasicFastGELU<float>;
+using FastSiLUf = BasicFastSiLU<float>;
+
 #endif // ACTIVATION_FUNCTION_HPP
\ No newline at end of file
@@ -0,0 +1,27 @@
+#ifndef ALLOCATION_COUNTER_HPP
+#define ALLOCATION_COUNTER_HPP
+
+#include <utility>
+
+// Heap allocation counting, for the allocation checks of the benchmarks and tests and for the Profiler.
+// Eigen allocates through malloc, so counting operator new would miss most allocations: src/allocation_counter.cpp
+// wraps malloc, calloc and realloc themselves (glibc only). Its object is not among the library objects of a default
+// build, since a program linking it would lose the allocator it brings (e.g. jemalloc): the benchmarks and tests
+// link build/allocation_counter.o, and profiling builds (PROFILE=1) add it to the library objects.
+
+/**
+ * @brief Whether allocations are counted, i.e. malloc is wrapped on this platform
+ */
+bool counts_allocations();
+
+/**
+ * @brief Heap allocations (count and bytes) made so far by the calling thread, 0 if they are not counted
+ */
+std::pair<long, long> thread_allocations();
+
+/**
+ * @brief Heap allocations made so far by every thread of the process, 0 if they are not counted
+ */
+long process_allocations();
+
+#endif // ALLOCATION_COUNTER_HPP
@@ -0,0 +1,187 @@
+#ifndef BATCH_SCORER_HPP
+#define BATCH_SCORER_HPP
+
+#include <eigen3/Eigen/Dense>
+#include <condition_variable>
+#include <cstdio>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "mlp.hpp"
+
+/**
+ * @brief Format of the rows read or written by a BasicBatchScorer.
+ * 
+ * CSV: one row per line, values separated by the delimiter, blank lines skipped. Binary: the dataset format
+ * (see DatasetHeader), inputs are the features of the records (their targets, if any, are skipped), predictions
+ * are written as records of num_targets = outputs values and no features.
+ */
+enum class ScoreFormat { CSV, Binary };
+
+/**
+ * @brief How a BasicBatchScorer splits and processes a file.
+ */
+struct ScoringOptions {
+    ScoreFormat input_format = ScoreFormat::CSV;
+    ScoreFormat output_format = ScoreFormat::CSV;
+    int chunk_rows = 4096; // rows of a forward pass
+    int num_workers = 0; // threads parsing, scoring and formatting the chunks, 0 for one per hardware thread
+    int depth = 0; // chunks in flight (read, scored or waiting to be written), 0 for twice the workers
+    char delimiter = ','; // CSV
+    bool skip_header = false; // CSV input: the first line holds column names
+};
+
+/**
+ * @brief Counters of a scoring run, the busy times of the stages show which one limits the throughput.
+ */
+struct ScoringStats {
+    long rows = 0;
+    long chunks = 0;
+    double seconds = 0; // wall time
+    double read_seconds = 0; // reader thread, reading the input
+    double parse_seconds = 0; // summed over the workers
+    double infer_seconds = 0; // summed over the workers
+    double format_seconds = 0; // summed over the workers
+    double write_seconds = 0; // writer, writing the output
+    double rows_per_second() const {return seconds > 0 ? rows / seconds : 0;};
+};
+
+/**
+ * @brief Streaming batch scorer of large files with a trained MLP.
+ * 
+ * The input is read by a reader thread in chunks of chunk_rows rows: raw bytes, cut at line boundaries for CSV.
+ * A pool of workers takes the chunks in order, parses them into a reused matrix, runs the forward pass
+ * (BasicMLP::infer, with a scratch of its own, against the one shared model) and formats the predictions. The
+ * calling thread writes the formatted chunks in input order. At most depth chunks are in flight, every one in a
+ * slot of buffers reused for the whole file, so the memory is bounded by depth chunks whatever the file size and
+ * nothing is allocated once every slot has held a chunk. Parsing and formatting, which cost more than the forward
+ * pass of a small model, scale with the workers instead of running in the reader and writer threads.
+ * 
+ * @tparam T Scalar type (float or double).
+ */
+template <typename T>
+class BasicBatchScorer {
+public:
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+
+private:
+    /**
+     * @brief Buffers of one chunk in flight, reused for every chunk of its slot.
+     */
+    struct Slot {
+        enum class State { Free, Read, Scored };
+
+        State state = State::Free;
+        long first_row = 0; // index of the first row of the chunk in the input (CSV: line of the file, from 0)
+        long lines = 0; // rows of the input bytes (CSV: lines, blank ones included)
+        long rows = 0; // rows scored
+        std::string input; // raw bytes of the chunk
+        std::string output; // formatted predictions
+    };
+
+    /**
+     * @brief State of one run of score, shared by the stages.
+     */
+    struct Pipeline {
+        std::string input_path;
+        std::string output_path;
+        std::FILE* in = nullptr;
+        std::FILE* out = nullptr;
+        int input_targets = 0; // binary input: values after the features of a record, skipped
+        std::vector<Slot> slots; // chunk k uses slot k % depth
+        long read = 0; // chunks read
+        long claimed = 0; // chunks taken by a worker
+        long total = -1; // number of chunks, once the input is exhausted
+        bool failed = false;
+        std::exception_ptr error; // first error of a stage
+        std::mutex mutex;
+        std::condition_variable changed; // a slot changed state, or the run ends
+        ScoringStats stats;
+    };
+
+    const BasicMLP<T>& model;
+    ScoringOptions options;
+
+    /**
+     * @brief Reader stage: fill free slots with the next chunks of the input, in order
+     */
+    void read(Pipeline& pipeline);
+
+    /**
+     * @brief Cut the CSV input into chunks of chunk_rows lines
+     */
+    void read_csv(Pipeline& pipeline);
+
+    /**
+     * @brief Cut the binary input into chunks of chunk_rows records
+     */
+    void read_binary(Pipeline& pipeline);
+
+    /**
+     * @brief Hand a chunk to the workers once its slot is free, false if the run failed
+     * 
+     * @param fill Fills the input of the slot, returns the rows of the chunk (0 at the end of the input)
+     */
+    template <typename Fill>
+    bool publish(Pipeline& pipeline, Fill fill);
+
+    /**
+     * @brief Worker stage: parse, score and format the chunks, taken in order
+     */
+    void work(Pipeline& pipeline);
+
+    /**
+     * @brief Parse the CSV lines of a chunk into the first rows of x, one row per non-blank line
+     * 
+     * @return long Number of rows
+     * @throws std::runtime_error If a line does not hold input_size numbers.
+     */
+    long parse_csv(const Slot& slot, Matrix& x) const;
+
+    /**
+     * @brief Format the first rows of y into the output of a slot
+     */
+    void format(const Matrix& y, long rows, Slot& slot) const;
+
+    /**
+     * @brief Writer stage: write the scored chunks in order, in the calling thread
+     */
+    void write(Pipeline& pipeline);
+
+    /**
+     * @brief Record the first error and stop every stage
+     */
+    void fail(Pipeline& pipeline, std::exception_ptr error);
+
+public:
+    /**
+     * @brief Construct a new BatchScorer object
+     * 
+     * @param model Trained model, it must outlive the scorer and is only read (it may serve other threads)
+     * @param options Formats, chunk size, number of workers and of chunks in flight
+     * @throws std::invalid_argument If chunk_rows is not positive, or num_workers or depth is negative.
+     */
+    BasicBatchScorer(const BasicMLP<T>& model, const ScoringOptions& options = ScoringOptions());
+
+    /**
+     * @brief Score every row of the input file and write the predictions, one row per input row, in order
+     * 
+     * @param input_path Input file, "-" for the standard input (CSV only)
+     * @param output_path Output file, overwritten, "-" for the standard output (CSV only)
+     * @return ScoringStats Rows, wall time and busy time of every stage
+     * @throws std::runtime_error If a file cannot be opened, read or written, is not of the expected format (binary
+     *         files must hold scalars of type T and input_size features), or a CSV line is malformed. The output is
+     *         then incomplete.
+     */
+    ScoringStats score(const std::string& input_path, const std::string& output_path);
+
+    const ScoringOptions& get_options() const {return options;};
+};
+
+// double precision (default) and single precision names
+using BatchScorer = BasicBatchScorer<double>;
+
+using BatchScorerf = BasicBatchScorer<float>;
+
+#endif // BATCH_SCORER_HPP
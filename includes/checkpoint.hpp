@@ -0,0 +1,125 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <eigen3/Eigen/Dense>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "activation_function.hpp"
+#include "mapped_file.hpp"
+#include "mlp.hpp"
+
+/**
+ * @brief Header of the binary checkpoint format, followed by num_layers CheckpointLayer entries.
+ * 
+ * Every array (weights, bias, momentum buffers) is stored column-major, as Eigen stores it, at a 64-byte
+ * aligned offset from the start of the file, so it can be used in place through an Eigen::Map once the file
+ * is mapped. Values use the native byte order and scalar_size bytes each (4 for float, 8 for double).
+ */
+struct CheckpointHeader {
+    char magic[4]; // "MLPC"
+    uint32_t version;
+    uint32_t scalar_size;
+    uint32_t num_layers;
+    uint32_t input_size;
+    uint32_t flags; // see CHECKPOINT_HAS_MOMENTUM
+};
+
+constexpr uint32_t CHECKPOINT_HAS_MOMENTUM = 1; // the momentum buffers are stored, training can resume exactly
+constexpr uint32_t CHECKPOINT_VERSION = 1;
+constexpr uint64_t CHECKPOINT_ALIGNMENT = 64;
+
+/**
+ * @brief Topology and array offsets of one layer of a checkpoint.
+ */
+struct CheckpointLayer {
+    uint32_t input_size;
+    uint32_t output_size;
+    uint32_t activation; // ActivationType, never Custom
+    uint32_t reserved;
+    uint64_t weights_offset;
+    uint64_t bias_offset;
+    uint64_t prev_weights_update_offset; // 0 if the momentum buffers are not stored
+    uint64_t prev_bias_update_offset;
+};
+
+/**
+ * @brief Read-only MLP served straight from a memory-mapped checkpoint (see BasicMLP::save).
+ * 
+ * Loading only maps the file and validates its layout: the layers are Eigen::Map views on the mapped pages,
+ * so startup does not depend on the model size and all the processes serving the same checkpoint on a host
+ * share one page-cached copy of the weights. The file must not be modified while it is mapped.
+ * 
+ * The model is immutable, so infer can be called concurrently.
+ * 
+ * @tparam T Scalar type, it must match the one of the checkpoint.
+ */
+template <typename T>
+class BasicMappedMLP {
+public:
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+    using ConstMap = Eigen::Map<const Matrix>;
+    using InferenceScratch = BasicInferenceScratch<T>;
+
+    /**
+     * @brief One layer of the checkpoint, viewed in place.
+     */
+    struct MappedLayer {
+        ActivationType activation;
+        ConstMap weights; // output_size x input_size
+        ConstMap bias; // output_size x 1
+        const T* prev_weights_update; // null if the momentum buffers are not stored
+        const T* prev_bias_update;
+    };
+
+private:
+    MappedFile file;
+    std::vector<MappedLayer> layers;
+    bool momentum = false;
+
+public:
+    /**
+     * @brief Map a checkpoint.
+     * 
+     * @param path Path of the checkpoint
+     * @throws std::runtime_error If the file cannot be mapped or is not a valid checkpoint of scalar type T.
+     */
+    explicit BasicMappedMLP(const std::string& path);
+
+    int get_num_layers() const {return layers.size();};
+    int get_input_size() const {return layers[0].weights.cols();};
+    int get_output_size() const {return layers.back().weights.rows();};
+    const MappedLayer& get_layer(int i) const {return layers[i];};
+    bool has_momentum() const {return momentum;};
+
+    /**
+     * @brief Forward pass, safe to call from many threads (see BasicMLP::infer).
+     * 
+     * @param x Input data
+     * @param out Output data, resized if needed. It must not alias x
+     */
+    void infer(const Eigen::Ref<const Matrix>& x, Matrix& out) const;
+
+    /**
+     * @brief Forward pass using caller-supplied scratch buffers
+     * 
+     * @param x Input data
+     * @param out Output data, resized if needed. It must not alias x
+     * @param scratch Ping-pong buffers, owned by the calling thread
+     */
+    void infer(const Eigen::Ref<const Matrix>& x, Matrix& out, InferenceScratch& scratch) const;
+
+    /**
+     * @brief Forward pass
+     * 
+     * @param x Input data
+     * @return Matrix Output data
+     */
+    Matrix predict(const Eigen::Ref<const Matrix>& x) const;
+};
+
+// double precision (default) and single precision names
+using MappedMLP = BasicMappedMLP<double>;
+using MappedMLPf = BasicMappedMLP<float>;
+
+#endif // CHECKPOINT_HPP
@@ -0,0 +1,196 @@
+#ifndef COMMUNICATOR_HPP
+#define COMMUNICATOR_HPP
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Collective operations of a group of processes training one model (see BasicMLP::set_communicator).
+ * 
+ * Every rank of the group must call the collectives in the same order with the same sizes, a call returns once
+ * every rank has made it. The sums are computed in an order that does not depend on the rank, so every rank gets
+ * bit-identical results and the replicas of the model stay identical.
+ * 
+ * @tparam T Scalar type (float or double).
+ */
+template <typename T>
+class BasicCommunicator {
+public:
+    using Scalar = T;
+
+    /**
+     * @brief Sum data over the ranks, in place
+     * 
+     * @param data count values, the sum on return
+     * @param count Number of values, the same on every rank
+     * @throws std::runtime_error If another rank is gone.
+     */
+    virtual void all_reduce(T* data, long count) = 0;
+
+    /**
+     * @brief Copy the data of root to every rank, in place
+     * 
+     * @throws std::runtime_error If another rank is gone.
+     */
+    void broadcast(T* data, long count, int root);
+
+    virtual int get_rank() const = 0;
+    virtual int get_size() const = 0;
+
+    virtual ~BasicCommunicator() = default;
+};
+
+/**
+ * @brief Communicator of the processes of one host, through a POSIX shared memory segment.
+ * 
+ * The segment holds one slot per rank and a result area, of capacity values each. An all-reduce works on pieces
+ * of at most capacity values: every rank copies its piece into its slot, then sums the share 1/size of the piece
+ * it owns over the slots of every rank, in rank order, and every rank copies the whole result back. That is a
+ * reduce-scatter followed by an all-gather, each value crossing the memory bus about three times, with two
+ * barriers per piece. Ranks wait at the barriers on a futex after a short spin, and check that the others are
+ * still alive.
+ * 
+ * @tparam T Scalar type (float or double).
+ */
+template <typename T>
+class BasicSharedMemoryCommunicator : public BasicCommunicator<T> {
+    struct Header;
+
+    int rank;
+    int size;
+    long capacity;
+    std::string name;
+    Header* header = nullptr;
+    std::size_t mapped_bytes = 0;
+    T* slots = nullptr; // size slots of capacity values, then the result area
+
+    /**
+     * @brief Wait until every rank has reached the barrier
+     */
+    void barrier();
+
+public:
+    /**
+     * @brief Create (rank 0) or attach to (other ranks) the segment of a group, waits until every rank is there.
+     * The segment name is removed once every rank has attached, the memory goes away with the last rank.
+     * 
+     * @param name Name of the segment (e.g. "/mlp-job-42"), unique to the group and the same for every rank
+     * @param rank Rank of the calling process, in [0, size)
+     * @param size Number of processes of the group
+     * @param capacity Values exchanged per piece of an all-reduce, the segment takes (size + 1) * capacity values
+     * @throws std::invalid_argument If rank, size or capacity is out of range.
+     * @throws std::runtime_error If the segment cannot be created, or attached to within 30 seconds.
+     */
+    BasicSharedMemoryCommunicator(const std::string& name, int rank, int size, long capacity = 1 << 20);
+
+    BasicSharedMemoryCommunicator(const BasicSharedMemoryCommunicator&) = delete;
+    BasicSharedMemoryCommunicator& operator=(const BasicSharedMemoryCommunicator&) = delete;
+
+    void all_reduce(T* data, long count) override;
+
+    int get_rank() const override {return rank;};
+    int get_size() const override {return size;};
+
+    ~BasicSharedMemoryCommunicator();
+};
+
+/**
+ * @brief Communicator over TCP, for ranks on several hosts.
+ * 
+ * The ranks form a ring: every rank is connected to the next one and to the previous one. An all-reduce is the
+ * ring algorithm: the data is split in size chunks, size - 1 steps of reduce-scatter leave every rank with the sum
+ * of one chunk, size - 1 steps of all-gather pass the sums around. Every rank sends and receives about twice the
+ * data whatever the number of ranks. Sends and receives of a step overlap (poll), so chunks can be larger than the
+ * socket buffers.
+ * 
+ * @tparam T Scalar type (float or double).
+ */
+template <typename T>
+class BasicSocketCommunicator : public BasicCommunicator<T> {
+    int rank;
+    int size;
+    int next_fd = -1; // connected to rank + 1
+    int previous_fd = -1; // accepted from rank - 1
+    std::vector<T> received; // chunk being received
+
+    /**
+     * @brief Send send_count values to the next rank while receiving receive_count from the previous one into received
+     */
+    void exchange(const T* send, long send_count, long receive_count);
+
+public:
+    /**
+     * @brief Listen on the address of this rank, connect to the next rank and accept the previous one
+     * 
+     * @param rank Rank of the calling process
+     * @param addresses "ip:port" of every rank (IPv4), the same list on every rank
+     * @param listen_fd Socket already listening on the address of this rank (e.g. bound by a launcher before
+     *        spawning the ranks, so that the ports are known), -1 to create it. Owned afterwards
+     * @throws std::invalid_argument If rank is out of range or an address is invalid.
+     * @throws std::runtime_error If the ring cannot be connected within 30 seconds.
+     */
+    BasicSocketCommunicator(int rank, const std::vector<std::string>& addresses, int listen_fd = -1);
+
+    BasicSocketCommunicator(const BasicSocketCommunicator&) = delete;
+    BasicSocketCommunicator& operator=(const BasicSocketCommunicator&) = delete;
+
+    void all_reduce(T* data, long count) override;
+
+    int get_rank() const override {return rank;};
+    int get_size() const override {return size;};
+
+    ~BasicSocketCommunicator();
+};
+
+/**
+ * @brief How launch_local spawns the ranks.
+ */
+struct LaunchOptions {
+    enum class Transport { SharedMemory, Socket };
+
+    Transport transport = Transport::SharedMemory;
+    bool pin_cpus = true; // pin every rank to the CPUs of one NUMA node (a share of them if ranks outnumber nodes)
+    long capacity = 1 << 20; // shared memory: values per piece of an all-reduce
+};
+
+/**
+ * @brief Run body in num_ranks child processes of this host, each with the communicator of its rank, and wait
+ * for all of them.
+ * 
+ * The children are forked: they share the data loaded before the call (copy-on-write) and nothing else. With
+ * pin_cpus, the memory every rank allocates after the fork (its model, optimizer state and activations) is first
+ * touched on its own NUMA node. Call it before starting any thread (e.g. models with set_num_threads), only the
+ * calling thread is forked.
+ * 
+ * @param num_ranks Number of processes
+ * @param body Work of a rank, e.g. fit a model on its shard of the data after set_communicator
+ * @param options Transport and pinning
+ * @throws std::invalid_argument If num_ranks is not positive.
+ * @throws std::runtime_error If a rank cannot be spawned or fails (its exception is printed to stderr).
+ */
+template <typename T>
+void launch_local(int num_ranks, const std::function<void(BasicCommunicator<T>&)>& body, const LaunchOptions& options = LaunchOptions());
+
+/**
+ * @brief Rows of a rank when n rows are split evenly over size ranks: every rank gets n / size contiguous rows,
+ * the last n % size rows are left out so that every rank runs the same number of minibatches.
+ * 
+ * @return std::pair<long, long> First row and number of rows
+ */
+inline std::pair<long, long> shard_range(long rows, int rank, int size){
+    long share = rows / size;
+    return {rank * share, share};
+}
+
+// double precision (default) and single precision names
+using Communicator = BasicCommunicator<double>;
+using SharedMemoryCommunicator = BasicSharedMemoryCommunicator<double>;
+using SocketCommunicator = BasicSocketCommunicator<double>;
+
+using Communicatorf = BasicCommunicator<float>;
+using SharedMemoryCommunicatorf = BasicSharedMemoryCommunicator<float>;
+using SocketCommunicatorf = BasicSocketCommunicator<float>;
+
+#endif // COMMUNICATOR_HPP
@@ -0,0 +1,175 @@
+#ifndef DATASET_HPP
+#define DATASET_HPP
+
+#include <eigen3/Eigen/Dense>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mapped_file.hpp"
+
+/**
+ * @brief Header of the binary dataset format.
+ * 
+ * The header is followed by num_rows records, each one made of num_features inputs followed by
+ * num_targets targets, stored row-major with scalar_size bytes per value (4 for float, 8 for double).
+ */
+struct DatasetHeader {
+    char magic[4]; // "MLPD"
+    uint32_t version;
+    uint32_t scalar_size;
+    uint32_t num_features;
+    uint32_t num_targets;
+    uint32_t reserved;
+    uint64_t num_rows;
+};
+
+/**
+ * @brief Read-only dataset backed by a memory-mapped binary file.
+ * 
+ * Only the pages actually touched are loaded, and they can be evicted by the kernel, so the dataset does not
+ * need to fit in RAM.
+ * 
+ * @tparam T Scalar type of the file (float or double).
+ */
+template <typename T>
+class BasicMappedDataset {
+public:
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+
+private:
+    MappedFile file;
+    const T* records = nullptr; // first value of the first row
+    DatasetHeader header;
+
+public:
+    static constexpr uint32_t VERSION = 1;
+
+    /**
+     * @brief Map a dataset file.
+     * 
+     * @param path Path of the file
+     * @param random_access Hint the kernel that rows will be read in random (shuffled) order
+     * @throws std::runtime_error If the file cannot be mapped or is not a valid dataset of scalar type T.
+     */
+    explicit BasicMappedDataset(const std::string& path, bool random_access = true);
+
+    /**
+     * @brief Write x (inputs) and y (targets) to a dataset file.
+     * 
+     * @param path Path of the file
+     * @param x Input data, one sample per row
+     * @param y Target data, one sample per row
+     * @throws std::runtime_error If the file cannot be written.
+     */
+    static void write(const std::string& path, const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y);
+
+    long rows() const {return header.num_rows;};
+    int num_features() const {return header.num_features;};
+    int num_targets() const {return header.num_targets;};
+
+    /**
+     * @brief Pointer to the record of row i: num_features inputs followed by num_targets targets.
+     */
+    const T* row(long i) const {return records + (std::size_t)i * ((std::size_t)header.num_features + header.num_targets);};
+
+    /**
+     * @brief Copy the given rows into x and y (resized if needed).
+     * 
+     * @param indices Row indices
+     * @param count Number of rows to copy
+     * @param x Receives the inputs
+     * @param y Receives the targets
+     */
+    void gather(const long* indices, int count, Matrix& x, Matrix& y) const;
+
+    /**
+     * @brief Copy the rows [begin, begin + count) into x and y (resized if needed).
+     */
+    void gather_range(long begin, int count, Matrix& x, Matrix& y) const;
+};
+
+/**
+ * @brief Background loader producing the minibatches of a BasicMappedDataset.
+ * 
+ * A producer thread reshuffles the rows every epoch (if requested) and gathers the next minibatches into a
+ * bounded ring of buffers while the current one trains. Buffers are handed over by swapping, so no copy
+ * and, after the first round, no allocation happens on the consumer side.
+ * 
+ * @tparam T Scalar type (float or double).
+ */
+template <typename T>
+class BasicBatchPrefetcher {
+public:
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+
+    /**
+     * @brief One minibatch.
+     */
+    struct Batch {
+        Matrix x;
+        Matrix y;
+    };
+
+private:
+    const BasicMappedDataset<T>& data;
+    int batch_size;
+    int batches_per_epoch;
+    int epochs;
+    bool shuffle;
+    unsigned seed;
+
+    std::vector<Batch> ring;
+    int head = 0; // next slot to consume
+    int count = 0; // filled slots
+    long consumed = 0; // minibatches handed to the consumer
+    bool stop = false;
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+    std::thread producer;
+
+    /**
+     * @brief Main loop of the producer thread.
+     */
+    void produce();
+
+public:
+    /**
+     * @brief Start prefetching.
+     * 
+     * @param data Dataset, it must outlive the prefetcher
+     * @param batch_size Rows per minibatch
+     * @param batches_per_epoch Minibatches produced per epoch, the last one is partial if the rows run out
+     * @param epochs Number of epochs
+     * @param shuffle Whether to draw a new random permutation of the rows every epoch
+     * @param seed Seed of the shuffling
+     * @param depth Number of minibatches prepared in advance
+     */
+    BasicBatchPrefetcher(const BasicMappedDataset<T>& data, int batch_size, int batches_per_epoch, int epochs,
+            bool shuffle = true, unsigned seed = 0, int depth = 4);
+
+    /**
+     * @brief Get the next minibatch, waiting for it if needed.
+     * 
+     * The buffers of batch are swapped with the prefetched ones and recycled by the producer.
+     * 
+     * @param batch Receives the minibatch
+     * @return bool false once all the minibatches of all the epochs have been consumed
+     */
+    bool next(Batch& batch);
+
+    ~BasicBatchPrefetcher();
+};
+
+// double precision (default) and single precision names
+using MappedDataset = BasicMappedDataset<double>;
+using BatchPrefetcher = BasicBatchPrefetcher<double>;
+
+using MappedDatasetf = BasicMappedDataset<float>;
+using BatchPrefetcherf = BasicBatchPrefetcher<float>;
+
+#endif // DATASET_HPP
\ No newline at end of file
@@ -0,0 +1,187 @@
+#ifndef ENSEMBLE_HPP
+#define ENSEMBLE_HPP
+
+#include <eigen3/Eigen/Dense>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "activation_function.hpp"
+#include "inference_scratch.hpp"
+#include "loss_function.hpp"
+#include "minibatch.hpp"
+#include "thread_pool.hpp"
+
+/**
+ * @brief Initialization and SGD hyperparameters of one member of an ensemble.
+ */
+struct EnsembleMember {
+    unsigned seed = 0; // the initial weights are the ones of an MLP built right after std::srand(seed)
+    double learning_rate = 0.01;
+    double momentum = 0.9;
+    double weight_decay = 0;
+};
+
+/**
+ * @brief M MLPs of the same topology trained together on the same minibatches.
+ * 
+ * The parameters of the members are stacked side by side: the weights of a layer are stored transposed as an
+ * input_size x (M * output_size) matrix whose column block m holds W_m^T, so the activations of all the members
+ * form one batch_size x (M * output_size) matrix. The first layer, whose input is shared, runs its forward pass
+ * and its weight gradient as one GEMM over a whole range of members; the other layers run one GEMM per member on
+ * contiguous blocks (Eigen has no batched GEMM), and the bias, activation and derivative are single passes over
+ * the range.
+ * 
+ * With several threads (see set_num_threads) the members are split in contiguous groups, one per thread, and
+ * every thread runs the whole training step of its group: one dispatch per minibatch, without the gradient
+ * reduction of data-parallel training. The GEMMs of a small model are too small to be split across cores, this
+ * keeps them all busy with independent members instead.
+ * 
+ * Each member behaves like an MLP trained alone with SGD and momentum, with its own seed and hyperparameters.
+ * 
+ * @tparam T Scalar type (float or double).
+ */
+template <typename T>
+class BasicEnsemble {
+public:
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+    using InferenceScratch = BasicInferenceScratch<T>;
+
+private:
+    /**
+     * @brief Stacked parameters of one layer.
+     */
+    struct Layer {
+        int input_size;
+        int output_size;
+        ActivationType activation;
+        Matrix weights; // input_size x (M * output_size), W_m^T in column block m
+        Matrix bias; // 1 x (M * output_size)
+        Matrix velocity_weights; // SGD momentum buffers, same shapes
+        Matrix velocity_bias;
+    };
+
+    /**
+     * @brief Training buffers of one layer, for one minibatch size.
+     */
+    struct Workspace {
+        Matrix output; // batch_size x (M * output_size)
+        Matrix delta; // gradient with respect to output, then to the pre-activation
+        Matrix grad_weights; // same shape as the weights
+        Matrix grad_bias;
+    };
+
+    int input_size;
+    std::vector<EnsembleMember> members;
+    std::vector<Layer> layers;
+    std::vector<Workspace> full_batches; // buffers of the full minibatches
+    std::vector<Workspace> last_batch; // buffers of the final partial minibatch
+    std::vector<Matrix> loss_grads; // per member
+    std::vector<double> batch_losses; // per member
+    std::unique_ptr<ThreadPool> pool;
+    int num_threads = 1;
+
+    /**
+     * @brief Size the buffers for a minibatch of the given number of rows (no-op when they already fit).
+     */
+    void prepare(std::vector<Workspace>& ws, long rows);
+
+    /**
+     * @brief Forward pass, backward pass and SGD step of the members [first, last) on one minibatch.
+     * 
+     * Only touches the column blocks of these members, so disjoint ranges can run concurrently.
+     * The loss of every member goes to batch_losses.
+     */
+    void train_step(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y, BasicLossFunction<T>* loss_function,
+            std::vector<Workspace>& ws, int first, int last);
+
+public:
+    /**
+     * @brief Construct a new Ensemble object
+     * 
+     * @param input_size Input size
+     * @param layers List of pairs of (number of neurons, activation) for each layer, the last one is the output layer
+     * @param members Seed and hyperparameters of every member
+     * @throws std::invalid_argument If there is no member or no layer, or an activation is Custom, GELU or SiLU (exact or fast): their derivative needs the pre-activation.
+     */
+    BasicEnsemble(int input_size, std::vector<std::pair<int, ActivationType>> layers, std::vector<EnsembleMember> members);
+
+    /**
+     * @brief Fit every member on the same minibatches
+     * 
+     * @param x_train Input data
+     * @param y_train Target data
+     * @param x_test Test input data
+     * @param y_test Test target data
+     * @param epochs Number of epochs
+     * @param batching Minibatch size, shuffling and handling of the partial minibatch (see MinibatchOptions)
+     * @param loss_function Loss function, its loss must be a mean over the rows; it must be stateless with several threads
+     * @return Loss history of every member: [member][epoch] = (train loss, test loss)
+     */
+    std::vector<std::vector<std::pair<double, double>>> fit(const Eigen::Ref<const Matrix>& x_train, const Eigen::Ref<const Matrix>& y_train,
+            const Eigen::Ref<const Matrix>& x_test, const Eigen::Ref<const Matrix>& y_test,
+            int epochs, const MinibatchOptions& batching, BasicLossFunction<T>* loss_function);
+
+    /**
+     * @brief Set the number of threads used by fit (1 by default), at most one per member is used
+     * 
+     * @param num_threads Number of threads
+     */
+    void set_num_threads(int num_threads);
+
+    /**
+     * @brief Outputs of every member, stacked: column block m holds the output of member m
+     * 
+     * The intermediate activations go into ping-pong buffers held thread-locally, as in MLP::infer.
+     * 
+     * @param x Input data
+     * @param out batch_size x (M * output_size), resized if needed
+     */
+    void infer_members(const Eigen::Ref<const Matrix>& x, Matrix& out) const;
+
+    /**
+     * @brief Outputs of every member, using caller-supplied scratch buffers
+     * 
+     * @param x Input data
+     * @param out batch_size x (M * output_size), resized if needed
+     * @param scratch Ping-pong buffers, owned by the calling thread
+     */
+    void infer_members(const Eigen::Ref<const Matrix>& x, Matrix& out, InferenceScratch& scratch) const;
+
+    /**
+     * @brief Prediction of the ensemble, the mean of the outputs of the members
+     */
+    Matrix predict(const Eigen::Ref<const Matrix>& x) const;
+
+    /**
+     * @brief Loss of every member
+     */
+    std::vector<double> evaluate_members(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y, BasicLossFunction<T>* loss_function) const;
+
+    /**
+     * @brief Loss of the prediction of the ensemble
+     */
+    double evaluate(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y, BasicLossFunction<T>* loss_function) const;
+
+    int get_num_members() const {return members.size();};
+    int get_num_layers() const {return layers.size();};
+    int get_input_size() const {return input_size;};
+    int get_output_size() const {return layers.back().output_size;};
+    const EnsembleMember& get_member(int m) const {return members[m];};
+
+    /**
+     * @brief Weights of a layer of a member, output_size x input_size as in FCLayer
+     */
+    Matrix get_weights(int layer, int member) const;
+
+    /**
+     * @brief Bias of a layer of a member, output_size x 1 as in FCLayer
+     */
+    Matrix get_bias(int layer, int member) const;
+};
+
+// double precision (default) and single precision names
+using Ensemble = BasicEnsemble<double>;
+
+using Ensemblef = BasicEnsemble<float>;
+
+#endif // ENSEMBLE_HPP
@@ -0,0 +1,20 @@
+#ifndef INFERENCE_SCRATCH_HPP
+#define INFERENCE_SCRATCH_HPP
+
+#include <eigen3/Eigen/Dense>
+
+/**
+ * @brief Ping-pong buffers used by MLP::infer (and MappedMLP::infer, Ensemble::infer_members), layer i writes into
+ * one and layer i+1 reads from it, and the rows gathered by the chunked evaluations.
+ * 
+ * A scratch must not be shared by concurrent infer calls, the model itself can.
+ */
+template <typename T>
+struct BasicInferenceScratch {
+    Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> ping;
+    Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> pong;
+    Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> x_chunk; // inputs of a chunk of rows
+    Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> y_chunk; // targets of a chunk of rows
+};
+
+#endif // INFERENCE_SCRATCH_HPP
@@ -0,0 +1,308 @@
+#ifndef INFERENCE_SERVER_HPP
+#define INFERENCE_SERVER_HPP
+
+#include <eigen3/Eigen/Dense>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mlp.hpp"
+
+/**
+ * @brief Greeting sent by the server on every new connection, then the client sends requests.
+ * 
+ * A request is a uint32 op followed by its payload: INFERENCE_PREDICT and input_size scalars, or
+ * INFERENCE_STATS alone. A response is a uint32 op followed by its payload: INFERENCE_PREDICT and output_size
+ * scalars, or INFERENCE_STATS, a uint32 length and the JSON of the ServerStats. Predictions are answered in
+ * the order of the requests of the connection, so a client can pipeline them. Values use the native byte
+ * order and scalar_size bytes each (4 for float, 8 for double): the protocol is meant for local clients.
+ */
+struct InferenceServerHello {
+    char magic[4]; // "MLPS"
+    uint32_t version;
+    uint32_t scalar_size;
+    uint32_t input_size;
+    uint32_t output_size;
+};
+
+constexpr uint32_t INFERENCE_PROTOCOL_VERSION = 1;
+constexpr uint32_t INFERENCE_PREDICT = 0;
+constexpr uint32_t INFERENCE_STATS = 1;
+
+/**
+ * @brief How the server groups requests into batches.
+ */
+struct BatchingOptions {
+    int max_batch_size = 64; // rows of a forward pass
+    std::chrono::microseconds max_delay{500}; // longest the oldest queued request waits for its batch to fill
+    int queue_capacity = 4096; // requests waiting at most, submitters block beyond it
+    int latency_window = 16384; // latencies of the last requests kept for the percentiles
+    int max_unread_answers = 65536; // answers a connection may have waiting for its client, which is disconnected beyond
+};
+
+/**
+ * @brief Counters of a server since its start.
+ */
+struct ServerStats {
+    long requests = 0; // answered
+    long batches = 0;
+    int queue_depth = 0; // requests waiting now
+    int max_queue_depth = 0;
+    std::vector<long> batch_sizes; // [s] = number of batches of s rows, s up to max_batch_size
+    double p50_latency_us = 0; // from the arrival of a request to its answer, over the latency window
+    double p99_latency_us = 0;
+};
+
+/**
+ * @brief JSON object of the stats, the batch size histogram as an array.
+ */
+std::string to_json(const ServerStats& stats);
+
+/**
+ * @brief Dynamic batching inference server around a trained MLP.
+ * 
+ * Single-row requests, from local clients (see listen_unix, listen_tcp and BasicInferenceClient) or from
+ * threads of the same process (see predict), are queued. A batching thread takes up to max_batch_size of them
+ * at a time, as soon as that many are queued or the oldest one has waited max_delay, runs one batched forward
+ * pass (BasicMLP::infer) and sends every row of the output back to its requester. Under load the batches fill
+ * up and the GEMMs run at batch efficiency, when idle a request waits at most max_delay.
+ * 
+ * The queue is a ring of rows allocated once. Every connection is served by its own reader and writer threads:
+ * the batching thread only appends the answers to the output buffer of the connection, so a client that stops
+ * reading never blocks it, and is disconnected once max_unread_answers answers wait for it.
+ * 
+ * @tparam T Scalar type (float or double).
+ */
+template <typename T>
+class BasicInferenceServer {
+public:
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+    using RowVector = Eigen::Matrix<T, 1, Eigen::Dynamic>;
+    using RowView = Eigen::Ref<const RowVector, 0, Eigen::InnerStride<>>;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief Receiver of the answer of a request: a connection or a thread waiting in predict.
+     */
+    struct Sink {
+        /**
+         * @brief Answers of consecutive requests of this sink, rows of output_size values one after the other
+         */
+        virtual void deliver(const T* answers, int rows) = 0;
+        virtual ~Sink() = default;
+    };
+
+    struct Waiter;
+    struct Connection;
+
+    struct Request {
+        std::shared_ptr<Sink> sink;
+        Clock::time_point arrival;
+    };
+
+    const BasicMLP<T>& model;
+    BatchingOptions options;
+    int input_size;
+    int output_size;
+
+    // queue of requests, a ring of queue_capacity rows
+    mutable std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> queue_rows;
+    std::vector<Request> queue;
+    int head = 0;
+    int size = 0;
+    int max_depth = 0;
+    bool stopping = false;
+    std::thread batcher;
+
+    // listeners and connections
+    std::vector<int> listen_fds;
+    std::vector<std::thread> acceptors;
+    std::string unix_path; // removed on stop
+    int tcp_port = 0;
+    std::mutex connections_mutex;
+    std::vector<std::shared_ptr<Connection>> connections;
+
+    // stats
+    mutable std::mutex stats_mutex;
+    ServerStats stats;
+    std::vector<float> latencies; // ring of the last latencies, in microseconds
+    long num_latencies = 0;
+
+    /**
+     * @brief Queue a request, waiting while the queue is full
+     * 
+     * @return bool false if the server is stopping
+     */
+    bool submit(const RowView& x, std::shared_ptr<Sink> sink);
+
+    /**
+     * @brief Main loop of the batching thread
+     */
+    void batch_loop();
+
+    /**
+     * @brief Accept the connections of a listening socket until stop
+     */
+    void accept_loop(int listen_fd);
+
+    /**
+     * @brief Read the requests of a connection until it is closed
+     */
+    void read_loop(std::shared_ptr<Connection> connection);
+
+public:
+    /**
+     * @brief Start the batching thread, requests can be submitted with predict right away
+     * 
+     * @param model Model served, it must outlive the server and must not be trained while it serves
+     * @param options Batching options
+     * @throws std::invalid_argument If max_batch_size, queue_capacity, latency_window or max_unread_answers is not positive.
+     */
+    BasicInferenceServer(const BasicMLP<T>& model, const BatchingOptions& options = BatchingOptions());
+
+    BasicInferenceServer(const BasicInferenceServer&) = delete;
+    BasicInferenceServer& operator=(const BasicInferenceServer&) = delete;
+
+    /**
+     * @brief Serve the clients connecting to a Unix domain socket, the file is replaced if it exists
+     * 
+     * @param path Path of the socket
+     * @throws std::runtime_error If the socket cannot be created.
+     */
+    void listen_unix(const std::string& path);
+
+    /**
+     * @brief Serve the clients connecting to a TCP port of the loopback interface
+     * 
+     * @param port Port, 0 for any free one (see get_port)
+     * @throws std::runtime_error If the socket cannot be created.
+     */
+    void listen_tcp(int port);
+
+    /**
+     * @brief TCP port listened on, once listen_tcp has been called
+     */
+    int get_port() const {return tcp_port;};
+
+    /**
+     * @brief Prediction of one row, batched with the other requests. Blocks until the answer is there.
+     * 
+     * @param x Input row, input_size values
+     * @param y Output row, output_size values
+     * @throws std::runtime_error If the server is stopping.
+     */
+    void predict(const RowView& x, Eigen::Ref<RowVector> y);
+
+    /**
+     * @brief Stats since the start of the server, the percentiles over the last latency_window requests
+     */
+    ServerStats get_stats() const;
+
+    /**
+     * @brief Close the listeners and the connections, answer the queued requests and join every thread.
+     * Called by the destructor.
+     */
+    void stop();
+
+    const BatchingOptions& get_options() const {return options;};
+
+    ~BasicInferenceServer();
+};
+
+/**
+ * @brief Client of an inference server over a Unix domain socket or loopback TCP.
+ * 
+ * Requests can be pipelined: send several rows, then receive their outputs in the same order. A client must
+ * not be shared by threads without synchronization, use one per thread instead.
+ * 
+ * @tparam T Scalar type (float or double), the one of the server.
+ */
+template <typename T>
+class BasicInferenceClient {
+public:
+    using RowVector = Eigen::Matrix<T, 1, Eigen::Dynamic>;
+    using RowView = Eigen::Ref<const RowVector, 0, Eigen::InnerStride<>>;
+
+private:
+    int fd = -1;
+    int input_size = 0;
+    int output_size = 0;
+    std::vector<char> frame; // request being written, op and row
+
+    /**
+     * @brief Read the greeting of the server and check it
+     */
+    void handshake();
+
+public:
+    /**
+     * @brief Connect to a server listening on a Unix domain socket
+     * 
+     * @param path Path of the socket
+     * @throws std::runtime_error If the connection fails or the server serves another scalar type.
+     */
+    explicit BasicInferenceClient(const std::string& path);
+
+    /**
+     * @brief Connect to a server listening on a TCP port of the loopback interface
+     * 
+     * @param port Port of the server
+     * @throws std::runtime_error If the connection fails or the server serves another scalar type.
+     */
+    explicit BasicInferenceClient(int port);
+
+    BasicInferenceClient(const BasicInferenceClient&) = delete;
+    BasicInferenceClient& operator=(const BasicInferenceClient&) = delete;
+
+    /**
+     * @brief Send a prediction request without waiting for its answer
+     * 
+     * @param x Input row, input_size values
+     * @throws std::runtime_error If the connection is lost.
+     */
+    void send(const RowView& x);
+
+    /**
+     * @brief Receive the answer of the oldest request sent and not received yet
+     * 
+     * @param y Output row, output_size values
+     * @throws std::runtime_error If the connection is lost.
+     */
+    void receive(Eigen::Ref<RowVector> y);
+
+    /**
+     * @brief Prediction of one row, send then receive
+     */
+    void predict(const RowView& x, Eigen::Ref<RowVector> y);
+
+    /**
+     * @brief Stats of the server as JSON (see to_json), every prediction sent must have been received
+     * 
+     * @throws std::runtime_error If the connection is lost.
+     */
+    std::string get_stats();
+
+    int get_input_size() const {return input_size;};
+    int get_output_size() const {return output_size;};
+
+    ~BasicInferenceClient();
+};
+
+// double precision (default) and single precision names
+using InferenceServer = BasicInferenceServer<double>;
+using InferenceClient = BasicInferenceClient<double>;
+
+using InferenceServerf = BasicInferenceServer<float>;
+using InferenceClientf = BasicInferenceClient<float>;
+
+#endif // INFERENCE_SERVER_HPP
@@ -2,25 +2,101 @@
 #define LAYER_HPP
 
 #include <eigen3/Eigen/Dense>
+#include <eigen3/Eigen/Sparse>
 #include <memory>
+#include <vector>
 #include "../includes/activation_function.hpp"
+#include "../includes/optimizer.hpp"
+#include "../includes/profiler.hpp"
+
+/**
+ * @brief Buffers used by a layer during one training step.
+ * 
+ * The workspace is owned by the caller (MLP keeps one per layer) and sized once for a given batch size,
+ * so that forward, backward and update can write into it in place without touching the heap.
+ * 
+ * @tparam T Scalar type (float or double).
+ */
+template <typename T>
+struct BasicLayerWorkspace {
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+    using SparseMatrix = Eigen::SparseMatrix<T, Eigen::RowMajor>;
+    using InputView = Eigen::Map<const Matrix, 0, Eigen::OuterStride<>>;
+    using SparseInputView = Eigen::Map<const SparseMatrix>;
+
+    InputView input{nullptr, 0, 0, Eigen::OuterStride<>(0)}; // view on the input of the last forward (not a copy)
+    SparseInputView sparse_input{0, 0, 0, nullptr, nullptr, nullptr}; // same, when that input was sparse
+    bool sparse = false; // whether the last forward had a sparse input
+    Matrix preactivation; // X*W^T + b^T, used by the generic (virtual) path and by activations whose derivative needs it
+    Matrix output; // activation(X*W^T + b^T)
+    Matrix delta; // grad * activation'(X*W^T + b^T)
+    Matrix grad_input;
+    Matrix grad_weights;
+    Matrix grad_bias;
+
+    /**
+     * @brief Allocate every buffer for the given batch size and layer shape.
+     * 
+     * preactivation is left empty: only the generic path uses it, and sizes it on its first forward.
+     * 
+     * @param batch_size Number of rows of the batches processed with this workspace.
+     * @param input_size Size of the input of the layer.
+     * @param output_size Size of the output of the layer.
+     * @param input_gradient Whether grad_input is needed (not for the first layer, whose input can be very wide).
+     */
+    void resize(int batch_size, int input_size, int output_size, bool input_gradient = true);
+
+    /**
+     * @brief Make input a view on x. x must stay alive (and unchanged) until the matching backward.
+     * 
+     * @param x Input matrix (batch) of the layer.
+     */
+    void bind_input(const Eigen::Ref<const Matrix>& x);
+
+    /**
+     * @brief Make sparse_input a view on x, same lifetime requirements as the dense version.
+     * 
+     * @param x Sparse input matrix (batch) of the layer, in compressed form.
+     */
+    void bind_input(const Eigen::Ref<const SparseMatrix>& x);
+};
 
 /**
  * @brief Abstract base class for neural network layers.
  * 
  * This class defines the interface for all neural network layers that can be used to build a neural network.
+ * Layers hold only their parameters: everything that depends on the batch lives in a BasicLayerWorkspace.
+ * 
+ * @tparam T Scalar type (float or double).
  */
-class Layer{
+template <typename T>
+class BasicLayer{
 public:
+    using Scalar = T;
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+    using Workspace = BasicLayerWorkspace<T>;
+
     /**
      * @brief Virtual function to perform the forward pass of the layer.
      * 
      * This method must be implemented by any derived class to perform the forward pass of the layer.
      * 
+     * @param x Input matrix (batch) to the layer. It must stay alive until the matching backward.
+     * @param ws Workspace receiving the activations of the layer.
+     * @return const Matrix& Output matrix (batch) of the layer (ws.output).
+     */
+    virtual const Matrix& forward(const Eigen::Ref<const Matrix>& x, Workspace& ws) = 0;
+
+    /**
+     * @brief Virtual function to perform the inference-only forward pass of the layer.
+     * 
+     * Unlike forward, nothing needed by backpropagation is stored: the layer is only read, so the same
+     * layer can serve many threads at once.
+     * 
      * @param x Input matrix (batch) to the layer.
-     * @return Eigen::MatrixXd Output matrix (batch) of the layer.
+     * @param out Output matrix (batch) of the layer, resized if needed. It must not alias x.
      */
-    virtual Eigen::MatrixXd forward(const Eigen::MatrixXd& x) = 0;
+    virtual void infer(const Eigen::Ref<const Matrix>& x, Matrix& out) const = 0;
 
     /**
      * @brief Virtual function to perform the backward pass of the layer.
@@ -28,46 +104,104 @@ public:
      * This method must be implemented by any derived class to perform the backward pass of the layer.
      * 
      * @param grad Gradient of the loss with respect to the output of the layer.
-     * @return Eigen::MatrixXd Gradient of the loss with respect to the input of the layer.
+     * @param ws Workspace filled by the last forward, receiving the gradients.
+     * @param propagate Whether the gradient with respect to the input has to be computed (not needed for the first layer).
+     * @return const Matrix& Gradient of the loss with respect to the input of the layer (ws.grad_input).
      */
-    virtual Eigen::MatrixXd backward(const Eigen::MatrixXd& grad) = 0;
+    virtual const Matrix& backward(const Eigen::Ref<const Matrix>& grad, Workspace& ws, bool propagate = true) = 0;
 
     /**
      * @brief Virtual function to update the weights of the layer.
      * 
      * This method must be implemented by any derived class to update the weights of the layer.
      * 
-     * @param learning_rate Learning rate used to update the weights.
-     * @param weight_decay Weight decay used to update the weights.
-     * @param momentum Momentum used to update the weights.
+     * @param ws Workspace holding the gradients computed by the last backward.
+     * @param optimizer Optimizer applying the update rule, it owns the state (momentum...) of the parameters.
+     * @param slot First optimizer slot of the layer, one slot per parameter tensor.
      */
-    virtual void update(double learning_rate, double weight_decay, double momentum) = 0;
+    virtual void update(const Workspace& ws, BasicOptimizer<T>& optimizer, int slot) = 0;
 
-    virtual ~Layer() = default;
+    virtual ~BasicLayer() = default;
 };
 
 /**
  * @brief Fully Connected layer.
  * 
  * The FullyConnected class implements a fully connected layer in a neural network.
+ * The activation function is called through the virtual ActivationFunction interface, so any
+ * user-defined activation can be used. The built-in activations are served by FusedFCLayer instead
+ * (see make_fc_layer).
+ * 
+ * In mixed precision mode (see enable_master_weights) a double precision master copy of the parameters
+ * receives the updates, and the working parameters of type T are rounded from it after every step.
+ * 
+ * A pruned layer (see prune_magnitude) keeps a mask of its weights, applied again after every update so that
+ * fine-tuning never revives a pruned weight. Once sparse enough, the weights are also kept in CSR form and the
+ * products with them skip the pruned weights (see SPARSE_MAX_DENSITY).
+ * 
+ * @tparam T Scalar type (float or double).
  */
-class FCLayer : public Layer {
-private:
+template <typename T>
+class BasicFCLayer : public BasicLayer<T> {
+public:
+    using typename BasicLayer<T>::Matrix;
+    using typename BasicLayer<T>::Workspace;
+    using SparseMatrix = typename Workspace::SparseMatrix;
+
+protected:
+    /**
+     * @brief Double precision copy of the parameters (mixed precision mode).
+     */
+    struct MasterCopy {
+        Eigen::MatrixXd weights;
+        Eigen::MatrixXd bias;
+    };
+
     int input_size;
     int output_size;
-    std::unique_ptr<ActivationFunction> activation;
-    Eigen::MatrixXd weights;
-    Eigen::MatrixXd bias;
-    Eigen::MatrixXd input;
-    Eigen::MatrixXd output;
-    Eigen::MatrixXd grad_weights;
-    Eigen::MatrixXd grad_bias;
-    Eigen::MatrixXd grad_input;
-    Eigen::MatrixXd grad_output;
-    Eigen::MatrixXd prev_weights_update;
-    Eigen::MatrixXd prev_bias_update;
+    std::unique_ptr<BasicActivationFunction<T>> activation;
+    Matrix weights;
+    Matrix bias;
+    std::unique_ptr<MasterCopy> master; // null unless mixed precision is enabled
+    Matrix mask; // 1 for the kept weights, 0 for the pruned ones, empty unless the layer is pruned
+    SparseMatrix sparse_weights; // CSR copy of the pruned weights, empty unless they are sparse enough
+    Profiler* profiler = nullptr; // not owned, null unless profiling is enabled
+    int profile_index = 0; // index of the layer in the profile
+
+    /**
+     * @brief Gradient of the weights, delta^T * X, from the dense or sparse input of the last forward.
+     */
+    void weight_gradient(Workspace& ws) const;
+
+    /**
+     * @brief Rest of the backward pass once ws.delta is known: gradients of the parameters and of the input.
+     */
+    const Matrix& backward_delta(Workspace& ws, bool propagate) const;
+
+    /**
+     * @brief X*W^T into out, with the CSR copy of the weights when it is faster than the dense GEMM
+     * 
+     * @param weights Weights of the product, the CSR copy only stands for the layer's own
+     */
+    void product(const Eigen::Ref<const Matrix>& x, Matrix& out, const Matrix& weights) const;
+
+    /**
+     * @brief Install a mask (empty to stop pruning), rebuild the CSR copy and zero the pruned weights
+     */
+    void set_mask(Matrix mask);
+
+    /**
+     * @brief Zero the pruned weights (and their master copy), then copy the weights into the CSR copy
+     */
+    void apply_mask();
 
 public:
+    // CSR products beat the dense ones from about 80% sparsity on batches of a few rows, while a single row
+    // goes through a GEMV that stays faster down to about 95% sparsity
+    static constexpr double SPARSE_MAX_DENSITY = 0.2; // density below which the CSR copy is kept
+    static constexpr int SPARSE_MIN_ROWS = 4; // rows from which the CSR copy is used at SPARSE_MAX_DENSITY
+    static constexpr double SPARSE_ROW_MAX_DENSITY = 0.05; // density below which it is used for fewer rows
+
     /**
      * @brief Construct a new FCLayer object.
      * 
@@ -80,21 +214,208 @@ public:
      * @param bias_max_val Maximum value for the random initialization of the bias.
      * @param bias_min_val Minimum value for the random initialization of the bias.
      */
-    FCLayer(int input_size, int output_size, std::unique_ptr<ActivationFunction> func, 
-            float min_val = -0.5, float max_val = 0.5, float bias_max_val = 0.1, float bias_min_val = -0.1);
+    BasicFCLayer(int input_size, int output_size, std::unique_ptr<BasicActivationFunction<T>> func,
+            double min_val = -0.5, double max_val = 0.5, double bias_max_val = 0.1, double bias_min_val = -0.1);
+
+    /**
+     * @brief Draw new parameters, the layer is not pruned anymore
+     */
+    void init_weights(double min_val, double max_val, double bias_max_val, double bias_min_val);
+
+    /**
+     * @brief Keep a double precision master copy of the parameters, updated in place of the working ones.
+     */
+    void enable_master_weights();
+
+    /**
+     * @brief Overwrite the parameters (e.g. from a checkpoint), the master copy follows if enabled. The mask of a
+     * pruned layer is applied to them.
+     * 
+     * @param weights Weights, output_size x input_size
+     * @param bias Bias, output_size x 1
+     * @throws std::invalid_argument If the shapes do not match the layer.
+     */
+    void set_parameters(const Eigen::Ref<const Matrix>& weights, const Eigen::Ref<const Matrix>& bias);
+
+    /**
+     * @brief Report the phases of this layer to a profiler (only with -DMLP_PROFILE).
+     * 
+     * @param profiler Profiler, not owned. nullptr stops profiling
+     * @param index Index of the layer in the profile
+     */
+    void set_profiler(Profiler* profiler, int index) {this->profiler = profiler; profile_index = index;};
+
+    const Matrix& forward(const Eigen::Ref<const Matrix>& x, Workspace& ws) override;
+
+    /**
+     * @brief Forward pass of a sparse (CSR) input, as the first layer of a model on sparse features.
+     * 
+     * X*W^T is a sparse x dense product, O(nnz * output_size) instead of O(batch_size * input_size * output_size),
+     * and backward computes the weight gradient the same way.
+     * 
+     * @param x Sparse input matrix (batch) in compressed form. It must stay alive until the matching backward.
+     * @param ws Workspace receiving the activations of the layer.
+     * @return const Matrix& Output matrix (batch) of the layer (ws.output).
+     */
+    virtual const Matrix& forward(const Eigen::Ref<const SparseMatrix>& x, Workspace& ws);
+
+    void infer(const Eigen::Ref<const Matrix>& x, Matrix& out) const override;
+
+    /**
+     * @brief Inference-only forward pass of a sparse (CSR) input.
+     */
+    void infer(const Eigen::Ref<const SparseMatrix>& x, Matrix& out) const;
 
-    void init_weights(float min_val, float max_val, float bias_max_val, float bias_min_val);
+    /**
+     * @brief Inference-only forward pass with the given parameters instead of the layer's own (e.g. a snapshot
+     * taken during training), the layer itself is only read for its activation.
+     * 
+     * @param x Input data
+     * @param out Output data, resized if needed. It must not alias x
+     * @param weights Weights, output_size x input_size
+     * @param bias Bias, output_size x 1
+     */
+    virtual void infer(const Eigen::Ref<const Matrix>& x, Matrix& out, const Matrix& weights, const Matrix& bias) const;
 
-    Eigen::MatrixXd forward(const Eigen::MatrixXd& x) override;
+    /**
+     * @brief Sparse version of the inference-only forward pass with the given parameters.
+     */
+    virtual void infer(const Eigen::Ref<const SparseMatrix>& x, Matrix& out, const Matrix& weights, const Matrix& bias) const;
 
-    Eigen::MatrixXd backward(const Eigen::MatrixXd& grad) override;
+    const Matrix& backward(const Eigen::Ref<const Matrix>& grad, Workspace& ws, bool propagate = true) override;
 
-    void update(double learning_rate, double weight_decay, double momentum) override;
+    /**
+     * @brief Backward pass from a delta already written into ws.delta, the gradient with respect to the
+     * pre-activation. A loss fused with a Linear output layer (see BasicLossFunction::loss_and_gradient) writes it
+     * there directly, which saves the copy of the gradient and the multiplication by the derivative.
+     * 
+     * @param ws Workspace filled by the last forward, whose delta is set, receiving the gradients.
+     * @param propagate Whether the gradient with respect to the input has to be computed.
+     * @return const Matrix& Gradient of the loss with respect to the input of the layer (ws.grad_input).
+     */
+    const Matrix& backward_from_delta(Workspace& ws, bool propagate = true);
 
-    const int get_input_size() {return input_size;};
-    const int get_output_size() {return output_size;};
+    void update(const Workspace& ws, BasicOptimizer<T>& optimizer, int slot) override;
 
-    ~FCLayer() = default;
+    /**
+     * @brief Magnitude pruning: zero the given fraction of the weights, the smallest in absolute value, and keep
+     * them at zero through later updates. The bias is not pruned.
+     * 
+     * The mask is computed again from the current weights, the weights pruned before being zero they stay pruned
+     * as long as the sparsity does not decrease.
+     * 
+     * @param sparsity Fraction of the weights pruned, in [0, 1)
+     * @throws std::invalid_argument If sparsity is out of range.
+     */
+    void prune_magnitude(double sparsity);
+
+    /**
+     * @brief Structured pruning: keep only the given neurons (rows of the weights and of the bias)
+     * 
+     * @param neurons Neurons kept, in increasing order
+     * @throws std::invalid_argument If neurons is empty, not increasing or out of range.
+     */
+    void keep_outputs(const std::vector<int>& neurons);
+
+    /**
+     * @brief Structured pruning: keep only the given inputs (columns of the weights), the neurons kept by the
+     * previous layer
+     * 
+     * @param inputs Inputs kept, in increasing order
+     * @throws std::invalid_argument If inputs is empty, not increasing or out of range.
+     */
+    void keep_inputs(const std::vector<int>& inputs);
+
+    /**
+     * @brief Fraction of the weights that are not pruned, 1 if the layer is not pruned
+     */
+    double get_density() const {return mask.size() ? mask.sum() / double(mask.size()) : 1.0;};
+
+    /**
+     * @brief Whether the CSR copy of the weights is kept, i.e. the layer is pruned down to SPARSE_MAX_DENSITY
+     */
+    bool has_sparse_weights() const {return sparse_weights.rows() > 0;};
+
+    const Matrix& get_mask() const {return mask;};
+
+    const int get_input_size() const {return input_size;};
+    const int get_output_size() const {return output_size;};
+    const Matrix& get_weights() const {return weights;};
+    const Matrix& get_bias() const {return bias;};
+    const BasicActivationFunction<T>& get_activation() const {return *activation;};
+
+    virtual ~BasicFCLayer() = default;
+};
+
+/**
+ * @brief Fully Connected layer specialized at compile time on its activation.
+ * 
+ * Act must provide the static kernels apply(z) and either derivative_from_output(a) (e.g. Linear, ReLU, Sigmoid
+ * and Tanh) or derivative_from_input(z) (GELU and SiLU, see DerivativeFromInput). The affine transform, the bias
+ * add and the activation are evaluated as a single Eigen expression, and backward reuses the cached output, or the
+ * pre-activation kept in the workspace, instead of re-evaluating the activation.
+ * 
+ * @tparam Act Activation function class, its scalar type is the one of the layer.
+ */
+template <typename Act>
+class FusedFCLayer : public BasicFCLayer<typename Act::Scalar> {
+public:
+    using T = typename Act::Scalar;
+    using typename BasicFCLayer<T>::Matrix;
+    using typename BasicFCLayer<T>::Workspace;
+    using typename BasicFCLayer<T>::SparseMatrix;
+
+private:
+    /**
+     * @brief Bias add and activation of z = X*W^T (ws.output, or ws.preactivation when f'(z) needs z) into ws.output.
+     */
+    void activate(Matrix& z, Workspace& ws) const;
+
+public:
+    /**
+     * @brief Construct a new FusedFCLayer object.
+     * 
+     * @param input_size Size of the input to the layer.
+     * @param output_size Size of the output of the layer.
+     * @param func Activation function instance, kept only to identify the activation of the layer.
+     */
+    FusedFCLayer(int input_size, int output_size, std::unique_ptr<BasicActivationFunction<T>> func,
+            double min_val = -0.5, double max_val = 0.5, double bias_max_val = 0.1, double bias_min_val = -0.1);
+
+    using BasicFCLayer<T>::infer;
+
+    const Matrix& forward(const Eigen::Ref<const Matrix>& x, Workspace& ws) override;
+
+    const Matrix& forward(const Eigen::Ref<const SparseMatrix>& x, Workspace& ws) override;
+
+    void infer(const Eigen::Ref<const Matrix>& x, Matrix& out, const Matrix& weights, const Matrix& bias) const override;
+
+    void infer(const Eigen::Ref<const SparseMatrix>& x, Matrix& out, const Matrix& weights, const Matrix& bias) const override;
+
+    const Matrix& backward(const Eigen::Ref<const Matrix>& grad, Workspace& ws, bool propagate = true) override;
 };
 
+/**
+ * @brief Build the fastest fully connected layer available for the given activation.
+ * 
+ * Built-in activations (every ActivationType but Custom) get a FusedFCLayer, any other activation falls back
+ * to the generic FCLayer.
+ * 
+ * @param input_size Size of the input to the layer.
+ * @param output_size Size of the output of the layer.
+ * @param func Activation function of the layer.
+ * @return std::unique_ptr<BasicFCLayer<T>> The new layer.
+ */
+template <typename T>
+std::unique_ptr<BasicFCLayer<T>> make_fc_layer(int input_size, int output_size, std::unique_ptr<BasicActivationFunction<T>> func);
+
+// double precision (default) and single precision names
+using LayerWorkspace = BasicLayerWorkspace<double>;
+using Layer = BasicLayer<double>;
+using FCLayer = BasicFCLayer<double>;
+
+using LayerWorkspacef = BasicLayerWorkspace<float>;
+using Layerf = BasicLayer<float>;
+using FCLayerf = BasicFCLayer<float>;
+
 #endif // LAYER_HPP
\ No newline at end of file
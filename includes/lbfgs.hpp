@@ -0,0 +1,119 @@
+#ifndef LBFGS_HPP
+#define LBFGS_HPP
+
+#include <eigen3/Eigen/Dense>
+#include <functional>
+#include <vector>
+
+/**
+ * @brief Settings of full-batch training with L-BFGS (see BasicMLP::fit_lbfgs).
+ */
+struct LBFGSOptions {
+    int history = 10; // (step, gradient change) pairs kept to approximate the inverse Hessian
+    int max_line_search = 20; // loss and gradient evaluations per iteration, at most
+    double c1 = 1e-4; // sufficient decrease of the line search (Armijo)
+    double c2 = 0.9; // curvature condition of the line search (strong Wolfe)
+    double gradient_tolerance = 1e-8; // stop once every component of the gradient is below, in absolute value
+    double loss_tolerance = 1e-12; // stop once an iteration decreases the loss by less than this share of it
+    double weight_decay = 0; // L2 regularization of the weights (never applied to the bias)
+};
+
+/**
+ * @brief Limited-memory BFGS minimizer of a smooth function of a flat vector, with a strong Wolfe line search.
+ * 
+ * Every iteration computes a quasi-Newton direction from the last pairs of steps and gradient changes (two-loop
+ * recursion, O(history * n)), then searches a step length along it: the unit step is tried first, extended while
+ * the loss still decreases steeply, and a bracket is narrowed by cubic interpolation otherwise. The vectors are
+ * in double precision whatever the scalar type of the model, and the history is a ring of preallocated vectors,
+ * so an iteration does not allocate after the first one.
+ * 
+ * When the line search finds no decrease the history is dropped and the steepest descent is tried, if that fails
+ * too the minimization stops at the best point.
+ */
+class LBFGS {
+public:
+    using Vector = Eigen::VectorXd;
+    /**
+     * @brief Loss at x, its gradient written into gradient (already sized)
+     */
+    using Objective = std::function<double(const Vector& x, Vector& gradient)>;
+    /**
+     * @brief Called at the end of every iteration, the objective was last evaluated at the new point
+     */
+    using Callback = std::function<void(int iteration, double loss)>;
+
+private:
+    LBFGSOptions options;
+    std::vector<Vector> steps; // s_k = x_k+1 - x_k, ring of history vectors
+    std::vector<Vector> changes; // y_k = g_k+1 - g_k
+    std::vector<double> rho; // 1 / (y_k . s_k)
+    std::vector<double> alpha; // two-loop scratch
+    double scale = 1; // y . s / y . y of the last pair, initial inverse Hessian
+    int newest = -1; // ring index of the last pair
+    int stored = 0; // pairs in the ring
+    long evaluations = 0;
+
+    Vector direction, x0, g0; // search direction, point and gradient at the start of the iteration
+
+    /**
+     * @brief Quasi-Newton direction -H g from the stored pairs, the scaled steepest descent if there is none
+     */
+    void compute_direction(const Vector& g);
+
+    /**
+     * @brief Store the pair of the step from x0 to x, skipped if its curvature y . s is not clearly positive
+     */
+    void push(const Vector& x, const Vector& g);
+
+    /**
+     * @brief Strong Wolfe line search from x0 along direction
+     * 
+     * @param f Objective
+     * @param loss0 Loss at x0
+     * @param step Initial step length
+     * @param x Point reached, the objective was last evaluated there (unspecified if the loss did not decrease)
+     * @param g Gradient at x
+     * @param loss Loss at x
+     * @return bool Whether the loss decreased
+     */
+    bool line_search(const Objective& f, double loss0, double step, Vector& x, Vector& g, double& loss);
+
+    /**
+     * @brief Evaluate the objective, counted
+     */
+    double evaluate(const Objective& f, const Vector& x, Vector& g);
+
+public:
+    /**
+     * @brief Construct a new LBFGS object
+     * 
+     * @throws std::invalid_argument If the history, line search length or constants are out of range.
+     */
+    explicit LBFGS(const LBFGSOptions& options = LBFGSOptions());
+
+    /**
+     * @brief Minimize f from x, in place
+     * 
+     * @param f Objective
+     * @param x Starting point, the best point reached on return, where the objective was last evaluated
+     * @param max_iterations Maximal number of iterations
+     * @param callback Called after every iteration, may be empty
+     * @return int Number of iterations run, fewer than max_iterations if the tolerances were met or no step
+     *         decreased the loss
+     */
+    int minimize(const Objective& f, Vector& x, int max_iterations, const Callback& callback);
+
+    /**
+     * @brief Forget the stored pairs, e.g. before minimizing another function
+     */
+    void reset() {stored = 0; newest = -1;};
+
+    /**
+     * @brief Loss and gradient evaluations made so far, i.e. passes over the whole dataset when training
+     */
+    long get_evaluations() const {return evaluations;};
+
+    const LBFGSOptions& get_options() const {return options;};
+};
+
+#endif // LBFGS_HPP
@@ -8,9 +8,14 @@
  * 
  * This class defines the interface for all loss functions that can be used to compute the loss
  * between the true and predicted values of a neural network.
+ * 
+ * @tparam T Scalar type (float or double).
  */
-class LossFunction {
+template <typename T>
+class BasicLossFunction {
 public:
+    using Scalar = T;
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
 
     /**
      * @brief Virtual function to compute the loss between true and predicted values.
@@ -22,7 +27,7 @@ public:
      * @param y_pred Predicted values of the target variable.
      * @return double The loss between the true and predicted values.
      */
-    virtual double loss(const Eigen::MatrixXd& y_true, const Eigen::MatrixXd& y_pred) = 0;
+    virtual double loss(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred) = 0;
 
     /**
      * @brief Virtual function to compute the derivative of the loss function.
@@ -32,11 +37,42 @@ public:
      * 
      * @param y_true True values of the target variable.
      * @param y_pred Predicted values of the target variable.
-     * @return Eigen::MatrixXd The derivative of the loss function.
+     * @return Matrix The derivative of the loss function.
      */
-    virtual Eigen::MatrixXd backward(const Eigen::MatrixXd& y_true, const Eigen::MatrixXd& y_pred) = 0;
+    virtual Matrix backward(const Matrix& y_true, const Matrix& y_pred) = 0;
 
-    virtual ~LossFunction() = default;
+    /**
+     * @brief Compute the derivative of the loss function into a preallocated matrix.
+     * 
+     * Used by the training loop to avoid allocating a new matrix for every minibatch. The default
+     * implementation falls back to backward(), derived classes should override it with an in-place version.
+     * 
+     * @param y_true True values of the target variable.
+     * @param y_pred Predicted values of the target variable.
+     * @param grad Output matrix receiving the derivative of the loss function.
+     */
+    virtual void backward_into(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred, Matrix& grad){
+        grad = backward(y_true, y_pred);
+    }
+
+    /**
+     * @brief Compute the loss and its derivative together.
+     * 
+     * Used by the training loop, which needs both for every minibatch: derived classes override it to share
+     * the work of the two (one pass over the predictions). The default implementation calls backward_into
+     * then loss.
+     * 
+     * @param y_true True values of the target variable.
+     * @param y_pred Predicted values of the target variable.
+     * @param grad Output matrix receiving the derivative of the loss function, it must not alias y_pred.
+     * @return double The loss between the true and predicted values.
+     */
+    virtual double loss_and_gradient(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred, Matrix& grad){
+        backward_into(y_true, y_pred, grad);
+        return loss(y_true, y_pred);
+    }
+
+    virtual ~BasicLossFunction() = default;
 };
 
 /**
@@ -45,8 +81,10 @@ public:
  * The Mean Squared Error (MSE) loss function is defined as L(y_true, y_pred) = (1 / n) * sum((y_true - y_pred)^2),
  * where n is the number of samples in the batch.
  */
-class MSE : public LossFunction {
+template <typename T>
+class BasicMSE : public BasicLossFunction<T> {
 public:
+    using typename BasicLossFunction<T>::Matrix;
 
     /**
      * @brief Compute the Mean Squared Error (MSE) loss between true and predicted values.
@@ -57,9 +95,90 @@ public:
      * @param y_pred Predicted values of the target variable.
      * @return double The Mean Squared Error (MSE) loss between the true and predicted values.
      */
-    double loss(const Eigen::MatrixXd& y_true, const Eigen::MatrixXd& y_pred) override;
+    double loss(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred) override;
+
+    Matrix backward(const Matrix& y_true, const Matrix& y_pred) override;
+
+    void backward_into(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred, Matrix& grad) override;
+
+    double loss_and_gradient(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred, Matrix& grad) override;
+};
+
+/**
+ * @brief Softmax cross-entropy loss, computed from the logits.
+ * 
+ * y_pred holds the logits z (the output of a Linear output layer) and every row of y_true a probability
+ * distribution over the classes, usually one-hot. With p = softmax(z) row by row, the loss is
+ * L = -(1 / n) * sum(y_true * log(p)) and its derivative with respect to the logits is (p - y_true) / n:
+ * the Jacobian of the softmax never has to be formed.
+ * 
+ * Both are evaluated with the log-sum-exp shift, log(p) = (z - max(z)) - log(sum(exp(z - max(z)))), so that
+ * no exponential overflows and confident predictions do not lose their loss to log(0).
+ */
+template <typename T>
+class BasicSoftmaxCrossEntropy : public BasicLossFunction<T> {
+public:
+    using typename BasicLossFunction<T>::Matrix;
+
+    double loss(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred) override;
+
+    Matrix backward(const Matrix& y_true, const Matrix& y_pred) override;
+
+    void backward_into(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred, Matrix& grad) override;
+
+    double loss_and_gradient(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred, Matrix& grad) override;
+
+    /**
+     * @brief Class probabilities of the given logits, softmax(z) row by row.
+     * 
+     * @param logits Output of the model, one row per sample.
+     * @return Matrix Probabilities, same shape.
+     */
+    static Matrix probabilities(const Eigen::Ref<const Matrix>& logits);
+};
 
-    Eigen::MatrixXd backward(const Eigen::MatrixXd& y_true, const Eigen::MatrixXd& y_pred) override;
+/**
+ * @brief Sigmoid binary cross-entropy loss, computed from the logits.
+ * 
+ * y_pred holds the logits z (the output of a Linear output layer) and y_true targets in [0, 1], every column
+ * being an independent binary label. With p = sigmoid(z), the loss is
+ * L = -(1 / n) * sum(y_true * log(p) + (1 - y_true) * log(1 - p)), summed over the labels and averaged over the
+ * n samples, and its derivative with respect to the logits is (p - y_true) / n.
+ * 
+ * The loss of an element is evaluated as max(z, 0) - z * y + log(1 + exp(-|z|)), which neither overflows
+ * nor takes the log of 0, and exp(-|z|) is shared with the sigmoid of the gradient.
+ */
+template <typename T>
+class BasicSigmoidCrossEntropy : public BasicLossFunction<T> {
+public:
+    using typename BasicLossFunction<T>::Matrix;
+
+    double loss(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred) override;
+
+    Matrix backward(const Matrix& y_true, const Matrix& y_pred) override;
+
+    void backward_into(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred, Matrix& grad) override;
+
+    double loss_and_gradient(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred, Matrix& grad) override;
+
+    /**
+     * @brief Probabilities of the labels for the given logits, sigmoid(z).
+     * 
+     * @param logits Output of the model, one row per sample.
+     * @return Matrix Probabilities, same shape.
+     */
+    static Matrix probabilities(const Eigen::Ref<const Matrix>& logits);
 };
 
-#endif // LOSS_FUNCTION_HPP
\ No newline at end of file
+// double precision (default) and single precision names
+using LossFunction = BasicLossFunction<double>;
+using MSE = BasicMSE<double>;
+using SoftmaxCrossEntropy = BasicSoftmaxCrossEntropy<double>;
+using SigmoidCrossEntropy = BasicSigmoidCrossEntropy<double>;
+
+using LossFunctionf = BasicLossFunction<float>;
+using MSEf = BasicMSE<float>;
+using SoftmaxCrossEntropyf = BasicSoftmaxCrossEntropy<float>;
+using SigmoidCrossEntropyf = BasicSigmoidCrossEntropy<float>;
+
+#endif // LOSS_FUNCTION_HPP
@@ -0,0 +1,42 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <string>
+
+/**
+ * @brief Read-only memory mapping of a whole file.
+ * 
+ * The mapping is shared: several processes mapping the same file read the same page-cached copy.
+ */
+class MappedFile {
+private:
+    void* mapping = nullptr;
+    std::size_t mapping_size = 0;
+
+public:
+    /**
+     * @brief Map a file.
+     * 
+     * @param path Path of the file
+     * @throws std::runtime_error If the file cannot be opened or mapped.
+     */
+    explicit MappedFile(const std::string& path);
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+     * @brief Hint the kernel about the access pattern.
+     * 
+     * @param random_access true for random reads, false for sequential ones (enables aggressive read-ahead)
+     */
+    void advise(bool random_access) const;
+
+    const char* data() const {return static_cast<const char*>(mapping);};
+    std::size_t size() const {return mapping_size;};
+
+    ~MappedFile();
+};
+
+#endif // MAPPED_FILE_HPP
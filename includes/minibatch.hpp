@@ -0,0 +1,220 @@
+#ifndef MINIBATCH_HPP
+#define MINIBATCH_HPP
+
+#include <eigen3/Eigen/Dense>
+#include <eigen3/Eigen/Sparse>
+#include <random>
+#include <vector>
+
+/**
+ * @brief How fit splits the training rows into minibatches.
+ */
+struct MinibatchOptions {
+    int batch_size; // rows per minibatch
+    bool shuffle = true; // draw the minibatches from a new random permutation of the rows every epoch
+    unsigned seed = 0; // seed of the shuffling
+    bool drop_last = false; // skip the final partial minibatch of an epoch instead of training on it
+
+    /**
+     * @brief Number of minibatches of an epoch over the given number of rows.
+     */
+    int num_batches(long rows) const {return drop_last ? rows / batch_size : (rows + batch_size - 1) / batch_size;};
+};
+
+/**
+ * @brief Copy the given rows of src into the first count rows of dst.
+ * 
+ * @param src Source data
+ * @param rows Row indices into src
+ * @param count Number of rows to copy
+ * @param dst Destination, with at least count rows
+ */
+template <typename T>
+void gather_rows(const Eigen::Ref<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>& src, const long* rows, int count,
+        Eigen::Ref<Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>> dst);
+
+/**
+ * @brief Copy the given rows of a sparse (CSR) src into the first count rows of dst, the other rows of dst are
+ * left empty. The storage of dst only grows, so a buffer reused for every minibatch stops allocating.
+ * 
+ * @param src Source data, in compressed form
+ * @param rows Row indices into src
+ * @param count Number of rows to copy
+ * @param dst Destination in compressed form, with at least count rows and as many columns as src
+ */
+template <typename T>
+void gather_rows(const Eigen::Ref<const Eigen::SparseMatrix<T, Eigen::RowMajor>>& src, const long* rows, int count,
+        Eigen::SparseMatrix<T, Eigen::RowMajor>& dst);
+
+/**
+ * @brief Walks the minibatches of an in-memory dataset, epoch after epoch.
+ * 
+ * Without shuffling a minibatch is a view on consecutive rows of the data, nothing is copied. With shuffling the
+ * rows of a new random permutation are gathered every epoch into buffers allocated once, so after construction
+ * iterating never allocates. The final partial minibatch is a view on the first rows of the same buffers.
+ * 
+ * The iteration can also be restricted to a subset of the rows (e.g. the training folds of a cross-validation),
+ * its minibatches are then always gathered.
+ * 
+ * @tparam T Scalar type (float or double).
+ */
+template <typename T>
+class BasicMinibatchIterator {
+public:
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+    using View = Eigen::Map<const Matrix, 0, Eigen::OuterStride<>>;
+
+private:
+    View x;
+    View y;
+    MinibatchOptions options;
+    std::mt19937 rng;
+    bool gather; // minibatches are gathered into the buffers instead of viewed
+    std::vector<long> order; // rows in the order of the epoch, used when gathering
+    Matrix x_buffer; // gathered minibatch
+    Matrix y_buffer;
+    long begin = 0; // position of the current minibatch in the epoch
+    long end = 0;
+
+    /**
+     * @brief View on the current minibatch of data (or of its gathered buffer).
+     */
+    View batch(const View& data, const Matrix& buffer) const;
+
+public:
+    /**
+     * @brief Prepare the iteration, call begin_epoch before the first minibatch.
+     * 
+     * @param x Input data, it must outlive the iterator
+     * @param y Target data, it must outlive the iterator
+     * @param options Minibatch size, shuffling and handling of the partial minibatch
+     * @throws std::invalid_argument If batch_size is not positive or x and y have a different number of rows.
+     */
+    BasicMinibatchIterator(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y, const MinibatchOptions& options);
+
+    /**
+     * @brief Prepare the iteration over a subset of the rows, call begin_epoch before the first minibatch.
+     * 
+     * @param x Input data, it must outlive the iterator
+     * @param y Target data, it must outlive the iterator
+     * @param rows Rows to iterate over, in the order used without shuffling (every row if empty)
+     * @param options Minibatch size, shuffling and handling of the partial minibatch
+     * @throws std::invalid_argument If batch_size is not positive, x and y have a different number of rows or a row is out of range.
+     */
+    BasicMinibatchIterator(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y, const std::vector<long>& rows,
+            const MinibatchOptions& options);
+
+    /**
+     * @brief Restart from the first minibatch, reshuffling the rows if requested.
+     */
+    void begin_epoch();
+
+    /**
+     * @brief Move to the next minibatch of the epoch.
+     * 
+     * @return bool false once the epoch is over
+     */
+    bool next();
+
+    /**
+     * @brief Inputs of the current minibatch, valid until the next call to next.
+     */
+    View x_batch() const {return batch(x, x_buffer);};
+
+    /**
+     * @brief Targets of the current minibatch, valid until the next call to next.
+     */
+    View y_batch() const {return batch(y, y_buffer);};
+
+    /**
+     * @brief Rows of the current minibatch, batch_size except for the final partial one.
+     */
+    int rows() const {return end - begin;};
+
+    /**
+     * @brief Rows visited by an epoch, the skipped partial minibatch included.
+     */
+    long get_num_rows() const {return gather ? order.size() : x.rows();};
+
+    int get_num_batches() const {return options.num_batches(get_num_rows());};
+};
+
+/**
+ * @brief Walks the minibatches of an in-memory dataset with sparse (CSR) inputs, epoch after epoch.
+ * 
+ * Same iteration as BasicMinibatchIterator: without shuffling the inputs of a minibatch are a view on consecutive
+ * rows of x (a CSR row range is contiguous), with shuffling they are gathered into a sparse buffer whose storage
+ * only grows, and the targets are dense as usual.
+ * 
+ * @tparam T Scalar type (float or double).
+ */
+template <typename T>
+class BasicSparseMinibatchIterator {
+public:
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+    using SparseMatrix = Eigen::SparseMatrix<T, Eigen::RowMajor>;
+    using View = Eigen::Map<const Matrix, 0, Eigen::OuterStride<>>;
+    using SparseView = Eigen::Map<const SparseMatrix>;
+
+private:
+    SparseView x;
+    View y;
+    MinibatchOptions options;
+    std::mt19937 rng;
+    std::vector<long> order; // rows in the order of the epoch, used when shuffling
+    SparseMatrix x_buffer; // gathered minibatch, batch_size rows
+    Matrix y_buffer;
+    long begin = 0; // position of the current minibatch in the epoch
+    long end = 0;
+
+public:
+    /**
+     * @brief Prepare the iteration, call begin_epoch before the first minibatch.
+     * 
+     * @param x Sparse input data in compressed form, it must outlive the iterator
+     * @param y Target data, it must outlive the iterator
+     * @param options Minibatch size, shuffling and handling of the partial minibatch
+     * @throws std::invalid_argument If batch_size is not positive, x is not compressed or x and y have a different number of rows.
+     */
+    BasicSparseMinibatchIterator(const SparseMatrix& x, const Eigen::Ref<const Matrix>& y, const MinibatchOptions& options);
+
+    /**
+     * @brief Restart from the first minibatch, reshuffling the rows if requested.
+     */
+    void begin_epoch();
+
+    /**
+     * @brief Move to the next minibatch of the epoch.
+     * 
+     * @return bool false once the epoch is over
+     */
+    bool next();
+
+    /**
+     * @brief Inputs of the current minibatch, valid until the next call to next.
+     */
+    SparseView x_batch() const;
+
+    /**
+     * @brief Targets of the current minibatch, valid until the next call to next.
+     */
+    View y_batch() const;
+
+    /**
+     * @brief Rows of the current minibatch, batch_size except for the final partial one.
+     */
+    int rows() const {return end - begin;};
+
+    long get_num_rows() const {return x.rows();};
+
+    int get_num_batches() const {return options.num_batches(get_num_rows());};
+};
+
+// double precision (default) and single precision names
+using MinibatchIterator = BasicMinibatchIterator<double>;
+using SparseMinibatchIterator = BasicSparseMinibatchIterator<double>;
+
+using MinibatchIteratorf = BasicMinibatchIterator<float>;
+using SparseMinibatchIteratorf = BasicSparseMinibatchIterator<float>;
+
+#endif // MINIBATCH_HPP
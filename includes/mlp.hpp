@@ -2,32 +2,310 @@
 #define MLP_HPP
 
 #include <eigen3/Eigen/Dense>
+#include <exception>
+#include <functional>
+#include <thread>
 #include <vector>
 #include <string>
 #include <utility>
 #include "layer.hpp"
+#include "thread_pool.hpp"
+#include "profiler.hpp"
+#include "optimizer.hpp"
+#include "dataset.hpp"
+#include "minibatch.hpp"
+#include "communicator.hpp"
+#include "lbfgs.hpp"
+#include "inference_scratch.hpp"
 #include "../includes/loss_function.hpp"
 
+/**
+ * @brief When and how fit computes the test loss of an epoch (see BasicMLP::set_evaluation).
+ */
+struct EvaluationOptions {
+    bool async = false; // evaluate a snapshot of the parameters in a background thread while the next epoch trains
+    int every = 1; // evaluate every k epochs and after the last one, the test loss of the other epochs is NaN
+    long subsample = 0; // evaluate on this many test rows drawn once at random, 0 for the whole test set
+    unsigned seed = 0; // seed of the subsample
+};
+
 /**
  * @brief Multi-layer perceptron class
  * 
  * This class implements a multi-layer perceptron (MLP) model, trained with standard SGD.
+ * Training can be data-parallel (see set_num_threads): every minibatch is split in contiguous shards, one per
+ * thread, and the shard gradients are summed with a fixed-order tree reduction before the update, so results
+ * are bit-reproducible for a given number of threads.
+ * 
+ * The whole stack is templated on the scalar type: MLP trains and infers in double precision, MLPf in single
+ * precision. MLPf can also keep a double precision master copy of the weights (see enable_master_weights).
+ * 
+ * @tparam T Scalar type (float or double).
  */
-class MLP{
+template <typename T>
+class BasicMLP{
+public:
+    using Scalar = T;
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+    using SparseMatrix = Eigen::SparseMatrix<T, Eigen::RowMajor>;
+    using Workspace = BasicLayerWorkspace<T>;
+    using InferenceScratch = BasicInferenceScratch<T>;
+
 private:
-    std::vector<std::unique_ptr<FCLayer>> layers;
+    std::vector<std::unique_ptr<BasicFCLayer<T>>> layers;
+    /**
+     * @brief Training buffers sized for one minibatch size: per thread, an arena (one workspace per layer) and the
+     * loss gradient of its shard
+     * 
+     * With checkpointing the arena only keeps the gradients of the parameters and the checkpointed activations,
+     * the layers run in the shared workspaces of the segments (see checkpoint_slots).
+     */
+    struct TrainingBuffers {
+        std::vector<std::vector<Workspace>> workspaces;
+        std::vector<Matrix> loss_grads;
+        std::vector<std::vector<Workspace>> segments; // checkpointing only: workspaces shared by the segments
+        std::vector<std::size_t> peak_bytes; // peak activation memory of the arena
+    };
+
+    TrainingBuffers full_batches; // buffers of the full minibatches
+    TrainingBuffers last_batch; // buffers of the final partial minibatch, kept apart so that no buffer is resized every epoch
+    std::vector<double> shard_losses;
+    std::unique_ptr<ThreadPool> pool;
+    int num_threads = 1;
+    int checkpoint_every = 0; // segment length of activation checkpointing, 0 when every activation is kept
+    std::vector<int> checkpoint_slots; // checkpointing: workspace of the segments used by every layer
+    std::unique_ptr<Profiler> profiler; // null unless profiling is enabled
+    std::unique_ptr<BasicOptimizer<T>> optimizer; // owns the state of the update rule (momentum, moments...)
+    BasicCommunicator<T>* communicator = nullptr; // not owned, null unless training with other processes
+    std::vector<T> sync_buffer; // gradients and loss of a minibatch, summed over the processes
+    EvaluationOptions evaluation_options;
+
+    /**
+     * @brief Copy of the parameters of every layer, evaluated while training goes on
+     */
+    struct ParameterSnapshot {
+        std::vector<Matrix> weights;
+        std::vector<Matrix> bias;
+    };
+
+    /**
+     * @brief Test evaluation at the end of the epochs of fit, following the EvaluationOptions of the model
+     * 
+     * In asynchronous mode the parameters are copied into a snapshot evaluated by a background thread while the
+     * next epoch trains. At most one evaluation is in flight and it is merged into the loss history before the
+     * next one starts, so the history is filled in epoch order.
+     */
+    class EpochEvaluator {
+    public:
+        using Evaluate = std::function<double(const ParameterSnapshot*, InferenceScratch&, Matrix&)>;
+
+    private:
+        const BasicMLP& model;
+        Evaluate evaluate; // test loss with the given parameters (null: the model's own)
+        std::vector<std::pair<double, double>>& history;
+        ParameterSnapshot snapshot;
+        InferenceScratch scratch;
+        Matrix y_pred;
+        std::thread thread;
+        int pending = -1; // epoch under evaluation, -1 if none
+        double pending_loss = 0;
+        std::exception_ptr error;
+
+    public:
+        EpochEvaluator(const BasicMLP& model, Evaluate evaluate, std::vector<std::pair<double, double>>& history)
+            : model(model), evaluate(std::move(evaluate)), history(history) {};
+
+        /**
+         * @brief Append the losses of an epoch to the history, the test loss is evaluated (or started) if due
+         */
+        void end_epoch(int epoch, int epochs, double train_loss);
+
+        /**
+         * @brief Wait for the pending evaluation and merge it into the history, rethrowing its exception if any
+         */
+        void finish();
+
+        ~EpochEvaluator();
+    };
+
+    /**
+     * @brief Size the given arena for the batch size, it does nothing if it is already sized for it
+     * 
+     * @param ws Arena to prepare
+     * @param batch_size Number of rows of the batches
+     */
+    void prepare_workspace(std::vector<Workspace>& ws, int batch_size);
+
+    /**
+     * @brief Forward pass writing the activations into the given arena
+     * 
+     * @param x Input data, it must stay alive until the matching backward
+     * @param ws Arena receiving the activations
+     * @return const Matrix& Output of the last layer (owned by the arena)
+     */
+    const Matrix& forward(const Eigen::Ref<const Matrix>& x, std::vector<Workspace>& ws);
+
+    /**
+     * @brief Forward pass of a sparse input, only the first layer sees it
+     */
+    const Matrix& forward(const Eigen::Ref<const SparseMatrix>& x, std::vector<Workspace>& ws);
+
+    /**
+     * @brief Whether the output layer is Linear: the loss gradient is then its delta, which the loss writes
+     * directly (see train_step)
+     */
+    bool linear_output() const {return activation_type(layers.back()->get_activation()) == ActivationType::Linear;};
 
     /**
      * @brief Backward pass
      * 
-     * @param loss_grad Gradient of the loss function
+     * @param loss_grad Gradient of the loss function, not read with a linear output layer whose delta already holds it
+     * @param ws Arena filled by the matching forward, receiving the gradients
+     */
+    void backward(const Matrix& loss_grad, std::vector<Workspace>& ws);
+
+    /**
+     * @brief Forward pass of the layers [begin, end) into the workspaces of a segment
+     * 
+     * @tparam Input Input of the first layer: dense (any Eigen dense expression) or sparse view
+     * @param x Input minibatch of the model, only read when begin is 0
+     * @param ws Arena whose output of layer begin - 1 is the checkpointed input of the segment
+     * @param segment Workspaces of the segments, layer i runs in segment[checkpoint_slots[i]]
+     */
+    template <typename Input>
+    void forward_segment(const Input& x, std::vector<Workspace>& ws, std::vector<Workspace>& segment, int begin, int end);
+
+    /**
+     * @brief Forward pass of one shard in the arena of thread t, keeping every activation or only the checkpoints
+     * 
+     * @return const Matrix& Output of the last layer, valid until the matching train_backward
+     */
+    template <typename Input>
+    const Matrix& train_forward(const Input& x, TrainingBuffers& buffers, int t);
+
+    /**
+     * @brief Backward pass of one shard from buffers.loss_grads[t], recomputing the segments with checkpointing
+     * 
+     * @param x Same input as the matching train_forward
+     */
+    template <typename Input>
+    void train_backward(const Input& x, TrainingBuffers& buffers, int t);
+
+    /**
+     * @brief Workspace of the output layer in the arena of thread t, after train_forward
+     */
+    Workspace& output_workspace(TrainingBuffers& buffers, int t);
+
+    /**
+     * @brief Bytes of the batch-sized buffers of the arena of thread t (activations and their gradients)
+     */
+    std::size_t activation_bytes(const TrainingBuffers& buffers, int t) const;
+
+    /**
+     * @brief Update weights with the optimizer, one step
+     * 
+     * @param ws Arena holding the gradients
+     */
+    void update(const std::vector<Workspace>& ws);
+
+    /**
+     * @brief Ping-pong buffers of the calling thread, shared by every model
+     */
+    static InferenceScratch& thread_scratch();
+
+    /**
+     * @brief Inference with the parameters of a snapshot, or the model's own if parameters is null
+     * 
+     * @tparam Input Eigen::Ref to a dense Matrix or to a SparseMatrix
+     */
+    template <typename Input>
+    void infer(const Input& x, Matrix& out, InferenceScratch& scratch, const ParameterSnapshot* parameters) const;
+
+    /**
+     * @brief Loss of the model (or of a snapshot of its parameters), using the given buffers
      */
-    void backward(Eigen::MatrixXd loss_grad);
+    double evaluate(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y, BasicLossFunction<T>* loss_function,
+            const ParameterSnapshot* parameters, InferenceScratch& scratch, Matrix& y_pred) const;
 
     /**
-     * @brief Update weights
+     * @brief Loss of the model (or of a snapshot of its parameters) on sparse inputs, using the given buffers
      */
-    void update(double lr, double weight_decay, double momentum);
+    double evaluate(const Eigen::Ref<const SparseMatrix>& x, const Eigen::Ref<const Matrix>& y, BasicLossFunction<T>* loss_function,
+            const ParameterSnapshot* parameters, InferenceScratch& scratch, Matrix& y_pred) const;
+
+    /**
+     * @brief Streamed loss of the model (or of a snapshot of its parameters) on a mapped dataset, using the given buffers
+     */
+    double evaluate(const BasicMappedDataset<T>& data, BasicLossFunction<T>* loss_function,
+            const ParameterSnapshot* parameters, InferenceScratch& scratch, Matrix& y_pred) const;
+
+    /**
+     * @brief Loss of the model (or of a snapshot of its parameters) on a subset of the rows, gathered in chunks
+     */
+    double evaluate(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y, const std::vector<long>& rows,
+            BasicLossFunction<T>* loss_function, const ParameterSnapshot* parameters, InferenceScratch& scratch, Matrix& y_pred) const;
+
+    /**
+     * @brief Train on every minibatch of an epoch and update the weights after each one
+     * 
+     * @tparam Minibatches BasicMinibatchIterator or BasicSparseMinibatchIterator
+     * @param minibatches Minibatches, begin_epoch is called here
+     * @param batch_size Rows of a full minibatch
+     * @param loss_function Loss function
+     * @return double Train loss of the epoch, the partial minibatch weighted by its share of a full one
+     */
+    template <typename Minibatches>
+    double train_epoch(Minibatches& minibatches, int batch_size, BasicLossFunction<T>* loss_function);
+
+    /**
+     * @brief Rows of the test subsample of the evaluation options, sorted, or none to use every row
+     * 
+     * @param rows Number of rows of the test set
+     */
+    std::vector<long> evaluation_sample(long rows) const;
+
+    /**
+     * @brief Make the optimizer an SGD with the given hyperparameters, keeping its velocity if it already is one
+     */
+    void use_sgd(double learning_rate, double weight_decay, double momentum);
+
+    /**
+     * @brief Forward and backward pass of one minibatch, sharded across the threads
+     * 
+     * The loss and its gradient are computed together (see BasicLossFunction::loss_and_gradient). With a Linear
+     * output layer the gradient is written straight into the delta of that layer, whose backward pass starts
+     * from there. The gradients of the whole minibatch are left in the first training arena of buffers.
+     * 
+     * @tparam Input Dense input (any Eigen dense expression) or sparse view (Eigen::Map of a SparseMatrix)
+     * @param x Input minibatch
+     * @param y Target minibatch
+     * @param loss_function Loss function, it must be stateless when more than one thread is used
+     * @param buffers Training buffers used for this minibatch size
+     * @return double Loss of the minibatch
+     */
+    template <typename Input>
+    double train_step(const Input& x, const Eigen::Ref<const Matrix>& y, BasicLossFunction<T>* loss_function, TrainingBuffers& buffers);
+
+    /**
+     * @brief Sum the gradients of the shards into the first arena with a fixed-order pairwise tree
+     * 
+     * @param num_shards Number of shards of the last minibatch
+     * @param buffers Training buffers of the last minibatch
+     */
+    void reduce_gradients(int num_shards, TrainingBuffers& buffers);
+
+    /**
+     * @brief Average the gradients and the loss of a minibatch over the processes of the communicator, if any
+     * 
+     * Every process contributes in proportion to its rows, so the result is the gradient of the loss of the
+     * union of the minibatches of every process.
+     * 
+     * @param ws Arena holding the gradients of the minibatch, overwritten with the averages
+     * @param loss Loss of the minibatch of this process
+     * @param rows Rows of the minibatch of this process
+     * @return double Loss of the union of the minibatches
+     */
+    double synchronize(std::vector<Workspace>& ws, double loss, int rows);
 
 public:
     /**
@@ -36,7 +314,34 @@ public:
      * @param input_size Input size
      * @param layers List of pairs of (number of neurons, activation function) for each layer. Last layer will be the output layer
      */
-    MLP(int input_size, std::vector<std::pair<int, ActivationFunction*>> layers);
+    BasicMLP(int input_size, std::vector<std::pair<int, BasicActivationFunction<T>*>> layers);
+
+    /**
+     * @brief Load a model from a checkpoint written by save
+     * 
+     * Momentum buffers are restored into an SGD optimizer when the checkpoint stores them, so that training resumes exactly.
+     * To serve a checkpoint without copying it, use BasicMappedMLP instead.
+     * 
+     * @param checkpoint_path Path of the checkpoint
+     * @throws std::runtime_error If the file is not a valid checkpoint of scalar type T.
+     */
+    explicit BasicMLP(const std::string& checkpoint_path);
+
+    /**
+     * @brief Save the model to a binary checkpoint (see CheckpointHeader for the format)
+     * 
+     * The checkpoint is written to a temporary file renamed over path, so processes mapping the previous
+     * version keep a consistent view. In mixed precision mode the weights are saved with scalar type T.
+     * 
+     * @param path Path of the checkpoint
+     * @param save_momentum Also store the momentum buffers (velocity of the SGD optimizer, if that is the current optimizer
+     *        and it has already taken a step), needed to resume training exactly. In mixed precision mode the velocity
+     *        of the master copy is saved with scalar type T, and carried over to the master copy of a loaded model
+     *        once enable_master_weights is called on it
+     * @throws std::invalid_argument If the model uses a user-defined activation function.
+     * @throws std::runtime_error If the file cannot be written.
+     */
+    void save(const std::string& path, bool save_momentum = true) const;
 
     /**
      * @brief Re-Initialize weights and biases given the ranges. the i-th ranges is used for layer i
@@ -44,18 +349,236 @@ public:
      * @param weight_ranges Weight ranges
      * @param bias_ranges Bias ranges
      */
-    void init_weights(std::vector<std::pair<int, int>> weight_ranges, std::vector<std::pair<int, int>> bias_ranges);
+    void init_weights(std::vector<std::pair<double, double>> weight_ranges, std::vector<std::pair<double, double>> bias_ranges);
+
+    /**
+     * @brief Mixed precision: keep a double precision master copy of the weights, updated by fit, while
+     * forward and backward passes keep running with scalar type T
+     */
+    void enable_master_weights();
+
+    /**
+     * @brief Magnitude pruning: zero the smallest weights of every layer (or of one), the fraction sparsity of each
+     * 
+     * Fine-tune afterwards with fit: the pruned weights stay at zero. Layers pruned down to
+     * BasicFCLayer::SPARSE_MAX_DENSITY keep their weights in CSR form too, inference and training then skip the
+     * pruned weights. A checkpoint stores the zeros but not the mask: pruning a loaded model again with the same
+     * sparsity gets the same mask back.
+     * 
+     * @param sparsity Fraction of the weights of a layer pruned, in [0, 1)
+     * @param layer Layer to prune, -1 for every layer
+     * @throws std::invalid_argument If sparsity or layer is out of range.
+     */
+    void prune_magnitude(double sparsity, int layer = -1);
+
+    /**
+     * @brief Structured pruning: remove the given fraction of the neurons of a hidden layer, the ones whose incoming
+     * weights have the smallest L2 norm (see remove_neurons)
+     * 
+     * @param layer Hidden layer
+     * @param fraction Fraction of its neurons removed, in [0, 1), at least one neuron is kept
+     * @throws std::invalid_argument If layer is not a hidden layer or fraction is out of range.
+     */
+    void prune_neurons(int layer, double fraction);
+
+    /**
+     * @brief Structured pruning: remove neurons of a hidden layer, the layer and the next one shrink so that the
+     * pruned model runs dense products of smaller shapes
+     * 
+     * The rows of the neurons are removed from the layer and their columns from the weights of the next layer,
+     * along with the optimizer state of the parameters (mixed precision state is reset). The training buffers
+     * are laid out again by the next fit.
+     * 
+     * @param layer Hidden layer
+     * @param neurons Neurons removed, in any order
+     * @throws std::invalid_argument If layer is not a hidden layer, a neuron is out of range or none would be left.
+     */
+    void remove_neurons(int layer, const std::vector<int>& neurons);
+
+    int get_num_layers() const {return layers.size();};
+    int get_input_size() const {return layers[0]->get_input_size();};
+    int get_output_size() const {return layers.back()->get_output_size();};
+    const BasicFCLayer<T>& get_layer(int i) const {return *layers[i];};
+
+    /**
+     * @brief Record wall time, FLOPs, allocations and calls of every layer and phase of training and inference
+     * 
+     * Only effective when the library is built with -DMLP_PROFILE (make PROFILE=1), see Profiler. Enabling it
+     * again starts a new, empty profile.
+     * 
+     * @param max_trace_events Number of records kept for the Chrome trace, the totals are always updated
+     */
+    void enable_profiling(std::size_t max_trace_events = 100000);
+
+    /**
+     * @brief Stop profiling and drop the profile
+     */
+    void disable_profiling();
+
+    /**
+     * @brief Profile of the model, null if profiling is not enabled
+     */
+    Profiler* get_profiler() const {return profiler.get();};
+
+    /**
+     * @brief Set the update rule used by fit, e.g. std::make_unique<Adam>(1e-3)
+     * 
+     * @param optimizer Optimizer, its state must not belong to another model
+     */
+    void set_optimizer(std::unique_ptr<BasicOptimizer<T>> optimizer);
+
+    /**
+     * @brief Current optimizer, null before the first set_optimizer or fit with explicit hyperparameters
+     */
+    BasicOptimizer<T>* get_optimizer() const {return optimizer.get();};
+
+    /**
+     * @brief Set when and how fit evaluates the test loss (see EvaluationOptions)
+     * 
+     * By default the test loss of every epoch is computed on the whole test set, in the training thread. With
+     * async it is computed in a background thread that overlaps the next epoch: the loss function must then be
+     * stateless, as with several training threads. The history is the same as with synchronous evaluation.
+     * 
+     * @param options Evaluation options
+     */
+    void set_evaluation(const EvaluationOptions& options) {evaluation_options = options;};
+
+    const EvaluationOptions& get_evaluation() const {return evaluation_options;};
+
+    /**
+     * @brief Set the number of threads used by fit (1 by default, i.e. sequential training)
+     * 
+     * @param num_threads Number of threads
+     */
+    void set_num_threads(int num_threads);
+
+    /**
+     * @brief Train as one of several processes (ranks), each fitting the model on its own shard of the data
+     * 
+     * Between the backward pass and the update of every minibatch, the gradients of the ranks are averaged
+     * with an all-reduce (weighted by the rows of the minibatches), so every rank applies the same update and the
+     * replicas stay identical: fit on N ranks with minibatches of B rows is SGD with minibatches of N*B rows. The
+     * train loss of the history is the one of the union of the minibatches, the test loss is the one of the test
+     * set of each rank. Every rank must run the same number of minibatches (see shard_range), and threads
+     * (set_num_threads) still split the minibatch of each rank.
+     * 
+     * This call is collective: the layers of every rank are checked against those of rank 0, then the parameters
+     * of rank 0 are copied to the other ranks. The model keeps the communicator only once both succeeded.
+     * 
+     * @param communicator Communicator of this rank (see launch_local), not owned. nullptr trains alone again
+     * @throws std::invalid_argument On every rank, if the model of some rank has other layer sizes or activations
+     *         than the one of rank 0.
+     */
+    void set_communicator(BasicCommunicator<T>* communicator);
+
+    BasicCommunicator<T>* get_communicator() const {return communicator;};
+
+    /**
+     * @brief Trade compute for memory in fit: keep the activations of every k-th layer only
+     * 
+     * The layers are split in segments of k layers. The forward pass keeps the output of the last layer of every
+     * segment and drops the others, the backward pass recomputes the forward pass of a segment from its
+     * checkpoint right before backpropagating through it. The activations held at once drop from the ones of N
+     * layers to the ones of N/k checkpoints plus one segment of k layers, k near sqrt(N) being the smallest, for
+     * one extra forward pass of every segment but the last (about a third more compute per step). The gradients,
+     * hence the training, are exactly the same.
+     * 
+     * The workspaces of a segment are reused by every segment, only by layers of the same shape, so nothing is
+     * allocated after the first step; layers of different widths add a few workspaces to the minimum of k + 1.
+     * 
+     * @param every Segment length k, 0 or 1 to keep every activation (the default)
+     */
+    void set_checkpointing(int every);
+
+    int get_checkpointing() const {return checkpoint_every;};
+
+    /**
+     * @brief Peak memory, in bytes, of the activations and activation gradients held by fit, summed over the
+     * training threads and the two minibatch sizes (full and partial), since the last set_checkpointing or
+     * set_num_threads call. The parameters, their gradients and the optimizer state are not included.
+     */
+    std::size_t get_peak_activation_memory() const;
 
     /**
      * @brief Forward pass
      * 
      * @param x Input data
-     * @return Eigen::MatrixXd Output data
+     * @return Matrix Output data
+     */
+    Matrix predict(const Eigen::Ref<const Matrix>& x) const;
+
+    /**
+     * @param x Sparse (CSR) input data
+     * @return Matrix Output data
+     */
+    Matrix predict(const Eigen::Ref<const SparseMatrix>& x) const;
+
+    /**
+     * @brief Inference-only forward pass, safe to call from many threads on the same model
+     * 
+     * No training state is touched. The intermediate activations go into ping-pong buffers held thread-locally,
+     * so after the first call on a thread no allocation happens for batches of the same size.
+     * 
+     * @param x Input data
+     * @param out Output data, resized if needed. It must not alias x
+     */
+    void infer(const Eigen::Ref<const Matrix>& x, Matrix& out) const;
+
+    /**
+     * @brief Inference-only forward pass using caller-supplied scratch buffers
+     * 
+     * @param x Input data
+     * @param out Output data, resized if needed. It must not alias x
+     * @param scratch Ping-pong buffers, owned by the calling thread
+     */
+    void infer(const Eigen::Ref<const Matrix>& x, Matrix& out, InferenceScratch& scratch) const;
+
+    /**
+     * @brief Inference-only forward pass of sparse (CSR) inputs, the first layer runs a sparse x dense product
+     * 
+     * @param x Sparse input data
+     * @param out Output data, resized if needed
+     */
+    void infer(const Eigen::Ref<const SparseMatrix>& x, Matrix& out) const;
+
+    /**
+     * @brief Fit the model with the current optimizer (see set_optimizer)
+     * 
+     * The train loss of an epoch is the mean of its minibatch losses, the final partial minibatch weighted by its
+     * share of a full one. The test loss is computed as set by set_evaluation, by default in the background.
+     * 
+     * @param x_train Input data
+     * @param y_train Target data
+     * @param x_test Test input data
+     * @param y_test Test target data
+     * @param epochs Number of epochs
+     * @param batching Minibatch size, shuffling and handling of the partial minibatch (see MinibatchOptions)
+     * @param loss_function Loss function
+     * @throws std::logic_error If no optimizer has been set.
+     * @throws std::invalid_argument If batching.batch_size is not positive.
+     */
+    std::vector<std::pair<double, double>> fit(const Eigen::Ref<const Matrix>& x_train, const Eigen::Ref<const Matrix>& y_train,
+            const Eigen::Ref<const Matrix>& x_test, const Eigen::Ref<const Matrix>& y_test,
+            int epochs, const MinibatchOptions& batching, BasicLossFunction<T>* loss_function);
+
+    /**
+     * @brief Fit the model with SGD and momentum (the optimizer becomes an SGD, see set_optimizer)
+     * 
+     * @param x Input data
+     * @param y Target data
+     * @param epochs Number of epochs
+     * @param batching Minibatch size, shuffling and handling of the partial minibatch (see MinibatchOptions)
+     * @param learning_rate Learning rate
+     * @param weight_decay Weight decay
+     * @param momentum Momentum
      */
-    Eigen::MatrixXd predict(Eigen::MatrixXd x);
+    std::vector<std::pair<double, double>> fit(const Eigen::Ref<const Matrix>& x_train, const Eigen::Ref<const Matrix>& y_train,
+            const Eigen::Ref<const Matrix>& x_test, const Eigen::Ref<const Matrix>& y_test,
+            int epochs, const MinibatchOptions& batching, double learning_rate, double weight_decay, double momentum, BasicLossFunction<T>* loss_function);
 
     /**
-     * @brief Fit the model
+     * @brief Fit the model with SGD and momentum on num_minibatches unshuffled minibatches of x.rows() / num_minibatches
+     * rows, the last x.rows() % num_minibatches rows are skipped
      * 
      * @param x Input data
      * @param y Target data
@@ -65,8 +588,99 @@ public:
      * @param weight_decay Weight decay
      * @param momentum Momentum
      */
-    std::vector<std::pair<double, double>> fit(Eigen::MatrixXd x_train, Eigen::MatrixXd y_train, Eigen::MatrixXd x_test, Eigen::MatrixXd y_test, 
-            int epochs, int num_minibatches, double learning_rate, double weight_decay, double momentum, LossFunction* loss_function);
+    std::vector<std::pair<double, double>> fit(const Eigen::Ref<const Matrix>& x_train, const Eigen::Ref<const Matrix>& y_train,
+            const Eigen::Ref<const Matrix>& x_test, const Eigen::Ref<const Matrix>& y_test,
+            int epochs, int num_minibatches, double learning_rate, double weight_decay, double momentum, BasicLossFunction<T>* loss_function);
+
+    /**
+     * @brief Fit the model with full-batch L-BFGS, for small smooth problems where minibatch SGD needs many epochs
+     * 
+     * The weights and biases of every layer are flattened into one vector, and every evaluation of the line search
+     * is a forward and backward pass over the whole training set (threads, checkpointing and the communicator
+     * apply as in fit), so the GEMMs have as many rows as the dataset. An iteration usually takes one or two
+     * passes. Pruned weights stay at zero. The optimizer (set_optimizer) is neither needed nor modified.
+     * 
+     * @param x_train Input data
+     * @param y_train Target data
+     * @param x_test Test input data
+     * @param y_test Test target data
+     * @param iterations Maximal number of iterations
+     * @param options History, line search and stopping settings, weight decay (see LBFGSOptions)
+     * @param loss_function Loss function, smooth in the parameters (e.g. MSE)
+     * @return Train loss (without weight decay) and test loss after every iteration, fewer than iterations if
+     *         the tolerances were met or the line search found no decrease
+     * @throws std::invalid_argument If the options are out of range.
+     * @throws std::runtime_error If the loss of the initial parameters is not finite.
+     */
+    std::vector<std::pair<double, double>> fit_lbfgs(const Eigen::Ref<const Matrix>& x_train, const Eigen::Ref<const Matrix>& y_train,
+            const Eigen::Ref<const Matrix>& x_test, const Eigen::Ref<const Matrix>& y_test,
+            int iterations, const LBFGSOptions& options, BasicLossFunction<T>* loss_function);
+
+    /**
+     * @brief Fit the model on a subset of the rows of x and y and evaluate it on another one (e.g. the folds of a
+     * cross-validation), with the current optimizer
+     * 
+     * The data is shared with the caller: only the minibatches and the chunks of evaluated rows are gathered.
+     * 
+     * @param x Input data
+     * @param y Target data
+     * @param train_rows Rows trained on
+     * @param test_rows Rows of the test loss
+     * @param epochs Number of epochs
+     * @param batching Minibatch size, shuffling and handling of the partial minibatch (see MinibatchOptions)
+     * @param loss_function Loss function
+     * @throws std::logic_error If no optimizer has been set.
+     * @throws std::invalid_argument If batching.batch_size is not positive or a row is out of range.
+     */
+    std::vector<std::pair<double, double>> fit(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y,
+            const std::vector<long>& train_rows, const std::vector<long>& test_rows,
+            int epochs, const MinibatchOptions& batching, BasicLossFunction<T>* loss_function);
+
+    /**
+     * @brief Fit the model on datasets too large for memory, with the current optimizer (see set_optimizer)
+     * 
+     * The minibatches are gathered from the mapped file by a background thread while the previous ones train.
+     * The train loss of an epoch is computed as for in-memory data, the test loss is streamed (see evaluate).
+     * 
+     * @param train Training dataset
+     * @param test Test dataset
+     * @param epochs Number of epochs
+     * @param batching Minibatch size, shuffling and handling of the partial minibatch (see MinibatchOptions)
+     * @param loss_function Loss function
+     * @throws std::logic_error If no optimizer has been set.
+     * @throws std::invalid_argument If batching.batch_size is not positive.
+     */
+    std::vector<std::pair<double, double>> fit(const BasicMappedDataset<T>& train, const BasicMappedDataset<T>& test,
+            int epochs, const MinibatchOptions& batching, BasicLossFunction<T>* loss_function);
+
+    /**
+     * @brief Fit the model on sparse (CSR) inputs, e.g. one-hot or bag-of-features data, with the current optimizer
+     * 
+     * The first layer multiplies the minibatches as sparse matrices: its forward pass and its weight gradient
+     * cost O(nnz * neurons) instead of O(rows * input_size * neurons). Its weights stay dense, and so does
+     * their update (the optimizer state, e.g. momentum, moves every weight), once per minibatch.
+     * 
+     * @param x_train Sparse input data, in compressed form
+     * @param y_train Target data
+     * @param x_test Sparse test input data
+     * @param y_test Test target data
+     * @param epochs Number of epochs
+     * @param batching Minibatch size, shuffling and handling of the partial minibatch (see MinibatchOptions)
+     * @param loss_function Loss function
+     * @throws std::logic_error If no optimizer has been set.
+     * @throws std::invalid_argument If batching.batch_size is not positive or x_train is not compressed.
+     */
+    std::vector<std::pair<double, double>> fit(const SparseMatrix& x_train, const Eigen::Ref<const Matrix>& y_train,
+            const SparseMatrix& x_test, const Eigen::Ref<const Matrix>& y_test,
+            int epochs, const MinibatchOptions& batching, BasicLossFunction<T>* loss_function);
+
+    /**
+     * @brief Fit the model on datasets too large for memory with SGD and momentum (the optimizer becomes an SGD), on
+     * num_minibatches minibatches per epoch, the last rows.size() % num_minibatches rows are skipped
+     */
+    std::vector<std::pair<double, double>> fit(const BasicMappedDataset<T>& train, const BasicMappedDataset<T>& test,
+            int epochs, int num_minibatches, double learning_rate, double weight_decay, double momentum, BasicLossFunction<T>* loss_function,
+            bool shuffle = true);
 
 
     /**
@@ -77,9 +691,47 @@ public:
      * @param loss_function Loss function
      * @return double Loss value
      */
-    double evaluate(Eigen::MatrixXd x, Eigen::MatrixXd y, LossFunction* loss_function);
+    double evaluate(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y, BasicLossFunction<T>* loss_function) const;
+
+    /**
+     * @brief Evaluate the model on a subset of the rows, gathered in chunks
+     * 
+     * @param x Input data
+     * @param y Target data
+     * @param rows Rows to evaluate
+     * @param loss_function Loss function, its loss must be a mean over the rows
+     * @return double Loss value (mean of the chunk losses weighted by their number of rows)
+     */
+    double evaluate(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y, const std::vector<long>& rows,
+            BasicLossFunction<T>* loss_function) const;
+
+    /**
+     * @brief Evaluate the model on a mapped dataset, in chunks of rows so that it never has to fit in memory
+     * 
+     * @param data Dataset
+     * @param loss_function Loss function, its loss must be a mean over the rows
+     * @return double Loss value (mean of the chunk losses weighted by their number of rows)
+     */
+    double evaluate(const BasicMappedDataset<T>& data, BasicLossFunction<T>* loss_function) const;
+
+    /**
+     * @brief Evaluate the model on sparse (CSR) inputs
+     * 
+     * @param x Sparse input data
+     * @param y Target data
+     * @param loss_function Loss function
+     * @return double Loss value
+     */
+    double evaluate(const Eigen::Ref<const SparseMatrix>& x, const Eigen::Ref<const Matrix>& y, BasicLossFunction<T>* loss_function) const;
 
-    ~MLP() = default;
+    ~BasicMLP() = default;
 };
 
+// double precision (default) and single precision names
+using InferenceScratch = BasicInferenceScratch<double>;
+using MLP = BasicMLP<double>;
+
+using InferenceScratchf = BasicInferenceScratch<float>;
+using MLPf = BasicMLP<float>;
+
 #endif // MLP_HPP
\ No newline at end of file
@@ -0,0 +1,149 @@
+#ifndef MODEL_SELECTION_HPP
+#define MODEL_SELECTION_HPP
+
+#include <eigen3/Eigen/Dense>
+#include <ostream>
+#include <vector>
+#include "activation_function.hpp"
+#include "loss_function.hpp"
+
+/**
+ * @brief One configuration of an MLP and of its training (SGD with momentum).
+ */
+struct HyperParameters {
+    std::vector<int> hidden_layers = {32}; // neurons of each hidden layer
+    ActivationType hidden_activation = ActivationType::Tanh;
+    ActivationType output_activation = ActivationType::Linear;
+    double learning_rate = 0.01;
+    double momentum = 0.9;
+    double weight_decay = 0;
+    int batch_size = 32;
+};
+
+/**
+ * @brief Candidate values of every hyperparameter.
+ */
+struct SearchSpace {
+    std::vector<std::vector<int>> topologies = {{32}}; // hidden layers
+    std::vector<ActivationType> hidden_activations = {ActivationType::Tanh};
+    std::vector<double> learning_rates = {0.01};
+    std::vector<double> momentums = {0.9};
+    std::vector<double> weight_decays = {0};
+    std::vector<int> batch_sizes = {32};
+    ActivationType output_activation = ActivationType::Linear;
+
+    /**
+     * @brief Every combination of the candidate values (grid search).
+     */
+    std::vector<HyperParameters> grid() const;
+
+    /**
+     * @brief Configurations drawn at random (random search).
+     * 
+     * The learning rate and the weight decay are drawn log-uniformly and the momentum uniformly between the smallest
+     * and the largest candidate (a zero weight decay is kept as a possible draw), the other hyperparameters among
+     * their candidates.
+     * 
+     * @param count Number of configurations
+     * @param seed Seed of the draws
+     */
+    std::vector<HyperParameters> random(int count, unsigned seed = 0) const;
+};
+
+/**
+ * @brief Budget and parallelism of a search.
+ */
+struct SearchOptions {
+    int max_epochs = 100; // epochs of the configurations that survive every rung
+    int min_epochs = 10; // epochs of the first rung of successive halving
+    int eta = 3; // only the best 1/eta configurations go on to the next rung, 1 disables pruning
+    int num_threads = 0; // concurrent trainings, 0 for one per hardware thread
+    unsigned seed = 0; // seed of the initial weights and of the shuffling
+};
+
+/**
+ * @brief Cross-validated score of one configuration.
+ */
+struct SearchResult {
+    HyperParameters parameters;
+    int epochs = 0; // epochs trained, fewer than max_epochs if the configuration was pruned
+    double train_loss = 0; // mean over the folds, last epoch
+    double validation_loss = 0; // mean over the folds, last epoch
+    double validation_std = 0; // standard deviation over the folds
+    std::vector<double> fold_losses; // validation loss of every fold
+};
+
+/**
+ * @brief Print the results as a table, one configuration per line in the given order.
+ */
+void print_search_results(std::ostream& out, const std::vector<SearchResult>& results);
+
+/**
+ * @brief Model selection by k-fold cross-validation, with successive halving.
+ * 
+ * Every configuration is trained once per fold. The trainings are independent jobs run concurrently, each one
+ * sequential, largest models first, pulled from a shared queue by the threads of a ThreadPool so that no thread
+ * idles while jobs are left. The jobs share the dataset: every model trains on the row indices of its folds (see
+ * BasicMLP::fit), nothing is copied besides the minibatches.
+ * 
+ * Successive halving: all the configurations first train for min_epochs, then only the best 1/eta (by mean
+ * validation loss) keep training, for eta times as many epochs in total, and so on up to max_epochs. Models resume
+ * from where they stopped, so the pruned configurations cost a fraction of a full training.
+ * 
+ * Results only depend on the seeds, not on the number of threads.
+ * 
+ * @tparam T Scalar type (float or double).
+ */
+template <typename T>
+class BasicModelSelection {
+public:
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+
+private:
+    Eigen::Map<const Matrix, 0, Eigen::OuterStride<>> x;
+    Eigen::Map<const Matrix, 0, Eigen::OuterStride<>> y;
+    std::vector<std::vector<long>> train_rows; // per fold
+    std::vector<std::vector<long>> validation_rows; // per fold
+
+public:
+    /**
+     * @brief Split the rows in k folds of a random permutation.
+     * 
+     * @param x Input data, it must outlive the object (temporaries, e.g. x.cast<T>(), are rejected)
+     * @param y Target data, it must outlive the object
+     * @param num_folds Number of folds
+     * @param seed Seed of the permutation
+     * @throws std::invalid_argument If num_folds is less than 2 or larger than the number of rows, or x and y have a different number of rows.
+     */
+    BasicModelSelection(const Matrix& x, const Matrix& y, int num_folds = 5, unsigned seed = 0);
+    BasicModelSelection(Matrix&& x, const Matrix& y, int num_folds = 5, unsigned seed = 0) = delete;
+    BasicModelSelection(const Matrix& x, Matrix&& y, int num_folds = 5, unsigned seed = 0) = delete;
+    BasicModelSelection(Matrix&& x, Matrix&& y, int num_folds = 5, unsigned seed = 0) = delete;
+
+    /**
+     * @brief Cross-validate the configurations.
+     * 
+     * The initial weights are drawn with std::rand, reseeded from options.seed: the folds of a configuration start
+     * from the same weights.
+     * 
+     * @param configurations Configurations to compare
+     * @param loss_function Loss function, shared by the concurrent trainings so it must be stateless
+     * @param options Budget and parallelism
+     * @return std::vector<SearchResult> One result per configuration, ranked: the ones that trained longest first,
+     *         by increasing validation loss (diverged trainings last)
+     * @throws std::invalid_argument If a configuration is invalid (e.g. non-positive batch size).
+     */
+    std::vector<SearchResult> run(const std::vector<HyperParameters>& configurations, BasicLossFunction<T>* loss_function,
+            const SearchOptions& options = SearchOptions()) const;
+
+    int get_num_folds() const {return train_rows.size();};
+    const std::vector<long>& get_train_rows(int fold) const {return train_rows[fold];};
+    const std::vector<long>& get_validation_rows(int fold) const {return validation_rows[fold];};
+};
+
+// double precision (default) and single precision names
+using ModelSelection = BasicModelSelection<double>;
+
+using ModelSelectionf = BasicModelSelection<float>;
+
+#endif // MODEL_SELECTION_HPP
@@ -0,0 +1,284 @@
+#ifndef OPTIMIZER_HPP
+#define OPTIMIZER_HPP
+
+#include <eigen3/Eigen/Dense>
+#include <array>
+#include <vector>
+
+/**
+ * @brief Abstract base class for the optimizers (update rules) of the parameters.
+ * 
+ * An optimizer owns the state buffers of every parameter tensor it updates (velocity, moment estimates...),
+ * identified by a slot: the MLP gives slot 2*i to the weights of layer i and 2*i+1 to its bias. The buffers
+ * are created (zeroed) the first time a slot is updated, so after the first step no update allocates. Every
+ * update is a single fused pass over the tensor, reading the gradient and updating the state and the parameter
+ * in place.
+ * 
+ * In mixed precision mode the layers hand their double precision master copy to update_master, whose state
+ * is kept in double as well.
+ * 
+ * @tparam T Scalar type of the gradients (float or double).
+ */
+template <typename T>
+class BasicOptimizer {
+public:
+    using Scalar = T;
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+
+    static constexpr int MAX_BUFFERS = 2; // state buffers per parameter tensor
+
+protected:
+    template <typename P>
+    using Buffers = std::array<Eigen::Matrix<P, Eigen::Dynamic, Eigen::Dynamic>, MAX_BUFFERS>;
+
+    double learning_rate;
+    double weight_decay;
+    long step_count = 0;
+    std::vector<Buffers<T>> state; // per slot
+    std::vector<Buffers<double>> master_state; // per slot, mixed precision mode
+
+    /**
+     * @brief State buffers of a slot, created and zeroed if missing or shaped for another tensor.
+     */
+    template <typename P>
+    Buffers<P>& buffers(std::vector<Buffers<P>>& states, int slot, const Eigen::Matrix<P, Eigen::Dynamic, Eigen::Dynamic>& param){
+        if(slot >= states.size()) states.resize(slot + 1);
+        Buffers<P>& b = states[slot];
+        for(int k = 0; k < get_num_buffers(); k++){
+            if(b[k].rows() != param.rows() || b[k].cols() != param.cols()) b[k].setZero(param.rows(), param.cols());
+        }
+        return b;
+    };
+
+    /**
+     * @brief Master state buffers of a slot. When they are created, a state buffer of the same shape (e.g. a
+     * velocity loaded from a checkpoint before mixed precision was enabled) is carried over.
+     */
+    Buffers<double>& master_buffers(int slot, const Eigen::MatrixXd& param){
+        bool created = slot >= master_state.size() || master_state[slot][0].rows() != param.rows() || master_state[slot][0].cols() != param.cols();
+        Buffers<double>& b = buffers(master_state, slot, param);
+        for(int k = 0; created && k < get_num_buffers(); k++){
+            const Matrix* loaded = get_buffer(slot, k);
+            if(loaded && loaded->rows() == param.rows() && loaded->cols() == param.cols()) b[k] = loaded->template cast<double>();
+        }
+        return b;
+    };
+
+public:
+    /**
+     * @brief Construct a new Optimizer object
+     * 
+     * @param learning_rate Learning rate
+     * @param weight_decay L2 regularization of the weights (never applied to the bias)
+     */
+    BasicOptimizer(double learning_rate, double weight_decay) : learning_rate(learning_rate), weight_decay(weight_decay) {};
+
+    /**
+     * @brief Start a new step: called once per minibatch, before the updates of the step.
+     */
+    virtual void begin_step() {step_count++;};
+
+    /**
+     * @brief Update a parameter tensor in place.
+     * 
+     * @param slot Slot of the tensor
+     * @param param Parameter tensor
+     * @param grad Gradient of the loss with respect to param
+     * @param decay Whether weight decay applies to this tensor
+     */
+    virtual void update(int slot, Matrix& param, const Matrix& grad, bool decay) = 0;
+
+    /**
+     * @brief Update a double precision master copy in place, from a gradient of scalar type T.
+     */
+    virtual void update_master(int slot, Eigen::MatrixXd& param, const Matrix& grad, bool decay) = 0;
+
+    /**
+     * @brief Number of state buffers per parameter tensor.
+     */
+    virtual int get_num_buffers() const = 0;
+
+    /**
+     * @brief State buffer k of a slot, null if the slot has not been updated yet (or only in mixed precision mode).
+     */
+    const Matrix* get_buffer(int slot, int k) const {
+        return slot < state.size() && k < get_num_buffers() && state[slot][k].size() > 0 ? &state[slot][k] : nullptr;
+    };
+
+    /**
+     * @brief State buffer k of a slot in mixed precision mode, null if the slot has not been updated in that mode.
+     */
+    const Eigen::MatrixXd* get_master_buffer(int slot, int k) const {
+        return slot < master_state.size() && k < get_num_buffers() && master_state[slot][k].size() > 0 ? &master_state[slot][k] : nullptr;
+    };
+
+    /**
+     * @brief Overwrite state buffer k of a slot (e.g. from a checkpoint).
+     */
+    void set_buffer(int slot, int k, const Eigen::Ref<const Matrix>& value){
+        if(slot >= state.size()) state.resize(slot + 1);
+        state[slot][k] = value;
+    };
+
+    /**
+     * @brief Drop every state buffer and restart the step count.
+     */
+    void reset(){
+        state.clear();
+        master_state.clear();
+        step_count = 0;
+    };
+
+    double get_learning_rate() const {return learning_rate;};
+    void set_learning_rate(double learning_rate) {this->learning_rate = learning_rate;};
+    double get_weight_decay() const {return weight_decay;};
+    void set_weight_decay(double weight_decay) {this->weight_decay = weight_decay;};
+    long get_step_count() const {return step_count;};
+
+    virtual ~BasicOptimizer() = default;
+};
+
+/**
+ * @brief Implements update and update_master of an optimizer with its kernel Derived::apply.
+ * 
+ * Derived must provide template <typename P> void apply(Buffers<P>& state, P* param, const T* grad, Eigen::Index n, bool decay),
+ * the fused update of n contiguous values.
+ */
+template <typename Derived, typename T>
+class BasicOptimizerKernel : public BasicOptimizer<T> {
+public:
+    using typename BasicOptimizer<T>::Matrix;
+    using BasicOptimizer<T>::BasicOptimizer;
+
+    void update(int slot, Matrix& param, const Matrix& grad, bool decay) override {
+        static_cast<Derived*>(this)->apply(this->buffers(this->state, slot, param), param.data(), grad.data(), param.size(), decay);
+    };
+
+    void update_master(int slot, Eigen::MatrixXd& param, const Matrix& grad, bool decay) override {
+        static_cast<Derived*>(this)->apply(this->master_buffers(slot, param), param.data(), grad.data(), param.size(), decay);
+    };
+};
+
+/**
+ * @brief Stochastic gradient descent with (optionally Nesterov) momentum.
+ * 
+ * v = momentum*v + lr*(grad + wd*w), then w -= v (or w -= momentum*v + lr*(grad + wd*w) with Nesterov).
+ * Buffer 0 is the velocity v.
+ */
+template <typename T>
+class BasicSGD : public BasicOptimizerKernel<BasicSGD<T>, T> {
+    friend class BasicOptimizerKernel<BasicSGD<T>, T>;
+
+private:
+    double momentum;
+    bool nesterov;
+
+    template <typename P>
+    void apply(typename BasicOptimizer<T>::template Buffers<P>& state, P* param, const T* grad, Eigen::Index n, bool decay);
+
+public:
+    /**
+     * @brief Construct a new SGD object
+     * 
+     * @param learning_rate Learning rate
+     * @param momentum Momentum
+     * @param weight_decay Weight decay
+     * @param nesterov Use Nesterov momentum
+     */
+    BasicSGD(double learning_rate, double momentum = 0, double weight_decay = 0, bool nesterov = false);
+
+    int get_num_buffers() const override {return 1;};
+
+    double get_momentum() const {return momentum;};
+    void set_momentum(double momentum) {this->momentum = momentum;};
+    bool is_nesterov() const {return nesterov;};
+};
+
+/**
+ * @brief Adam, with the weight decay added to the gradient (L2 regularization).
+ * 
+ * Buffers 0 and 1 are the first and second moment estimates, bias-corrected with the step count.
+ */
+template <typename T>
+class BasicAdam : public BasicOptimizerKernel<BasicAdam<T>, T> {
+    friend class BasicOptimizerKernel<BasicAdam<T>, T>;
+
+protected:
+    double beta1;
+    double beta2;
+    double epsilon;
+    bool decoupled = false; // AdamW: weight decay applied to the weights instead of the gradient
+
+    template <typename P>
+    void apply(typename BasicOptimizer<T>::template Buffers<P>& state, P* param, const T* grad, Eigen::Index n, bool decay);
+
+public:
+    /**
+     * @brief Construct a new Adam object
+     * 
+     * @param learning_rate Learning rate
+     * @param weight_decay Weight decay
+     * @param beta1 Decay rate of the first moment estimate
+     * @param beta2 Decay rate of the second moment estimate
+     * @param epsilon Term added to the denominator for numerical stability
+     */
+    BasicAdam(double learning_rate = 1e-3, double weight_decay = 0, double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-8);
+
+    int get_num_buffers() const override {return 2;};
+};
+
+/**
+ * @brief AdamW: Adam with decoupled weight decay, w -= lr*wd*w independently of the adaptive step.
+ */
+template <typename T>
+class BasicAdamW : public BasicAdam<T> {
+public:
+    BasicAdamW(double learning_rate = 1e-3, double weight_decay = 1e-2, double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-8);
+};
+
+/**
+ * @brief RMSProp, with optional momentum on the normalized gradient.
+ * 
+ * Buffer 0 is the running mean of the squared gradient, buffer 1 the momentum buffer.
+ */
+template <typename T>
+class BasicRMSProp : public BasicOptimizerKernel<BasicRMSProp<T>, T> {
+    friend class BasicOptimizerKernel<BasicRMSProp<T>, T>;
+
+private:
+    double rho;
+    double epsilon;
+    double momentum;
+
+    template <typename P>
+    void apply(typename BasicOptimizer<T>::template Buffers<P>& state, P* param, const T* grad, Eigen::Index n, bool decay);
+
+public:
+    /**
+     * @brief Construct a new RMSProp object
+     * 
+     * @param learning_rate Learning rate
+     * @param weight_decay Weight decay
+     * @param rho Decay rate of the mean of the squared gradient
+     * @param momentum Momentum
+     * @param epsilon Term added to the denominator for numerical stability
+     */
+    BasicRMSProp(double learning_rate = 1e-3, double weight_decay = 0, double rho = 0.9, double momentum = 0, double epsilon = 1e-8);
+
+    int get_num_buffers() const override {return 2;};
+};
+
+// double precision (default) and single precision names
+using Optimizer = BasicOptimizer<double>;
+using SGD = BasicSGD<double>;
+using Adam = BasicAdam<double>;
+using AdamW = BasicAdamW<double>;
+using RMSProp = BasicRMSProp<double>;
+
+using Optimizerf = BasicOptimizer<float>;
+using SGDf = BasicSGD<float>;
+using Adamf = BasicAdam<float>;
+using AdamWf = BasicAdamW<float>;
+using RMSPropf = BasicRMSProp<float>;
+
+#endif // OPTIMIZER_HPP
@@ -0,0 +1,181 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Phases of training and inference recorded by the Profiler.
+ */
+enum class Phase { Forward, Activation, Backward, Update, Loss, Evaluate, Sync };
+
+constexpr int NUM_PHASES = 7;
+
+/**
+ * @brief Name of a phase, as shown in the summary and in the trace.
+ */
+const char* phase_name(Phase phase);
+
+/**
+ * @brief Totals of one phase of one layer.
+ */
+struct PhaseStats {
+    long calls = 0;
+    double seconds = 0; // wall time
+    double flops = 0; // floating point operations, elementwise kernels count one per element
+    long allocations = 0; // heap allocations made during the phase
+    long bytes_allocated = 0;
+};
+
+/**
+ * @brief Per-layer, per-phase instrumentation of an MLP (see BasicMLP::enable_profiling).
+ * 
+ * The instrumentation points are only compiled in with -DMLP_PROFILE (make PROFILE=1): otherwise
+ * MLP_PROFILE_SCOPE expands to nothing and a Profiler never receives any record. When compiled in, a disabled
+ * profiler costs one null pointer test per point, an enabled one two clock reads and a short critical section
+ * per layer and phase, i.e. per GEMM-sized piece of work. Allocations are counted by wrapping malloc (glibc only).
+ * 
+ * Besides the totals, the first max_trace_events records are kept as events that can be written as a
+ * Chrome trace (chrome://tracing, Perfetto).
+ */
+class Profiler {
+public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr int MODEL = -1; // layer index of the model-level phases (Loss, Evaluate)
+
+private:
+    /**
+     * @brief One record, kept for the trace.
+     */
+    struct Event {
+        int layer;
+        Phase phase;
+        int thread;
+        clock::time_point start;
+        double seconds;
+        double flops;
+        long bytes_allocated;
+    };
+
+    std::vector<std::array<PhaseStats, NUM_PHASES>> stats; // index 0 is the model, layer i is at i + 1
+    std::vector<Event> events;
+    std::size_t max_trace_events;
+    std::unordered_map<std::thread::id, int> threads; // small ids for the trace
+    clock::time_point origin;
+    mutable std::mutex mutex;
+
+public:
+    /**
+     * @brief Create an empty profile.
+     * 
+     * @param num_layers Number of layers of the profiled model
+     * @param max_trace_events Number of events kept for the trace, the totals are always updated
+     */
+    Profiler(int num_layers, std::size_t max_trace_events = 100000);
+
+    /**
+     * @brief Whether the instrumentation points have been compiled in (-DMLP_PROFILE).
+     */
+    static constexpr bool compiled_in(){
+#ifdef MLP_PROFILE
+        return true;
+#else
+        return false;
+#endif
+    };
+
+    /**
+     * @brief Heap allocations (count and bytes) made so far by the calling thread, 0 unless profiling on glibc
+     * (see allocation_counter.hpp).
+     */
+    static std::pair<long, long> thread_allocations();
+
+    /**
+     * @brief Add a record, safe to call from many threads.
+     * 
+     * @param layer Layer index, or MODEL
+     * @param phase Phase
+     * @param start Start of the phase
+     * @param seconds Duration of the phase
+     * @param flops Floating point operations of the phase
+     * @param allocations Heap allocations of the phase
+     * @param bytes_allocated Heap bytes allocated by the phase
+     */
+    void record(int layer, Phase phase, clock::time_point start, double seconds, double flops, long allocations, long bytes_allocated);
+
+    /**
+     * @brief Totals of a layer (or of the model) for a phase.
+     */
+    PhaseStats get_stats(int layer, Phase phase) const;
+
+    int get_num_layers() const {return stats.size() - 1;};
+
+    /**
+     * @brief Drop every record.
+     */
+    void reset();
+
+    /**
+     * @brief Print a table of the totals: time share, GFLOP/s and allocations of every layer and phase.
+     */
+    void print_summary(std::ostream& out) const;
+
+    /**
+     * @brief Write the recorded events in the Chrome trace event format.
+     * 
+     * @param path Path of the JSON file
+     * @throws std::runtime_error If the file cannot be written.
+     */
+    void write_chrome_trace(const std::string& path) const;
+};
+
+/**
+ * @brief Times the enclosing scope and records it, if the profiler is not null.
+ */
+class ProfileScope {
+private:
+    Profiler* profiler;
+    int layer;
+    Phase phase;
+    double flops;
+    Profiler::clock::time_point start;
+    std::pair<long, long> allocations_before;
+
+public:
+    ProfileScope(Profiler* profiler, int layer, Phase phase, double flops) : profiler(profiler), layer(layer), phase(phase), flops(flops){
+        if(!profiler) return;
+        allocations_before = Profiler::thread_allocations();
+        start = Profiler::clock::now();
+    };
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+    ~ProfileScope(){
+        if(!profiler) return;
+        double seconds = std::chrono::duration<double>(Profiler::clock::now() - start).count();
+        std::pair<long, long> allocations = Profiler::thread_allocations();
+        profiler->record(layer, phase, start, seconds, flops, allocations.first - allocations_before.first, allocations.second - allocations_before.second);
+    };
+};
+
+#define MLP_PROFILE_CONCAT_(a, b) a##b
+#define MLP_PROFILE_CONCAT(a, b) MLP_PROFILE_CONCAT_(a, b)
+
+#ifdef MLP_PROFILE
+// record the rest of the enclosing scope: MLP_PROFILE_SCOPE(profiler, layer index, Phase::X, flops)
+#define MLP_PROFILE_SCOPE(profiler, layer, phase, flops) ProfileScope MLP_PROFILE_CONCAT(profile_scope_, __LINE__)(profiler, layer, phase, flops)
+#else
+#define MLP_PROFILE_SCOPE(profiler, layer, phase, flops) ((void)0)
+#endif
+
+#endif // PROFILER_HPP
@@ -0,0 +1,135 @@
+#ifndef QUANTIZED_MLP_HPP
+#define QUANTIZED_MLP_HPP
+
+#include <eigen3/Eigen/Dense>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "activation_function.hpp"
+#include "loss_function.hpp"
+#include "mlp.hpp"
+
+/**
+ * @brief Accuracy drift of a quantized model with respect to the model it was exported from.
+ */
+struct QuantizationReport {
+    double reference_loss; // loss of the original model
+    double quantized_loss; // loss of the quantized model
+    double max_abs_error; // max |y_reference - y_quantized| over all the outputs
+    double mean_abs_error; // mean |y_reference - y_quantized| over all the outputs
+};
+
+/**
+ * @brief Post-training int8 quantized inference engine for a trained MLP.
+ * 
+ * The weights of every layer are stored as int8 with one scale per output channel (symmetric, max-abs),
+ * the bias stays in float. Layer inputs are quantized to int8 either dynamically (one scale per row, computed
+ * on the fly) or with a static per-layer scale found by calibrate(). The products run on an int8 kernel with
+ * int32 accumulation: AVX-512/AVX VNNI or AVX2 when the build enables them (e.g. -march=native), scalar otherwise.
+ * Dequantization, bias add and activation happen in float.
+ * 
+ * Only the built-in activations are supported. The model is immutable after calibration, so infer can be
+ * called concurrently.
+ * 
+ * @tparam T Scalar type of the input and output data (float or double).
+ */
+template <typename T>
+class BasicQuantizedMLP {
+public:
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+
+private:
+    struct QuantizedLayer {
+        int input_size;
+        int output_size;
+        int stride; // input_size rounded up to the kernel width, rows are zero padded
+        std::vector<int8_t> weights; // row-major, output_size x stride
+        std::vector<float> weight_scales; // one per output channel
+        std::vector<float> bias;
+        ActivationType activation;
+        float input_scale = 0; // static input scale, 0 means dynamic quantization
+    };
+
+    /**
+     * @brief Per-thread buffers of infer.
+     */
+    struct Scratch {
+        std::vector<int8_t> input; // quantized input, row-major batch x stride
+        std::vector<float> input_scales; // one per row
+        Eigen::MatrixXf ping;
+        Eigen::MatrixXf pong;
+    };
+
+    std::vector<QuantizedLayer> layers;
+
+    /**
+     * @brief Quantize x (batch x input_size) into scratch, with the static scale of the layer or one scale per row.
+     */
+    template <typename Derived>
+    static void quantize_input(const Eigen::MatrixBase<Derived>& x, const QuantizedLayer& layer, Scratch& scratch);
+
+    /**
+     * @brief int8 product of the quantized input with the layer weights, dequantization, bias and activation.
+     */
+    static void layer_forward(const QuantizedLayer& layer, int batch_size, const Scratch& scratch, Eigen::MatrixXf& out);
+
+public:
+    /**
+     * @brief Quantize a trained model, with dynamic quantization of the activations.
+     * 
+     * @param model Trained model
+     * @throws std::invalid_argument If the model uses a user-defined activation function.
+     */
+    explicit BasicQuantizedMLP(const BasicMLP<T>& model);
+
+    /**
+     * @brief Switch to static quantization of the activations, using the max-abs input of every layer on x.
+     * 
+     * @param x Calibration data, representative of the data the model will score
+     */
+    void calibrate(const Eigen::Ref<const Matrix>& x);
+
+    /**
+     * @brief Back to dynamic (per-row) quantization of the activations.
+     */
+    void clear_calibration();
+
+    /**
+     * @brief Quantized forward pass, safe to call from many threads.
+     * 
+     * @param x Input data
+     * @param out Output data, resized if needed
+     */
+    void infer(const Eigen::Ref<const Matrix>& x, Matrix& out) const;
+
+    /**
+     * @brief Quantized forward pass
+     * 
+     * @param x Input data
+     * @return Matrix Output data
+     */
+    Matrix predict(const Eigen::Ref<const Matrix>& x) const;
+
+    /**
+     * @brief Measure the accuracy drift against the original model on a held-out set.
+     * 
+     * @param reference Model the quantized one was built from
+     * @param x Held-out input data
+     * @param y Held-out target data
+     * @param loss_function Loss function used for both models
+     * @return QuantizationReport Losses of the two models and output error statistics
+     */
+    QuantizationReport drift(const BasicMLP<T>& reference, const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y,
+            BasicLossFunction<T>* loss_function) const;
+
+    /**
+     * @brief Size of the quantized parameters in bytes.
+     */
+    std::size_t size_bytes() const;
+};
+
+// double precision (default) and single precision names
+using QuantizedMLP = BasicQuantizedMLP<double>;
+using QuantizedMLPf = BasicQuantizedMLP<float>;
+
+#endif // QUANTIZED_MLP_HPP
\ No newline at end of file
@@ -0,0 +1,151 @@
+#ifndef STATIC_MLP_HPP
+#define STATIC_MLP_HPP
+
+#include <eigen3/Eigen/Dense>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include "mlp.hpp"
+
+/**
+ * @brief Compile-time description of a fully connected layer of a StaticMLP.
+ * 
+ * @tparam Outputs Number of neurons.
+ * @tparam Act Built-in activation function class (Linear, ReLU, Sigmoid, Tanh or their f versions), only its static
+ *         apply kernel is used. Its scalar type is the one of the network.
+ */
+template <int Outputs, typename Act>
+struct StaticLayer {
+    static_assert(Outputs > 0, "StaticLayer: a layer needs at least one neuron");
+    static constexpr int size = Outputs;
+    using Activation = Act;
+};
+
+/**
+ * @brief Parameters of the layers of a StaticMLP, one recursion level per layer so that the whole chain is inlined.
+ * 
+ * @tparam T Scalar type.
+ * @tparam Inputs Input size of the first layer of the chain.
+ * @tparam Layers StaticLayer descriptions, none for the end of the chain.
+ */
+template <typename T, int Inputs, typename... Layers>
+struct StaticLayerChain {
+    static constexpr int output_size = Inputs;
+
+    void load(const BasicMLP<T>&, int) {};
+
+    Eigen::Matrix<T, Inputs, 1> forward(const Eigen::Matrix<T, Inputs, 1>& x) const {return x;};
+};
+
+template <typename T, int Inputs, typename Layer, typename... Rest>
+struct StaticLayerChain<T, Inputs, Layer, Rest...> {
+    using Act = typename Layer::Activation;
+    using Next = StaticLayerChain<T, Layer::size, Rest...>;
+    static_assert(std::is_same_v<typename Act::Scalar, T>, "StaticMLP: every activation must have the scalar type of the network");
+
+    static constexpr int output_size = Next::output_size;
+
+    Eigen::Matrix<T, Layer::size, Inputs> weights;
+    Eigen::Matrix<T, Layer::size, 1> bias;
+    Next next;
+
+    /**
+     * @brief Copy the parameters of layer index of mlp and of the next ones
+     * 
+     * @throws std::invalid_argument If the shape or the activation of a layer differ from the description.
+     */
+    void load(const BasicMLP<T>& mlp, int index){
+        const BasicFCLayer<T>& layer = mlp.get_layer(index);
+        if(layer.get_input_size() != Inputs || layer.get_output_size() != Layer::size
+                || activation_type(layer.get_activation()) != activation_type(Act())){
+            throw std::invalid_argument("StaticMLP: layer " + std::to_string(index) + " does not match the MLP");
+        }
+
+        weights = layer.get_weights();
+        bias = layer.get_bias();
+        next.load(mlp, index + 1);
+    }
+
+    Eigen::Matrix<T, output_size, 1> forward(const Eigen::Matrix<T, Inputs, 1>& x) const {
+        Eigen::Matrix<T, Layer::size, 1> z = weights * x + bias;
+        return next.forward(Act::apply(z.array()).matrix());
+    }
+};
+
+/**
+ * @brief Inference-only MLP whose topology is fixed at compile time, for per-row scoring of tiny networks.
+ * 
+ * Every weight matrix and activation vector is a fixed-size Eigen object, so a prediction allocates nothing,
+ * does not go through the virtual layers and activations of BasicMLP, and the compiler unrolls the layer chain
+ * and the small products. Meant for layers of a few dozen neurons: the activations live on the stack and the
+ * products are not cache blocked, larger networks are better served by BasicMLP::infer on batches.
+ * 
+ * @code
+ * StaticMLP<5, StaticLayer<50, Sigmoid>, StaticLayer<50, Sigmoid>, StaticLayer<3, Linear>> net(mlp);
+ * auto y = net.predict_row(x.row(0)); // Eigen::Matrix<double, 1, 3>
+ * @endcode
+ * 
+ * @tparam Inputs Input size.
+ * @tparam Layers StaticLayer descriptions, the last one is the output layer.
+ */
+template <int Inputs, typename... Layers>
+class StaticMLP {
+    static_assert(Inputs > 0 && sizeof...(Layers) > 0, "StaticMLP: needs an input and at least one layer");
+
+public:
+    using T = typename std::tuple_element_t<0, std::tuple<Layers...>>::Activation::Scalar;
+    using Chain = StaticLayerChain<T, Inputs, Layers...>;
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+
+    static constexpr int input_size = Inputs;
+    static constexpr int output_size = Chain::output_size;
+    static constexpr int num_layers = sizeof...(Layers);
+
+    using InputRow = Eigen::Matrix<T, 1, Inputs>;
+    using OutputRow = Eigen::Matrix<T, 1, output_size>;
+
+private:
+    Chain layers;
+
+public:
+    /**
+     * @brief Copy the parameters of a trained MLP of the same topology
+     * 
+     * @param mlp Model, e.g. trained with fit or loaded from a checkpoint. It is not referenced afterwards
+     * @throws std::invalid_argument If the number of layers, a shape or an activation differ from the description.
+     */
+    explicit StaticMLP(const BasicMLP<T>& mlp){
+        if(mlp.get_num_layers() != num_layers){
+            throw std::invalid_argument("StaticMLP: the MLP has " + std::to_string(mlp.get_num_layers()) + " layers, expected " + std::to_string(num_layers));
+        }
+        layers.load(mlp, 0);
+    }
+
+    /**
+     * @brief Prediction of one row, without any heap allocation
+     * 
+     * @param x Input row
+     * @return OutputRow Output row
+     */
+    OutputRow predict_row(const InputRow& x) const {
+        return layers.forward(x.transpose()).transpose();
+    }
+
+    /**
+     * @brief Prediction of every row of a batch, one row at a time
+     * 
+     * @param x Input matrix (batch), input_size columns
+     * @return Matrix Output matrix (batch)
+     * @throws std::invalid_argument If x does not have input_size columns.
+     */
+    Matrix predict(const Eigen::Ref<const Matrix>& x) const {
+        if(x.cols() != Inputs) throw std::invalid_argument("StaticMLP::predict: the input must have " + std::to_string(Inputs) + " columns");
+
+        Matrix out(x.rows(), output_size);
+        for(Eigen::Index i = 0; i < x.rows(); i++) out.row(i) = predict_row(x.row(i));
+        return out;
+    }
+};
+
+#endif // STATIC_MLP_HPP
@@ -0,0 +1,77 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief Fixed-size pool of worker threads running data-parallel loops.
+ * 
+ * The calling thread takes part in every loop, so a pool of size n owns n - 1 threads.
+ * Dispatching a loop does not allocate, which keeps the training step allocation-free.
+ */
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+
+    void (*task)(void*, int) = nullptr; // type-erased loop body
+    void* task_ctx = nullptr;
+    int num_tasks = 0;
+    std::atomic<int> next_task{0};
+    int active_workers = 0;
+    long generation = 0; // incremented for every loop, wakes up the workers
+    bool stop = false;
+
+    /**
+     * @brief Main loop of a worker thread.
+     */
+    void worker_loop();
+
+    /**
+     * @brief Run the pending loop indices until none is left.
+     */
+    void execute();
+
+    /**
+     * @brief Run task(ctx, i) for every i in [0, n) and wait for completion.
+     */
+    void run(int n, void (*task)(void*, int), void* ctx);
+
+public:
+    /**
+     * @brief Construct a new ThreadPool object
+     * 
+     * @param num_threads Total number of threads running the loops, the caller included
+     */
+    explicit ThreadPool(int num_threads);
+
+    /**
+     * @brief Run fn(i) for every i in [0, n) on the pool and wait for all of them.
+     * 
+     * Indices are handed out dynamically, so fn must not depend on which thread runs which index.
+     * 
+     * @param n Number of iterations
+     * @param fn Loop body, called as fn(int)
+     */
+    template <typename F>
+    void parallel_for(int n, F&& fn){
+        using Fn = std::remove_reference_t<F>;
+        run(n, [](void* ctx, int i){ (*static_cast<Fn*>(ctx))(i); }, const_cast<void*>(static_cast<const void*>(&fn)));
+    }
+
+    /**
+     * @brief Number of threads running the loops, the caller included
+     */
+    int size() const {return workers.size() + 1;};
+
+    ~ThreadPool();
+};
+
+#endif // THREAD_POOL_HPP
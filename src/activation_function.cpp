@@ -1,39 +1,328 @@
 #include "../includes/activation_function.hpp"
 #include <iostream>
+#include <stdexcept>
+#include <typeinfo>
 
 // ---------------------------------------- Linear ----------------------------------------
-Eigen::MatrixXd Linear::activate(const Eigen::MatrixXd& x){
+template <typename T>
+typename BasicLinear<T>::Matrix BasicLinear<T>::activate(const Matrix& x) const{
     return x;
 };
 
-Eigen::MatrixXd Linear::derivative(const Eigen::MatrixXd& x){
-    return Eigen::MatrixXd::Ones(x.rows(), x.cols());
+template <typename T>
+typename BasicLinear<T>::Matrix BasicLinear<T>::derivative(const Matrix& x) const{
+    return Matrix::Ones(x.rows(), x.cols());
+};
+
+template <typename T>
+void BasicLinear<T>::activate_into(const Matrix& x, Matrix& out) const{
+    if(&out != &x) out = x;
+};
+
+template <typename T>
+void BasicLinear<T>::derivative_into(const Matrix& x, Matrix& out) const{
+    out.setOnes(x.rows(), x.cols());
 };
 
 
 // ---------------------------------------- RELU ----------------------------------------
-Eigen::MatrixXd ReLU::activate(const Eigen::MatrixXd& x){
-    return x.cwiseMax(0);
+template <typename T>
+typename BasicReLU<T>::Matrix BasicReLU<T>::activate(const Matrix& x) const{
+    return x.cwiseMax(T(0));
+};
+
+template <typename T>
+typename BasicReLU<T>::Matrix BasicReLU<T>::derivative(const Matrix& x) const{
+    return (x.array() > T(0)).template cast<T>();
 };
 
-Eigen::MatrixXd ReLU::derivative(const Eigen::MatrixXd& x){
-    return (x.array() > 0).cast<double>();
+template <typename T>
+void BasicReLU<T>::activate_into(const Matrix& x, Matrix& out) const{
+    out = apply(x.array()).matrix();
+};
+
+template <typename T>
+void BasicReLU<T>::derivative_into(const Matrix& x, Matrix& out) const{
+    out = (x.array() > T(0)).template cast<T>().matrix();
 };
 
 // ---------------------------------------- Sigmoid ----------------------------------------
-Eigen::MatrixXd Sigmoid::activate(const Eigen::MatrixXd& x){
-    return 1 / (1 + (-x.array()).exp());
+template <typename T>
+typename BasicSigmoid<T>::Matrix BasicSigmoid<T>::activate(const Matrix& x) const{
+    return T(1) / (T(1) + (-x.array()).exp());
 };
 
-Eigen::MatrixXd Sigmoid::derivative(const Eigen::MatrixXd& x){
-    return activate(x).array() * (1 - activate(x).array());
+template <typename T>
+typename BasicSigmoid<T>::Matrix BasicSigmoid<T>::derivative(const Matrix& x) const{
+    Array a = apply(x.array()); // evaluate exp() only once
+    return derivative_from_output(a);
+};
+
+template <typename T>
+void BasicSigmoid<T>::activate_into(const Matrix& x, Matrix& out) const{
+    out = apply(x.array()).matrix();
+};
+
+template <typename T>
+void BasicSigmoid<T>::derivative_into(const Matrix& x, Matrix& out) const{
+    out = apply(x.array()).matrix();
+    out = derivative_from_output(out.array()).matrix(); // the activation is evaluated only once
 };
 
 // ---------------------------------------- Tanh ----------------------------------------
-Eigen::MatrixXd Tanh::activate(const Eigen::MatrixXd& x){
+template <typename T>
+typename BasicTanh<T>::Matrix BasicTanh<T>::activate(const Matrix& x) const{
     return x.array().tanh();
 };
 
-Eigen::MatrixXd Tanh::derivative(const Eigen::MatrixXd& x){
-    return 1 - activate(x).array().square();
-};
\ No newline at end of file
+template <typename T>
+typename BasicTanh<T>::Matrix BasicTanh<T>::derivative(const Matrix& x) const{
+    Array a = apply(x.array());
+    return derivative_from_output(a);
+};
+
+template <typename T>
+void BasicTanh<T>::activate_into(const Matrix& x, Matrix& out) const{
+    out = apply(x.array()).matrix();
+};
+
+template <typename T>
+void BasicTanh<T>::derivative_into(const Matrix& x, Matrix& out) const{
+    out = apply(x.array()).matrix();
+    out = derivative_from_output(out.array()).matrix(); // the activation is evaluated only once
+};
+
+// ---------------------------------------- LeakyReLU ----------------------------------------
+template <typename T>
+typename BasicLeakyReLU<T>::Matrix BasicLeakyReLU<T>::activate(const Matrix& x) const{
+    return apply(x.array());
+};
+
+template <typename T>
+typename BasicLeakyReLU<T>::Matrix BasicLeakyReLU<T>::derivative(const Matrix& x) const{
+    return derivative_from_output(x.array()); // same sign as the output
+};
+
+template <typename T>
+void BasicLeakyReLU<T>::activate_into(const Matrix& x, Matrix& out) const{
+    out = apply(x.array()).matrix();
+};
+
+template <typename T>
+void BasicLeakyReLU<T>::derivative_into(const Matrix& x, Matrix& out) const{
+    out = derivative_from_output(x.array()).matrix();
+};
+
+// ---------------------------------------- FastSigmoid ----------------------------------------
+template <typename T>
+typename BasicFastSigmoid<T>::Matrix BasicFastSigmoid<T>::activate(const Matrix& x) const{
+    return apply(x.array());
+};
+
+template <typename T>
+typename BasicFastSigmoid<T>::Matrix BasicFastSigmoid<T>::derivative(const Matrix& x) const{
+    Array a = apply(x.array());
+    return derivative_from_output(a);
+};
+
+template <typename T>
+void BasicFastSigmoid<T>::activate_into(const Matrix& x, Matrix& out) const{
+    out = apply(x.array()).matrix();
+};
+
+template <typename T>
+void BasicFastSigmoid<T>::derivative_into(const Matrix& x, Matrix& out) const{
+    out = apply(x.array()).matrix();
+    out = derivative_from_output(out.array()).matrix(); // the activation is evaluated only once
+};
+
+// ---------------------------------------- FastTanh ----------------------------------------
+template <typename T>
+typename BasicFastTanh<T>::Matrix BasicFastTanh<T>::activate(const Matrix& x) const{
+    return apply(x.array());
+};
+
+template <typename T>
+typename BasicFastTanh<T>::Matrix BasicFastTanh<T>::derivative(const Matrix& x) const{
+    Array a = apply(x.array());
+    return derivative_from_output(a);
+};
+
+template <typename T>
+void BasicFastTanh<T>::activate_into(const Matrix& x, Matrix& out) const{
+    out = apply(x.array()).matrix();
+};
+
+template <typename T>
+void BasicFastTanh<T>::derivative_into(const Matrix& x, Matrix& out) const{
+    out = apply(x.array()).matrix();
+    out = derivative_from_output(out.array()).matrix(); // the activation is evaluated only once
+};
+
+// ---------------------------------------- GELU ----------------------------------------
+template <typename T>
+typename BasicGELU<T>::Matrix BasicGELU<T>::activate(const Matrix& x) const{
+    return apply(x.array());
+};
+
+template <typename T>
+typename BasicGELU<T>::Matrix BasicGELU<T>::derivative(const Matrix& x) const{
+    return derivative_from_input(x.array());
+};
+
+template <typename T>
+void BasicGELU<T>::activate_into(const Matrix& x, Matrix& out) const{
+    out = apply(x.array()).matrix();
+};
+
+template <typename T>
+void BasicGELU<T>::derivative_into(const Matrix& x, Matrix& out) const{
+    out = derivative_from_input(x.array()).matrix();
+};
+
+template <typename T>
+typename BasicFastGELU<T>::Matrix BasicFastGELU<T>::activate(const Matrix& x) const{
+    return apply(x.array());
+};
+
+template <typename T>
+typename BasicFastGELU<T>::Matrix BasicFastGELU<T>::derivative(const Matrix& x) const{
+    return derivative_from_input(x.array());
+};
+
+template <typename T>
+void BasicFastGELU<T>::activate_into(const Matrix& x, Matrix& out) const{
+    out = apply(x.array()).matrix();
+};
+
+template <typename T>
+void BasicFastGELU<T>::derivative_into(const Matrix& x, Matrix& out) const{
+    out = derivative_from_input(x.array()).matrix();
+};
+
+// ---------------------------------------- SiLU ----------------------------------------
+template <typename T>
+typename BasicSiLU<T>::Matrix BasicSiLU<T>::activate(const Matrix& x) const{
+    return apply(x.array());
+};
+
+template <typename T>
+typename BasicSiLU<T>::Matrix BasicSiLU<T>::derivative(const Matrix& x) const{
+    return derivative_from_input(x.array());
+};
+
+template <typename T>
+void BasicSiLU<T>::activate_into(const Matrix& x, Matrix& out) const{
+    out = apply(x.array()).matrix();
+};
+
+template <typename T>
+void BasicSiLU<T>::derivative_into(const Matrix& x, Matrix& out) const{
+    out = derivative_from_input(x.array()).matrix();
+};
+
+template <typename T>
+typename BasicFastSiLU<T>::Matrix BasicFastSiLU<T>::activate(const Matrix& x) const{
+    return apply(x.array());
+};
+
+template <typename T>
+typename BasicFastSiLU<T>::Matrix BasicFastSiLU<T>::derivative(const Matrix& x) const{
+    return derivative_from_input(x.array());
+};
+
+template <typename T>
+void BasicFastSiLU<T>::activate_into(const Matrix& x, Matrix& out) const{
+    out = apply(x.array()).matrix();
+};
+
+template <typename T>
+void BasicFastSiLU<T>::derivative_into(const Matrix& x, Matrix& out) const{
+    out = derivative_from_input(x.array()).matrix();
+};
+
+template class BasicLinear<float>;
+template class BasicLinear<double>;
+template class BasicReLU<float>;
+template class BasicReLU<double>;
+template class BasicSigmoid<float>;
+template class BasicSigmoid<double>;
+template class BasicTanh<float>;
+template class BasicTanh<double>;
+template class BasicLeakyReLU<float>;
+template class BasicLeakyReLU<double>;
+template class BasicFastSigmoid<float>;
+template class BasicFastSigmoid<double>;
+template class BasicFastTanh<float>;
+template class BasicFastTanh<double>;
+template class BasicGELU<float>;
+template class BasicGELU<double>;
+template class BasicFastGELU<float>;
+template class BasicFastGELU<double>;
+template class BasicSiLU<float>;
+template class BasicSiLU<double>;
+template class BasicFastSiLU<float>;
+template class BasicFastSiLU<double>;
+
+// ---------------------------------------- ActivationType ----------------------------------------
+template <typename T>
+ActivationType activation_type(const BasicActivationFunction<T>& func){
+    const std::type_info& type = typeid(func);
+
+    if(type == typeid(BasicLinear<T>)) return ActivationType::Linear;
+    if(type == typeid(BasicReLU<T>)) return ActivationType::ReLU;
+    if(type == typeid(BasicSigmoid<T>)) return ActivationType::Sigmoid;
+    if(type == typeid(BasicTanh<T>)) return ActivationType::Tanh;
+    if(type == typeid(BasicLeakyReLU<T>)) return ActivationType::LeakyReLU;
+    if(type == typeid(BasicGELU<T>)) return ActivationType::GELU;
+    if(type == typeid(BasicSiLU<T>)) return ActivationType::SiLU;
+    if(type == typeid(BasicFastSigmoid<T>)) return ActivationType::FastSigmoid;
+    if(type == typeid(BasicFastTanh<T>)) return ActivationType::FastTanh;
+    if(type == typeid(BasicFastGELU<T>)) return ActivationType::FastGELU;
+    if(type == typeid(BasicFastSiLU<T>)) return ActivationType::FastSiLU;
+
+    return ActivationType::Custom;
+};
+
+template <typename T>
+std::unique_ptr<BasicActivationFunction<T>> make_activation(ActivationType type){
+    switch(type){
+        case ActivationType::Linear: return std::make_unique<BasicLinear<T>>();
+        case ActivationType::ReLU: return std::make_unique<BasicReLU<T>>();
+        case ActivationType::Sigmoid: return std::make_unique<BasicSigmoid<T>>();
+        case ActivationType::Tanh: return std::make_unique<BasicTanh<T>>();
+        case ActivationType::LeakyReLU: return std::make_unique<BasicLeakyReLU<T>>();
+        case ActivationType::GELU: return std::make_unique<BasicGELU<T>>();
+        case ActivationType::SiLU: return std::make_unique<BasicSiLU<T>>();
+        case ActivationType::FastSigmoid: return std::make_unique<BasicFastSigmoid<T>>();
+        case ActivationType::FastTanh: return std::make_unique<BasicFastTanh<T>>();
+        case ActivationType::FastGELU: return std::make_unique<BasicFastGELU<T>>();
+        case ActivationType::FastSiLU: return std::make_unique<BasicFastSiLU<T>>();
+        default: throw std::invalid_argument("make_activation: no built-in activation for this type");
+    }
+};
+
+template <typename T>
+void apply_activation(ActivationType type, Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>& x){
+    switch(type){
+        case ActivationType::Linear: break;
+        case ActivationType::ReLU: x = BasicReLU<T>::apply(x.array()).matrix(); break;
+        case ActivationType::Sigmoid: x = BasicSigmoid<T>::apply(x.array()).matrix(); break;
+        case ActivationType::Tanh: x = BasicTanh<T>::apply(x.array()).matrix(); break;
+        case ActivationType::LeakyReLU: x = BasicLeakyReLU<T>::apply(x.array()).matrix(); break;
+        case ActivationType::GELU: x = BasicGELU<T>::apply(x.array()).matrix(); break;
+        case ActivationType::SiLU: x = BasicSiLU<T>::apply(x.array()).matrix(); break;
+        case ActivationType::FastSigmoid: x = BasicFastSigmoid<T>::apply(x.array()).matrix(); break;
+        case ActivationType::FastTanh: x = BasicFastTanh<T>::apply(x.array()).matrix(); break;
+        case ActivationType::FastGELU: x = BasicFastGELU<T>::apply(x.array()).matrix(); break;
+        case ActivationType::FastSiLU: x = BasicFastSiLU<T>::apply(x.array()).matrix(); break;
+        default: throw std::invalid_argument("apply_activation: no built-in activation for this type");
+    }
+};
+
+template ActivationType activation_type(const BasicActivationFunction<float>&);
+template ActivationType activation_type(const BasicActivationFunction<double>&);
+template std::unique_ptr<BasicActivationFunction<float>> make_activation(ActivationType);
+template std::unique_ptr<BasicActivationFunction<double>> make_activation(ActivationType);
+template void apply_activation(ActivationType, Eigen::MatrixXf&);
+template void apply_activation(ActivationType, Eigen::MatrixXd&);
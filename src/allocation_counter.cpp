@@ -0,0 +1,44 @@
+#include "../includes/allocation_counter.hpp"
+#include <atomic>
+#include <cstddef>
+
+// The per-thread counters use initial-exec TLS, which never allocates, so a scope of the Profiler only sees its own
+// thread. The process-wide count covers the work a benchmark hands to other threads.
+#if defined(__GLIBC__)
+static thread_local __attribute__((tls_model("initial-exec"))) long allocation_count = 0;
+static thread_local __attribute__((tls_model("initial-exec"))) long allocation_bytes = 0;
+static std::atomic<long> process_count{0};
+
+extern "C" void* __libc_malloc(std::size_t size);
+extern "C" void* __libc_calloc(std::size_t count, std::size_t size);
+extern "C" void* __libc_realloc(void* ptr, std::size_t size);
+
+static void record(std::size_t bytes){
+    allocation_count++;
+    allocation_bytes += bytes;
+    process_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+extern "C" void* malloc(std::size_t size){
+    record(size);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(std::size_t count, std::size_t size){
+    record(count * size);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, std::size_t size){
+    record(size);
+    return __libc_realloc(ptr, size);
+}
+
+bool counts_allocations() {return true;}
+std::pair<long, long> thread_allocations() {return {allocation_count, allocation_bytes};}
+long process_allocations() {return process_count.load(std::memory_order_relaxed);}
+#else
+bool counts_allocations() {return false;}
+std::pair<long, long> thread_allocations() {return {0, 0};}
+long process_allocations() {return 0;}
+#endif
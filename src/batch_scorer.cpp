@@ -0,0 +1,353 @@
+#include "../includes/batch_scorer.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+constexpr std::size_t READ_BLOCK = 1 << 20; // bytes read at once from a CSV input
+
+static double seconds_since(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <typename T>
+BasicBatchScorer<T>::BasicBatchScorer(const BasicMLP<T>& model, const ScoringOptions& options) : model(model), options(options) {
+    if(options.chunk_rows <= 0) throw std::invalid_argument("BasicBatchScorer: chunk_rows must be positive");
+    if(options.num_workers < 0 || options.depth < 0) throw std::invalid_argument("BasicBatchScorer: num_workers and depth cannot be negative");
+}
+
+template <typename T>
+void BasicBatchScorer<T>::fail(Pipeline& pipeline, std::exception_ptr error){
+    {
+        std::lock_guard<std::mutex> lock(pipeline.mutex);
+        if(!pipeline.error) pipeline.error = error;
+        pipeline.failed = true;
+    }
+    pipeline.changed.notify_all();
+}
+
+// ---------------------------------------- reader ----------------------------------------
+template <typename T>
+template <typename Fill>
+bool BasicBatchScorer<T>::publish(Pipeline& pipeline, Fill fill){
+    Slot& slot = pipeline.slots[pipeline.read % pipeline.slots.size()];
+    {
+        std::unique_lock<std::mutex> lock(pipeline.mutex);
+        pipeline.changed.wait(lock, [&]{ return slot.state == Slot::State::Free || pipeline.failed; });
+        if(pipeline.failed) return false;
+    }
+
+    // the slot is free: only the reader touches it until it is published
+    auto start = std::chrono::steady_clock::now();
+    slot.lines = fill(slot);
+    pipeline.stats.read_seconds += seconds_since(start);
+    if(slot.lines == 0) return false;
+
+    {
+        std::lock_guard<std::mutex> lock(pipeline.mutex);
+        slot.state = Slot::State::Read;
+        pipeline.read++;
+    }
+    pipeline.changed.notify_all();
+    return true;
+}
+
+template <typename T>
+void BasicBatchScorer<T>::read(Pipeline& pipeline){
+    if(options.input_format == ScoreFormat::CSV) read_csv(pipeline);
+    else read_binary(pipeline);
+
+    {
+        std::lock_guard<std::mutex> lock(pipeline.mutex);
+        pipeline.total = pipeline.read;
+    }
+    pipeline.changed.notify_all();
+}
+
+template <typename T>
+void BasicBatchScorer<T>::read_csv(Pipeline& pipeline){
+    std::string pending; // bytes read and not handed out yet, starting at the beginning of a line
+    bool eof = false;
+    auto refill = [&]{
+        std::size_t size = pending.size();
+        pending.resize(size + READ_BLOCK);
+        std::size_t count = std::fread(pending.data() + size, 1, READ_BLOCK, pipeline.in);
+        pending.resize(size + count);
+        if(count < READ_BLOCK){
+            if(std::ferror(pipeline.in)) throw std::runtime_error("BasicBatchScorer: cannot read " + pipeline.input_path);
+            eof = true;
+        }
+    };
+
+    long line = 0; // line of the file at the start of pending
+    if(options.skip_header){
+        std::size_t end;
+        while((end = pending.find('\n')) == std::string::npos && !eof) refill();
+        pending.erase(0, end == std::string::npos ? pending.size() : end + 1);
+        line = 1;
+    }
+
+    bool more = true;
+    while(more){
+        more = publish(pipeline, [&](Slot& slot) -> long {
+            // the end of the chunk_rows-th line, reading more blocks as needed (the last line may lack its '\n')
+            long lines = 0;
+            std::size_t cut = 0;
+            while(lines < options.chunk_rows){
+                const char* newline = static_cast<const char*>(std::memchr(pending.data() + cut, '\n', pending.size() - cut));
+                if(newline){
+                    cut = newline - pending.data() + 1;
+                    lines++;
+                }else if(!eof){
+                    refill();
+                }else{
+                    if(cut < pending.size()) cut = pending.size(), lines++;
+                    break;
+                }
+            }
+
+            slot.input.assign(pending, 0, cut);
+            pending.erase(0, cut);
+            slot.first_row = line;
+            line += lines;
+            return lines;
+        });
+    }
+}
+
+template <typename T>
+void BasicBatchScorer<T>::read_binary(Pipeline& pipeline){
+    DatasetHeader header;
+    if(std::fread(&header, sizeof(header), 1, pipeline.in) != 1 || std::memcmp(header.magic, "MLPD", 4) != 0
+            || header.version != BasicMappedDataset<T>::VERSION || header.scalar_size != sizeof(T)){
+        throw std::runtime_error("BasicBatchScorer: " + pipeline.input_path + " is not a valid dataset of the requested scalar type");
+    }
+    if(header.num_features != model.get_input_size()){
+        throw std::runtime_error("BasicBatchScorer: " + pipeline.input_path + " has " + std::to_string(header.num_features)
+                + " features, the model takes " + std::to_string(model.get_input_size()));
+    }
+    pipeline.input_targets = header.num_targets;
+    std::size_t record_bytes = (header.num_features + header.num_targets) * sizeof(T);
+
+    long row = 0;
+    bool more = true;
+    while(more){
+        more = publish(pipeline, [&](Slot& slot) -> long {
+            long count = std::min<long>(options.chunk_rows, header.num_rows - row);
+            slot.input.resize(count * record_bytes);
+            if(count > 0 && std::fread(slot.input.data(), record_bytes, count, pipeline.in) != count){
+                throw std::runtime_error("BasicBatchScorer: " + pipeline.input_path + " is truncated");
+            }
+            slot.first_row = row;
+            row += count;
+            return count;
+        });
+    }
+}
+
+// ---------------------------------------- workers ----------------------------------------
+// spaces around the values, unless one of them is the delimiter
+static bool is_blank(char c, char delimiter){
+    return (c == ' ' || c == '\t' || c == '\r') && c != delimiter;
+}
+
+template <typename T>
+long BasicBatchScorer<T>::parse_csv(const Slot& slot, Matrix& x) const{
+    int features = model.get_input_size();
+    if(x.rows() < slot.lines || x.cols() != features) x.resize(slot.lines, features); // the chunk size, after the first one
+
+    const char* p = slot.input.data();
+    const char* end = p + slot.input.size();
+    long rows = 0;
+    for(long line = slot.first_row + 1; p < end; line++){
+        const char* line_end = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if(!line_end) line_end = end;
+
+        while(p < line_end && is_blank(*p, options.delimiter)) p++;
+        if(p == line_end){ // blank line
+            p = line_end + 1;
+            continue;
+        }
+
+        for(int j = 0; j < features; j++){
+            while(p < line_end && is_blank(*p, options.delimiter)) p++;
+            auto [next, error] = std::from_chars(p, line_end, x(rows, j));
+            p = next;
+            while(p < line_end && is_blank(*p, options.delimiter)) p++;
+            bool separated = j + 1 < features ? p < line_end && *p == options.delimiter : p == line_end;
+            if(error != std::errc() || !separated){
+                throw std::runtime_error("BasicBatchScorer: line " + std::to_string(line) + " does not hold " + std::to_string(features)
+                        + " numbers separated by '" + options.delimiter + "'");
+            }
+            p++; // delimiter, or the end of the line
+        }
+        rows++;
+    }
+    return rows;
+}
+
+template <typename T>
+void BasicBatchScorer<T>::format(const Matrix& y, long rows, Slot& slot) const{
+    int outputs = y.cols();
+    if(options.output_format == ScoreFormat::Binary){
+        using RowMajorMap = Eigen::Map<Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>>;
+        slot.output.resize(rows * outputs * sizeof(T));
+        RowMajorMap(reinterpret_cast<T*>(slot.output.data()), rows, outputs) = y.topRows(rows);
+        return;
+    }
+
+    // shortest representation that reads back to the same value: at most 24 characters for a double
+    constexpr int MAX_CHARS = 25;
+    slot.output.resize(rows * outputs * MAX_CHARS);
+    char* p = slot.output.data();
+    char* end = p + slot.output.size();
+    for(long i = 0; i < rows; i++){
+        for(int j = 0; j < outputs; j++){
+            p = std::to_chars(p, end, y(i, j)).ptr;
+            *p++ = j + 1 < outputs ? options.delimiter : '\n';
+        }
+    }
+    slot.output.resize(p - slot.output.data());
+}
+
+template <typename T>
+void BasicBatchScorer<T>::work(Pipeline& pipeline){
+    using RowMajorMap = Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>, 0, Eigen::OuterStride<>>;
+    BasicInferenceScratch<T> scratch;
+    Matrix x, y;
+    double parse_seconds = 0, infer_seconds = 0, format_seconds = 0;
+
+    while(true){
+        Slot* slot;
+        {
+            std::unique_lock<std::mutex> lock(pipeline.mutex);
+            pipeline.changed.wait(lock, [&]{ return pipeline.failed || pipeline.claimed < pipeline.read || pipeline.claimed == pipeline.total; });
+            if(pipeline.failed || pipeline.claimed == pipeline.total) break;
+            slot = &pipeline.slots[pipeline.claimed++ % pipeline.slots.size()];
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        if(options.input_format == ScoreFormat::CSV){
+            slot->rows = parse_csv(*slot, x);
+        }else{
+            int features = model.get_input_size();
+            Eigen::OuterStride<> stride(features + pipeline.input_targets);
+            x = RowMajorMap(reinterpret_cast<const T*>(slot->input.data()), slot->lines, features, stride);
+            slot->rows = slot->lines;
+        }
+        parse_seconds += seconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        model.infer(x.topRows(slot->rows), y, scratch);
+        infer_seconds += seconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        format(y, slot->rows, *slot);
+        format_seconds += seconds_since(start);
+
+        {
+            std::lock_guard<std::mutex> lock(pipeline.mutex);
+            slot->state = Slot::State::Scored;
+        }
+        pipeline.changed.notify_all();
+    }
+
+    std::lock_guard<std::mutex> lock(pipeline.mutex);
+    pipeline.stats.parse_seconds += parse_seconds;
+    pipeline.stats.infer_seconds += infer_seconds;
+    pipeline.stats.format_seconds += format_seconds;
+}
+
+// ---------------------------------------- writer ----------------------------------------
+template <typename T>
+void BasicBatchScorer<T>::write(Pipeline& pipeline){
+    for(long k = 0;; k++){
+        Slot& slot = pipeline.slots[k % pipeline.slots.size()];
+        {
+            // chunk k - depth has been written, so a scored chunk in this slot is chunk k
+            std::unique_lock<std::mutex> lock(pipeline.mutex);
+            pipeline.changed.wait(lock, [&]{ return pipeline.failed || slot.state == Slot::State::Scored || k == pipeline.total; });
+            if(pipeline.failed || slot.state != Slot::State::Scored) return;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        if(std::fwrite(slot.output.data(), 1, slot.output.size(), pipeline.out) != slot.output.size()){
+            throw std::runtime_error("BasicBatchScorer: cannot write " + pipeline.output_path);
+        }
+        pipeline.stats.write_seconds += seconds_since(start);
+        pipeline.stats.rows += slot.rows;
+        pipeline.stats.chunks++;
+
+        {
+            std::lock_guard<std::mutex> lock(pipeline.mutex);
+            slot.state = Slot::State::Free;
+        }
+        pipeline.changed.notify_all();
+    }
+}
+
+template <typename T>
+ScoringStats BasicBatchScorer<T>::score(const std::string& input_path, const std::string& output_path){
+    auto start = std::chrono::steady_clock::now();
+    auto close = [](std::FILE* file){ if(file && file != stdin && file != stdout) std::fclose(file); };
+    using File = std::unique_ptr<std::FILE, decltype(close)>;
+
+    if((input_path == "-" && options.input_format == ScoreFormat::Binary) || (output_path == "-" && options.output_format == ScoreFormat::Binary)){
+        throw std::runtime_error("BasicBatchScorer: binary files cannot be streamed through the standard input or output");
+    }
+    File in(input_path == "-" ? stdin : std::fopen(input_path.c_str(), "rb"), close);
+    if(!in) throw std::runtime_error("BasicBatchScorer: cannot read " + input_path);
+    File out(output_path == "-" ? stdout : std::fopen(output_path.c_str(), "wb"), close);
+    if(!out) throw std::runtime_error("BasicBatchScorer: cannot write " + output_path);
+
+    int outputs = model.get_output_size();
+    DatasetHeader header = {{'M', 'L', 'P', 'D'}, BasicMappedDataset<T>::VERSION, sizeof(T), 0, (uint32_t)outputs, 0, 0};
+    if(options.output_format == ScoreFormat::Binary && std::fwrite(&header, sizeof(header), 1, out.get()) != 1){
+        throw std::runtime_error("BasicBatchScorer: cannot write " + output_path);
+    }
+
+    int num_workers = options.num_workers > 0 ? options.num_workers : std::max(1u, std::thread::hardware_concurrency());
+    Pipeline pipeline;
+    pipeline.input_path = input_path;
+    pipeline.output_path = output_path;
+    pipeline.in = in.get();
+    pipeline.out = out.get();
+    pipeline.slots.resize(options.depth > 0 ? options.depth : 2 * num_workers);
+
+    // the stages run until the input is exhausted or one of them fails, which stops the others
+    auto stage = [&](void (BasicBatchScorer::*run)(Pipeline&)){
+        return [this, &pipeline, run]{
+            try{
+                (this->*run)(pipeline);
+            }catch(...){
+                fail(pipeline, std::current_exception());
+            }
+        };
+    };
+    std::thread reader(stage(&BasicBatchScorer::read));
+    std::vector<std::thread> workers;
+    for(int i = 0; i < num_workers; i++) workers.emplace_back(stage(&BasicBatchScorer::work));
+    stage(&BasicBatchScorer::write)();
+
+    reader.join();
+    for(std::thread& worker : workers) worker.join();
+    if(pipeline.error) std::rethrow_exception(pipeline.error);
+
+    if(options.output_format == ScoreFormat::Binary){ // the number of rows is known now
+        header.num_rows = pipeline.stats.rows;
+        if(std::fseek(out.get(), 0, SEEK_SET) != 0 || std::fwrite(&header, sizeof(header), 1, out.get()) != 1){
+            throw std::runtime_error("BasicBatchScorer: cannot write " + output_path);
+        }
+    }
+    if(std::fflush(out.get()) != 0) throw std::runtime_error("BasicBatchScorer: cannot write " + output_path);
+
+    pipeline.stats.seconds = seconds_since(start);
+    return pipeline.stats;
+}
+
+template class BasicBatchScorer<float>;
+template class BasicBatchScorer<double>;
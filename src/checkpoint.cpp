@@ -0,0 +1,86 @@
+#include "../includes/checkpoint.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+template <typename T>
+BasicMappedMLP<T>::BasicMappedMLP(const std::string& path) : file(path){
+    auto invalid = [&](const std::string& reason){
+        return std::runtime_error("BasicMappedMLP: " + path + ": " + reason);
+    };
+
+    if(file.size() < sizeof(CheckpointHeader)) throw invalid("not a checkpoint");
+    CheckpointHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if(std::memcmp(header.magic, "MLPC", 4) != 0) throw invalid("not a checkpoint");
+    if(header.version != CHECKPOINT_VERSION) throw invalid("unsupported version " + std::to_string(header.version));
+    if(header.scalar_size != sizeof(T)) throw invalid("scalar type mismatch");
+    if(header.num_layers == 0 || file.size() < sizeof(CheckpointHeader) + header.num_layers * sizeof(CheckpointLayer)) throw invalid("truncated");
+
+    momentum = header.flags & CHECKPOINT_HAS_MOMENTUM;
+
+    // every array must lie inside the file, aligned for T
+    auto array = [&](uint64_t offset, uint64_t size) -> const T* {
+        if(offset % alignof(T) != 0 || offset > file.size() || size > (file.size() - offset) / sizeof(T)) throw invalid("corrupted array offset");
+        return reinterpret_cast<const T*>(file.data() + offset);
+    };
+
+    uint32_t input_size = header.input_size;
+    for(uint32_t l = 0; l < header.num_layers; l++){
+        CheckpointLayer entry;
+        std::memcpy(&entry, file.data() + sizeof(CheckpointHeader) + l * sizeof(CheckpointLayer), sizeof(entry));
+        if(entry.input_size != input_size || entry.output_size == 0) throw invalid("inconsistent topology at layer " + std::to_string(l));
+        if(entry.activation >= (uint32_t)ActivationType::Custom) throw invalid("unknown activation at layer " + std::to_string(l));
+
+        uint64_t weights_size = (uint64_t)entry.output_size * entry.input_size;
+        layers.push_back(MappedLayer{
+            ActivationType(entry.activation),
+            ConstMap(array(entry.weights_offset, weights_size), entry.output_size, entry.input_size),
+            ConstMap(array(entry.bias_offset, entry.output_size), entry.output_size, 1),
+            momentum ? array(entry.prev_weights_update_offset, weights_size) : nullptr,
+            momentum ? array(entry.prev_bias_update_offset, entry.output_size) : nullptr
+        });
+        input_size = entry.output_size;
+    }
+};
+
+template <typename T>
+void BasicMappedMLP<T>::infer(const Eigen::Ref<const Matrix>& x, Matrix& out) const{
+    static thread_local InferenceScratch scratch;
+    infer(x, out, scratch);
+};
+
+template <typename T>
+void BasicMappedMLP<T>::infer(const Eigen::Ref<const Matrix>& x, Matrix& out, InferenceScratch& scratch) const{
+    auto layer_forward = [](const MappedLayer& layer, const Eigen::Ref<const Matrix>& in, Matrix& result){
+        result.noalias() = in * layer.weights.transpose(); // X*W^T
+        result.rowwise() += layer.bias.col(0).transpose(); // + b^T
+        apply_activation(layer.activation, result);
+    };
+
+    int last = layers.size() - 1;
+    Matrix* current = &scratch.ping;
+    Matrix* other = &scratch.pong;
+
+    if(last == 0){
+        layer_forward(layers[0], x, out);
+        return;
+    }
+
+    layer_forward(layers[0], x, *current);
+    for(int i = 1; i < last; i++){
+        layer_forward(layers[i], *current, *other);
+        std::swap(current, other);
+    }
+    layer_forward(layers[last], *current, out);
+};
+
+template <typename T>
+typename BasicMappedMLP<T>::Matrix BasicMappedMLP<T>::predict(const Eigen::Ref<const Matrix>& x) const{
+    Matrix out;
+    infer(x, out);
+    return out;
+};
+
+template class BasicMappedMLP<float>;
+template class BasicMappedMLP<double>;
@@ -0,0 +1,492 @@
+#include "../includes/communicator.hpp"
+
+#include <eigen3/Eigen/Dense>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cctype>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+constexpr auto CONNECT_TIMEOUT = std::chrono::seconds(30);
+
+static std::runtime_error system_error(const std::string& what){
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+// ---------------------------------------- Communicator ----------------------------------------
+template <typename T>
+void BasicCommunicator<T>::broadcast(T* data, long count, int root){
+    if(get_rank() != root) std::fill(data, data + count, T(0));
+    all_reduce(data, count); // root + zeros: exactly the values of root
+}
+
+template class BasicCommunicator<float>;
+template class BasicCommunicator<double>;
+
+
+// ---------------------------------------- SharedMemoryCommunicator ----------------------------------------
+static_assert(std::atomic<uint32_t>::is_always_lock_free && sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+        "the barrier needs address-free 32-bit atomics to wait on them with a futex");
+
+// futex shared between processes (not FUTEX_PRIVATE), the wait returns at the latest after timeout_ms
+static void futex_wait(std::atomic<uint32_t>* word, uint32_t expected, long timeout_ms){
+    timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000};
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+}
+
+static void futex_wake_all(std::atomic<uint32_t>* word){
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+// the segment starts zero-filled (ftruncate): rank 0 fills the plain fields, then publishes them with ready
+template <typename T>
+struct BasicSharedMemoryCommunicator<T>::Header {
+    int32_t size;
+    int32_t scalar_size;
+    int64_t capacity;
+    std::atomic<uint32_t> ready;
+    std::atomic<uint32_t> arrived; // ranks in the current barrier
+    std::atomic<uint32_t> generation; // barriers completed
+    std::atomic<int32_t> pids[1]; // size entries, the pid of every rank once attached
+};
+
+template <typename T>
+BasicSharedMemoryCommunicator<T>::BasicSharedMemoryCommunicator(const std::string& name, int rank, int size, long capacity)
+    : rank(rank), size(size), capacity(capacity), name(name) {
+    if(size < 1 || rank < 0 || rank >= size || capacity < 1) throw std::invalid_argument("BasicSharedMemoryCommunicator: invalid rank, size or capacity");
+
+    std::size_t slots_offset = (offsetof(Header, pids) + size * sizeof(std::atomic<int32_t>) + 63) / 64 * 64;
+    mapped_bytes = slots_offset + (size + 1) * capacity * sizeof(T);
+    auto deadline = Clock::now() + CONNECT_TIMEOUT;
+
+    int fd;
+    if(rank == 0){
+        shm_unlink(name.c_str()); // left by a crashed group of the same name
+        fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if(fd < 0) throw system_error("BasicSharedMemoryCommunicator: cannot create " + name);
+        if(ftruncate(fd, mapped_bytes) != 0){
+            close(fd);
+            shm_unlink(name.c_str());
+            throw system_error("BasicSharedMemoryCommunicator: cannot size " + name);
+        }
+    }else{
+        struct stat info;
+        while((fd = shm_open(name.c_str(), O_RDWR, 0)) < 0 || fstat(fd, &info) != 0 || (std::size_t)info.st_size < mapped_bytes){
+            if(fd >= 0) close(fd);
+            if(Clock::now() > deadline) throw std::runtime_error("BasicSharedMemoryCommunicator: rank 0 did not create " + name);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    void* memory = mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(memory == MAP_FAILED){
+        if(rank == 0) shm_unlink(name.c_str());
+        throw system_error("BasicSharedMemoryCommunicator: cannot map " + name);
+    }
+    header = static_cast<Header*>(memory);
+    slots = reinterpret_cast<T*>(static_cast<char*>(memory) + slots_offset);
+
+    if(rank == 0){
+        header->size = size;
+        header->scalar_size = sizeof(T);
+        header->capacity = capacity;
+        header->ready.store(1, std::memory_order_release);
+    }else{
+        while(header->ready.load(std::memory_order_acquire) == 0){
+            if(Clock::now() > deadline) throw std::runtime_error("BasicSharedMemoryCommunicator: " + name + " was never initialized");
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if(header->size != size || header->scalar_size != sizeof(T) || header->capacity != capacity){
+            munmap(memory, mapped_bytes);
+            throw std::runtime_error("BasicSharedMemoryCommunicator: " + name + " belongs to a group of another size, scalar type or capacity");
+        }
+    }
+    header->pids[rank].store(getpid());
+
+    barrier(); // every rank is attached, the name can go
+    if(rank == 0) shm_unlink(name.c_str());
+}
+
+template <typename T>
+void BasicSharedMemoryCommunicator<T>::barrier(){
+    constexpr int SPINS = 64; // short waits (balanced ranks) never reach the futex
+    uint32_t generation = header->generation.load(std::memory_order_acquire);
+
+    if(header->arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == (uint32_t)size){ // last one releases the others
+        header->arrived.store(0, std::memory_order_relaxed);
+        header->generation.fetch_add(1, std::memory_order_release);
+        futex_wake_all(&header->generation);
+        return;
+    }
+
+    for(int spin = 0; header->generation.load(std::memory_order_acquire) == generation; spin++){
+        if(spin < SPINS){
+            std::this_thread::yield();
+            continue;
+        }
+        futex_wait(&header->generation, generation, 100);
+        for(int r = 0; r < size; r++){ // a rank that died would leave the others waiting forever
+            int32_t pid = header->pids[r].load();
+            if(pid > 0 && kill(pid, 0) != 0 && errno == ESRCH){
+                throw std::runtime_error("BasicSharedMemoryCommunicator: rank " + std::to_string(r) + " is gone");
+            }
+        }
+    }
+}
+
+template <typename T>
+void BasicSharedMemoryCommunicator<T>::all_reduce(T* data, long count){
+    using Vector = Eigen::Matrix<T, Eigen::Dynamic, 1>;
+    if(size == 1) return;
+
+    T* result = slots + size * capacity;
+    for(long offset = 0; offset < count; offset += capacity){
+        long n = std::min(capacity, count - offset);
+        std::copy(data + offset, data + offset + n, slots + rank * capacity);
+        barrier(); // every piece is in its slot
+
+        // reduce-scatter: this rank sums its share over the slots, in rank order whichever rank it is
+        long begin = n * rank / size, end = n * (rank + 1) / size;
+        Eigen::Map<Vector> sum(result + begin, end - begin);
+        sum = Eigen::Map<const Vector>(slots + begin, end - begin);
+        for(int r = 1; r < size; r++){
+            sum += Eigen::Map<const Vector>(slots + r * capacity + begin, end - begin);
+        }
+        barrier(); // every share is summed
+
+        // all-gather; the next piece only writes the slots, and the result once every rank is past its first barrier
+        std::copy(result, result + n, data + offset);
+    }
+}
+
+template <typename T>
+BasicSharedMemoryCommunicator<T>::~BasicSharedMemoryCommunicator(){
+    if(header) munmap(header, mapped_bytes);
+}
+
+template class BasicSharedMemoryCommunicator<float>;
+template class BasicSharedMemoryCommunicator<double>;
+
+
+// ---------------------------------------- SocketCommunicator ----------------------------------------
+static sockaddr_in parse_address(const std::string& address){
+    std::size_t colon = address.rfind(':');
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    if(colon == std::string::npos || inet_pton(AF_INET, address.substr(0, colon).c_str(), &addr.sin_addr) != 1){
+        throw std::invalid_argument("BasicSocketCommunicator: invalid address " + address + ", expected ip:port");
+    }
+    addr.sin_port = htons(std::stoi(address.substr(colon + 1)));
+    return addr;
+}
+
+template <typename T>
+BasicSocketCommunicator<T>::BasicSocketCommunicator(int rank, const std::vector<std::string>& addresses, int listen_fd)
+    : rank(rank), size(addresses.size()) {
+    if(rank < 0 || rank >= size){
+        if(listen_fd >= 0) close(listen_fd);
+        throw std::invalid_argument("BasicSocketCommunicator: rank out of range");
+    }
+    if(size == 1){
+        if(listen_fd >= 0) close(listen_fd);
+        return;
+    }
+
+    sockaddr_in next = parse_address(addresses[(rank + 1) % size]);
+    if(listen_fd < 0){
+        sockaddr_in self = parse_address(addresses[rank]);
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if(listen_fd < 0 || bind(listen_fd, (sockaddr*)&self, sizeof(self)) != 0 || listen(listen_fd, 1) != 0){
+            std::runtime_error error = system_error("BasicSocketCommunicator: cannot listen on " + addresses[rank]);
+            if(listen_fd >= 0) close(listen_fd);
+            throw error;
+        }
+    }
+
+    // every rank listens before connecting, so the connections complete in the backlog whatever the start order
+    auto deadline = Clock::now() + CONNECT_TIMEOUT;
+    while(true){
+        next_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(next_fd >= 0 && connect(next_fd, (sockaddr*)&next, sizeof(next)) == 0) break;
+        if(next_fd >= 0) close(next_fd);
+        next_fd = -1;
+        if(Clock::now() > deadline){
+            close(listen_fd);
+            throw std::runtime_error("BasicSocketCommunicator: cannot connect to rank " + std::to_string((rank + 1) % size));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    pollfd pending = {listen_fd, POLLIN, 0};
+    int ready = poll(&pending, 1, std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count());
+    previous_fd = ready > 0 ? accept(listen_fd, nullptr, nullptr) : -1;
+    close(listen_fd);
+
+    // the previous rank introduces itself, then both sockets go non-blocking for the overlapped exchanges
+    uint32_t me = rank, peer = UINT32_MAX;
+    bool introduced = previous_fd >= 0 && send(next_fd, &me, sizeof(me), MSG_NOSIGNAL) == sizeof(me)
+            && recv(previous_fd, &peer, sizeof(peer), MSG_WAITALL) == sizeof(peer);
+    if(!introduced || peer != (uint32_t)((rank + size - 1) % size)){
+        close(next_fd);
+        if(previous_fd >= 0) close(previous_fd);
+        throw std::runtime_error("BasicSocketCommunicator: rank " + std::to_string((rank + size - 1) % size) + " did not connect");
+    }
+    int on = 1;
+    for(int fd : {next_fd, previous_fd}){
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+}
+
+template <typename T>
+void BasicSocketCommunicator<T>::exchange(const T* send, long send_count, long receive_count){
+    const char* out = reinterpret_cast<const char*>(send);
+    char* in = reinterpret_cast<char*>(received.data());
+    std::size_t to_send = send_count * sizeof(T), to_receive = receive_count * sizeof(T);
+
+    while(to_send > 0 || to_receive > 0){
+        pollfd fds[2] = {{next_fd, short(to_send > 0 ? POLLOUT : 0), 0}, {previous_fd, short(to_receive > 0 ? POLLIN : 0), 0}};
+        if(poll(fds, 2, -1) < 0){ // no timeout: a rank may compute for long, a dead one closes its sockets
+            if(errno == EINTR) continue;
+            throw system_error("BasicSocketCommunicator: poll");
+        }
+        if(fds[0].revents){
+            ssize_t n = ::send(next_fd, out, to_send, MSG_NOSIGNAL);
+            if(n < 0 && errno != EAGAIN && errno != EINTR) throw std::runtime_error("BasicSocketCommunicator: rank " + std::to_string((rank + 1) % size) + " is gone");
+            if(n > 0){
+                out += n;
+                to_send -= n;
+            }
+        }
+        if(fds[1].revents){
+            ssize_t n = recv(previous_fd, in, to_receive, 0);
+            if(n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)){
+                throw std::runtime_error("BasicSocketCommunicator: rank " + std::to_string((rank + size - 1) % size) + " is gone");
+            }
+            if(n > 0){
+                in += n;
+                to_receive -= n;
+            }
+        }
+    }
+}
+
+template <typename T>
+void BasicSocketCommunicator<T>::all_reduce(T* data, long count){
+    using Vector = Eigen::Matrix<T, Eigen::Dynamic, 1>;
+    if(size == 1) return;
+
+    auto begin = [&](int chunk){ return count * ((chunk % size + size) % size) / size; };
+    auto length = [&](int chunk){ chunk = (chunk % size + size) % size; return count * (chunk + 1) / size - count * chunk / size; };
+    received.resize(count / size + 1);
+
+    // reduce-scatter: at step s, chunk rank - s goes to the next rank and chunk rank - s - 1 comes in and is summed,
+    // after size - 1 steps this rank holds the sum of chunk rank + 1
+    for(int s = 0; s < size - 1; s++){
+        int out = rank - s, in = rank - s - 1;
+        exchange(data + begin(out), length(out), length(in));
+        Eigen::Map<Vector>(data + begin(in), length(in)) += Eigen::Map<const Vector>(received.data(), length(in));
+    }
+
+    // all-gather: the sums go around the ring and are copied, so every rank ends with the same values
+    for(int s = 0; s < size - 1; s++){
+        int out = rank + 1 - s, in = rank - s;
+        exchange(data + begin(out), length(out), length(in));
+        std::copy(received.data(), received.data() + length(in), data + begin(in));
+    }
+}
+
+template <typename T>
+BasicSocketCommunicator<T>::~BasicSocketCommunicator(){
+    if(next_fd >= 0) close(next_fd);
+    if(previous_fd >= 0) close(previous_fd);
+}
+
+template class BasicSocketCommunicator<float>;
+template class BasicSocketCommunicator<double>;
+
+
+// ---------------------------------------- Launcher ----------------------------------------
+// "0-3,8,10-11" as a list of CPUs
+static std::vector<int> parse_cpu_list(const std::string& list){
+    std::vector<int> cpus;
+    std::stringstream ranges(list);
+    std::string range;
+    while(std::getline(ranges, range, ',')){
+        if(range.empty() || !std::isdigit((unsigned char)range[0])) continue;
+        std::size_t dash = range.find('-');
+        int first = std::stoi(range), last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for(int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+// CPUs this process may run on, grouped by NUMA node, the whole set as one node without NUMA information
+static std::vector<std::vector<int>> numa_nodes(){
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+
+    std::vector<std::vector<int>> nodes;
+    for(int node = 0;; node++){
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if(!file) break;
+        std::string list;
+        std::getline(file, list);
+        std::vector<int> cpus;
+        for(int cpu : parse_cpu_list(list)){
+            if(cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+        }
+        if(!cpus.empty()) nodes.push_back(cpus);
+    }
+
+    if(nodes.empty()){
+        nodes.emplace_back();
+        for(int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+            if(CPU_ISSET(cpu, &allowed)) nodes[0].push_back(cpu);
+        }
+    }
+    return nodes;
+}
+
+// rank r runs on node r % nodes, sharing it with the other ranks of that node
+static void pin_rank(int rank, int num_ranks, const std::vector<std::vector<int>>& nodes){
+    int num_nodes = nodes.size();
+    const std::vector<int>& cpus = nodes[rank % num_nodes];
+    int share = rank / num_nodes, shares = (num_ranks - rank % num_nodes + num_nodes - 1) / num_nodes;
+    std::size_t first = cpus.size() * share / shares, last = cpus.size() * (share + 1) / shares;
+    if(first == last){ // more ranks than CPUs on the node
+        first = 0;
+        last = cpus.size();
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(std::size_t i = first; i < last; i++) CPU_SET(cpus[i], &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+template <typename T>
+void launch_local(int num_ranks, const std::function<void(BasicCommunicator<T>&)>& body, const LaunchOptions& options){
+    if(num_ranks < 1) throw std::invalid_argument("launch_local: num_ranks must be positive");
+
+    static std::atomic<int> launches{0};
+    std::string name = "/mlp-" + std::to_string(getpid()) + "-" + std::to_string(launches++);
+    bool sockets = options.transport == LaunchOptions::Transport::Socket;
+
+    // sockets: every rank's port is bound here, so that the whole list is known before the ranks start
+    std::vector<int> listen_fds;
+    std::vector<std::string> addresses;
+    auto close_listeners = [&]{ for(int fd : listen_fds) close(fd); };
+    for(int r = 0; sockets && r < num_ranks; r++){
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(addr);
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 1) != 0 || getsockname(fd, (sockaddr*)&addr, &length) != 0){
+            std::runtime_error error = system_error("launch_local: cannot listen on the loopback interface");
+            if(fd >= 0) close(fd);
+            close_listeners();
+            throw error;
+        }
+        listen_fds.push_back(fd);
+        addresses.push_back("127.0.0.1:" + std::to_string(ntohs(addr.sin_port)));
+    }
+
+    std::vector<std::vector<int>> nodes = options.pin_cpus ? numa_nodes() : std::vector<std::vector<int>>();
+    std::cout.flush(); // anything buffered would be written again by every child
+    std::fflush(nullptr);
+
+    std::vector<pid_t> children;
+    for(int r = 0; r < num_ranks; r++){
+        pid_t pid = fork();
+        if(pid < 0){
+            std::runtime_error error = system_error("launch_local: cannot spawn rank " + std::to_string(r));
+            for(pid_t child : children) kill(child, SIGTERM);
+            for(pid_t child : children) waitpid(child, nullptr, 0);
+            close_listeners();
+            throw error;
+        }
+
+        if(pid == 0){
+            int status = 0;
+            try{
+                if(!nodes.empty()) pin_rank(r, num_ranks, nodes);
+                for(int i = 0; i < listen_fds.size(); i++){
+                    if(i != r) close(listen_fds[i]);
+                }
+                if(sockets){
+                    BasicSocketCommunicator<T> communicator(r, addresses, listen_fds[r]);
+                    body(communicator);
+                }else{
+                    BasicSharedMemoryCommunicator<T> communicator(name, r, num_ranks, options.capacity);
+                    body(communicator);
+                }
+            }catch(const std::exception& e){
+                std::cerr << "rank " << r << ": " << e.what() << std::endl;
+                status = 1;
+            }
+            std::cout.flush();
+            std::fflush(nullptr);
+            _exit(status); // no static destructors or atexit handlers of the parent in the child
+        }
+        children.push_back(pid);
+    }
+    close_listeners();
+
+    // the first failure takes the other ranks down, they would otherwise wait for it in their next collective
+    int failed = -1;
+    for(int left = num_ranks; left > 0;){
+        for(int r = 0; r < num_ranks; r++){
+            if(children[r] < 0) continue;
+            int status;
+            if(waitpid(children[r], &status, WNOHANG) != children[r]) continue;
+            children[r] = -1;
+            left--;
+            if((!WIFEXITED(status) || WEXITSTATUS(status) != 0) && failed < 0){
+                failed = r;
+                for(pid_t child : children){
+                    if(child > 0) kill(child, SIGTERM);
+                }
+            }
+        }
+        if(left > 0) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    if(!sockets) shm_unlink(name.c_str()); // rank 0 may have died before removing it
+
+    if(failed >= 0) throw std::runtime_error("launch_local: rank " + std::to_string(failed) + " failed");
+}
+
+template void launch_local<float>(int, const std::function<void(BasicCommunicator<float>&)>&, const LaunchOptions&);
+template void launch_local<double>(int, const std::function<void(BasicCommunicator<double>&)>&, const LaunchOptions&);
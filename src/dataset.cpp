@@ -0,0 +1,147 @@
+#include "../includes/dataset.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <utility>
+
+// ---------------------------------------- MappedDataset ----------------------------------------
+template <typename T>
+BasicMappedDataset<T>::BasicMappedDataset(const std::string& path, bool random_access) : file(path){
+    if(file.size() < sizeof(DatasetHeader)) throw std::runtime_error("BasicMappedDataset: " + path + " is not a dataset file");
+
+    std::memcpy(&header, file.data(), sizeof(DatasetHeader));
+    // sizes from the file are untrusted: the records must fit in the bytes after the header, computed in uint64
+    // without an overflow, and the feature and target counts must fit the int accessors
+    uint64_t record_size = ((uint64_t)header.num_features + header.num_targets) * sizeof(T);
+    uint64_t max_rows = record_size == 0 ? UINT64_MAX : (file.size() - sizeof(DatasetHeader)) / record_size;
+    bool sizes_valid = header.num_features <= INT_MAX && header.num_targets <= INT_MAX && header.num_rows <= max_rows;
+    if(std::memcmp(header.magic, "MLPD", 4) != 0 || header.version != VERSION || header.scalar_size != sizeof(T) || !sizes_valid){
+        throw std::runtime_error("BasicMappedDataset: " + path + " is not a valid dataset of the requested scalar type");
+    }
+
+    records = reinterpret_cast<const T*>(file.data() + sizeof(DatasetHeader));
+    file.advise(random_access);
+};
+
+template <typename T>
+void BasicMappedDataset<T>::write(const std::string& path, const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y){
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if(!file) throw std::runtime_error("BasicMappedDataset: cannot write " + path);
+
+    DatasetHeader header = {{'M', 'L', 'P', 'D'}, VERSION, sizeof(T), (uint32_t)x.cols(), (uint32_t)y.cols(), 0, (uint64_t)x.rows()};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<T> record(x.cols() + y.cols());
+    for(long i = 0; i < x.rows(); i++){
+        for(int j = 0; j < x.cols(); j++) record[j] = x(i, j);
+        for(int j = 0; j < y.cols(); j++) record[x.cols() + j] = y(i, j);
+        file.write(reinterpret_cast<const char*>(record.data()), record.size() * sizeof(T));
+    }
+
+    if(!file) throw std::runtime_error("BasicMappedDataset: cannot write " + path);
+};
+
+template <typename T>
+void BasicMappedDataset<T>::gather(const long* indices, int count, Matrix& x, Matrix& y) const{
+    using RowMap = Eigen::Map<const Eigen::Matrix<T, 1, Eigen::Dynamic>>;
+    x.resize(count, num_features());
+    y.resize(count, num_targets());
+
+    for(int r = 0; r < count; r++){
+        const T* record = row(indices[r]);
+        x.row(r) = RowMap(record, num_features());
+        y.row(r) = RowMap(record + num_features(), num_targets());
+    }
+};
+
+template <typename T>
+void BasicMappedDataset<T>::gather_range(long begin, int count, Matrix& x, Matrix& y) const{
+    // contiguous rows: view them as row-major blocks and let Eigen transpose them in one pass
+    using RowMajorMap = Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>, 0, Eigen::OuterStride<>>;
+    Eigen::OuterStride<> stride(num_features() + num_targets());
+
+    x = RowMajorMap(row(begin), count, num_features(), stride);
+    y = RowMajorMap(row(begin) + num_features(), count, num_targets(), stride);
+};
+
+template class BasicMappedDataset<float>;
+template class BasicMappedDataset<double>;
+
+
+// ---------------------------------------- BatchPrefetcher ----------------------------------------
+template <typename T>
+BasicBatchPrefetcher<T>::BasicBatchPrefetcher(const BasicMappedDataset<T>& data, int batch_size, int batches_per_epoch, int epochs,
+        bool shuffle, unsigned seed, int depth)
+    : data(data), batch_size(batch_size), batches_per_epoch(batches_per_epoch), epochs(epochs), shuffle(shuffle), seed(seed), ring(std::max(1, depth)){
+
+    producer = std::thread(&BasicBatchPrefetcher<T>::produce, this);
+};
+
+template <typename T>
+BasicBatchPrefetcher<T>::~BasicBatchPrefetcher(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    not_full.notify_all();
+    producer.join();
+};
+
+template <typename T>
+void BasicBatchPrefetcher<T>::produce(){
+    std::vector<long> order(data.rows());
+    std::iota(order.begin(), order.end(), 0L);
+    std::mt19937 rng(seed);
+
+    for(int epoch = 0; epoch < epochs; epoch++){
+        if(shuffle) std::shuffle(order.begin(), order.end(), rng);
+
+        for(int j = 0; j < batches_per_epoch; j++){
+            int slot;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                not_full.wait(lock, [&]{ return stop || count < (int)ring.size(); });
+                if(stop) return;
+                slot = (head + count) % ring.size(); // free slot: the consumer only touches the filled ones
+            }
+
+            long begin = (long)j * batch_size;
+            int rows = std::min<long>(batch_size, data.rows() - begin); // the last minibatch of an epoch may be partial
+            if(shuffle) data.gather(order.data() + begin, rows, ring[slot].x, ring[slot].y);
+            else data.gather_range(begin, rows, ring[slot].x, ring[slot].y);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                count++;
+            }
+            not_empty.notify_one();
+        }
+    }
+};
+
+template <typename T>
+bool BasicBatchPrefetcher<T>::next(Batch& batch){
+    if(epochs == 0 || batches_per_epoch == 0) return false;
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if(consumed == (long)epochs * batches_per_epoch) return false;
+        not_empty.wait(lock, [&]{ return count > 0; });
+
+        std::swap(batch.x, ring[head].x); // O(1), the old buffers of batch are recycled by the producer
+        std::swap(batch.y, ring[head].y);
+        head = (head + 1) % ring.size();
+        count--;
+        consumed++;
+    }
+    not_full.notify_one();
+    return true;
+};
+
+template class BasicBatchPrefetcher<float>;
+template class BasicBatchPrefetcher<double>;
@@ -0,0 +1,288 @@
+#include "../includes/ensemble.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+
+// call f with the type (std::type_identity) of the built-in activation, among those whose derivative follows from the output
+template <typename T, typename F>
+static void with_activation(ActivationType type, F&& f){
+    switch(type){
+        case ActivationType::Linear: f(std::type_identity<BasicLinear<T>>()); break;
+        case ActivationType::ReLU: f(std::type_identity<BasicReLU<T>>()); break;
+        case ActivationType::Sigmoid: f(std::type_identity<BasicSigmoid<T>>()); break;
+        case ActivationType::Tanh: f(std::type_identity<BasicTanh<T>>()); break;
+        case ActivationType::LeakyReLU: f(std::type_identity<BasicLeakyReLU<T>>()); break;
+        case ActivationType::FastSigmoid: f(std::type_identity<BasicFastSigmoid<T>>()); break;
+        case ActivationType::FastTanh: f(std::type_identity<BasicFastTanh<T>>()); break;
+        default: throw std::invalid_argument("BasicEnsemble: activation not supported (custom, GELU or SiLU)");
+    }
+}
+
+template <typename T>
+BasicEnsemble<T>::BasicEnsemble(int input_size, std::vector<std::pair<int, ActivationType>> layers, std::vector<EnsembleMember> members)
+    : input_size(input_size), members(std::move(members)){
+    if(this->members.empty() || layers.empty()) throw std::invalid_argument("BasicEnsemble: no member or no layer");
+    int num_members = this->members.size();
+
+    for(int l = 0; l < layers.size(); l++){
+        with_activation<T>(layers[l].second, [](auto){}); // throws for the unsupported ones
+
+        Layer layer;
+        layer.input_size = l == 0 ? input_size : layers[l - 1].first;
+        layer.output_size = layers[l].first;
+        layer.activation = layers[l].second;
+        layer.weights.resize(layer.input_size, num_members * layer.output_size);
+        layer.bias.resize(1, num_members * layer.output_size);
+        layer.velocity_weights.setZero(layer.weights.rows(), layer.weights.cols());
+        layer.velocity_bias.setZero(1, layer.bias.cols());
+        this->layers.push_back(std::move(layer));
+    }
+
+    // same draws as the constructor of an MLP called right after std::srand(seed), see FCLayer::init_weights
+    for(int m = 0; m < num_members; m++){
+        std::srand(this->members[m].seed);
+        for(Layer& layer : this->layers){
+            int o = layer.output_size;
+            Eigen::MatrixXd weights = -0.5 + (Eigen::MatrixXd::Random(o, layer.input_size).array() + 1.0) * (0.5 - -0.5) / 2.0;
+            Eigen::MatrixXd bias = -0.1 + (Eigen::MatrixXd::Random(o, 1).array() + 1.0) * (0.1 - -0.1) / 2.0;
+            layer.weights.middleCols(m * o, o) = weights.transpose().template cast<T>();
+            layer.bias.middleCols(m * o, o) = bias.transpose().template cast<T>();
+        }
+    }
+
+    loss_grads.resize(num_members);
+    batch_losses.resize(num_members);
+};
+
+template <typename T>
+void BasicEnsemble<T>::set_num_threads(int num_threads){
+    this->num_threads = std::max(1, std::min<int>(num_threads, members.size()));
+    pool = this->num_threads > 1 ? std::make_unique<ThreadPool>(this->num_threads) : nullptr;
+};
+
+template <typename T>
+void BasicEnsemble<T>::prepare(std::vector<Workspace>& ws, long rows){
+    // sized once, before the threads write their column blocks
+    int num_members = members.size();
+    ws.resize(layers.size());
+    for(int l = 0; l < layers.size(); l++){
+        const Layer& layer = layers[l];
+        ws[l].output.resize(rows, num_members * layer.output_size);
+        ws[l].delta.resize(rows, num_members * layer.output_size);
+        ws[l].grad_weights.resize(layer.input_size, num_members * layer.output_size);
+        ws[l].grad_bias.resize(1, num_members * layer.output_size);
+    }
+};
+
+template <typename T>
+void BasicEnsemble<T>::train_step(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y, BasicLossFunction<T>* loss_function,
+        std::vector<Workspace>& ws, int first, int last){
+    int count = last - first;
+    int num_layers = layers.size();
+
+    // forward
+    for(int l = 0; l < num_layers; l++){
+        const Layer& layer = layers[l];
+        int i = layer.input_size, o = layer.output_size;
+        auto output = ws[l].output.middleCols(first * o, count * o);
+
+        if(l == 0){
+            output.noalias() = x * layer.weights.middleCols(first * o, count * o); // shared input: one GEMM for the whole range
+        }else{
+            const Matrix& input = ws[l - 1].output;
+            for(int m = first; m < last; m++){
+                ws[l].output.middleCols(m * o, o).noalias() = input.middleCols(m * i, i) * layer.weights.middleCols(m * o, o);
+            }
+        }
+
+        with_activation<T>(layer.activation, [&](auto act){ // bias and activation of the range in one pass
+            using Act = typename decltype(act)::type;
+            output = Act::apply((output.rowwise() + layer.bias.middleCols(first * o, count * o).row(0)).array()).matrix();
+        });
+    }
+
+    // loss gradient of every member, into the delta of the output layer
+    int k = get_output_size();
+    Workspace& top = ws.back();
+    for(int m = first; m < last; m++){
+        auto y_pred = top.output.middleCols(m * k, k);
+        batch_losses[m] = loss_function->loss_and_gradient(y, y_pred, loss_grads[m]);
+        top.delta.middleCols(m * k, k) = loss_grads[m];
+    }
+
+    // backward
+    for(int l = num_layers - 1; l >= 0; l--){
+        const Layer& layer = layers[l];
+        Workspace& w = ws[l];
+        int i = layer.input_size, o = layer.output_size;
+        auto delta = w.delta.middleCols(first * o, count * o);
+
+        with_activation<T>(layer.activation, [&](auto act){
+            using Act = typename decltype(act)::type;
+            if constexpr (!std::is_same_v<Act, BasicLinear<T>>){
+                delta.array() *= Act::derivative_from_output(w.output.middleCols(first * o, count * o).array());
+            }
+        });
+        w.grad_bias.middleCols(first * o, count * o).noalias() = delta.colwise().sum();
+
+        if(l == 0){
+            w.grad_weights.middleCols(first * o, count * o).noalias() = x.transpose() * delta; // shared input: one GEMM for the whole range
+            continue; // no need to backpropagate past the first layer
+        }
+
+        const Matrix& input = ws[l - 1].output;
+        Matrix& grad_input = ws[l - 1].delta; // straight into the delta of the previous layer
+        for(int m = first; m < last; m++){
+            auto delta_m = w.delta.middleCols(m * o, o);
+            w.grad_weights.middleCols(m * o, o).noalias() = input.middleCols(m * i, i).transpose() * delta_m;
+            grad_input.middleCols(m * i, i).noalias() = delta_m * layer.weights.middleCols(m * o, o).transpose();
+        }
+    }
+
+    // SGD with momentum as BasicSGD, on the contiguous blocks of every member: v = mu*v + lr*(g + wd*w), w -= v
+    auto sgd = [](T* param, T* velocity, const T* grad, Eigen::Index n, T lr, T mu, T wd){
+        for(Eigen::Index j = 0; j < n; j++){
+            T v = mu * velocity[j] + lr * (grad[j] + wd * param[j]);
+            velocity[j] = v;
+            param[j] -= v;
+        }
+    };
+
+    for(int l = 0; l < num_layers; l++){
+        Layer& layer = layers[l];
+        const Workspace& w = ws[l];
+        Eigen::Index weights_size = (Eigen::Index)layer.input_size * layer.output_size;
+
+        for(int m = first; m < last; m++){
+            const EnsembleMember& member = members[m];
+            T lr = member.learning_rate, mu = member.momentum, wd = member.weight_decay;
+            Eigen::Index offset = m * weights_size;
+            sgd(layer.weights.data() + offset, layer.velocity_weights.data() + offset, w.grad_weights.data() + offset, weights_size, lr, mu, wd);
+
+            offset = m * layer.output_size; // no regularization for the bias
+            sgd(layer.bias.data() + offset, layer.velocity_bias.data() + offset, w.grad_bias.data() + offset, layer.output_size, lr, mu, T(0));
+        }
+    }
+};
+
+template <typename T>
+std::vector<std::vector<std::pair<double, double>>> BasicEnsemble<T>::fit(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y,
+        const Eigen::Ref<const Matrix>& x_test, const Eigen::Ref<const Matrix>& y_test, int epochs, const MinibatchOptions& batching, BasicLossFunction<T>* loss_function){
+    int num_members = members.size();
+    std::vector<std::vector<std::pair<double, double>>> loss_history(num_members);
+    BasicMinibatchIterator<T> minibatches(x, y, batching);
+    std::vector<double> train_losses(num_members);
+
+    for(int e = 0; e < epochs; e++){
+        std::fill(train_losses.begin(), train_losses.end(), 0.0);
+        double num_batches = 0; // the partial minibatch counts as a fraction of a full one, as in MLP::fit
+
+        minibatches.begin_epoch();
+        while(minibatches.next()){
+            std::vector<Workspace>& ws = minibatches.rows() == batching.batch_size ? full_batches : last_batch;
+            double weight = (double)minibatches.rows() / batching.batch_size;
+
+            prepare(ws, minibatches.rows());
+
+            auto x_batch = minibatches.x_batch();
+            auto y_batch = minibatches.y_batch();
+            if(pool){
+                pool->parallel_for(num_threads, [&](int g){ // contiguous groups of members, one per thread
+                    train_step(x_batch, y_batch, loss_function, ws, num_members * g / num_threads, num_members * (g + 1) / num_threads);
+                });
+            }else{
+                train_step(x_batch, y_batch, loss_function, ws, 0, num_members);
+            }
+
+            for(int m = 0; m < num_members; m++) train_losses[m] += weight * batch_losses[m];
+            num_batches += weight;
+        }
+
+        std::vector<double> test_losses = evaluate_members(x_test, y_test, loss_function);
+        for(int m = 0; m < num_members; m++){
+            loss_history[m].push_back(std::make_pair(num_batches > 0 ? train_losses[m] / num_batches : 0, test_losses[m]));
+        }
+    }
+
+    return loss_history;
+};
+
+template <typename T>
+void BasicEnsemble<T>::infer_members(const Eigen::Ref<const Matrix>& x, Matrix& out) const{
+    static thread_local InferenceScratch scratch; // one per thread, as in MLP::infer
+    infer_members(x, out, scratch);
+};
+
+template <typename T>
+void BasicEnsemble<T>::infer_members(const Eigen::Ref<const Matrix>& x, Matrix& out, InferenceScratch& scratch) const{
+    int num_members = members.size();
+    int last = layers.size() - 1;
+
+    const Matrix* input = nullptr;
+    for(int l = 0; l <= last; l++){
+        const Layer& layer = layers[l];
+        int i = layer.input_size, o = layer.output_size;
+        Matrix& output = l == last ? out : (l % 2 == 0 ? scratch.ping : scratch.pong);
+        output.resize(x.rows(), num_members * o);
+
+        if(l == 0){
+            output.noalias() = x * layer.weights;
+        }else{
+            for(int m = 0; m < num_members; m++){
+                output.middleCols(m * o, o).noalias() = input->middleCols(m * i, i) * layer.weights.middleCols(m * o, o);
+            }
+        }
+
+        with_activation<T>(layer.activation, [&](auto act){
+            using Act = typename decltype(act)::type;
+            output = Act::apply((output.rowwise() + layer.bias.row(0)).array()).matrix();
+        });
+        input = &output;
+    }
+};
+
+template <typename T>
+typename BasicEnsemble<T>::Matrix BasicEnsemble<T>::predict(const Eigen::Ref<const Matrix>& x) const{
+    Matrix outputs;
+    InferenceScratch scratch;
+    infer_members(x, outputs, scratch);
+
+    int k = get_output_size();
+    Matrix mean = outputs.leftCols(k);
+    for(int m = 1; m < members.size(); m++) mean += outputs.middleCols(m * k, k);
+    return mean / T(members.size());
+};
+
+template <typename T>
+std::vector<double> BasicEnsemble<T>::evaluate_members(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y, BasicLossFunction<T>* loss_function) const{
+    Matrix outputs;
+    InferenceScratch scratch;
+    infer_members(x, outputs, scratch);
+
+    int k = get_output_size();
+    std::vector<double> losses(members.size());
+    for(int m = 0; m < members.size(); m++) losses[m] = loss_function->loss(y, outputs.middleCols(m * k, k));
+    return losses;
+};
+
+template <typename T>
+double BasicEnsemble<T>::evaluate(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y, BasicLossFunction<T>* loss_function) const{
+    return loss_function->loss(y, predict(x));
+};
+
+template <typename T>
+typename BasicEnsemble<T>::Matrix BasicEnsemble<T>::get_weights(int layer, int member) const{
+    int o = layers[layer].output_size;
+    return layers[layer].weights.middleCols(member * o, o).transpose();
+};
+
+template <typename T>
+typename BasicEnsemble<T>::Matrix BasicEnsemble<T>::get_bias(int layer, int member) const{
+    int o = layers[layer].output_size;
+    return layers[layer].bias.middleCols(member * o, o).transpose();
+};
+
+template class BasicEnsemble<float>;
+template class BasicEnsemble<double>;
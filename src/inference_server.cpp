@@ -0,0 +1,575 @@
+#include "../includes/inference_server.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// ---------------------------------------- Sockets ----------------------------------------
+// whole reads and writes, false once the peer is gone
+static bool read_all(int fd, void* data, std::size_t size){
+    char* p = static_cast<char*>(data);
+    while(size > 0){
+        ssize_t n = recv(fd, p, size, 0);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void* data, std::size_t size){
+    const char* p = static_cast<const char*>(data);
+    while(size > 0){
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL); // a closed peer is an error, not a SIGPIPE
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static sockaddr_un unix_address(const std::string& path){
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path)) throw std::runtime_error("socket path too long: " + path);
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return addr;
+}
+
+static sockaddr_in loopback_address(int port){
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return addr;
+}
+
+std::string to_json(const ServerStats& stats){
+    std::ostringstream out;
+    out << "{\"requests\": " << stats.requests << ", \"batches\": " << stats.batches
+        << ", \"queue_depth\": " << stats.queue_depth << ", \"max_queue_depth\": " << stats.max_queue_depth
+        << ", \"p50_latency_us\": " << stats.p50_latency_us << ", \"p99_latency_us\": " << stats.p99_latency_us
+        << ", \"batch_sizes\": [";
+    for(std::size_t s = 0; s < stats.batch_sizes.size(); s++){
+        out << (s ? ", " : "") << stats.batch_sizes[s];
+    }
+    out << "]}";
+    return out.str();
+}
+
+// ---------------------------------------- InferenceServer ----------------------------------------
+template <typename T>
+struct BasicInferenceServer<T>::Waiter : Sink {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool done = false;
+    T* output = nullptr; // room for one answer
+    int output_size = 0;
+
+    void deliver(const T* answers, int rows) override {
+        // a waiting thread has a single request in flight, so rows is 1 and never more than one answer is copied
+        std::lock_guard<std::mutex> lock(mutex);
+        std::copy(answers, answers + std::min(rows, 1) * output_size, output);
+        done = true;
+        cv.notify_one();
+    }
+};
+
+template <typename T>
+struct BasicInferenceServer<T>::Connection : Sink {
+    int fd;
+    int output_size;
+    std::size_t max_pending; // bytes of answers waiting for the client at most
+    std::thread reader;
+    std::thread writer;
+    std::atomic<bool> done{false}; // the reader has returned
+    std::atomic<bool> flushed{false}; // the writer has returned
+    std::atomic<bool> closing{false}; // the server stops: the writer gives up on a client that does not read
+
+    std::mutex mutex; // answers come from the batching thread, stats from the reader, both only append
+    std::condition_variable changed;
+    std::vector<char> pending; // frames not handed to the socket yet
+    std::vector<char> writing; // frames being written by the writer, swapped with pending
+    int in_flight = 0; // requests submitted and not answered yet
+    bool reader_done = false;
+    bool broken = false;
+
+    Connection(int fd, int output_size, std::size_t max_pending) : fd(fd), output_size(output_size), max_pending(max_pending) {};
+
+    /**
+     * @brief Append a frame to the pending output, or drop the client if it is too far behind. Never blocks on the socket.
+     */
+    template <typename Fill>
+    void append(std::size_t bytes, Fill fill){
+        if(broken) return;
+        if(pending.size() + bytes > max_pending){ // the client does not read its answers: disconnect it
+            broken = true;
+            shutdown(fd, SHUT_RDWR); // wakes the reader and the writer up
+        }else{
+            std::size_t offset = pending.size();
+            pending.resize(offset + bytes);
+            fill(pending.data() + offset);
+        }
+        changed.notify_one();
+    }
+
+    void deliver(const T* answers, int rows) override { // one frame per answer, written by the writer thread
+        std::size_t row_bytes = output_size * sizeof(T);
+        std::lock_guard<std::mutex> lock(mutex);
+        in_flight -= rows;
+        append(rows * (sizeof(uint32_t) + row_bytes), [&](char* p){
+            for(int i = 0; i < rows; i++){
+                std::memcpy(p, &INFERENCE_PREDICT, sizeof(uint32_t));
+                std::memcpy(p + sizeof(uint32_t), answers + i * output_size, row_bytes);
+                p += sizeof(uint32_t) + row_bytes;
+            }
+        });
+        if(in_flight == 0) changed.notify_one();
+    }
+
+    void deliver_stats(const std::string& json){
+        uint32_t header[2] = {INFERENCE_STATS, (uint32_t)json.size()};
+        std::lock_guard<std::mutex> lock(mutex);
+        append(sizeof(header) + json.size(), [&](char* p){
+            std::memcpy(p, header, sizeof(header));
+            std::memcpy(p + sizeof(header), json.data(), json.size());
+        });
+    }
+
+    /**
+     * @brief Count a request about to be submitted, false if the client was dropped
+     */
+    bool begin_request(){
+        std::lock_guard<std::mutex> lock(mutex);
+        if(broken) return false;
+        in_flight++;
+        return true;
+    }
+
+    void cancel_request(){
+        std::lock_guard<std::mutex> lock(mutex);
+        in_flight--;
+        changed.notify_one();
+    }
+
+    void finish_reading(){
+        std::lock_guard<std::mutex> lock(mutex);
+        reader_done = true;
+        changed.notify_one();
+        done = true;
+    }
+
+    /**
+     * @brief Writer thread: hand the pending frames to the socket until the client is gone, or has stopped sending
+     * and every answer is written
+     */
+    void write_loop(){
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true){
+            changed.wait(lock, [&]{ return !pending.empty() || broken || (reader_done && in_flight == 0); });
+            if(broken || pending.empty()) break;
+
+            writing.swap(pending);
+            lock.unlock();
+            bool written = send_all(writing.data(), writing.size());
+            writing.clear();
+            lock.lock();
+            if(!written) broken = true;
+        }
+        flushed = true;
+    }
+
+    /**
+     * @brief Whole write, the socket has a send timeout so that stop is noticed while the client does not read
+     */
+    bool send_all(const char* p, std::size_t size){
+        while(size > 0){
+            ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+            if(n < 0 && errno == EINTR) continue;
+            if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && !closing) continue;
+            if(n <= 0) return false;
+            p += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    ~Connection(){
+        close(fd);
+    }
+};
+
+template <typename T>
+BasicInferenceServer<T>::BasicInferenceServer(const BasicMLP<T>& model, const BatchingOptions& options)
+    : model(model), options(options), input_size(model.get_input_size()), output_size(model.get_output_size()) {
+    if(options.max_batch_size <= 0 || options.queue_capacity <= 0 || options.latency_window <= 0 || options.max_unread_answers <= 0){
+        throw std::invalid_argument("BasicInferenceServer: max_batch_size, queue_capacity, latency_window and max_unread_answers must be positive");
+    }
+
+    queue_rows.resize(options.queue_capacity, input_size);
+    queue.resize(options.queue_capacity);
+    stats.batch_sizes.assign(options.max_batch_size + 1, 0);
+    latencies.resize(options.latency_window);
+
+    batcher = std::thread(&BasicInferenceServer::batch_loop, this);
+}
+
+template <typename T>
+bool BasicInferenceServer<T>::submit(const RowView& x, std::shared_ptr<Sink> sink){
+    std::unique_lock<std::mutex> lock(mutex);
+    not_full.wait(lock, [&]{ return size < options.queue_capacity || stopping; });
+    if(stopping) return false;
+
+    int slot = (head + size) % options.queue_capacity;
+    queue_rows.row(slot) = x;
+    queue[slot] = {std::move(sink), Clock::now()};
+    size++;
+    max_depth = std::max(max_depth, size);
+
+    // the batching thread waits for a first request, then for a full batch or the deadline
+    if(size == 1 || size == options.max_batch_size) not_empty.notify_one();
+    return true;
+}
+
+template <typename T>
+void BasicInferenceServer<T>::batch_loop(){
+    int max_batch_size = options.max_batch_size;
+    Matrix x(max_batch_size, input_size);
+    Matrix y;
+    Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> answers(max_batch_size, output_size);
+    BasicInferenceScratch<T> scratch;
+    std::vector<Request> batch(max_batch_size);
+    std::vector<float> batch_latencies(max_batch_size);
+
+    while(true){
+        int rows;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            not_empty.wait(lock, [&]{ return size > 0 || stopping; });
+            if(size == 0) return; // stopping, every request is answered
+
+            // the batch leaves once full or once its oldest request has waited max_delay
+            not_empty.wait_until(lock, queue[head].arrival + options.max_delay, [&]{ return size >= max_batch_size || stopping; });
+
+            rows = std::min(size, max_batch_size);
+            for(int i = 0; i < rows; i++){
+                int slot = (head + i) % options.queue_capacity;
+                x.row(i) = queue_rows.row(slot);
+                batch[i] = std::move(queue[slot]);
+            }
+            head = (head + rows) % options.queue_capacity;
+            size -= rows;
+        }
+        not_full.notify_all();
+
+        model.infer(x.topRows(rows), y, scratch);
+        answers.topRows(rows) = y;
+
+        // the sinks only copy the answers (a connection's writer thread does the socket I/O), outside stats_mutex
+        for(int i = 0; i < rows;){ // the consecutive requests of a connection are answered in one frame
+            int end = i + 1;
+            while(end < rows && batch[end].sink == batch[i].sink) end++;
+            batch[i].sink->deliver(answers.row(i).data(), end - i);
+
+            auto now = Clock::now();
+            for(; i < end; i++){
+                batch_latencies[i] = std::chrono::duration<float, std::micro>(now - batch[i].arrival).count();
+                batch[i].sink.reset(); // a closed connection goes away with its last request
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        for(int i = 0; i < rows; i++) latencies[num_latencies++ % latencies.size()] = batch_latencies[i];
+        stats.requests += rows;
+        stats.batches++;
+        stats.batch_sizes[rows]++;
+    }
+}
+
+template <typename T>
+void BasicInferenceServer<T>::predict(const RowView& x, Eigen::Ref<RowVector> y){
+    static thread_local std::shared_ptr<Waiter> waiter = std::make_shared<Waiter>(); // one request in flight per thread
+    waiter->done = false;
+    waiter->output = y.data();
+    waiter->output_size = output_size;
+
+    if(!submit(x, waiter)) throw std::runtime_error("BasicInferenceServer::predict: the server is stopping");
+
+    std::unique_lock<std::mutex> lock(waiter->mutex);
+    waiter->cv.wait(lock, [&]{ return waiter->done; });
+}
+
+template <typename T>
+ServerStats BasicInferenceServer<T>::get_stats() const{
+    ServerStats snapshot;
+    std::vector<float> window;
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        snapshot = stats;
+        window.assign(latencies.begin(), latencies.begin() + std::min<long>(num_latencies, latencies.size()));
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        snapshot.queue_depth = size;
+        snapshot.max_queue_depth = max_depth;
+    }
+
+    auto percentile = [&](double q){
+        auto nth = window.begin() + std::min<long>(window.size() - 1, q * window.size());
+        std::nth_element(window.begin(), nth, window.end());
+        return (double)*nth;
+    };
+    if(!window.empty()){
+        snapshot.p50_latency_us = percentile(0.5);
+        snapshot.p99_latency_us = percentile(0.99);
+    }
+    return snapshot;
+}
+
+template <typename T>
+void BasicInferenceServer<T>::listen_unix(const std::string& path){
+    sockaddr_un addr = unix_address(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) throw std::runtime_error("BasicInferenceServer: cannot create a socket");
+
+    unlink(path.c_str()); // left by a previous server
+    if(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0){
+        close(fd);
+        throw std::runtime_error("BasicInferenceServer: cannot listen on " + path);
+    }
+
+    unix_path = path;
+    listen_fds.push_back(fd);
+    acceptors.emplace_back(&BasicInferenceServer::accept_loop, this, fd);
+}
+
+template <typename T>
+void BasicInferenceServer<T>::listen_tcp(int port){
+    sockaddr_in addr = loopback_address(port);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0) throw std::runtime_error("BasicInferenceServer: cannot create a socket");
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    socklen_t length = sizeof(addr);
+    if(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0
+            || getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &length) != 0){
+        close(fd);
+        throw std::runtime_error("BasicInferenceServer: cannot listen on port " + std::to_string(port));
+    }
+
+    tcp_port = ntohs(addr.sin_port);
+    listen_fds.push_back(fd);
+    acceptors.emplace_back(&BasicInferenceServer::accept_loop, this, fd);
+}
+
+template <typename T>
+void BasicInferenceServer<T>::accept_loop(int listen_fd){
+    InferenceServerHello hello = {{'M', 'L', 'P', 'S'}, INFERENCE_PROTOCOL_VERSION, sizeof(T), (uint32_t)input_size, (uint32_t)output_size};
+
+    while(true){
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if(fd < 0 && errno == EINTR) continue;
+        if(fd < 0) return; // shut down by stop
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // small frames must not wait (fails harmlessly on Unix sockets)
+        timeval timeout = {0, 100000}; // a blocked send returns every 100 ms, so that the writer sees stop
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        std::size_t frame_bytes = sizeof(uint32_t) + output_size * sizeof(T);
+        auto connection = std::make_shared<Connection>(fd, output_size, options.max_unread_answers * frame_bytes);
+        if(!write_all(fd, &hello, sizeof(hello))) continue;
+
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        std::erase_if(connections, [](const std::shared_ptr<Connection>& c){ // reap the closed connections
+            if(!c->done || !c->flushed) return false;
+            c->reader.join();
+            c->writer.join();
+            return true;
+        });
+        connection->writer = std::thread(&Connection::write_loop, connection.get());
+        connection->reader = std::thread(&BasicInferenceServer::read_loop, this, connection);
+        connections.push_back(std::move(connection));
+    }
+}
+
+template <typename T>
+void BasicInferenceServer<T>::read_loop(std::shared_ptr<Connection> connection){
+    // requests are read in chunks and parsed from the buffer, a pipelining client costs one recv per chunk
+    std::size_t frame_bytes = sizeof(uint32_t) + input_size * sizeof(T);
+    std::vector<char> buffer(std::max<std::size_t>(65536, 2 * frame_bytes));
+    std::size_t begin = 0, end = 0;
+    RowVector row(input_size);
+
+    while(true){
+        while(end - begin >= sizeof(uint32_t)){
+            uint32_t op;
+            std::memcpy(&op, buffer.data() + begin, sizeof(op));
+            if(op == INFERENCE_PREDICT){
+                if(end - begin < frame_bytes) break;
+                std::memcpy(row.data(), buffer.data() + begin + sizeof(op), input_size * sizeof(T));
+                begin += frame_bytes;
+                if(!connection->begin_request()) break; // dropped for not reading its answers
+                if(!submit(row, connection)){
+                    connection->cancel_request();
+                    connection->finish_reading();
+                    return;
+                }
+            }else if(op == INFERENCE_STATS){
+                begin += sizeof(op);
+                connection->deliver_stats(to_json(get_stats()));
+            }else{
+                connection->finish_reading(); // not the protocol, drop the client
+                return;
+            }
+        }
+
+        std::copy(buffer.begin() + begin, buffer.begin() + end, buffer.begin());
+        end -= begin;
+        begin = 0;
+        ssize_t n = recv(connection->fd, buffer.data() + end, buffer.size() - end, 0);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) break;
+        end += n;
+    }
+    connection->finish_reading();
+}
+
+template <typename T>
+void BasicInferenceServer<T>::stop(){
+    // no new connection
+    for(int fd : listen_fds) shutdown(fd, SHUT_RDWR); // wakes accept up
+    for(std::thread& acceptor : acceptors) acceptor.join();
+    for(int fd : listen_fds) close(fd);
+    listen_fds.clear();
+    acceptors.clear();
+    if(!unix_path.empty()) unlink(unix_path.c_str());
+    unix_path.clear();
+
+    // no new request, the queued ones are still answered
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        for(auto& connection : connections) shutdown(connection->fd, SHUT_RD); // wakes the readers up
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    not_empty.notify_all();
+    not_full.notify_all();
+    if(batcher.joinable()) batcher.join();
+
+    // the writers flush the answers, giving up on the clients that do not read them
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    for(auto& connection : connections){
+        connection->reader.join();
+        connection->closing = true;
+        connection->writer.join();
+    }
+    connections.clear();
+}
+
+template <typename T>
+BasicInferenceServer<T>::~BasicInferenceServer(){
+    stop();
+}
+
+template class BasicInferenceServer<float>;
+template class BasicInferenceServer<double>;
+
+// ---------------------------------------- InferenceClient ----------------------------------------
+template <typename T>
+BasicInferenceClient<T>::BasicInferenceClient(const std::string& path){
+    sockaddr_un addr = unix_address(path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0){
+        if(fd >= 0) close(fd);
+        throw std::runtime_error("BasicInferenceClient: cannot connect to " + path);
+    }
+    handshake();
+}
+
+template <typename T>
+BasicInferenceClient<T>::BasicInferenceClient(int port){
+    sockaddr_in addr = loopback_address(port);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0){
+        if(fd >= 0) close(fd);
+        throw std::runtime_error("BasicInferenceClient: cannot connect to port " + std::to_string(port));
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    handshake();
+}
+
+template <typename T>
+void BasicInferenceClient<T>::handshake(){
+    InferenceServerHello hello;
+    bool valid = read_all(fd, &hello, sizeof(hello)) && std::memcmp(hello.magic, "MLPS", 4) == 0
+            && hello.version == INFERENCE_PROTOCOL_VERSION && hello.scalar_size == sizeof(T);
+    if(!valid){
+        close(fd);
+        throw std::runtime_error("BasicInferenceClient: not an inference server of this scalar type");
+    }
+
+    input_size = hello.input_size;
+    output_size = hello.output_size;
+    frame.resize(sizeof(uint32_t) + input_size * sizeof(T));
+}
+
+template <typename T>
+void BasicInferenceClient<T>::send(const RowView& x){
+    std::memcpy(frame.data(), &INFERENCE_PREDICT, sizeof(uint32_t));
+    char* p = frame.data() + sizeof(uint32_t);
+    for(int i = 0; i < input_size; i++, p += sizeof(T)){
+        T value = x(i);
+        std::memcpy(p, &value, sizeof(T));
+    }
+    if(!write_all(fd, frame.data(), frame.size())) throw std::runtime_error("BasicInferenceClient: connection lost");
+}
+
+template <typename T>
+void BasicInferenceClient<T>::receive(Eigen::Ref<RowVector> y){
+    uint32_t op;
+    if(!read_all(fd, &op, sizeof(op)) || op != INFERENCE_PREDICT || !read_all(fd, y.data(), output_size * sizeof(T))){
+        throw std::runtime_error("BasicInferenceClient: connection lost");
+    }
+}
+
+template <typename T>
+void BasicInferenceClient<T>::predict(const RowView& x, Eigen::Ref<RowVector> y){
+    send(x);
+    receive(y);
+}
+
+template <typename T>
+std::string BasicInferenceClient<T>::get_stats(){
+    uint32_t header[2] = {INFERENCE_STATS, 0};
+    if(!write_all(fd, &header[0], sizeof(uint32_t)) || !read_all(fd, header, sizeof(header)) || header[0] != INFERENCE_STATS){
+        throw std::runtime_error("BasicInferenceClient: connection lost");
+    }
+
+    std::string json(header[1], '\0');
+    if(!read_all(fd, json.data(), json.size())) throw std::runtime_error("BasicInferenceClient: connection lost");
+    return json;
+}
+
+template <typename T>
+BasicInferenceClient<T>::~BasicInferenceClient(){
+    close(fd);
+}
+
+template class BasicInferenceClient<float>;
+template class BasicInferenceClient<double>;
@@ -2,52 +2,400 @@
 #include <memory>
 #include "../includes/activation_function.hpp"
 #include "../includes/loss_function.hpp"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <numeric>
+#include <stdexcept>
+
+// ---------------------------------------- LayerWorkspace ----------------------------------------
+template <typename T>
+void BasicLayerWorkspace<T>::resize(int batch_size, int input_size, int output_size, bool input_gradient){
+    output.resize(batch_size, output_size);
+    delta.resize(batch_size, output_size);
+    grad_input.resize(input_gradient ? batch_size : 0, input_size);
+    grad_weights.resize(output_size, input_size);
+    grad_bias.resize(output_size, 1);
+};
+
+template <typename T>
+void BasicLayerWorkspace<T>::bind_input(const Eigen::Ref<const Matrix>& x){
+    new (&input) InputView(x.data(), x.rows(), x.cols(), Eigen::OuterStride<>(x.outerStride())); // rebind the map, no copy
+    sparse = false;
+};
+
+template <typename T>
+void BasicLayerWorkspace<T>::bind_input(const Eigen::Ref<const SparseMatrix>& x){
+    new (&sparse_input) SparseInputView(x.rows(), x.cols(), x.nonZeros(), x.outerIndexPtr(), x.innerIndexPtr(), x.valuePtr(), x.innerNonZeroPtr());
+    sparse = true;
+};
+
+template struct BasicLayerWorkspace<float>;
+template struct BasicLayerWorkspace<double>;
+
+
+// ---------------------------------------- FCLayer ----------------------------------------
+template <typename T>
+BasicFCLayer<T>::BasicFCLayer(int input_size, int output_size, std::unique_ptr<BasicActivationFunction<T>> func,
+            double min_val, double max_val, double bias_max_val, double bias_min_val){
 
-FCLayer::FCLayer(int input_size, int output_size, std::unique_ptr<ActivationFunction> func, 
-            float min_val, float max_val, float bias_max_val, float bias_min_val){
-    
     activation = std::move(func);
     this->input_size = input_size;
     this->output_size = output_size;
 
+    init_weights(min_val, max_val, bias_max_val, bias_min_val);
+};
+
+template <typename T>
+void BasicFCLayer<T>::init_weights(double min_val, double max_val, double bias_max_val, double bias_min_val){
     // Uniform random initialization in the range [min_val, max_val] both for weights and bias
-    weights = min_val + (Eigen::MatrixXd::Random(output_size, input_size).array() + 1.0) * (max_val - min_val) / 2.0;
-    bias =  bias_min_val + (Eigen::MatrixXd::Random(output_size, 1).array() + 1.0) * (bias_max_val - bias_min_val) / 2.0; 
+    weights = (min_val + (Eigen::MatrixXd::Random(output_size, input_size).array() + 1.0) * (max_val - min_val) / 2.0).template cast<T>();
+    bias = (bias_min_val + (Eigen::MatrixXd::Random(output_size, 1).array() + 1.0) * (bias_max_val - bias_min_val) / 2.0).template cast<T>();
+
+    if(master){
+        master.reset();
+        enable_master_weights();
+    }
+    set_mask(Matrix());
+};
+
+template <typename T>
+void BasicFCLayer<T>::enable_master_weights(){
+    master = std::make_unique<MasterCopy>();
+    master->weights = weights.template cast<double>();
+    master->bias = bias.template cast<double>();
+};
+
+template <typename T>
+void BasicFCLayer<T>::set_parameters(const Eigen::Ref<const Matrix>& weights, const Eigen::Ref<const Matrix>& bias){
+    if(weights.rows() != output_size || weights.cols() != input_size || bias.rows() != output_size || bias.cols() != 1){
+        throw std::invalid_argument("BasicFCLayer::set_parameters: shape mismatch");
+    }
+
+    this->weights = weights;
+    this->bias = bias;
+    if(master){
+        master->weights = this->weights.template cast<double>();
+        master->bias = this->bias.template cast<double>();
+    }
+    apply_mask();
+};
 
-    prev_weights_update = Eigen::MatrixXd::Zero(output_size, input_size);
-    prev_bias_update = Eigen::MatrixXd::Zero(output_size, 1);
+template <typename T>
+const typename BasicFCLayer<T>::Matrix& BasicFCLayer<T>::forward(const Eigen::Ref<const Matrix>& x, Workspace& ws){
+    ws.bind_input(x);
+    {
+        MLP_PROFILE_SCOPE(profiler, profile_index, Phase::Forward, (2.0 * input_size + 1) * output_size * x.rows());
+        product(x, ws.preactivation, weights); // X*W^T
+        ws.preactivation.rowwise() += bias.col(0).transpose(); // + b^T
+    }
+    {
+        MLP_PROFILE_SCOPE(profiler, profile_index, Phase::Activation, double(output_size) * x.rows());
+        activation->activate_into(ws.preactivation, ws.output); // activation(X*W^T + b^T)
+    }
+    return ws.output;
 };
 
-void FCLayer::init_weights(float min_val, float max_val, float bias_max_val, float bias_min_val){
-    weights = min_val + (Eigen::MatrixXd::Random(output_size, input_size).array() + 1.0) * (max_val - min_val) / 2.0;
-    bias =  bias_min_val + (Eigen::MatrixXd::Random(output_size, 1).array() + 1.0) * (bias_max_val - bias_min_val) / 2.0; 
+template <typename T>
+const typename BasicFCLayer<T>::Matrix& BasicFCLayer<T>::forward(const Eigen::Ref<const SparseMatrix>& x, Workspace& ws){
+    ws.bind_input(x);
+    {
+        MLP_PROFILE_SCOPE(profiler, profile_index, Phase::Forward, (2.0 * x.nonZeros() + x.rows()) * output_size);
+        ws.preactivation.noalias() = x * weights.transpose(); // sparse x dense: every non-zero scales a column of W
+        ws.preactivation.rowwise() += bias.col(0).transpose();
+    }
+    {
+        MLP_PROFILE_SCOPE(profiler, profile_index, Phase::Activation, double(output_size) * x.rows());
+        activation->activate_into(ws.preactivation, ws.output);
+    }
+    return ws.output;
 };
 
-Eigen::MatrixXd FCLayer::forward(const Eigen::MatrixXd& x){
-    input = x;
-    output = x * weights.transpose() + bias.transpose().replicate(x.rows(), 1); // X*W^T + b^T
-    return activation->activate(output); // activation(X*W^T + b^T)
+template <typename T>
+void BasicFCLayer<T>::infer(const Eigen::Ref<const Matrix>& x, Matrix& out) const{
+    infer(x, out, weights, bias);
 };
 
-Eigen::MatrixXd FCLayer::backward(const Eigen::MatrixXd& grad){
-    Eigen::MatrixXd tmp = activation->derivative(output);
-    Eigen::MatrixXd delta = grad.cwiseProduct(activation->derivative(output)); // grad * activation'(output)
+template <typename T>
+void BasicFCLayer<T>::infer(const Eigen::Ref<const SparseMatrix>& x, Matrix& out) const{
+    infer(x, out, weights, bias);
+};
 
-    grad_weights = delta.transpose() * input; // delta^T * X
-    grad_bias = delta.colwise().sum();
+template <typename T>
+void BasicFCLayer<T>::infer(const Eigen::Ref<const Matrix>& x, Matrix& out, const Matrix& weights, const Matrix& bias) const{
+    {
+        MLP_PROFILE_SCOPE(profiler, profile_index, Phase::Forward, (2.0 * input_size + 1) * output_size * x.rows());
+        product(x, out, weights); // X*W^T
+        out.rowwise() += bias.col(0).transpose(); // + b^T
+    }
+    MLP_PROFILE_SCOPE(profiler, profile_index, Phase::Activation, double(output_size) * x.rows());
+    activation->activate_into(out, out);
+};
 
-    return delta * weights; // error to backpropagate
+template <typename T>
+void BasicFCLayer<T>::infer(const Eigen::Ref<const SparseMatrix>& x, Matrix& out, const Matrix& weights, const Matrix& bias) const{
+    {
+        MLP_PROFILE_SCOPE(profiler, profile_index, Phase::Forward, (2.0 * x.nonZeros() + x.rows()) * output_size);
+        out.noalias() = x * weights.transpose();
+        out.rowwise() += bias.col(0).transpose();
+    }
+    MLP_PROFILE_SCOPE(profiler, profile_index, Phase::Activation, double(output_size) * x.rows());
+    activation->activate_into(out, out);
 };
 
-void FCLayer::update(double learning_rate, double weight_decay, double momentum){
-    Eigen::MatrixXd weights_update = learning_rate * grad_weights + momentum * prev_weights_update; // lr*grad + momentum*prev_update
-    Eigen::MatrixXd bias_update = learning_rate * grad_bias.transpose() + momentum * prev_bias_update;
+template <typename T>
+void BasicFCLayer<T>::product(const Eigen::Ref<const Matrix>& x, Matrix& out, const Matrix& weights) const{
+    bool sparse = &weights == &this->weights && has_sparse_weights()
+            && (x.rows() >= SPARSE_MIN_ROWS || sparse_weights.nonZeros() <= SPARSE_ROW_MAX_DENSITY * weights.size());
+    if(sparse) out.noalias() = x * sparse_weights.transpose(); // every row of x meets the kept weights only
+    else out.noalias() = x * weights.transpose();
+};
 
+template <typename T>
+void BasicFCLayer<T>::weight_gradient(Workspace& ws) const{
+    if(ws.sparse) ws.grad_weights.noalias() = ws.delta.transpose() * ws.sparse_input; // O(nnz * output_size) products
+    else ws.grad_weights.noalias() = ws.delta.transpose() * ws.input; // delta^T * X
+};
+
+template <typename T>
+const typename BasicFCLayer<T>::Matrix& BasicFCLayer<T>::backward(const Eigen::Ref<const Matrix>& grad, Workspace& ws, bool propagate){
+    MLP_PROFILE_SCOPE(profiler, profile_index, Phase::Backward, ((propagate ? 4.0 : 2.0) * input_size + 2) * output_size * grad.rows());
+    activation->derivative_into(ws.preactivation, ws.delta);
+    ws.delta.array() *= grad.array(); // grad * activation'(output)
+    return backward_delta(ws, propagate);
+};
+
+template <typename T>
+const typename BasicFCLayer<T>::Matrix& BasicFCLayer<T>::backward_from_delta(Workspace& ws, bool propagate){
+    MLP_PROFILE_SCOPE(profiler, profile_index, Phase::Backward, ((propagate ? 4.0 : 2.0) * input_size + 1) * output_size * ws.delta.rows());
+    return backward_delta(ws, propagate);
+};
 
-    weights -= weights_update - weight_decay * weights; // w = w - lr*grad - wd*w
-    bias -= bias_update; // do not apply regularization for the bias
+template <typename T>
+const typename BasicFCLayer<T>::Matrix& BasicFCLayer<T>::backward_delta(Workspace& ws, bool propagate) const{
+    weight_gradient(ws); // delta^T * X
+    ws.grad_bias.noalias() = ws.delta.colwise().sum().transpose();
+
+    if(propagate){ // error to backpropagate
+        if(has_sparse_weights() && ws.delta.rows() >= SPARSE_MIN_ROWS) ws.grad_input.noalias() = ws.delta * sparse_weights;
+        else ws.grad_input.noalias() = ws.delta * weights;
+    }
+    return ws.grad_input;
+};
+
+template <typename T>
+void BasicFCLayer<T>::update(const Workspace& ws, BasicOptimizer<T>& optimizer, int slot){
+    MLP_PROFILE_SCOPE(profiler, profile_index, Phase::Update, 6.0 * output_size * (input_size + 1));
+
+    if(master){ // the rule is applied to the double precision copy, the working parameters are rounded from it
+        optimizer.update_master(slot, master->weights, ws.grad_weights, true);
+        optimizer.update_master(slot + 1, master->bias, ws.grad_bias, false);
+
+        weights = master->weights.template cast<T>();
+        bias = master->bias.template cast<T>();
+    }else{
+        optimizer.update(slot, weights, ws.grad_weights, true);
+        optimizer.update(slot + 1, bias, ws.grad_bias, false); // do not apply regularization for the bias
+    }
+    apply_mask(); // the gradient of a pruned weight is not zero, the step moved it
+};
+
+template <typename T>
+void BasicFCLayer<T>::set_mask(Matrix mask){
+    this->mask = std::move(mask);
+    sparse_weights = SparseMatrix();
+    if(this->mask.size() && get_density() <= SPARSE_MAX_DENSITY){
+        sparse_weights = this->mask.sparseView(); // the pattern of the kept weights, their values are copied by apply_mask
+        sparse_weights.makeCompressed();
+    }
+    apply_mask();
+};
+
+template <typename T>
+void BasicFCLayer<T>::apply_mask(){
+    if(mask.size() == 0) return;
+
+    weights.array() *= mask.array();
+    if(master) master->weights.array() *= mask.array().template cast<double>();
+    for(int i = 0; i < sparse_weights.outerSize(); i++){ // O(nnz): the pattern does not change
+        for(typename SparseMatrix::InnerIterator it(sparse_weights, i); it; ++it) it.valueRef() = weights(i, it.col());
+    }
+};
+
+template <typename T>
+void BasicFCLayer<T>::prune_magnitude(double sparsity){
+    if(!(sparsity >= 0 && sparsity < 1)) throw std::invalid_argument("BasicFCLayer::prune_magnitude: sparsity must be in [0, 1)");
+
+    // the pruned weights are the first ones of a partial ordering by magnitude, exactly round(sparsity * size) of them
+    std::vector<int> order(weights.size());
+    std::iota(order.begin(), order.end(), 0);
+    long pruned = std::lround(sparsity * weights.size());
+    const T* w = weights.data();
+    std::nth_element(order.begin(), order.begin() + pruned, order.end(), [w](int a, int b){ return std::abs(w[a]) < std::abs(w[b]); });
+
+    Matrix mask = Matrix::Ones(output_size, input_size);
+    for(long k = 0; k < pruned; k++) mask.data()[order[k]] = 0;
+    set_mask(std::move(mask));
+};
+
+// indices kept by a structured pruning: not empty, increasing and below size
+static void check_kept(const std::vector<int>& kept, int size, const char* what){
+    bool valid = !kept.empty() && kept.front() >= 0 && kept.back() < size && std::is_sorted(kept.begin(), kept.end())
+            && std::adjacent_find(kept.begin(), kept.end()) == kept.end();
+    if(!valid) throw std::invalid_argument(std::string("BasicFCLayer::") + what + ": indices must be increasing and in range");
+}
+
+template <typename T>
+void BasicFCLayer<T>::keep_outputs(const std::vector<int>& neurons){
+    check_kept(neurons, output_size, "keep_outputs");
+
+    weights = weights(neurons, Eigen::all).eval();
+    bias = bias(neurons, Eigen::all).eval();
+    if(master){
+        master->weights = master->weights(neurons, Eigen::all).eval();
+        master->bias = master->bias(neurons, Eigen::all).eval();
+    }
+    output_size = neurons.size();
+    if(mask.size()) set_mask(mask(neurons, Eigen::all));
+};
+
+template <typename T>
+void BasicFCLayer<T>::keep_inputs(const std::vector<int>& inputs){
+    check_kept(inputs, input_size, "keep_inputs");
+
+    weights = weights(Eigen::all, inputs).eval();
+    if(master) master->weights = master->weights(Eigen::all, inputs).eval();
+    input_size = inputs.size();
+    if(mask.size()) set_mask(mask(Eigen::all, inputs));
+};
+
+template class BasicFCLayer<float>;
+template class BasicFCLayer<double>;
+
+
+// ---------------------------------------- FusedFCLayer ----------------------------------------
+template <typename Act>
+FusedFCLayer<Act>::FusedFCLayer(int input_size, int output_size, std::unique_ptr<BasicActivationFunction<T>> func,
+            double min_val, double max_val, double bias_max_val, double bias_min_val)
+    : BasicFCLayer<T>(input_size, output_size, std::move(func), min_val, max_val, bias_max_val, bias_min_val) {};
+
+template <typename Act>
+void FusedFCLayer<Act>::activate(Matrix& z, Workspace& ws) const{
+    if constexpr (DerivativeFromInput<Act>){
+        z.rowwise() += this->bias.col(0).transpose();
+        ws.output = Act::apply(z.array()).matrix();
+    }else{
+        ws.output = Act::apply((ws.output.rowwise() + this->bias.col(0).transpose()).array()).matrix();
+    }
+};
+
+template <typename Act>
+const typename FusedFCLayer<Act>::Matrix& FusedFCLayer<Act>::forward(const Eigen::Ref<const Matrix>& x, Workspace& ws){
+    ws.bind_input(x);
+    Matrix& z = DerivativeFromInput<Act> ? ws.preactivation : ws.output; // kept for the backward when f'(z) needs z
+    {
+        MLP_PROFILE_SCOPE(this->profiler, this->profile_index, Phase::Forward, 2.0 * this->input_size * this->output_size * x.rows());
+        this->product(x, z, this->weights); // GEMM straight into the output buffer
+    }
+    {
+        // bias add and activation are applied in the same elementwise pass
+        MLP_PROFILE_SCOPE(this->profiler, this->profile_index, Phase::Activation, 2.0 * this->output_size * x.rows());
+        activate(z, ws);
+    }
+    return ws.output;
+};
+
+template <typename Act>
+const typename FusedFCLayer<Act>::Matrix& FusedFCLayer<Act>::forward(const Eigen::Ref<const SparseMatrix>& x, Workspace& ws){
+    ws.bind_input(x);
+    Matrix& z = DerivativeFromInput<Act> ? ws.preactivation : ws.output;
+    {
+        MLP_PROFILE_SCOPE(this->profiler, this->profile_index, Phase::Forward, 2.0 * x.nonZeros() * this->output_size);
+        z.noalias() = x * this->weights.transpose(); // sparse x dense straight into the output buffer
+    }
+    {
+        MLP_PROFILE_SCOPE(this->profiler, this->profile_index, Phase::Activation, 2.0 * this->output_size * x.rows());
+        activate(z, ws);
+    }
+    return ws.output;
+};
+
+template <typename Act>
+void FusedFCLayer<Act>::infer(const Eigen::Ref<const Matrix>& x, Matrix& out, const Matrix& weights, const Matrix& bias) const{
+    {
+        MLP_PROFILE_SCOPE(this->profiler, this->profile_index, Phase::Forward, 2.0 * this->input_size * this->output_size * x.rows());
+        this->product(x, out, weights);
+    }
+    MLP_PROFILE_SCOPE(this->profiler, this->profile_index, Phase::Activation, 2.0 * this->output_size * x.rows());
+    out = Act::apply((out.rowwise() + bias.col(0).transpose()).array()).matrix();
+};
+
+template <typename Act>
+void FusedFCLayer<Act>::infer(const Eigen::Ref<const SparseMatrix>& x, Matrix& out, const Matrix& weights, const Matrix& bias) const{
+    {
+        MLP_PROFILE_SCOPE(this->profiler, this->profile_index, Phase::Forward, 2.0 * x.nonZeros() * this->output_size);
+        out.noalias() = x * weights.transpose();
+    }
+    MLP_PROFILE_SCOPE(this->profiler, this->profile_index, Phase::Activation, 2.0 * this->output_size * x.rows());
+    out = Act::apply((out.rowwise() + bias.col(0).transpose()).array()).matrix();
+};
+
+template <typename Act>
+const typename FusedFCLayer<Act>::Matrix& FusedFCLayer<Act>::backward(const Eigen::Ref<const Matrix>& grad, Workspace& ws, bool propagate){
+    MLP_PROFILE_SCOPE(this->profiler, this->profile_index, Phase::Backward, ((propagate ? 4.0 : 2.0) * this->input_size + 2) * this->output_size * grad.rows());
+    if constexpr (std::is_same_v<Act, BasicLinear<T>>){
+        ws.delta = grad; // f'(z) = 1
+    }else if constexpr (DerivativeFromInput<Act>){
+        ws.delta = (grad.array() * Act::derivative_from_input(ws.preactivation.array())).matrix();
+    }else{
+        ws.delta = (grad.array() * Act::derivative_from_output(ws.output.array())).matrix(); // grad * f'(z), f'(z) computed from f(z)
+    }
+    return this->backward_delta(ws, propagate);
+};
+
+template class FusedFCLayer<BasicLinear<float>>;
+template class FusedFCLayer<BasicReLU<float>>;
+template class FusedFCLayer<BasicSigmoid<float>>;
+template class FusedFCLayer<BasicTanh<float>>;
+template class FusedFCLayer<BasicLeakyReLU<float>>;
+template class FusedFCLayer<BasicGELU<float>>;
+template class FusedFCLayer<BasicSiLU<float>>;
+template class FusedFCLayer<BasicFastSigmoid<float>>;
+template class FusedFCLayer<BasicFastTanh<float>>;
+template class FusedFCLayer<BasicFastGELU<float>>;
+template class FusedFCLayer<BasicFastSiLU<float>>;
+template class FusedFCLayer<BasicLinear<double>>;
+template class FusedFCLayer<BasicReLU<double>>;
+template class FusedFCLayer<BasicSigmoid<double>>;
+template class FusedFCLayer<BasicTanh<double>>;
+template class FusedFCLayer<BasicLeakyReLU<double>>;
+template class FusedFCLayer<BasicGELU<double>>;
+template class FusedFCLayer<BasicSiLU<double>>;
+template class FusedFCLayer<BasicFastSigmoid<double>>;
+template class FusedFCLayer<BasicFastTanh<double>>;
+template class FusedFCLayer<BasicFastGELU<double>>;
+template class FusedFCLayer<BasicFastSiLU<double>>;
+
+template <typename T>
+std::unique_ptr<BasicFCLayer<T>> make_fc_layer(int input_size, int output_size, std::unique_ptr<BasicActivationFunction<T>> func){
+    // exact type match: a user subclass overriding activate() must keep going through the virtual path
+    switch(activation_type(*func)){
+        case ActivationType::Linear: return std::make_unique<FusedFCLayer<BasicLinear<T>>>(input_size, output_size, std::move(func));
+        case ActivationType::ReLU: return std::make_unique<FusedFCLayer<BasicReLU<T>>>(input_size, output_size, std::move(func));
+        case ActivationType::Sigmoid: return std::make_unique<FusedFCLayer<BasicSigmoid<T>>>(input_size, output_size, std::move(func));
+        case ActivationType::Tanh: return std::make_unique<FusedFCLayer<BasicTanh<T>>>(input_size, output_size, std::move(func));
+        case ActivationType::LeakyReLU: return std::make_unique<FusedFCLayer<BasicLeakyReLU<T>>>(input_size, output_size, std::move(func));
+        case ActivationType::GELU: return std::make_unique<FusedFCLayer<BasicGELU<T>>>(input_size, output_size, std::move(func));
+        case ActivationType::SiLU: return std::make_unique<FusedFCLayer<BasicSiLU<T>>>(input_size, output_size, std::move(func));
+        case ActivationType::FastSigmoid: return std::make_unique<FusedFCLayer<BasicFastSigmoid<T>>>(input_size, output_size, std::move(func));
+        case ActivationType::FastTanh: return std::make_unique<FusedFCLayer<BasicFastTanh<T>>>(input_size, output_size, std::move(func));
+        case ActivationType::FastGELU: return std::make_unique<FusedFCLayer<BasicFastGELU<T>>>(input_size, output_size, std::move(func));
+        case ActivationType::FastSiLU: return std::make_unique<FusedFCLayer<BasicFastSiLU<T>>>(input_size, output_size, std::move(func));
+        default: break;
+    }
+
+    return std::make_unique<BasicFCLayer<T>>(input_size, output_size, std::move(func));
+};
 
-    prev_weights_update = weights_update;
-    prev_bias_update = bias_update;
-};
\ No newline at end of file
+template std::unique_ptr<BasicFCLayer<float>> make_fc_layer(int, int, std::unique_ptr<BasicActivationFunction<float>>);
+template std::unique_ptr<BasicFCLayer<double>> make_fc_layer(int, int, std::unique_ptr<BasicActivationFunction<double>>);
@@ -0,0 +1,159 @@
+#include "../includes/lbfgs.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+
+LBFGS::LBFGS(const LBFGSOptions& options) : options(options) {
+    if(options.history < 1) throw std::invalid_argument("LBFGS: history must be positive");
+    if(options.max_line_search < 1) throw std::invalid_argument("LBFGS: max_line_search must be positive");
+    if(!(0 < options.c1 && options.c1 < options.c2 && options.c2 < 1)) throw std::invalid_argument("LBFGS: constants must satisfy 0 < c1 < c2 < 1");
+}
+
+double LBFGS::evaluate(const Objective& f, const Vector& x, Vector& g){
+    evaluations++;
+    return f(x, g);
+}
+
+void LBFGS::compute_direction(const Vector& g){
+    direction = -g;
+    int history = options.history;
+
+    // two-loop recursion: newest to oldest, scale by the initial inverse Hessian, then oldest to newest
+    for(int k = 0, j = newest; k < stored; k++, j = (j + history - 1) % history){
+        alpha[j] = rho[j] * steps[j].dot(direction);
+        direction.noalias() -= alpha[j] * changes[j];
+    }
+    if(stored > 0) direction *= scale;
+    for(int k = 0, j = (newest + history - stored + 1) % history; k < stored; k++, j = (j + 1) % history){
+        double beta = rho[j] * changes[j].dot(direction);
+        direction.noalias() += (alpha[j] - beta) * steps[j];
+    }
+}
+
+void LBFGS::push(const Vector& x, const Vector& g){
+    double ys = (g - g0).dot(x - x0); // expressions: nothing is written before the pair is accepted
+    double yy = (g - g0).squaredNorm();
+    if(!(ys > 1e-10 * yy)) return; // not a descent of a convex model, the oldest pair is kept instead
+
+    int slot = (newest + 1) % options.history;
+    steps[slot].noalias() = x - x0;
+    changes[slot].noalias() = g - g0;
+    rho[slot] = 1 / ys;
+    scale = ys / yy;
+    newest = slot;
+    stored = std::min(stored + 1, options.history);
+}
+
+// minimizer of the cubic matching the losses and slopes at a and b, kept away from both ends
+static double interpolate(double a, double loss_a, double slope_a, double b, double loss_b, double slope_b){
+    double low = std::min(a, b), high = std::max(a, b);
+    double margin = 0.1 * (high - low);
+    double step = (a + b) / 2; // bisection if the cubic has no minimizer or a loss is not finite
+
+    double d1 = slope_a + slope_b - 3 * (loss_a - loss_b) / (a - b);
+    double discriminant = d1 * d1 - slope_a * slope_b;
+    if(std::isfinite(loss_b) && std::isfinite(discriminant) && discriminant >= 0){
+        double d2 = std::copysign(std::sqrt(discriminant), b - a);
+        double cubic = b - (b - a) * (slope_b + d2 - d1) / (slope_b - slope_a + 2 * d2);
+        if(std::isfinite(cubic)) step = cubic;
+    }
+    return std::clamp(step, low + margin, high - margin);
+}
+
+bool LBFGS::line_search(const Objective& f, double loss0, double step, Vector& x, Vector& g, double& loss){
+    double slope0 = g0.dot(direction);
+
+    // lo: lowest step meeting the sufficient decrease so far (0 if none), hi: other end of the bracket once found
+    double lo = 0, loss_lo = loss0, slope_lo = slope0;
+    double hi = 0, loss_hi = 0, slope_hi = 0;
+    bool bracketed = false;
+    double evaluated = -1; // step of the last evaluation
+
+    for(int k = 0; k < options.max_line_search; k++){
+        if(bracketed) step = interpolate(lo, loss_lo, slope_lo, hi, loss_hi, slope_hi);
+
+        x.noalias() = x0 + step * direction;
+        double l = evaluate(f, x, g);
+        double slope = g.dot(direction);
+        evaluated = step;
+
+        if(!(l <= loss0 + options.c1 * step * slope0) || l >= loss_lo){ // too far (a non-finite loss is too far)
+            hi = step, loss_hi = l, slope_hi = slope;
+            bracketed = true;
+            continue;
+        }
+        if(std::abs(slope) <= -options.c2 * slope0){ // strong Wolfe conditions met
+            loss = l;
+            return true;
+        }
+
+        if(bracketed){
+            if(slope * (hi - lo) >= 0) hi = lo, loss_hi = loss_lo, slope_hi = slope_lo;
+        }else if(slope >= 0){ // past the minimizer: it lies between the previous step and this one
+            hi = lo, loss_hi = loss_lo, slope_hi = slope_lo;
+            bracketed = true;
+        }
+        lo = step, loss_lo = l, slope_lo = slope;
+        if(!bracketed) step *= 4; // still descending steeply: extrapolate
+    }
+
+    if(lo == 0) return false;
+    if(evaluated != lo){ // the curvature condition was never met: settle for the lowest loss, evaluated again
+        x.noalias() = x0 + lo * direction;
+        loss_lo = evaluate(f, x, g);
+    }
+    loss = loss_lo;
+    return true;
+}
+
+int LBFGS::minimize(const Objective& f, Vector& x, int max_iterations, const Callback& callback){
+    long n = x.size();
+    if(steps.size() != options.history || steps[0].size() != n){
+        steps.assign(options.history, Vector(n));
+        changes.assign(options.history, Vector(n));
+        rho.resize(options.history);
+        alpha.resize(options.history);
+        reset();
+    }
+
+    Vector g(n);
+    double loss = evaluate(f, x, g);
+    if(!std::isfinite(loss)) throw std::runtime_error("LBFGS::minimize: the loss at the starting point is not finite");
+
+    int iteration = 0;
+    while(iteration < max_iterations && n > 0 && g.cwiseAbs().maxCoeff() > options.gradient_tolerance){
+        x0 = x;
+        g0 = g;
+        double loss0 = loss;
+
+        bool decreased = false;
+        for(int attempt = 0; attempt < 2 && !decreased; attempt++){
+            if(attempt > 0){
+                if(stored == 0) break; // the steepest descent already failed
+                reset();
+            }
+            compute_direction(g0);
+            if(!(g0.dot(direction) < 0)){ // the pairs lost positive definiteness numerically
+                reset();
+                compute_direction(g0);
+            }
+            // without curvature information the first step moves every parameter by at most 1
+            double step = stored > 0 ? 1 : std::min(1.0, 1 / g0.lpNorm<1>());
+            decreased = line_search(f, loss0, step, x, g, loss);
+        }
+
+        if(!decreased){ // back to the best point, which the objective must hold on return
+            x = x0;
+            loss = evaluate(f, x, g);
+            break;
+        }
+
+        push(x, g);
+        if(callback) callback(iteration, loss);
+        iteration++;
+        if(loss0 - loss <= options.loss_tolerance * std::max({std::abs(loss0), std::abs(loss), 1.0})) break;
+    }
+    return iteration;
+}
@@ -1,13 +1,146 @@
 #include "../includes/loss_function.hpp"
+#include <algorithm>
 #include <iostream>
 
 
-double MSE::loss(const Eigen::MatrixXd& y_true, const Eigen::MatrixXd& y_pred) {
+template <typename T>
+double BasicMSE<T>::loss(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred) {
     // Compute the Mean Squared Error (MSE) loss
     return (y_true - y_pred).array().square().mean();
 }
 
-Eigen::MatrixXd MSE::backward(const Eigen::MatrixXd& y_true, const Eigen::MatrixXd& y_pred) {
+template <typename T>
+typename BasicMSE<T>::Matrix BasicMSE<T>::backward(const Matrix& y_true, const Matrix& y_pred) {
     // Compute the derivative of the Mean Squared Error (MSE) loss
-    return 2 * (y_pred - y_true) / y_true.rows();
-}
\ No newline at end of file
+    return T(2) * (y_pred - y_true) / T(y_true.rows());
+}
+
+template <typename T>
+void BasicMSE<T>::backward_into(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred, Matrix& grad) {
+    grad = T(2) * (y_pred - y_true) / T(y_true.rows());
+}
+
+template <typename T>
+double BasicMSE<T>::loss_and_gradient(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred, Matrix& grad) {
+    T scale = T(2) / T(y_true.rows());
+    grad = scale * (y_pred - y_true);
+    // the loss is read back from the gradient while it is still in cache: sum((y_pred - y_true)^2) = sum(grad^2) / scale^2
+    return grad.squaredNorm() / (scale * scale) / y_true.size();
+}
+
+template class BasicMSE<float>;
+template class BasicMSE<double>;
+
+// ---------------------------------------- SoftmaxCrossEntropy ----------------------------------------
+// (softmax(z) - y_true) / n into grad unless it is null, returns the loss. The rows are taken in blocks, so that
+// their per-row values (max, sum) stay on the stack: no heap allocation besides sizing grad
+template <typename T>
+static double softmax_cross_entropy(const Eigen::Ref<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>& y_true,
+        const Eigen::Ref<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>& z, Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>* grad) {
+    constexpr int BLOCK = 64;
+    using Column = Eigen::Matrix<T, Eigen::Dynamic, 1, 0, BLOCK, 1>;
+    T n = T(z.rows());
+    if(grad) grad->resize(z.rows(), z.cols());
+
+    double loss = 0;
+    for(Eigen::Index begin = 0; begin < z.rows(); begin += BLOCK){
+        Eigen::Index rows = std::min<Eigen::Index>(BLOCK, z.rows() - begin);
+        auto z_block = z.middleRows(begin, rows);
+        auto y_block = y_true.middleRows(begin, rows);
+
+        Column shift = z_block.rowwise().maxCoeff(), sum;
+        if(grad){
+            auto g = grad->middleRows(begin, rows);
+            g = (z_block.colwise() - shift).array().exp().matrix(); // in (0, 1], nothing overflows
+            sum = g.rowwise().sum(); // >= 1, the log is finite
+            g = ((g.array().colwise() / sum.array() - y_block.array()) / n).matrix();
+        }else{
+            sum = (z_block.colwise() - shift).array().exp().matrix().rowwise().sum();
+        }
+
+        shift.array() += sum.array().log(); // log-sum-exp of every row
+        loss += (y_block.array() * ((-z_block.array()).colwise() + shift.array())).sum(); // every term y * (lse - z) is >= 0
+    }
+    return loss / n;
+}
+
+template <typename T>
+double BasicSoftmaxCrossEntropy<T>::loss(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred) {
+    return softmax_cross_entropy<T>(y_true, y_pred, nullptr);
+}
+
+template <typename T>
+typename BasicSoftmaxCrossEntropy<T>::Matrix BasicSoftmaxCrossEntropy<T>::backward(const Matrix& y_true, const Matrix& y_pred) {
+    Matrix grad;
+    softmax_cross_entropy<T>(y_true, y_pred, &grad);
+    return grad;
+}
+
+template <typename T>
+void BasicSoftmaxCrossEntropy<T>::backward_into(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred, Matrix& grad) {
+    softmax_cross_entropy<T>(y_true, y_pred, &grad);
+}
+
+template <typename T>
+double BasicSoftmaxCrossEntropy<T>::loss_and_gradient(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred, Matrix& grad) {
+    return softmax_cross_entropy<T>(y_true, y_pred, &grad);
+}
+
+template <typename T>
+typename BasicSoftmaxCrossEntropy<T>::Matrix BasicSoftmaxCrossEntropy<T>::probabilities(const Eigen::Ref<const Matrix>& logits) {
+    Eigen::Matrix<T, Eigen::Dynamic, 1> shift = logits.rowwise().maxCoeff();
+    Matrix p = (logits.colwise() - shift).array().exp().matrix();
+    Eigen::Matrix<T, Eigen::Dynamic, 1> sum = p.rowwise().sum();
+    p.array().colwise() /= sum.array();
+    return p;
+}
+
+template class BasicSoftmaxCrossEntropy<float>;
+template class BasicSoftmaxCrossEntropy<double>;
+
+// ---------------------------------------- SigmoidCrossEntropy ----------------------------------------
+// (sigmoid(z) - y_true) / n into grad, returns the loss
+template <typename T>
+static double sigmoid_cross_entropy(const Eigen::Ref<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>& y_true,
+        const Eigen::Ref<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>& z, Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>& grad) {
+    T n = T(z.rows());
+
+    grad = (-z.array().abs()).exp().matrix(); // e = exp(-|z|) in (0, 1]
+    // log(1 + e) rather than log1p(e), which is not vectorized: 1 + e is in (1, 2], the absolute error stays within an ulp
+    double loss = (z.array().max(T(0)) - z.array() * y_true.array() + (T(1) + grad.array()).log()).sum() / n;
+    // sigmoid(z) = 1 / (1 + e) for z >= 0, e / (1 + e) otherwise
+    grad = (((z.array() >= T(0)).select(T(1), grad.array()) / (T(1) + grad.array()) - y_true.array()) / n).matrix();
+    return loss;
+}
+
+template <typename T>
+double BasicSigmoidCrossEntropy<T>::loss(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred) {
+    // the loss term of sigmoid_cross_entropy, evaluated in one pass without a gradient
+    return (y_pred.array().max(T(0)) - y_pred.array() * y_true.array() + (T(1) + (-y_pred.array().abs()).exp()).log()).sum() / T(y_pred.rows());
+}
+
+template <typename T>
+typename BasicSigmoidCrossEntropy<T>::Matrix BasicSigmoidCrossEntropy<T>::backward(const Matrix& y_true, const Matrix& y_pred) {
+    Matrix grad;
+    sigmoid_cross_entropy<T>(y_true, y_pred, grad);
+    return grad;
+}
+
+template <typename T>
+void BasicSigmoidCrossEntropy<T>::backward_into(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred, Matrix& grad) {
+    sigmoid_cross_entropy<T>(y_true, y_pred, grad);
+}
+
+template <typename T>
+double BasicSigmoidCrossEntropy<T>::loss_and_gradient(const Eigen::Ref<const Matrix>& y_true, const Eigen::Ref<const Matrix>& y_pred, Matrix& grad) {
+    return sigmoid_cross_entropy<T>(y_true, y_pred, grad);
+}
+
+template <typename T>
+typename BasicSigmoidCrossEntropy<T>::Matrix BasicSigmoidCrossEntropy<T>::probabilities(const Eigen::Ref<const Matrix>& logits) {
+    Matrix e = (-logits.array().abs()).exp().matrix();
+    return ((logits.array() >= T(0)).select(T(1), e.array()) / (T(1) + e.array())).matrix();
+}
+
+template class BasicSigmoidCrossEntropy<float>;
+template class BasicSigmoidCrossEntropy<double>;
@@ -0,0 +1,34 @@
+#include "../includes/mapped_file.hpp"
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string& path){
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) throw std::runtime_error("MappedFile: cannot open " + path);
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0){
+        close(fd);
+        throw std::runtime_error("MappedFile: cannot map empty file " + path);
+    }
+
+    mapping_size = st.st_size;
+    mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file alive
+    if(mapping == MAP_FAILED){
+        mapping = nullptr;
+        throw std::runtime_error("MappedFile: cannot map " + path);
+    }
+};
+
+void MappedFile::advise(bool random_access) const{
+    madvise(mapping, mapping_size, random_access ? MADV_RANDOM : MADV_SEQUENTIAL);
+};
+
+MappedFile::~MappedFile(){
+    munmap(mapping, mapping_size);
+};
@@ -0,0 +1,159 @@
+#include "../includes/minibatch.hpp"
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+template <typename T>
+void gather_rows(const Eigen::Ref<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>& src, const long* rows, int count,
+        Eigen::Ref<Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>> dst){
+    // column by column: the writes are sequential, only the reads jump around
+    for(int c = 0; c < src.cols(); c++){
+        for(int r = 0; r < count; r++) dst(r, c) = src(rows[r], c);
+    }
+}
+
+template void gather_rows<float>(const Eigen::Ref<const Eigen::MatrixXf>&, const long*, int, Eigen::Ref<Eigen::MatrixXf>);
+template void gather_rows<double>(const Eigen::Ref<const Eigen::MatrixXd>&, const long*, int, Eigen::Ref<Eigen::MatrixXd>);
+
+template <typename T>
+void gather_rows(const Eigen::Ref<const Eigen::SparseMatrix<T, Eigen::RowMajor>>& src, const long* rows, int count,
+        Eigen::SparseMatrix<T, Eigen::RowMajor>& dst){
+    const auto* src_outer = src.outerIndexPtr();
+    long nnz = 0;
+    for(int r = 0; r < count; r++) nnz += src_outer[rows[r] + 1] - src_outer[rows[r]];
+    dst.resizeNonZeros(nnz);
+
+    // whole CSR rows: one contiguous run of indices and values each
+    auto* dst_outer = dst.outerIndexPtr();
+    long pos = 0;
+    for(int r = 0; r < count; r++){
+        long first = src_outer[rows[r]], last = src_outer[rows[r] + 1];
+        std::copy(src.innerIndexPtr() + first, src.innerIndexPtr() + last, dst.innerIndexPtr() + pos);
+        std::copy(src.valuePtr() + first, src.valuePtr() + last, dst.valuePtr() + pos);
+        dst_outer[r] = pos;
+        pos += last - first;
+    }
+    for(long r = count; r <= dst.rows(); r++) dst_outer[r] = pos; // the remaining rows are empty
+}
+
+template void gather_rows<float>(const Eigen::Ref<const Eigen::SparseMatrix<float, Eigen::RowMajor>>&, const long*, int, Eigen::SparseMatrix<float, Eigen::RowMajor>&);
+template void gather_rows<double>(const Eigen::Ref<const Eigen::SparseMatrix<double, Eigen::RowMajor>>&, const long*, int, Eigen::SparseMatrix<double, Eigen::RowMajor>&);
+
+
+// ---------------------------------------- MinibatchIterator ----------------------------------------
+template <typename T>
+BasicMinibatchIterator<T>::BasicMinibatchIterator(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y, const MinibatchOptions& options)
+    : BasicMinibatchIterator(x, y, {}, options) {};
+
+template <typename T>
+BasicMinibatchIterator<T>::BasicMinibatchIterator(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y, const std::vector<long>& rows,
+        const MinibatchOptions& options)
+    : x(x.data(), x.rows(), x.cols(), Eigen::OuterStride<>(x.outerStride())), y(y.data(), y.rows(), y.cols(), Eigen::OuterStride<>(y.outerStride())),
+      options(options), rng(options.seed), gather(options.shuffle || !rows.empty()), order(rows){
+    if(options.batch_size <= 0) throw std::invalid_argument("BasicMinibatchIterator: batch_size must be positive");
+    if(x.rows() != y.rows()) throw std::invalid_argument("BasicMinibatchIterator: x and y have a different number of rows");
+    for(long row : rows){
+        if(row < 0 || row >= x.rows()) throw std::invalid_argument("BasicMinibatchIterator: row out of range");
+    }
+
+    if(gather){
+        if(rows.empty()){
+            order.resize(x.rows());
+            std::iota(order.begin(), order.end(), 0L);
+        }
+        long buffer_rows = std::min<long>(options.batch_size, order.size());
+        x_buffer.resize(buffer_rows, x.cols());
+        y_buffer.resize(buffer_rows, y.cols());
+    }
+};
+
+template <typename T>
+void BasicMinibatchIterator<T>::begin_epoch(){
+    if(options.shuffle) std::shuffle(order.begin(), order.end(), rng); // same permutations as BasicBatchPrefetcher for the same seed
+    begin = 0;
+    end = 0;
+};
+
+template <typename T>
+bool BasicMinibatchIterator<T>::next(){
+    long num_rows = get_num_rows();
+    long epoch_rows = (long)options.num_batches(num_rows) * options.batch_size;
+    begin = end;
+    if(begin >= std::min(epoch_rows, num_rows)) return false;
+    end = std::min<long>(begin + options.batch_size, num_rows);
+
+    if(gather){
+        gather_rows<T>(x, order.data() + begin, end - begin, x_buffer);
+        gather_rows<T>(y, order.data() + begin, end - begin, y_buffer);
+    }
+    return true;
+};
+
+template <typename T>
+typename BasicMinibatchIterator<T>::View BasicMinibatchIterator<T>::batch(const View& data, const Matrix& buffer) const{
+    if(gather) return View(buffer.data(), end - begin, buffer.cols(), Eigen::OuterStride<>(buffer.rows()));
+    return View(data.data() + begin, end - begin, data.cols(), Eigen::OuterStride<>(data.outerStride()));
+};
+
+template class BasicMinibatchIterator<float>;
+template class BasicMinibatchIterator<double>;
+
+
+// ---------------------------------------- SparseMinibatchIterator ----------------------------------------
+template <typename T>
+BasicSparseMinibatchIterator<T>::BasicSparseMinibatchIterator(const SparseMatrix& x, const Eigen::Ref<const Matrix>& y, const MinibatchOptions& options)
+    : x(x.rows(), x.cols(), x.nonZeros(), x.outerIndexPtr(), x.innerIndexPtr(), x.valuePtr()),
+      y(y.data(), y.rows(), y.cols(), Eigen::OuterStride<>(y.outerStride())), options(options), rng(options.seed){
+    if(options.batch_size <= 0) throw std::invalid_argument("BasicSparseMinibatchIterator: batch_size must be positive");
+    if(!x.isCompressed()) throw std::invalid_argument("BasicSparseMinibatchIterator: x must be compressed (see SparseMatrix::makeCompressed)");
+    if(x.rows() != y.rows()) throw std::invalid_argument("BasicSparseMinibatchIterator: x and y have a different number of rows");
+
+    if(options.shuffle){
+        order.resize(x.rows());
+        std::iota(order.begin(), order.end(), 0L);
+        long buffer_rows = std::min<long>(options.batch_size, x.rows());
+        x_buffer.resize(buffer_rows, x.cols());
+        y_buffer.resize(buffer_rows, y.cols());
+    }
+};
+
+template <typename T>
+void BasicSparseMinibatchIterator<T>::begin_epoch(){
+    if(options.shuffle) std::shuffle(order.begin(), order.end(), rng); // same permutations as BasicMinibatchIterator for the same seed
+    begin = 0;
+    end = 0;
+};
+
+template <typename T>
+bool BasicSparseMinibatchIterator<T>::next(){
+    long num_rows = get_num_rows();
+    long epoch_rows = (long)options.num_batches(num_rows) * options.batch_size;
+    begin = end;
+    if(begin >= std::min(epoch_rows, num_rows)) return false;
+    end = std::min<long>(begin + options.batch_size, num_rows);
+
+    if(options.shuffle){
+        gather_rows<T>(x, order.data() + begin, end - begin, x_buffer);
+        gather_rows<T>(y, order.data() + begin, end - begin, y_buffer);
+    }
+    return true;
+};
+
+template <typename T>
+typename BasicSparseMinibatchIterator<T>::SparseView BasicSparseMinibatchIterator<T>::x_batch() const{
+    // a row range of a CSR matrix: its slice of the row pointers, whose offsets index the full arrays
+    const SparseView& source = options.shuffle ? SparseView(x_buffer.rows(), x_buffer.cols(), x_buffer.nonZeros(),
+            x_buffer.outerIndexPtr(), x_buffer.innerIndexPtr(), x_buffer.valuePtr()) : x;
+    long first = options.shuffle ? 0 : begin;
+    long nnz = source.outerIndexPtr()[first + rows()] - source.outerIndexPtr()[first];
+    return SparseView(rows(), x.cols(), nnz, source.outerIndexPtr() + first, source.innerIndexPtr(), source.valuePtr());
+};
+
+template <typename T>
+typename BasicSparseMinibatchIterator<T>::View BasicSparseMinibatchIterator<T>::y_batch() const{
+    if(options.shuffle) return View(y_buffer.data(), end - begin, y_buffer.cols(), Eigen::OuterStride<>(y_buffer.rows()));
+    return View(y.data() + begin, end - begin, y.cols(), Eigen::OuterStride<>(y.outerStride()));
+};
+
+template class BasicSparseMinibatchIterator<float>;
+template class BasicSparseMinibatchIterator<double>;
@@ -1,70 +1,1050 @@
 #include "../includes/mlp.hpp"
 #include "../includes/layer.hpp"
 #include "../includes/activation_function.hpp"
+#include "../includes/checkpoint.hpp"
 
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <utility>
 
 
-MLP::MLP(int input_size, std::vector<std::pair<int, ActivationFunction*>> layers) {
+template <typename T>
+BasicMLP<T>::BasicMLP(int input_size, std::vector<std::pair<int, BasicActivationFunction<T>*>> layers) {
     for (int i = 0; i < layers.size(); i++) {  
-        std::unique_ptr<ActivationFunction> activation_function = std::unique_ptr<ActivationFunction>(layers[i].second);
+        std::unique_ptr<BasicActivationFunction<T>> activation_function(layers[i].second);
         
-        this->layers.push_back(std::make_unique<FCLayer>(input_size, layers[i].first, std::move(activation_function)));
+        this->layers.push_back(make_fc_layer(input_size, layers[i].first, std::move(activation_function)));
         input_size = layers[i].first;
     }
+
+    set_num_threads(1);
+}
+
+template <typename T>
+BasicMLP<T>::BasicMLP(const std::string& checkpoint_path) {
+    BasicMappedMLP<T> checkpoint(checkpoint_path);
+
+    for (int i = 0; i < checkpoint.get_num_layers(); i++) {
+        const auto& layer = checkpoint.get_layer(i);
+        int rows = layer.weights.rows(), cols = layer.weights.cols();
+
+        this->layers.push_back(make_fc_layer(cols, rows, make_activation<T>(layer.activation)));
+        this->layers.back()->set_parameters(layer.weights, layer.bias);
+    }
+
+    if (checkpoint.has_momentum()) { // the hyperparameters are set again by fit
+        optimizer = std::make_unique<BasicSGD<T>>(0);
+        for (int i = 0; i < checkpoint.get_num_layers(); i++) {
+            const auto& layer = checkpoint.get_layer(i);
+            int rows = layer.weights.rows(), cols = layer.weights.cols();
+            optimizer->set_buffer(2 * i, 0, Eigen::Map<const Matrix>(layer.prev_weights_update, rows, cols));
+            optimizer->set_buffer(2 * i + 1, 0, Eigen::Map<const Matrix>(layer.prev_bias_update, rows, 1));
+        }
+    }
+
+    set_num_threads(1);
+}
+
+template <typename T>
+void BasicMLP<T>::save(const std::string& path, bool save_momentum) const{
+    auto align = [](uint64_t offset){ return (offset + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT; };
+
+    // the momentum buffers are the velocity of an SGD optimizer, once it has taken a step (in double precision
+    // in mixed precision mode, saved with scalar type T like the weights)
+    auto* sgd = dynamic_cast<const BasicSGD<T>*>(optimizer.get());
+    std::vector<Matrix> velocity;
+    if(save_momentum && sgd){
+        velocity.reserve(2 * layers.size()); // stable addresses for the arrays below
+        for(int slot = 0; slot < 2 * layers.size(); slot++){
+            if(const Eigen::MatrixXd* master = sgd->get_master_buffer(slot, 0)) velocity.push_back(master->template cast<T>());
+            else if(const Matrix* state = sgd->get_buffer(slot, 0)) velocity.push_back(*state);
+            else break;
+        }
+    }
+    save_momentum = velocity.size() == 2 * layers.size();
+
+    // layout: header, layer table, then the arrays of every layer at aligned offsets
+    CheckpointHeader header = {{'M', 'L', 'P', 'C'}, CHECKPOINT_VERSION, sizeof(T), (uint32_t)layers.size(), (uint32_t)get_input_size(),
+            save_momentum ? CHECKPOINT_HAS_MOMENTUM : 0};
+    std::vector<CheckpointLayer> table(layers.size());
+    std::vector<std::pair<uint64_t, const Matrix*>> arrays;
+
+    uint64_t offset = sizeof(CheckpointHeader) + layers.size() * sizeof(CheckpointLayer);
+    auto place = [&](const Matrix& m){
+        offset = align(offset);
+        arrays.push_back(std::make_pair(offset, &m));
+        offset += m.size() * sizeof(T);
+        return arrays.back().first;
+    };
+
+    for(int i = 0; i < layers.size(); i++){
+        ActivationType type = activation_type(layers[i]->get_activation());
+        if(type == ActivationType::Custom) throw std::invalid_argument("BasicMLP::save: user-defined activation functions cannot be saved");
+
+        table[i] = {(uint32_t)layers[i]->get_input_size(), (uint32_t)layers[i]->get_output_size(), (uint32_t)type, 0, 0, 0, 0, 0};
+        table[i].weights_offset = place(layers[i]->get_weights());
+        table[i].bias_offset = place(layers[i]->get_bias());
+        if(save_momentum){
+            table[i].prev_weights_update_offset = place(velocity[2 * i]);
+            table[i].prev_bias_update_offset = place(velocity[2 * i + 1]);
+        }
+    }
+
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        if(!file) throw std::runtime_error("BasicMLP::save: cannot write " + tmp_path);
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(CheckpointLayer));
+        for(const auto& [array_offset, m] : arrays){
+            static const char padding[CHECKPOINT_ALIGNMENT] = {};
+            file.write(padding, array_offset - file.tellp());
+            file.write(reinterpret_cast<const char*>(m->data()), m->size() * sizeof(T));
+        }
+
+        if(!file) throw std::runtime_error("BasicMLP::save: cannot write " + tmp_path);
+    }
+
+    if(std::rename(tmp_path.c_str(), path.c_str()) != 0){
+        std::remove(tmp_path.c_str());
+        throw std::runtime_error("BasicMLP::save: cannot replace " + path);
+    }
 }
 
-void MLP::init_weights(std::vector<std::pair<int, int>> weight_ranges, std::vector<std::pair<int, int>> bias_ranges){
+template <typename T>
+void BasicMLP<T>::init_weights(std::vector<std::pair<double, double>> weight_ranges, std::vector<std::pair<double, double>> bias_ranges){
     for(int i = 0; i < layers.size(); i++){
         layers[i]->init_weights(weight_ranges[i].first, weight_ranges[i].second, bias_ranges[i].first, bias_ranges[i].second); //re-init weights
     }
 }
 
-Eigen::MatrixXd MLP::predict(Eigen::MatrixXd x){
+template <typename T>
+void BasicMLP<T>::prepare_workspace(std::vector<Workspace>& ws, int batch_size){
+    if(ws.size() == layers.size() && ws[0].output.rows() == batch_size) return; // already sized, no allocation
+
+    ws.resize(layers.size());
+    for(int i = 0; i < layers.size(); i++){
+        ws[i].resize(batch_size, layers[i]->get_input_size(), layers[i]->get_output_size(), i > 0); // nothing flows back past the first layer
+    }
+}
+
+template <typename T>
+const typename BasicMLP<T>::Matrix& BasicMLP<T>::forward(const Eigen::Ref<const Matrix>& x, std::vector<Workspace>& ws){
+    prepare_workspace(ws, x.rows());
+
+    layers[0]->forward(x, ws[0]);
+    for(int i = 1; i < layers.size(); i++){
+        layers[i]->forward(ws[i - 1].output, ws[i]); // the input of layer i is a view on the output of layer i-1
+    }
+
+    return ws.back().output;
+}
+
+template <typename T>
+const typename BasicMLP<T>::Matrix& BasicMLP<T>::forward(const Eigen::Ref<const SparseMatrix>& x, std::vector<Workspace>& ws){
+    prepare_workspace(ws, x.rows());
+
+    layers[0]->forward(x, ws[0]); // sparse x dense, the activations are dense from there on
+    for(int i = 1; i < layers.size(); i++){
+        layers[i]->forward(ws[i - 1].output, ws[i]);
+    }
+
+    return ws.back().output;
+}
+
+template <typename T>
+typename BasicMLP<T>::Matrix BasicMLP<T>::predict(const Eigen::Ref<const Matrix>& x) const{
+    Matrix out;
+    infer(x, out);
+    return out;
+}
+
+template <typename T>
+typename BasicMLP<T>::Matrix BasicMLP<T>::predict(const Eigen::Ref<const SparseMatrix>& x) const{
+    Matrix out;
+    infer(x, out);
+    return out;
+}
+
+template <typename T>
+typename BasicMLP<T>::InferenceScratch& BasicMLP<T>::thread_scratch(){
+    static thread_local InferenceScratch scratch; // one per thread, reused across calls and models
+    return scratch;
+}
+
+template <typename T>
+void BasicMLP<T>::infer(const Eigen::Ref<const Matrix>& x, Matrix& out) const{
+    infer(x, out, thread_scratch(), nullptr);
+}
+
+template <typename T>
+void BasicMLP<T>::infer(const Eigen::Ref<const Matrix>& x, Matrix& out, InferenceScratch& scratch) const{
+    infer(x, out, scratch, nullptr);
+}
+
+template <typename T>
+void BasicMLP<T>::infer(const Eigen::Ref<const SparseMatrix>& x, Matrix& out) const{
+    infer(x, out, thread_scratch(), nullptr);
+}
+
+template <typename T>
+template <typename Input>
+void BasicMLP<T>::infer(const Input& x, Matrix& out, InferenceScratch& scratch, const ParameterSnapshot* parameters) const{
+    auto layer_infer = [&](int i, const auto& in, Matrix& layer_out){ // in is sparse for the first layer of a sparse input
+        if(parameters) layers[i]->infer(in, layer_out, parameters->weights[i], parameters->bias[i]);
+        else layers[i]->infer(in, layer_out);
+    };
+
+    int last = layers.size() - 1;
+    if(last == 0){
+        layer_infer(0, x, out);
+        return;
+    }
+
+    Matrix* current = &scratch.ping;
+    Matrix* other = &scratch.pong;
+
+    layer_infer(0, x, *current);
+    for(int i = 1; i < last; i++){
+        layer_infer(i, *current, *other);
+        std::swap(current, other);
+    }
+    layer_infer(last, *current, out); // the last layer writes straight into the caller's buffer
+}
+
+template <typename T>
+void BasicMLP<T>::backward(const Matrix& grad, std::vector<Workspace>& ws){
+    int last = layers.size() - 1;
+    const Matrix* layer_grad = linear_output() ? &layers[last]->backward_from_delta(ws[last], last > 0) : &layers[last]->backward(grad, ws[last], last > 0);
+    for(int i = last - 1; i >= 0; i--){
+        layer_grad = &layers[i]->backward(*layer_grad, ws[i], i > 0); // no need to backpropagate past the first layer
+    }
+}
+
+template <typename T>
+template <typename Input>
+void BasicMLP<T>::forward_segment(const Input& x, std::vector<Workspace>& ws, std::vector<Workspace>& segment, int begin, int end){
+    for(int i = begin; i < end; i++){
+        Workspace& layer_ws = segment[checkpoint_slots[i]];
+        if(i == 0) layers[0]->forward(x, layer_ws);
+        else layers[i]->forward(i == begin ? ws[i - 1].output : segment[checkpoint_slots[i - 1]].output, layer_ws);
+    }
+}
+
+template <typename T>
+template <typename Input>
+const typename BasicMLP<T>::Matrix& BasicMLP<T>::train_forward(const Input& x, TrainingBuffers& buffers, int t){
+    std::vector<Workspace>& ws = buffers.workspaces[t];
+    if(checkpoint_every == 0) return forward(x, ws);
+
+    int num_layers = layers.size();
+    std::vector<Workspace>& segment = buffers.segments[t];
+    if(ws.size() != num_layers){ // the batch-sized buffers are sized by the layers themselves, on first use
+        ws.resize(num_layers);
+        for(int i = 0; i < num_layers; i++){
+            ws[i].grad_weights.resize(layers[i]->get_output_size(), layers[i]->get_input_size());
+            ws[i].grad_bias.resize(layers[i]->get_output_size(), 1);
+        }
+        segment.resize(*std::max_element(checkpoint_slots.begin(), checkpoint_slots.end()) + 1);
+    }
+
+    int begin = 0;
+    for(; begin + checkpoint_every < num_layers; begin += checkpoint_every){
+        int end = begin + checkpoint_every;
+        forward_segment(x, ws, segment, begin, end);
+        std::swap(ws[end - 1].output, segment[checkpoint_slots[end - 1]].output); // checkpoint: the input of the next segment
+    }
+    forward_segment(x, ws, segment, begin, num_layers); // the last segment stays in place for the backward pass
+
+    return segment[checkpoint_slots.back()].output;
+}
+
+template <typename T>
+template <typename Input>
+void BasicMLP<T>::train_backward(const Input& x, TrainingBuffers& buffers, int t){
+    std::vector<Workspace>& ws = buffers.workspaces[t];
+    if(checkpoint_every == 0){
+        backward(buffers.loss_grads[t], ws);
+        buffers.peak_bytes[t] = std::max(buffers.peak_bytes[t], activation_bytes(buffers, t)); // every buffer is in use by now
+        return;
+    }
+
+    int num_layers = layers.size();
+    std::vector<Workspace>& segment = buffers.segments[t];
+    bool from_delta = linear_output();
+    const Matrix* layer_grad = &buffers.loss_grads[t];
+    for(int begin = (num_layers - 1) / checkpoint_every * checkpoint_every; begin >= 0; begin -= checkpoint_every){
+        int end = std::min(begin + checkpoint_every, num_layers);
+        // recompute from the checkpoint, layer_grad is the grad_input of layer end, whose workspace is not reused here
+        if(end < num_layers) forward_segment(x, ws, segment, begin, end);
+
+        for(int i = end - 1; i >= begin; i--){
+            Workspace& layer_ws = segment[checkpoint_slots[i]];
+            if(i == num_layers - 1 && from_delta) layer_grad = &layers[i]->backward_from_delta(layer_ws, i > 0);
+            else layer_grad = &layers[i]->backward(*layer_grad, layer_ws, i > 0);
+            std::swap(ws[i].grad_weights, layer_ws.grad_weights); // same shapes, the gradients move to the arena where update reads them
+            std::swap(ws[i].grad_bias, layer_ws.grad_bias);
+        }
+        buffers.peak_bytes[t] = std::max(buffers.peak_bytes[t], activation_bytes(buffers, t));
+    }
+}
+
+template <typename T>
+typename BasicMLP<T>::Workspace& BasicMLP<T>::output_workspace(TrainingBuffers& buffers, int t){
+    return checkpoint_every ? buffers.segments[t][checkpoint_slots.back()] : buffers.workspaces[t].back();
+}
+
+template <typename T>
+std::size_t BasicMLP<T>::activation_bytes(const TrainingBuffers& buffers, int t) const{
+    std::size_t size = 0;
+    for(const auto* arena : {&buffers.workspaces[t], &buffers.segments[t]}){
+        for(const Workspace& ws : *arena){
+            size += ws.preactivation.size() + ws.output.size() + ws.delta.size() + ws.grad_input.size();
+        }
+    }
+    return size * sizeof(T);
+}
+
+template <typename T>
+void BasicMLP<T>::set_checkpointing(int every){
+    int num_layers = layers.size();
+    checkpoint_every = every > 1 ? every : 0;
+    checkpoint_slots.assign(num_layers, 0);
+
+    if(checkpoint_every){
+        // a workspace is only shared by layers of the same shape, so its buffers are never resized, and a segment
+        // leaves alone the workspace of the first layer of the next one, which holds the gradient flowing back
+        std::vector<std::pair<int, int>> shapes; // shape of the layers of every workspace
+        for(int begin = (num_layers - 1) / checkpoint_every * checkpoint_every; begin >= 0; begin -= checkpoint_every){
+            int end = std::min(begin + checkpoint_every, num_layers);
+            std::vector<bool> taken(shapes.size(), false);
+            if(end < num_layers) taken[checkpoint_slots[end]] = true;
+
+            for(int i = begin; i < end; i++){
+                std::pair<int, int> shape(layers[i]->get_input_size(), layers[i]->get_output_size());
+                int slot = 0;
+                while(slot < shapes.size() && (taken[slot] || shapes[slot] != shape)) slot++;
+                if(slot == shapes.size()){
+                    shapes.push_back(shape);
+                    taken.push_back(false);
+                }
+                taken[slot] = true;
+                checkpoint_slots[i] = slot;
+            }
+        }
+    }
+
+    for(TrainingBuffers* buffers : {&full_batches, &last_batch}){ // laid out again for the new mode by the next step
+        for(int t = 0; t < num_threads; t++){
+            buffers->workspaces[t].clear();
+            buffers->segments[t].clear();
+            buffers->peak_bytes[t] = 0;
+        }
+    }
+}
+
+template <typename T>
+double BasicMLP<T>::synchronize(std::vector<Workspace>& ws, double loss, int rows){
+    if(!communicator) return loss;
+
+    // one all-reduce per minibatch: every gradient scaled by the rows, then the loss and the rows
+    long size = 2;
+    for(const Workspace& w : ws) size += w.grad_weights.size() + w.grad_bias.size();
+    MLP_PROFILE_SCOPE(profiler.get(), Profiler::MODEL, Phase::Sync, 2.0 * size);
+    sync_buffer.resize(size);
+
+    T* p = sync_buffer.data();
+    for(const Workspace& w : ws){
+        for(const Matrix* grad : {&w.grad_weights, &w.grad_bias}){
+            Eigen::Map<Matrix>(p, grad->rows(), grad->cols()) = *grad * T(rows);
+            p += grad->size();
+        }
+    }
+    p[0] = loss * rows;
+    p[1] = rows;
+
+    communicator->all_reduce(sync_buffer.data(), size);
+
+    T total_rows = p[1];
+    p = sync_buffer.data();
+    for(Workspace& w : ws){
+        for(Matrix* grad : {&w.grad_weights, &w.grad_bias}){
+            *grad = Eigen::Map<const Matrix>(p, grad->rows(), grad->cols()) / total_rows;
+            p += grad->size();
+        }
+    }
+    return p[0] / total_rows;
+}
+
+template <typename T>
+void BasicMLP<T>::set_communicator(BasicCommunicator<T>* communicator){
+    if(!communicator){
+        this->communicator = nullptr;
+        return;
+    }
+
+    // every rank throws or none does: the mismatch flags of the ranks are summed
+    auto agree = [communicator](bool match, const char* what){
+        T mismatches = match ? 0 : 1;
+        communicator->all_reduce(&mismatches, 1);
+        if(mismatches != 0) throw std::invalid_argument(std::string("BasicMLP::set_communicator: ") + what);
+    };
+    // integers are exchanged as 16-bit digits, exact in float and double
+    auto digits = [](const std::vector<uint32_t>& values){
+        std::vector<T> encoded;
+        for(uint32_t value : values){
+            encoded.push_back(T(value >> 16));
+            encoded.push_back(T(value & 0xffff));
+        }
+        return encoded;
+    };
+
+    std::vector<uint32_t> shape = {uint32_t(layers.size())};
+    std::vector<T> encoded = digits(shape), root = encoded;
+    communicator->broadcast(root.data(), root.size(), 0);
+    agree(root == encoded, "the model of rank 0 has another number of layers");
+
+    shape.clear();
+    for(const auto& layer : layers){
+        shape.push_back(uint32_t(layer->get_input_size()));
+        shape.push_back(uint32_t(layer->get_output_size()));
+        shape.push_back(uint32_t(activation_type(layer->get_activation())));
+    }
+    encoded = digits(shape);
+    root = encoded;
+    communicator->broadcast(root.data(), root.size(), 0);
+    agree(root == encoded, "the model of rank 0 has other layer sizes or activations");
+
+    // every replica starts from the parameters of rank 0
+    std::vector<T> parameters;
+    for(const auto& layer : layers){
+        parameters.insert(parameters.end(), layer->get_weights().data(), layer->get_weights().data() + layer->get_weights().size());
+        parameters.insert(parameters.end(), layer->get_bias().data(), layer->get_bias().data() + layer->get_bias().size());
+    }
+    communicator->broadcast(parameters.data(), parameters.size(), 0);
+
+    const T* p = parameters.data();
+    for(const auto& layer : layers){
+        int rows = layer->get_output_size(), cols = layer->get_input_size();
+        layer->set_parameters(Eigen::Map<const Matrix>(p, rows, cols), Eigen::Map<const Matrix>(p + rows * cols, rows, 1));
+        p += rows * (cols + 1);
+    }
+    this->communicator = communicator;
+}
+
+template <typename T>
+std::size_t BasicMLP<T>::get_peak_activation_memory() const{
+    std::size_t bytes = 0;
+    for(const TrainingBuffers* buffers : {&full_batches, &last_batch}){
+        for(std::size_t peak : buffers->peak_bytes) bytes += peak;
+    }
+    return bytes;
+}
+
+template <typename T>
+void BasicMLP<T>::update(const std::vector<Workspace>& ws){
+    optimizer->begin_step();
     for(int i = 0; i < layers.size(); i++){
-        x = layers[i]->forward(x);
+        layers[i]->update(ws[i], *optimizer, 2 * i); // slots 2i and 2i+1: weights and bias of layer i
     }
+}
 
-    return x;
+template <typename T>
+void BasicMLP<T>::set_optimizer(std::unique_ptr<BasicOptimizer<T>> optimizer){
+    this->optimizer = std::move(optimizer);
 }
 
-void MLP::backward(Eigen::MatrixXd grad){
-    for(int i = layers.size() - 1; i >= 0; i--){
-        grad = layers[i]->backward(grad);
+template <typename T>
+void BasicMLP<T>::use_sgd(double learning_rate, double weight_decay, double momentum){
+    auto* sgd = dynamic_cast<BasicSGD<T>*>(optimizer.get());
+    if(sgd && !sgd->is_nesterov()){ // successive fit calls keep the velocity, as with the former built-in rule
+        sgd->set_learning_rate(learning_rate);
+        sgd->set_weight_decay(weight_decay);
+        sgd->set_momentum(momentum);
+        return;
+    }
+
+    optimizer = std::make_unique<BasicSGD<T>>(learning_rate, momentum, weight_decay);
+}
+
+template <typename T>
+void BasicMLP<T>::enable_profiling(std::size_t max_trace_events){
+    profiler = std::make_unique<Profiler>(layers.size(), max_trace_events);
+    for(int i = 0; i < layers.size(); i++){
+        layers[i]->set_profiler(profiler.get(), i);
     }
 }
 
-void MLP::update(double lr, double weight_decay, double momentum){
+template <typename T>
+void BasicMLP<T>::disable_profiling(){
     for(int i = 0; i < layers.size(); i++){
-        layers[i]->update(lr, weight_decay, momentum);
+        layers[i]->set_profiler(nullptr, i);
+    }
+    profiler.reset();
+}
+
+template <typename T>
+void BasicMLP<T>::set_num_threads(int num_threads){
+    this->num_threads = std::max(1, num_threads);
+    pool = this->num_threads > 1 ? std::make_unique<ThreadPool>(this->num_threads) : nullptr;
+    for(TrainingBuffers* buffers : {&full_batches, &last_batch}){
+        buffers->workspaces.resize(this->num_threads);
+        buffers->loss_grads.resize(this->num_threads);
+        buffers->segments.resize(this->num_threads);
+        buffers->peak_bytes.assign(this->num_threads, 0);
+    }
+    shard_losses.resize(this->num_threads);
+}
+
+// rows [begin, begin + rows) of a minibatch: a block of a dense one, a slice of the row pointers of a sparse one
+template <typename Derived>
+static auto shard_rows(const Eigen::DenseBase<Derived>& x, long begin, long rows){
+    return x.derived().middleRows(begin, rows);
+}
+
+template <typename T>
+static Eigen::Map<const Eigen::SparseMatrix<T, Eigen::RowMajor>> shard_rows(const Eigen::Map<const Eigen::SparseMatrix<T, Eigen::RowMajor>>& x, long begin, long rows){
+    const auto* outer = x.outerIndexPtr();
+    return Eigen::Map<const Eigen::SparseMatrix<T, Eigen::RowMajor>>(rows, x.cols(), outer[begin + rows] - outer[begin], outer + begin, x.innerIndexPtr(), x.valuePtr());
+}
+
+template <typename T>
+template <typename Input>
+double BasicMLP<T>::train_step(const Input& x, const Eigen::Ref<const Matrix>& y, BasicLossFunction<T>* loss_function, TrainingBuffers& buffers){
+    std::vector<Matrix>& loss_grads = buffers.loss_grads;
+    int batch_size = x.rows();
+    int num_shards = std::min(num_threads, batch_size);
+    bool from_delta = linear_output();
+
+    if(num_shards == 1){
+        const Matrix& y_pred = train_forward(x, buffers, 0); //forward pass
+        double loss;
+        {
+            MLP_PROFILE_SCOPE(profiler.get(), Profiler::MODEL, Phase::Loss, 5.0 * y.size());
+            Matrix& loss_grad = from_delta ? output_workspace(buffers, 0).delta : loss_grads[0];
+            loss = loss_function->loss_and_gradient(y, y_pred, loss_grad); //loss of the minibatch and its gradient
+        }
+        train_backward(x, buffers, 0); //backward pass
+        return synchronize(buffers.workspaces[0], loss, batch_size);
     }
+
+    pool->parallel_for(num_shards, [&](int t){
+        int begin = (long)batch_size * t / num_shards; // contiguous shards, sizes differ by at most one row
+        int rows = (long)batch_size * (t + 1) / num_shards - begin;
+        double shard_weight = (double)rows / batch_size; // the minibatch loss is the weighted mean of the shard losses
+
+        auto shard = shard_rows(x, begin, rows);
+        const Matrix& y_pred = train_forward(shard, buffers, t);
+        {
+            MLP_PROFILE_SCOPE(profiler.get(), Profiler::MODEL, Phase::Loss, 5.0 * y_pred.size());
+            Matrix& loss_grad = from_delta ? output_workspace(buffers, t).delta : loss_grads[t];
+            shard_losses[t] = shard_weight * loss_function->loss_and_gradient(y.middleRows(begin, rows), y_pred, loss_grad);
+            loss_grad *= shard_weight;
+        }
+        train_backward(shard, buffers, t);
+    });
+
+    reduce_gradients(num_shards, buffers);
+
+    double loss = 0;
+    for(int t = 0; t < num_shards; t++){ // fixed order, as for the gradients
+        loss += shard_losses[t];
+    }
+    return synchronize(buffers.workspaces[0], loss, batch_size);
+}
+
+template <typename T>
+void BasicMLP<T>::reduce_gradients(int num_shards, TrainingBuffers& buffers){
+    std::vector<std::vector<Workspace>>& workspaces = buffers.workspaces;
+    int num_layers = layers.size();
+
+    // level by level: shard t accumulates shard t + stride, the pairing only depends on num_shards
+    for(int stride = 1; stride < num_shards; stride *= 2){
+        int num_pairs = (num_shards - stride + 2 * stride - 1) / (2 * stride);
+
+        pool->parallel_for(num_pairs * num_layers, [&](int k){
+            int t = (k / num_layers) * 2 * stride;
+            int l = k % num_layers;
+            workspaces[t][l].grad_weights += workspaces[t + stride][l].grad_weights;
+            workspaces[t][l].grad_bias += workspaces[t + stride][l].grad_bias;
+        });
+    }
+}
+
+template <typename T>
+double BasicMLP<T>::evaluate(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y, BasicLossFunction<T>* loss_function) const{
+    Matrix y_pred;
+    return evaluate(x, y, loss_function, nullptr, thread_scratch(), y_pred);
+}
+
+template <typename T>
+double BasicMLP<T>::evaluate(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y, BasicLossFunction<T>* loss_function,
+        const ParameterSnapshot* parameters, InferenceScratch& scratch, Matrix& y_pred) const{
+    MLP_PROFILE_SCOPE(profiler.get(), Profiler::MODEL, Phase::Evaluate, 0);
+    infer(x, y_pred, scratch, parameters);
+    return loss_function->loss(y, y_pred);
+}
+
+template <typename T>
+double BasicMLP<T>::evaluate(const Eigen::Ref<const SparseMatrix>& x, const Eigen::Ref<const Matrix>& y, BasicLossFunction<T>* loss_function) const{
+    Matrix y_pred;
+    return evaluate(x, y, loss_function, nullptr, thread_scratch(), y_pred);
 }
 
-double MLP::evaluate(Eigen::MatrixXd x, Eigen::MatrixXd y, LossFunction* loss_function){
-    Eigen::MatrixXd y_pred = predict(x);
+template <typename T>
+double BasicMLP<T>::evaluate(const Eigen::Ref<const SparseMatrix>& x, const Eigen::Ref<const Matrix>& y, BasicLossFunction<T>* loss_function,
+        const ParameterSnapshot* parameters, InferenceScratch& scratch, Matrix& y_pred) const{
+    MLP_PROFILE_SCOPE(profiler.get(), Profiler::MODEL, Phase::Evaluate, 0);
+    infer(x, y_pred, scratch, parameters);
     return loss_function->loss(y, y_pred);
 }
 
-std::vector<std::pair<double, double>> MLP::fit(Eigen::MatrixXd x, Eigen::MatrixXd y, Eigen::MatrixXd x_test, Eigen::MatrixXd y_test, int epochs, int num_minibatches, double learning_rate, double weight_decay, double momentum, LossFunction* loss_function){
+template <typename T>
+std::vector<long> BasicMLP<T>::evaluation_sample(long rows) const{
+    long count = evaluation_options.subsample;
+    if(count <= 0 || count >= rows) return {};
+
+    std::vector<long> sample(rows);
+    std::iota(sample.begin(), sample.end(), 0L);
+    std::mt19937 rng(evaluation_options.seed);
+    for(long i = 0; i < count; i++){ // partial Fisher-Yates, the first count rows are a uniform sample
+        std::uniform_int_distribution<long> pick(i, rows - 1);
+        std::swap(sample[i], sample[pick(rng)]);
+    }
+    sample.resize(count);
+    std::sort(sample.begin(), sample.end()); // gather in memory order
+    return sample;
+}
+
+// ---------------------------------------- EpochEvaluator ----------------------------------------
+template <typename T>
+void BasicMLP<T>::EpochEvaluator::end_epoch(int epoch, int epochs, double train_loss){
+    const EvaluationOptions& options = model.evaluation_options;
+    history.push_back(std::make_pair(train_loss, std::numeric_limits<double>::quiet_NaN()));
+
+    bool due = (epoch + 1) % std::max(1, options.every) == 0 || epoch == epochs - 1;
+    if(!due) return;
+
+    if(!options.async){
+        history.back().second = evaluate(nullptr, scratch, y_pred);
+        return;
+    }
+
+    finish(); // the snapshot is free again
+    int num_layers = model.layers.size();
+    snapshot.weights.resize(num_layers);
+    snapshot.bias.resize(num_layers);
+    for(int i = 0; i < num_layers; i++){ // same shapes every epoch, no allocation after the first one
+        snapshot.weights[i] = model.layers[i]->get_weights();
+        snapshot.bias[i] = model.layers[i]->get_bias();
+    }
+
+    pending = epoch;
+    thread = std::thread([this]{
+        try{
+            pending_loss = evaluate(&snapshot, scratch, y_pred);
+        }catch(...){
+            error = std::current_exception();
+        }
+    });
+}
+
+template <typename T>
+void BasicMLP<T>::EpochEvaluator::finish(){
+    if(pending < 0) return;
+    thread.join();
+
+    int epoch = pending;
+    pending = -1;
+    if(error){
+        std::exception_ptr e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+    }
+    history[epoch].second = pending_loss;
+}
+
+template <typename T>
+BasicMLP<T>::EpochEvaluator::~EpochEvaluator(){
+    if(thread.joinable()) thread.join(); // fit is unwinding, the result is dropped
+}
+
+template <typename T>
+std::vector<std::pair<double, double>> BasicMLP<T>::fit(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y,
+        const Eigen::Ref<const Matrix>& x_test, const Eigen::Ref<const Matrix>& y_test, int epochs, int num_minibatches, double learning_rate, double weight_decay, double momentum, BasicLossFunction<T>* loss_function){
+    MinibatchOptions batching = {(int)(x.rows() / num_minibatches), false, 0, true}; // fixed order, remainder skipped
+    return fit(x, y, x_test, y_test, epochs, batching, learning_rate, weight_decay, momentum, loss_function);
+}
+
+template <typename T>
+std::vector<std::pair<double, double>> BasicMLP<T>::fit(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y,
+        const Eigen::Ref<const Matrix>& x_test, const Eigen::Ref<const Matrix>& y_test, int epochs, const MinibatchOptions& batching, double learning_rate, double weight_decay, double momentum, BasicLossFunction<T>* loss_function){
+    use_sgd(learning_rate, weight_decay, momentum);
+    return fit(x, y, x_test, y_test, epochs, batching, loss_function);
+}
+
+template <typename T>
+std::vector<std::pair<double, double>> BasicMLP<T>::fit(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y,
+        const Eigen::Ref<const Matrix>& x_test, const Eigen::Ref<const Matrix>& y_test, int epochs, const MinibatchOptions& batching, BasicLossFunction<T>* loss_function){
+    if(!optimizer) throw std::logic_error("BasicMLP::fit: no optimizer set");
+
     std::vector<std::pair<double, double>> loss_history; //store the loss history both for training and testing
+    loss_history.reserve(epochs);
+    BasicMinibatchIterator<T> minibatches(x, y, batching); //views on the data, or gathered into reused buffers when shuffling
+
+    std::vector<long> sample = evaluation_sample(x_test.rows()); //test rows gathered once, if subsampling
+    Matrix x_sample(sample.size(), x_test.cols()), y_sample(sample.size(), y_test.cols());
+    for(int r = 0; r < sample.size(); r++){
+        x_sample.row(r) = x_test.row(sample[r]);
+        y_sample.row(r) = y_test.row(sample[r]);
+    }
+
+    EpochEvaluator evaluator(*this, [&](const ParameterSnapshot* parameters, InferenceScratch& scratch, Matrix& y_pred){
+        if(!sample.empty()) return evaluate(x_sample, y_sample, loss_function, parameters, scratch, y_pred);
+        return evaluate(x_test, y_test, loss_function, parameters, scratch, y_pred);
+    }, loss_history);
     
     for(int i = 0; i < epochs; i++){
-        double tmp_train_loss = 0;
-        for(int j = 0; j < num_minibatches; j++){
-            int batch_size = x.rows() / num_minibatches;
-            Eigen::MatrixXd x_train_batch = x.block(j * batch_size, 0, batch_size, x.cols()); //take the input minibatch 
-            Eigen::MatrixXd y_true_batch = y.block(j * batch_size, 0, batch_size, y.cols()); //take the targets minibatch
+        double train_loss = train_epoch(minibatches, batching.batch_size, loss_function);
+        evaluator.end_epoch(i, epochs, train_loss); //test loss of the epoch, overlapping the next one
+    }
+
+    evaluator.finish();
+    return loss_history;
+}
+
+template <typename T>
+template <typename Minibatches>
+double BasicMLP<T>::train_epoch(Minibatches& minibatches, int batch_size, BasicLossFunction<T>* loss_function){
+    double train_loss = 0;
+    double num_batches = 0; //the partial minibatch counts as a fraction of a full one
+    minibatches.begin_epoch();
+    while(minibatches.next()){
+        TrainingBuffers& buffers = minibatches.rows() == batch_size ? full_batches : last_batch;
+        double weight = (double)minibatches.rows() / batch_size;
+
+        train_loss += weight * train_step(minibatches.x_batch(), minibatches.y_batch(), loss_function, buffers); //forward and backward pass
+        update(buffers.workspaces[0]); //update weights
+        num_batches += weight;
+    }
+
+    return num_batches > 0 ? train_loss / num_batches : 0;
+}
+
+template <typename T>
+std::vector<std::pair<double, double>> BasicMLP<T>::fit_lbfgs(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y,
+        const Eigen::Ref<const Matrix>& x_test, const Eigen::Ref<const Matrix>& y_test, int iterations, const LBFGSOptions& options, BasicLossFunction<T>* loss_function){
+    LBFGS lbfgs(options);
+    int num_layers = layers.size();
+
+    std::vector<std::pair<double, double>> loss_history;
+    loss_history.reserve(iterations);
+
+    std::vector<long> sample = evaluation_sample(x_test.rows());
+    Matrix x_sample(sample.size(), x_test.cols()), y_sample(sample.size(), y_test.cols());
+    for(int r = 0; r < sample.size(); r++){
+        x_sample.row(r) = x_test.row(sample[r]);
+        y_sample.row(r) = y_test.row(sample[r]);
+    }
+    auto test_loss = [&](const ParameterSnapshot* parameters, InferenceScratch& scratch, Matrix& y_pred){
+        if(!sample.empty()) return evaluate(x_sample, y_sample, loss_function, parameters, scratch, y_pred);
+        return evaluate(x_test, y_test, loss_function, parameters, scratch, y_pred);
+    };
+    EpochEvaluator evaluator(*this, test_loss, loss_history);
+
+    // flat parameters: the weights then the bias of every layer, column-major
+    long size = 0;
+    for(const auto& layer : layers) size += layer->get_weights().size() + layer->get_bias().size();
+    Eigen::VectorXd parameters(size);
+    double* p = parameters.data();
+    for(const auto& layer : layers){
+        for(const Matrix* param : {&layer->get_weights(), &layer->get_bias()}){
+            Eigen::Map<Eigen::MatrixXd>(p, param->rows(), param->cols()) = param->template cast<double>();
+            p += param->size();
+        }
+    }
+
+    std::vector<Matrix> weights(num_layers), bias(num_layers); // parameters of type T handed to the layers
+    double train_loss = 0; // loss of the last evaluation, without weight decay
+    auto objective = [&](const Eigen::VectorXd& parameters, Eigen::VectorXd& gradient){
+        const double* p = parameters.data();
+        for(int i = 0; i < num_layers; i++){
+            int rows = layers[i]->get_output_size(), cols = layers[i]->get_input_size();
+            weights[i] = Eigen::Map<const Eigen::MatrixXd>(p, rows, cols).template cast<T>();
+            bias[i] = Eigen::Map<const Eigen::MatrixXd>(p + rows * cols, rows, 1).template cast<T>();
+            layers[i]->set_parameters(weights[i], bias[i]);
+            p += rows * (cols + 1);
+        }
+
+        train_loss = train_step(x, y, loss_function, full_batches); // whole dataset: one minibatch
+        double penalty = 0;
+        double* g = gradient.data();
+        for(int i = 0; i < num_layers; i++){
+            const Workspace& ws = full_batches.workspaces[0][i];
+            const Matrix& w = layers[i]->get_weights();
+            Eigen::Map<Eigen::MatrixXd> grad_weights(g, w.rows(), w.cols());
+            grad_weights = ws.grad_weights.template cast<double>();
+            if(options.weight_decay != 0){
+                grad_weights += options.weight_decay * w.template cast<double>();
+                penalty += 0.5 * options.weight_decay * w.template cast<double>().squaredNorm();
+            }
+            const Matrix& mask = layers[i]->get_mask();
+            if(mask.size() > 0) grad_weights.array() *= mask.template cast<double>().array(); // pruned weights stay at zero
+            g += w.size();
+
+            Eigen::Map<Eigen::MatrixXd>(g, w.rows(), 1) = ws.grad_bias.template cast<double>();
+            g += w.rows();
+        }
+        return train_loss + penalty;
+    };
+
+    lbfgs.minimize(objective, parameters, iterations, [&](int iteration, double){
+        evaluator.end_epoch(iteration, iterations, train_loss);
+    });
+
+    evaluator.finish();
+    if(!loss_history.empty() && std::isnan(loss_history.back().second)){ // stopped early between two evaluations
+        Matrix y_pred;
+        loss_history.back().second = test_loss(nullptr, thread_scratch(), y_pred);
+    }
+    return loss_history;
+}
+
+template <typename T>
+std::vector<std::pair<double, double>> BasicMLP<T>::fit(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y,
+        const std::vector<long>& train_rows, const std::vector<long>& test_rows, int epochs, const MinibatchOptions& batching, BasicLossFunction<T>* loss_function){
+    if(!optimizer) throw std::logic_error("BasicMLP::fit: no optimizer set");
+    for(long row : test_rows){
+        if(row < 0 || row >= x.rows()) throw std::invalid_argument("BasicMLP::fit: row out of range");
+    }
+
+    std::vector<std::pair<double, double>> loss_history;
+    loss_history.reserve(epochs);
+    BasicMinibatchIterator<T> minibatches(x, y, train_rows, batching);
+
+    std::vector<long> rows = test_rows;
+    std::vector<long> sample = evaluation_sample(test_rows.size());
+    if(!sample.empty()){
+        for(int r = 0; r < sample.size(); r++) rows[r] = test_rows[sample[r]];
+        rows.resize(sample.size());
+    }
+
+    EpochEvaluator evaluator(*this, [&](const ParameterSnapshot* parameters, InferenceScratch& scratch, Matrix& y_pred){
+        return evaluate(x, y, rows, loss_function, parameters, scratch, y_pred);
+    }, loss_history);
+
+    for(int i = 0; i < epochs; i++){
+        evaluator.end_epoch(i, epochs, train_epoch(minibatches, batching.batch_size, loss_function));
+    }
+
+    evaluator.finish();
+    return loss_history;
+}
+
+template <typename T>
+double BasicMLP<T>::evaluate(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y, const std::vector<long>& rows,
+        BasicLossFunction<T>* loss_function) const{
+    InferenceScratch scratch; // the gathered chunks are not kept in the scratch of the thread
+    Matrix y_pred;
+    return evaluate(x, y, rows, loss_function, nullptr, scratch, y_pred);
+}
+
+template <typename T>
+double BasicMLP<T>::evaluate(const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y, const std::vector<long>& rows,
+        BasicLossFunction<T>* loss_function, const ParameterSnapshot* parameters, InferenceScratch& scratch, Matrix& y_pred) const{
+    constexpr int CHUNK_ROWS = 4096;
+    Matrix& x_chunk = scratch.x_chunk;
+    Matrix& y_chunk = scratch.y_chunk;
+
+    double loss = 0;
+    for(long begin = 0; begin < rows.size(); begin += CHUNK_ROWS){
+        int count = std::min<long>(CHUNK_ROWS, rows.size() - begin);
+        x_chunk.resize(count, x.cols());
+        y_chunk.resize(count, y.cols());
+        gather_rows<T>(x, rows.data() + begin, count, x_chunk);
+        gather_rows<T>(y, rows.data() + begin, count, y_chunk);
+        loss += count * evaluate(x_chunk, y_chunk, loss_function, parameters, scratch, y_pred);
+    }
 
-            Eigen::MatrixXd y_pred = predict(x_train_batch); //forward pass
-            tmp_train_loss += loss_function->loss(y_true_batch, y_pred); //compute loss of the minibatch
-            Eigen::MatrixXd loss_grad = loss_function->backward(y_true_batch, y_pred); //compute loss gradient
+    return rows.size() > 0 ? loss / rows.size() : 0;
+}
+
+template <typename T>
+double BasicMLP<T>::evaluate(const BasicMappedDataset<T>& data, BasicLossFunction<T>* loss_function) const{
+    InferenceScratch scratch; // the gathered chunks are not kept in the scratch of the thread
+    Matrix y_pred;
+    return evaluate(data, loss_function, nullptr, scratch, y_pred);
+}
+
+template <typename T>
+double BasicMLP<T>::evaluate(const BasicMappedDataset<T>& data, BasicLossFunction<T>* loss_function,
+        const ParameterSnapshot* parameters, InferenceScratch& scratch, Matrix& y_pred) const{
+    constexpr int CHUNK_ROWS = 4096;
+    Matrix& x_chunk = scratch.x_chunk;
+    Matrix& y_chunk = scratch.y_chunk;
+
+    double loss = 0;
+    for(long begin = 0; begin < data.rows(); begin += CHUNK_ROWS){
+        int rows = std::min<long>(CHUNK_ROWS, data.rows() - begin);
+        data.gather_range(begin, rows, x_chunk, y_chunk);
+        loss += rows * evaluate(x_chunk, y_chunk, loss_function, parameters, scratch, y_pred);
+    }
+
+    return data.rows() > 0 ? loss / data.rows() : 0;
+}
+
+template <typename T>
+std::vector<std::pair<double, double>> BasicMLP<T>::fit(const BasicMappedDataset<T>& train, const BasicMappedDataset<T>& test, int epochs, int num_minibatches,
+        double learning_rate, double weight_decay, double momentum, BasicLossFunction<T>* loss_function, bool shuffle){
+    use_sgd(learning_rate, weight_decay, momentum);
+    return fit(train, test, epochs, MinibatchOptions{(int)(train.rows() / num_minibatches), shuffle, 0, true}, loss_function);
+}
+
+template <typename T>
+std::vector<std::pair<double, double>> BasicMLP<T>::fit(const BasicMappedDataset<T>& train, const BasicMappedDataset<T>& test, int epochs,
+        const MinibatchOptions& batching, BasicLossFunction<T>* loss_function){
+    if(!optimizer) throw std::logic_error("BasicMLP::fit: no optimizer set");
+    if(batching.batch_size <= 0) throw std::invalid_argument("BasicMLP::fit: batch_size must be positive");
+
+    std::vector<std::pair<double, double>> loss_history;
+    loss_history.reserve(epochs);
+    int batches_per_epoch = batching.num_batches(train.rows());
+
+    BasicBatchPrefetcher<T> prefetcher(train, batching.batch_size, batches_per_epoch, epochs, batching.shuffle, batching.seed);
+    typename BasicBatchPrefetcher<T>::Batch batch;
+
+    std::vector<long> sample = evaluation_sample(test.rows()); // test rows gathered once, if subsampling
+    Matrix x_sample, y_sample;
+    if(!sample.empty()) test.gather(sample.data(), sample.size(), x_sample, y_sample);
+
+    EpochEvaluator evaluator(*this, [&](const ParameterSnapshot* parameters, InferenceScratch& scratch, Matrix& y_pred){
+        if(!sample.empty()) return evaluate(x_sample, y_sample, loss_function, parameters, scratch, y_pred);
+        return evaluate(test, loss_function, parameters, scratch, y_pred);
+    }, loss_history);
+
+    for(int i = 0; i < epochs; i++){
+        double tmp_train_loss = 0;
+        double num_batches = 0;
+        for(int j = 0; j < batches_per_epoch && prefetcher.next(batch); j++){ // the next minibatches load while this one trains
+            TrainingBuffers& buffers = batch.x.rows() == batching.batch_size ? full_batches : last_batch;
+            double weight = (double)batch.x.rows() / batching.batch_size;
 
-            backward(loss_grad); //backward pass
-            update(learning_rate, weight_decay, momentum); //update weights
+            tmp_train_loss += weight * train_step(batch.x, batch.y, loss_function, buffers);
+            update(buffers.workspaces[0]);
+            num_batches += weight;
         }
 
-        loss_history.push_back(std::make_pair(tmp_train_loss / num_minibatches, evaluate(x_test, y_test, loss_function)));
+        evaluator.end_epoch(i, epochs, num_batches > 0 ? tmp_train_loss / num_batches : 0);
     }
 
+    evaluator.finish();
     return loss_history;
-}
\ No newline at end of file
+}
+
+template <typename T>
+std::vector<std::pair<double, double>> BasicMLP<T>::fit(const SparseMatrix& x, const Eigen::Ref<const Matrix>& y,
+        const SparseMatrix& x_test, const Eigen::Ref<const Matrix>& y_test, int epochs, const MinibatchOptions& batching, BasicLossFunction<T>* loss_function){
+    if(!optimizer) throw std::logic_error("BasicMLP::fit: no optimizer set");
+
+    std::vector<std::pair<double, double>> loss_history;
+    loss_history.reserve(epochs);
+    BasicSparseMinibatchIterator<T> minibatches(x, y, batching); //row ranges of x, or gathered into a reused buffer when shuffling
+
+    std::vector<long> sample = evaluation_sample(x_test.rows()); //test rows gathered once, if subsampling
+    SparseMatrix x_sample(sample.size(), x_test.cols());
+    Matrix y_sample(sample.size(), y_test.cols());
+    if(!sample.empty()){
+        gather_rows<T>(x_test, sample.data(), sample.size(), x_sample);
+        gather_rows<T>(y_test, sample.data(), sample.size(), y_sample);
+    }
+
+    EpochEvaluator evaluator(*this, [&](const ParameterSnapshot* parameters, InferenceScratch& scratch, Matrix& y_pred){
+        if(!sample.empty()) return evaluate(x_sample, y_sample, loss_function, parameters, scratch, y_pred);
+        return evaluate(x_test, y_test, loss_function, parameters, scratch, y_pred);
+    }, loss_history);
+
+    for(int i = 0; i < epochs; i++){
+        evaluator.end_epoch(i, epochs, train_epoch(minibatches, batching.batch_size, loss_function));
+    }
+
+    evaluator.finish();
+    return loss_history;
+}
+
+template <typename T>
+void BasicMLP<T>::enable_master_weights(){
+    for(int i = 0; i < layers.size(); i++){
+        layers[i]->enable_master_weights();
+    }
+}
+
+template <typename T>
+void BasicMLP<T>::prune_magnitude(double sparsity, int layer){
+    if(layer < -1 || layer >= (int)layers.size()) throw std::invalid_argument("BasicMLP::prune_magnitude: no layer " + std::to_string(layer));
+
+    for(int i = 0; i < layers.size(); i++){
+        if(layer == -1 || layer == i) layers[i]->prune_magnitude(sparsity);
+    }
+}
+
+template <typename T>
+void BasicMLP<T>::prune_neurons(int layer, double fraction){
+    if(layer < 0 || layer + 1 >= (int)layers.size()) throw std::invalid_argument("BasicMLP::prune_neurons: layer " + std::to_string(layer) + " is not a hidden layer");
+    if(!(fraction >= 0 && fraction < 1)) throw std::invalid_argument("BasicMLP::prune_neurons: fraction must be in [0, 1)");
+
+    // the neurons whose incoming weights are the smallest contribute the least to the next layer
+    const Matrix& weights = layers[layer]->get_weights();
+    int size = weights.rows();
+    std::vector<int> order(size);
+    std::iota(order.begin(), order.end(), 0);
+    int removed = std::min<int>(std::lround(fraction * size), size - 1);
+    Eigen::VectorXd norms = weights.template cast<double>().rowwise().norm();
+    std::nth_element(order.begin(), order.begin() + removed, order.end(), [&](int a, int b){ return norms(a) < norms(b); });
+
+    order.resize(removed);
+    remove_neurons(layer, order);
+}
+
+template <typename T>
+void BasicMLP<T>::remove_neurons(int layer, const std::vector<int>& neurons){
+    if(layer < 0 || layer + 1 >= (int)layers.size()) throw std::invalid_argument("BasicMLP::remove_neurons: layer " + std::to_string(layer) + " is not a hidden layer");
+
+    int size = layers[layer]->get_output_size();
+    std::vector<bool> removed(size, false);
+    for(int neuron : neurons){
+        if(neuron < 0 || neuron >= size) throw std::invalid_argument("BasicMLP::remove_neurons: no neuron " + std::to_string(neuron));
+        removed[neuron] = true;
+    }
+    std::vector<int> kept;
+    for(int i = 0; i < size; i++){
+        if(!removed[i]) kept.push_back(i);
+    }
+    if(kept.empty()) throw std::invalid_argument("BasicMLP::remove_neurons: at least one neuron must be kept");
+
+    // the optimizer state follows its parameters: rows of the weights and bias of the layer, columns of the next weights
+    if(optimizer){
+        for(int k = 0; k < optimizer->get_num_buffers(); k++){
+            for(int slot : {2 * layer, 2 * layer + 1}){
+                const Matrix* state = optimizer->get_buffer(slot, k);
+                if(state && state->rows() == size) optimizer->set_buffer(slot, k, (*state)(kept, Eigen::all).eval());
+            }
+            const Matrix* state = optimizer->get_buffer(2 * layer + 2, k);
+            if(state && state->cols() == size) optimizer->set_buffer(2 * layer + 2, k, (*state)(Eigen::all, kept).eval());
+        }
+    }
+
+    layers[layer]->keep_outputs(kept);
+    layers[layer + 1]->keep_inputs(kept);
+    set_checkpointing(checkpoint_every); // clears the training buffers, shaped for the former layers
+}
+
+template class BasicMLP<float>;
+template class BasicMLP<double>;
@@ -0,0 +1,268 @@
+#include "../includes/model_selection.hpp"
+#include "../includes/mlp.hpp"
+#include "../includes/thread_pool.hpp"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+// ---------------------------------------- SearchSpace ----------------------------------------
+std::vector<HyperParameters> SearchSpace::grid() const{
+    std::vector<HyperParameters> configurations;
+    for(const auto& topology : topologies){
+        for(ActivationType activation : hidden_activations){
+            for(double learning_rate : learning_rates){
+                for(double momentum : momentums){
+                    for(double weight_decay : weight_decays){
+                        for(int batch_size : batch_sizes){
+                            configurations.push_back({topology, activation, output_activation, learning_rate, momentum, weight_decay, batch_size});
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return configurations;
+}
+
+std::vector<HyperParameters> SearchSpace::random(int count, unsigned seed) const{
+    std::mt19937 rng(seed);
+
+    auto pick = [&](const auto& values){
+        if(values.empty()) throw std::invalid_argument("SearchSpace::random: no candidate value");
+        return values[std::uniform_int_distribution<std::size_t>(0, values.size() - 1)(rng)];
+    };
+    auto uniform = [&](const std::vector<double>& values){
+        auto [low, high] = std::minmax_element(values.begin(), values.end());
+        return std::uniform_real_distribution<double>(*low, *high)(rng);
+    };
+    auto log_uniform = [&](const std::vector<double>& values){ // scale parameters: every order of magnitude is as likely
+        std::vector<double> positive;
+        for(double v : values) if(v > 0) positive.push_back(v);
+        if(positive.size() < values.size() && std::bernoulli_distribution(1.0 / values.size())(rng)) return 0.0;
+        if(positive.empty()) return 0.0;
+
+        auto [low, high] = std::minmax_element(positive.begin(), positive.end());
+        return std::exp(std::uniform_real_distribution<double>(std::log(*low), std::log(*high))(rng));
+    };
+
+    std::vector<HyperParameters> configurations;
+    for(int i = 0; i < count; i++){
+        HyperParameters p;
+        p.hidden_layers = pick(topologies);
+        p.hidden_activation = pick(hidden_activations);
+        p.output_activation = output_activation;
+        p.learning_rate = log_uniform(learning_rates);
+        p.momentum = uniform(momentums);
+        p.weight_decay = log_uniform(weight_decays);
+        p.batch_size = pick(batch_sizes);
+        configurations.push_back(p);
+    }
+    return configurations;
+}
+
+// ---------------------------------------- results ----------------------------------------
+static const char* activation_name(ActivationType type){
+    switch(type){
+        case ActivationType::Linear: return "linear";
+        case ActivationType::ReLU: return "relu";
+        case ActivationType::Sigmoid: return "sigmoid";
+        case ActivationType::Tanh: return "tanh";
+        case ActivationType::LeakyReLU: return "leaky_relu";
+        case ActivationType::GELU: return "gelu";
+        case ActivationType::SiLU: return "silu";
+        case ActivationType::FastSigmoid: return "fast_sigmoid";
+        case ActivationType::FastTanh: return "fast_tanh";
+        case ActivationType::FastGELU: return "fast_gelu";
+        case ActivationType::FastSiLU: return "fast_silu";
+        default: return "custom";
+    }
+}
+
+void print_search_results(std::ostream& out, const std::vector<SearchResult>& results){
+    char line[200];
+    std::snprintf(line, sizeof(line), "%-5s %-16s %-8s %10s %8s %10s %6s %7s %12s %12s %12s\n",
+            "rank", "hidden", "act", "lr", "momentum", "wd", "batch", "epochs", "train", "validation", "std");
+    out << line;
+    for(int i = 0; i < results.size(); i++){
+        const SearchResult& r = results[i];
+        const HyperParameters& p = r.parameters;
+
+        std::string hidden;
+        for(int j = 0; j < p.hidden_layers.size(); j++) hidden += (j ? "-" : "") + std::to_string(p.hidden_layers[j]);
+
+        std::snprintf(line, sizeof(line), "%-5d %-16s %-8s %10.3g %8.3g %10.3g %6d %7d %12.6g %12.6g %12.6g\n",
+                i + 1, hidden.c_str(), activation_name(p.hidden_activation), p.learning_rate, p.momentum, p.weight_decay, p.batch_size,
+                r.epochs, r.train_loss, r.validation_loss, r.validation_std);
+        out << line;
+    }
+}
+
+// ---------------------------------------- ModelSelection ----------------------------------------
+template <typename T>
+BasicModelSelection<T>::BasicModelSelection(const Matrix& x, const Matrix& y, int num_folds, unsigned seed)
+    : x(x.data(), x.rows(), x.cols(), Eigen::OuterStride<>(x.outerStride())), y(y.data(), y.rows(), y.cols(), Eigen::OuterStride<>(y.outerStride())){
+    if(x.rows() != y.rows()) throw std::invalid_argument("BasicModelSelection: x and y have a different number of rows");
+    if(num_folds < 2 || num_folds > x.rows()) throw std::invalid_argument("BasicModelSelection: invalid number of folds");
+
+    std::vector<long> order(x.rows());
+    std::iota(order.begin(), order.end(), 0L);
+    std::mt19937 rng(seed);
+    std::shuffle(order.begin(), order.end(), rng);
+
+    std::vector<int> fold_of(x.rows());
+    for(int f = 0; f < num_folds; f++){
+        for(long i = x.rows() * f / num_folds; i < x.rows() * (f + 1) / num_folds; i++) fold_of[order[i]] = f;
+    }
+
+    // rows in increasing order within every fold, the gathers then read the data forward
+    train_rows.resize(num_folds);
+    validation_rows.resize(num_folds);
+    for(long i = 0; i < x.rows(); i++){
+        for(int f = 0; f < num_folds; f++) (fold_of[i] == f ? validation_rows[f] : train_rows[f]).push_back(i);
+    }
+};
+
+template <typename T>
+std::vector<SearchResult> BasicModelSelection<T>::run(const std::vector<HyperParameters>& configurations, BasicLossFunction<T>* loss_function,
+        const SearchOptions& options) const{
+    for(const HyperParameters& p : configurations){
+        bool valid = p.batch_size > 0 && p.hidden_activation != ActivationType::Custom && p.output_activation != ActivationType::Custom;
+        for(int neurons : p.hidden_layers) valid = valid && neurons > 0;
+        if(!valid) throw std::invalid_argument("BasicModelSelection::run: invalid configuration");
+    }
+    if(options.min_epochs <= 0 || options.max_epochs <= 0) throw std::invalid_argument("BasicModelSelection::run: the epochs must be positive");
+
+    int num_configurations = configurations.size();
+    int num_folds = get_num_folds();
+
+    // rungs of successive halving: min_epochs, eta * min_epochs, ..., max_epochs
+    std::vector<int> rungs;
+    if(options.eta > 1){
+        for(long epochs = std::min(options.min_epochs, options.max_epochs); epochs < options.max_epochs; epochs *= options.eta) rungs.push_back(epochs);
+    }
+    rungs.push_back(options.max_epochs);
+
+    // one trial per configuration and fold, trial c * num_folds + f
+    struct Trial {
+        std::unique_ptr<BasicMLP<T>> model;
+        double train_loss = 0;
+        double validation_loss = 0;
+        std::exception_ptr error;
+    };
+    std::vector<Trial> trials(num_configurations * num_folds);
+    std::vector<double> cost(num_configurations); // weights of the model, proportional to the time of an epoch
+
+    for(int c = 0; c < num_configurations; c++){
+        const HyperParameters& p = configurations[c];
+        std::vector<int> sizes = p.hidden_layers;
+        sizes.push_back(y.cols());
+
+        int input_size = x.cols();
+        for(int neurons : sizes){
+            cost[c] += double(input_size + 1) * neurons;
+            input_size = neurons;
+        }
+
+        for(int f = 0; f < num_folds; f++){
+            std::vector<std::pair<int, BasicActivationFunction<T>*>> layers;
+            for(int l = 0; l < sizes.size(); l++){
+                layers.push_back({sizes[l], make_activation<T>(l + 1 < sizes.size() ? p.hidden_activation : p.output_activation).release()});
+            }
+
+            std::srand(options.seed + c); // every fold of a configuration starts from the same weights
+            auto model = std::make_unique<BasicMLP<T>>(x.cols(), layers);
+            model->set_optimizer(std::make_unique<BasicSGD<T>>(p.learning_rate, p.momentum, p.weight_decay));
+            model->set_evaluation(EvaluationOptions{false, INT_MAX}); // only the last epoch of a rung is scored
+            trials[c * num_folds + f].model = std::move(model);
+        }
+    }
+
+    std::vector<SearchResult> results(num_configurations);
+    for(int c = 0; c < num_configurations; c++){
+        results[c].parameters = configurations[c];
+        results[c].fold_losses.resize(num_folds);
+    }
+
+    auto score = [](double loss){ return std::isnan(loss) ? std::numeric_limits<double>::infinity() : loss; }; // diverged trainings rank last
+
+    int num_threads = options.num_threads > 0 ? options.num_threads : std::max(1u, std::thread::hardware_concurrency());
+    ThreadPool pool(num_threads);
+
+    std::vector<int> alive(num_configurations);
+    std::iota(alive.begin(), alive.end(), 0);
+    int trained = 0;
+
+    for(int r = 0; r < rungs.size(); r++){
+        int epochs = rungs[r] - trained;
+
+        // largest models first, so that the last jobs to start are short ones
+        std::vector<int> jobs;
+        for(int c : alive){
+            for(int f = 0; f < num_folds; f++) jobs.push_back(c * num_folds + f);
+        }
+        std::stable_sort(jobs.begin(), jobs.end(), [&](int a, int b){ return cost[a / num_folds] > cost[b / num_folds]; });
+
+        pool.parallel_for(jobs.size(), [&](int j){
+            Trial& trial = trials[jobs[j]];
+            int c = jobs[j] / num_folds, f = jobs[j] % num_folds;
+            try{
+                MinibatchOptions batching = {configurations[c].batch_size, true, options.seed + (unsigned)(r * num_folds + f)};
+                auto history = trial.model->fit(x, y, train_rows[f], validation_rows[f], epochs, batching, loss_function);
+                trial.train_loss = history.back().first;
+                trial.validation_loss = history.back().second;
+            }catch(...){
+                trial.error = std::current_exception();
+            }
+        });
+
+        for(int job : jobs){
+            if(trials[job].error) std::rethrow_exception(trials[job].error);
+        }
+        trained = rungs[r];
+
+        for(int c : alive){
+            SearchResult& result = results[c];
+            result.epochs = trained;
+            result.train_loss = 0;
+            result.validation_loss = 0;
+            for(int f = 0; f < num_folds; f++){
+                const Trial& trial = trials[c * num_folds + f];
+                result.fold_losses[f] = trial.validation_loss;
+                result.train_loss += trial.train_loss / num_folds;
+                result.validation_loss += trial.validation_loss / num_folds;
+            }
+
+            double variance = 0;
+            for(double loss : result.fold_losses) variance += (loss - result.validation_loss) * (loss - result.validation_loss) / num_folds;
+            result.validation_std = std::sqrt(variance);
+        }
+
+        if(r + 1 < rungs.size()){ // keep the best 1/eta, free the models of the others
+            std::stable_sort(alive.begin(), alive.end(), [&](int a, int b){ return score(results[a].validation_loss) < score(results[b].validation_loss); });
+            int keep = std::max<int>(1, (alive.size() + options.eta - 1) / options.eta);
+            for(int i = keep; i < alive.size(); i++){
+                for(int f = 0; f < num_folds; f++) trials[alive[i] * num_folds + f].model.reset();
+            }
+            alive.resize(keep);
+        }
+    }
+
+    std::stable_sort(results.begin(), results.end(), [&](const SearchResult& a, const SearchResult& b){
+        if(a.epochs != b.epochs) return a.epochs > b.epochs;
+        return score(a.validation_loss) < score(b.validation_loss);
+    });
+    return results;
+};
+
+template class BasicModelSelection<float>;
+template class BasicModelSelection<double>;
@@ -0,0 +1,100 @@
+#include "../includes/optimizer.hpp"
+#include <algorithm>
+#include <cmath>
+
+// ---------------------------------------- SGD ----------------------------------------
+template <typename T>
+BasicSGD<T>::BasicSGD(double learning_rate, double momentum, double weight_decay, bool nesterov)
+    : BasicOptimizerKernel<BasicSGD<T>, T>(learning_rate, weight_decay), momentum(momentum), nesterov(nesterov) {};
+
+template <typename T>
+template <typename P>
+void BasicSGD<T>::apply(typename BasicOptimizer<T>::template Buffers<P>& state, P* param, const T* grad, Eigen::Index n, bool decay){
+    const P lr = this->learning_rate;
+    const P mu = momentum;
+    const P wd = decay ? this->weight_decay : 0;
+    P* velocity = state[0].data();
+
+    for(Eigen::Index i = 0; i < n; i++){
+        P g = P(grad[i]) + wd * param[i]; // L2 regularization pulls the weights towards zero
+        P v = mu * velocity[i] + lr * g;
+        velocity[i] = v;
+        param[i] -= nesterov ? mu * v + lr * g : v;
+    }
+};
+
+template class BasicSGD<float>;
+template class BasicSGD<double>;
+template class BasicOptimizerKernel<BasicSGD<float>, float>;
+template class BasicOptimizerKernel<BasicSGD<double>, double>;
+
+
+// ---------------------------------------- Adam ----------------------------------------
+template <typename T>
+BasicAdam<T>::BasicAdam(double learning_rate, double weight_decay, double beta1, double beta2, double epsilon)
+    : BasicOptimizerKernel<BasicAdam<T>, T>(learning_rate, weight_decay), beta1(beta1), beta2(beta2), epsilon(epsilon) {};
+
+template <typename T>
+template <typename P>
+void BasicAdam<T>::apply(typename BasicOptimizer<T>::template Buffers<P>& state, P* param, const T* grad, Eigen::Index n, bool decay){
+    long t = std::max(1L, this->step_count);
+    const P lr = this->learning_rate;
+    const P b1 = beta1, b2 = beta2, eps = epsilon;
+    const P c1 = 1 / (1 - std::pow(beta1, t)); // bias corrections
+    const P c2 = 1 / (1 - std::pow(beta2, t));
+    const P wd = decay ? this->weight_decay : 0;
+    const P l2 = decoupled ? 0 : wd; // added to the gradient
+    const P shrink = decoupled ? lr * wd : 0; // applied to the weights
+    P* m = state[0].data();
+    P* v = state[1].data();
+
+    for(Eigen::Index i = 0; i < n; i++){
+        P g = P(grad[i]) + l2 * param[i];
+        m[i] = b1 * m[i] + (1 - b1) * g;
+        v[i] = b2 * v[i] + (1 - b2) * g * g;
+        param[i] -= lr * (m[i] * c1) / (std::sqrt(v[i] * c2) + eps) + shrink * param[i];
+    }
+};
+
+template class BasicAdam<float>;
+template class BasicAdam<double>;
+template class BasicOptimizerKernel<BasicAdam<float>, float>;
+template class BasicOptimizerKernel<BasicAdam<double>, double>;
+
+template <typename T>
+BasicAdamW<T>::BasicAdamW(double learning_rate, double weight_decay, double beta1, double beta2, double epsilon)
+    : BasicAdam<T>(learning_rate, weight_decay, beta1, beta2, epsilon) {
+    this->decoupled = true;
+};
+
+template class BasicAdamW<float>;
+template class BasicAdamW<double>;
+
+
+// ---------------------------------------- RMSProp ----------------------------------------
+template <typename T>
+BasicRMSProp<T>::BasicRMSProp(double learning_rate, double weight_decay, double rho, double momentum, double epsilon)
+    : BasicOptimizerKernel<BasicRMSProp<T>, T>(learning_rate, weight_decay), rho(rho), epsilon(epsilon), momentum(momentum) {};
+
+template <typename T>
+template <typename P>
+void BasicRMSProp<T>::apply(typename BasicOptimizer<T>::template Buffers<P>& state, P* param, const T* grad, Eigen::Index n, bool decay){
+    const P lr = this->learning_rate;
+    const P r = rho, eps = epsilon, mu = momentum;
+    const P wd = decay ? this->weight_decay : 0;
+    P* mean_square = state[0].data();
+    P* buffer = state[1].data();
+
+    for(Eigen::Index i = 0; i < n; i++){
+        P g = P(grad[i]) + wd * param[i];
+        mean_square[i] = r * mean_square[i] + (1 - r) * g * g;
+        P step = g / (std::sqrt(mean_square[i]) + eps);
+        buffer[i] = mu * buffer[i] + step; // plain RMSProp when momentum is 0
+        param[i] -= lr * buffer[i];
+    }
+};
+
+template class BasicRMSProp<float>;
+template class BasicRMSProp<double>;
+template class BasicOptimizerKernel<BasicRMSProp<float>, float>;
+template class BasicOptimizerKernel<BasicRMSProp<double>, double>;
@@ -0,0 +1,113 @@
+#include "../includes/profiler.hpp"
+#include "../includes/allocation_counter.hpp"
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+// ---------------------------------------- allocation counting ----------------------------------------
+// the counters live with the malloc wrapper (see allocation_counter.hpp), linked by profiling builds only
+#if defined(MLP_PROFILE)
+std::pair<long, long> Profiler::thread_allocations(){
+    return ::thread_allocations();
+}
+#else
+std::pair<long, long> Profiler::thread_allocations(){
+    return {0, 0};
+}
+#endif
+
+const char* phase_name(Phase phase){
+    switch(phase){
+        case Phase::Forward: return "forward";
+        case Phase::Activation: return "activation";
+        case Phase::Backward: return "backward";
+        case Phase::Update: return "update";
+        case Phase::Loss: return "loss";
+        case Phase::Evaluate: return "evaluate";
+        case Phase::Sync: return "sync";
+    }
+    return "unknown";
+}
+
+Profiler::Profiler(int num_layers, std::size_t max_trace_events) : stats(num_layers + 1), max_trace_events(max_trace_events), origin(clock::now()){
+    events.reserve(max_trace_events); // recording must not allocate inside an enclosing scope
+}
+
+void Profiler::record(int layer, Phase phase, clock::time_point start, double seconds, double flops, long allocations, long bytes_allocated){
+    std::lock_guard<std::mutex> lock(mutex);
+
+    PhaseStats& s = stats[layer + 1][(int)phase];
+    s.calls++;
+    s.seconds += seconds;
+    s.flops += flops;
+    s.allocations += allocations;
+    s.bytes_allocated += bytes_allocated;
+
+    if(events.size() < max_trace_events){
+        auto thread = threads.try_emplace(std::this_thread::get_id(), (int)threads.size()).first;
+        events.push_back({layer, phase, thread->second, start, seconds, flops, bytes_allocated});
+    }
+}
+
+PhaseStats Profiler::get_stats(int layer, Phase phase) const{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats[layer + 1][(int)phase];
+}
+
+void Profiler::reset(){
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto& layer : stats) layer.fill(PhaseStats());
+    events.clear();
+    origin = clock::now();
+}
+
+void Profiler::print_summary(std::ostream& out) const{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    double total = 0;
+    for(const auto& layer : stats){
+        for(int p = 0; p < NUM_PHASES; p++){
+            if(p != (int)Phase::Evaluate) total += layer[p].seconds; // evaluate encloses the layer records of inference
+        }
+    }
+
+    char line[160];
+    std::snprintf(line, sizeof(line), "%-8s %-11s %10s %12s %7s %10s %12s %14s\n", "layer", "phase", "calls", "time [ms]", "share", "GFLOP/s", "allocations", "bytes alloc");
+    out << line;
+    for(int l = 0; l < stats.size(); l++){
+        for(int p = 0; p < NUM_PHASES; p++){
+            const PhaseStats& s = stats[l][p];
+            if(s.calls == 0) continue;
+
+            std::string layer = l == 0 ? "model" : std::to_string(l - 1);
+            double share = total > 0 && p != (int)Phase::Evaluate ? 100 * s.seconds / total : 0;
+            double gflops = s.seconds > 0 ? s.flops / s.seconds * 1e-9 : 0;
+            std::snprintf(line, sizeof(line), "%-8s %-11s %10ld %12.3f %6.1f%% %10.2f %12ld %14ld\n",
+                    layer.c_str(), phase_name(Phase(p)), s.calls, 1e3 * s.seconds, share, gflops, s.allocations, s.bytes_allocated);
+            out << line;
+        }
+    }
+}
+
+void Profiler::write_chrome_trace(const std::string& path) const{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ofstream file(path);
+    if(!file) throw std::runtime_error("Profiler: cannot write " + path);
+
+    // complete ("X") events, timestamps and durations in microseconds
+    file << std::fixed << std::setprecision(3) << "{\"traceEvents\": [\n";
+    for(std::size_t i = 0; i < events.size(); i++){
+        const Event& e = events[i];
+        std::string name = (e.layer == MODEL ? std::string("model") : "layer " + std::to_string(e.layer)) + " " + phase_name(e.phase);
+        double ts = std::chrono::duration<double, std::micro>(e.start - origin).count();
+
+        file << "{\"name\": \"" << name << "\", \"cat\": \"" << phase_name(e.phase) << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << e.thread
+             << ", \"ts\": " << ts << ", \"dur\": " << 1e6 * e.seconds
+             << ", \"args\": {\"flops\": " << e.flops << ", \"bytes_allocated\": " << e.bytes_allocated << "}}"
+             << (i + 1 < events.size() ? ",\n" : "\n");
+    }
+    file << "], \"displayTimeUnit\": \"ms\"}\n";
+
+    if(!file) throw std::runtime_error("Profiler: cannot write " + path);
+}
@@ -0,0 +1,199 @@
+#include "../includes/quantized_mlp.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+constexpr int KERNEL_WIDTH = 16; // int8 values consumed by one iteration of the SIMD kernels
+
+/**
+ * @brief Dot product of two int8 vectors with int32 accumulation, n is a multiple of KERNEL_WIDTH.
+ */
+inline int32_t dot_i8(const int8_t* a, const int8_t* b, int n){
+#if defined(__AVX2__)
+    __m256i acc = _mm256_setzero_si256();
+    for(int k = 0; k < n; k += KERNEL_WIDTH){
+        // sign-extend 16 int8 to int16, then multiply-add adjacent pairs into 8 int32
+        __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + k)));
+        __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + k)));
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+        acc = _mm256_dpwssd_epi32(acc, va, vb); // VNNI: fused multiply-add of the int16 pairs
+#elif defined(__AVXVNNI__)
+        acc = _mm256_dpwssd_avx_epi32(acc, va, vb);
+#else
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+#endif
+    }
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+#else
+    int32_t acc = 0;
+    for(int k = 0; k < n; k++){
+        acc += int32_t(a[k]) * int32_t(b[k]);
+    }
+    return acc;
+#endif
+}
+
+inline int8_t quantize(float value, float inv_scale){
+    int q = (int)std::nearbyint(value * inv_scale); // round to nearest, vectorizes unlike lround
+    return (int8_t)std::min(127, std::max(-127, q));
+}
+
+} // namespace
+
+template <typename T>
+BasicQuantizedMLP<T>::BasicQuantizedMLP(const BasicMLP<T>& model){
+    for(int l = 0; l < model.get_num_layers(); l++){
+        const BasicFCLayer<T>& fc = model.get_layer(l);
+        QuantizedLayer layer;
+
+        layer.activation = activation_type(fc.get_activation());
+        if(layer.activation == ActivationType::Custom){
+            throw std::invalid_argument("BasicQuantizedMLP: only built-in activation functions can be quantized");
+        }
+
+        layer.input_size = fc.get_input_size();
+        layer.output_size = fc.get_output_size();
+        layer.stride = (layer.input_size + KERNEL_WIDTH - 1) / KERNEL_WIDTH * KERNEL_WIDTH;
+        layer.weights.assign((std::size_t)layer.output_size * layer.stride, 0);
+        layer.weight_scales.resize(layer.output_size);
+        layer.bias.resize(layer.output_size);
+
+        // symmetric per-output-channel quantization: the largest weight of the row maps to 127
+        for(int o = 0; o < layer.output_size; o++){
+            double max_abs = fc.get_weights().row(o).cwiseAbs().maxCoeff();
+            float scale = max_abs > 0 ? float(max_abs / 127.0) : 1.0f;
+
+            layer.weight_scales[o] = scale;
+            layer.bias[o] = float(fc.get_bias()(o, 0));
+            for(int k = 0; k < layer.input_size; k++){
+                layer.weights[(std::size_t)o * layer.stride + k] = quantize(float(fc.get_weights()(o, k)), 1.0f / scale);
+            }
+        }
+
+        layers.push_back(std::move(layer));
+    }
+}
+
+template <typename T>
+template <typename Derived>
+void BasicQuantizedMLP<T>::quantize_input(const Eigen::MatrixBase<Derived>& x, const QuantizedLayer& layer, Scratch& scratch){
+    int batch_size = x.rows();
+    scratch.input.assign((std::size_t)batch_size * layer.stride, 0); // keeps the padding at zero
+    scratch.input_scales.resize(batch_size);
+
+    for(int i = 0; i < batch_size; i++){
+        float scale = layer.input_scale;
+        if(scale == 0){ // dynamic: one scale per row
+            float max_abs = float(x.row(i).cwiseAbs().maxCoeff());
+            scale = max_abs > 0 ? max_abs / 127.0f : 1.0f;
+        }
+
+        scratch.input_scales[i] = scale;
+        int8_t* row = scratch.input.data() + (std::size_t)i * layer.stride;
+        for(int k = 0; k < layer.input_size; k++){
+            row[k] = quantize(float(x(i, k)), 1.0f / scale);
+        }
+    }
+}
+
+template <typename T>
+void BasicQuantizedMLP<T>::layer_forward(const QuantizedLayer& layer, int batch_size, const Scratch& scratch, Eigen::MatrixXf& out){
+    out.resize(batch_size, layer.output_size);
+
+    for(int i = 0; i < batch_size; i++){
+        const int8_t* x_row = scratch.input.data() + (std::size_t)i * layer.stride;
+        for(int o = 0; o < layer.output_size; o++){
+            int32_t acc = dot_i8(x_row, layer.weights.data() + (std::size_t)o * layer.stride, layer.stride);
+            out(i, o) = float(acc) * scratch.input_scales[i] * layer.weight_scales[o] + layer.bias[o]; // dequantize + bias
+        }
+    }
+
+    apply_activation(layer.activation, out);
+}
+
+template <typename T>
+void BasicQuantizedMLP<T>::infer(const Eigen::Ref<const Matrix>& x, Matrix& out) const{
+    static thread_local Scratch scratch;
+    Eigen::MatrixXf* current = &scratch.ping;
+    Eigen::MatrixXf* other = &scratch.pong;
+
+    quantize_input(x, layers[0], scratch);
+    layer_forward(layers[0], x.rows(), scratch, *current);
+    for(int l = 1; l < layers.size(); l++){
+        quantize_input(*current, layers[l], scratch);
+        layer_forward(layers[l], x.rows(), scratch, *other);
+        std::swap(current, other);
+    }
+
+    out = current->template cast<T>();
+}
+
+template <typename T>
+typename BasicQuantizedMLP<T>::Matrix BasicQuantizedMLP<T>::predict(const Eigen::Ref<const Matrix>& x) const{
+    Matrix out;
+    infer(x, out);
+    return out;
+}
+
+template <typename T>
+void BasicQuantizedMLP<T>::calibrate(const Eigen::Ref<const Matrix>& x){
+    clear_calibration();
+
+    Scratch scratch;
+    Eigen::MatrixXf input = x.template cast<float>();
+    Eigen::MatrixXf output;
+
+    // run the dynamic model layer by layer and record the range of the input of each layer
+    for(int l = 0; l < layers.size(); l++){
+        float max_abs = input.cwiseAbs().maxCoeff();
+
+        quantize_input(input, layers[l], scratch);
+        layer_forward(layers[l], input.rows(), scratch, output);
+        layers[l].input_scale = max_abs > 0 ? max_abs / 127.0f : 1.0f;
+        std::swap(input, output);
+    }
+}
+
+template <typename T>
+void BasicQuantizedMLP<T>::clear_calibration(){
+    for(QuantizedLayer& layer : layers){
+        layer.input_scale = 0;
+    }
+}
+
+template <typename T>
+QuantizationReport BasicQuantizedMLP<T>::drift(const BasicMLP<T>& reference, const Eigen::Ref<const Matrix>& x, const Eigen::Ref<const Matrix>& y,
+        BasicLossFunction<T>* loss_function) const{
+    Matrix y_reference = reference.predict(x);
+    Matrix y_quantized = predict(x);
+    auto error = (y_reference - y_quantized).array().abs();
+
+    QuantizationReport report;
+    report.reference_loss = loss_function->loss(y, y_reference);
+    report.quantized_loss = loss_function->loss(y, y_quantized);
+    report.max_abs_error = error.maxCoeff();
+    report.mean_abs_error = error.mean();
+    return report;
+}
+
+template <typename T>
+std::size_t BasicQuantizedMLP<T>::size_bytes() const{
+    std::size_t size = 0;
+    for(const QuantizedLayer& layer : layers){
+        size += layer.weights.size() * sizeof(int8_t) + (layer.weight_scales.size() + layer.bias.size()) * sizeof(float);
+    }
+    return size;
+}
+
+template class BasicQuantizedMLP<float>;
+template class BasicQuantizedMLP<double>;
@@ -0,0 +1,68 @@
+#include "../includes/thread_pool.hpp"
+
+ThreadPool::ThreadPool(int num_threads){
+    for(int i = 1; i < num_threads; i++){
+        workers.emplace_back(&ThreadPool::worker_loop, this);
+    }
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    start_cv.notify_all();
+
+    for(std::thread& worker : workers){
+        worker.join();
+    }
+}
+
+void ThreadPool::execute(){
+    for(int i = next_task.fetch_add(1); i < num_tasks; i = next_task.fetch_add(1)){
+        task(task_ctx, i);
+    }
+}
+
+void ThreadPool::worker_loop(){
+    long seen_generation = 0;
+
+    while(true){
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            start_cv.wait(lock, [&]{ return stop || generation != seen_generation; });
+            if(stop) return;
+            seen_generation = generation;
+        }
+
+        execute();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(--active_workers == 0) done_cv.notify_one();
+        }
+    }
+}
+
+void ThreadPool::run(int n, void (*task)(void*, int), void* ctx){
+    if(workers.empty()){ // nothing to dispatch, run inline
+        for(int i = 0; i < n; i++) task(ctx, i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->task = task;
+        task_ctx = ctx;
+        num_tasks = n;
+        next_task = 0;
+        active_workers = workers.size();
+        generation++;
+    }
+    start_cv.notify_all();
+
+    execute(); // the caller works too
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [&]{ return active_workers == 0; });
+}
@@ -0,0 +1,157 @@
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+#include <eigen3/Eigen/Dense>
+
+#include "../includes/activation_function.hpp"
+
+// ---------------------------------------- references ----------------------------------------
+// evaluated in long double, so that their own rounding is negligible next to the bounds checked
+using Reference = std::function<long double(long double)>;
+
+long double tanh_ref(long double z) {return std::tanh(z);}
+long double sigmoid_ref(long double z) {return 1 / (1 + std::exp(-z));}
+long double silu_ref(long double z) {return z * sigmoid_ref(z);}
+long double gelu_ref(long double z) {return 0.5L * z * (1 + std::erf(z / std::sqrt(2.0L)));}
+long double gelu_tanh_ref(long double z) {return z * sigmoid_ref(2 * std::sqrt(2 / M_PIl) * (z + 0.044715L * z * z * z));}
+
+int failures = 0;
+
+void check(const std::string& name, double measured, double bound){
+    bool ok = measured <= bound;
+    std::cout << name << ": " << measured << " (bound " << bound << ") " << (ok ? "ok" : "FAILED") << "\n";
+    failures += !ok;
+}
+
+/**
+ * @brief Points of [-20, 20] every 1e-4, then the magnitudes 2^-40 to 20 on a log scale, of both signs.
+ */
+template <typename T>
+Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> grid(){
+    std::vector<T> points;
+    for(long i = -200000; i <= 200000; i++) points.push_back(T(i * 1e-4L));
+    for(long double z = std::ldexp(1.0L, -40); z < 20; z *= 1.0001L){
+        points.push_back(T(z));
+        points.push_back(T(-z));
+    }
+    return Eigen::Map<Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>(points.data(), points.size(), 1); // odd size: packets and scalar tail
+}
+
+/**
+ * @brief Distance to the reference in units in the last place of T at the reference.
+ */
+template <typename T>
+double ulps(T value, long double reference){
+    T rounded = std::abs(T(reference));
+    T ulp = std::nextafter(rounded, std::numeric_limits<T>::infinity()) - rounded;
+    return double(std::abs(value - reference) / ulp);
+}
+
+/**
+ * @brief Max error of an activation over the grid: absolute, absolute divided by |z|, and in ULP where the reference
+ * is at least min_ulp_reference (ULP are meaningless where an absolute error meets a vanishing output).
+ */
+struct Errors { double absolute = 0, scaled = 0, ulp = 0; };
+
+template <typename T>
+Errors errors(const BasicActivationFunction<T>& func, const Reference& reference, long double min_ulp_reference = 0){
+    auto z = grid<T>();
+    Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> a = func.activate(z);
+
+    Errors e;
+    for(long i = 0; i < z.size(); i++){
+        long double r = reference(z(i));
+        double error = double(std::abs(a(i) - r));
+        e.absolute = std::max(e.absolute, error);
+        if(z(i) != 0) e.scaled = std::max(e.scaled, error / double(std::abs(z(i))));
+        if(std::abs(r) >= min_ulp_reference) e.ulp = std::max(e.ulp, ulps<T>(a(i), r));
+    }
+    return e;
+}
+
+// ---------------------------------------- approximation bounds ----------------------------------------
+// the bounds documented with the kernels (activation_function.hpp)
+void approximation_bounds(){
+    check("FastTanh float, ULP", errors(BasicFastTanh<float>(), tanh_ref).ulp, 7);
+    check("FastTanh double, absolute", errors(BasicFastTanh<double>(), tanh_ref).absolute, 2.2e-7);
+
+    check("FastSigmoid float, absolute", errors(BasicFastSigmoid<float>(), sigmoid_ref).absolute, 2.3e-7);
+    check("FastSigmoid double, absolute", errors(BasicFastSigmoid<double>(), sigmoid_ref).absolute, 1.1e-7);
+    check("FastSigmoid float, ULP (output >= 1/2)", errors(BasicFastSigmoid<float>(), sigmoid_ref, 0.5L).ulp, 4);
+
+    check("FastSiLU float, absolute / |x|", errors(BasicFastSiLU<float>(), silu_ref).scaled, 2.4e-7);
+    check("FastSiLU double, absolute / |x|", errors(BasicFastSiLU<double>(), silu_ref).scaled, 1.1e-7);
+    check("FastSiLU float, ULP (output >= 1/2)", errors(BasicFastSiLU<float>(), silu_ref, 0.5L).ulp, 4);
+
+    check("FastGELU float vs GELU, absolute", errors(BasicFastGELU<float>(), gelu_ref).absolute, 4.74e-4);
+    check("FastGELU double vs GELU, absolute", errors(BasicFastGELU<double>(), gelu_ref).absolute, 4.74e-4);
+    check("FastGELU double vs tanh form, absolute / |x|", errors(BasicFastGELU<double>(), gelu_tanh_ref).scaled, 1.1e-7);
+
+    // the exact activations stay within a few roundings of the references
+    check("Tanh float, ULP", errors(BasicTanh<float>(), tanh_ref).ulp, 7);
+    check("Sigmoid double, absolute", errors(BasicSigmoid<double>(), sigmoid_ref).absolute, 1e-15);
+    check("SiLU double, absolute / |x|", errors(BasicSiLU<double>(), silu_ref).scaled, 1e-15);
+    check("GELU double, absolute", errors(BasicGELU<double>(), gelu_ref).absolute, 1e-14);
+}
+
+// ---------------------------------------- derivatives ----------------------------------------
+/**
+ * @brief Max difference, divided by (1 + |z|)^power, between derivative() and the central difference of the function
+ * the activation computes (its reference, in long double), on [-20, 20] away from the kink at 0. The in-place
+ * variants must give the same values as activate() and derivative().
+ */
+double derivative_error(const std::string& name, const BasicActivationFunction<double>& func, const Reference& reference, int power = 1){
+    const long double h = 1e-5L;
+    std::vector<double> points;
+    for(long i = -20000; i <= 20000; i++){
+        if(i != 0) points.push_back(i * 1e-3);
+    }
+    Eigen::MatrixXd z = Eigen::Map<Eigen::MatrixXd>(points.data(), points.size(), 1);
+    Eigen::MatrixXd d = func.derivative(z);
+
+    Eigen::MatrixXd a_into, d_into;
+    func.activate_into(z, a_into);
+    func.derivative_into(z, d_into);
+    if(a_into != func.activate(z) || d_into != d){
+        std::cout << name << ": activate_into / derivative_into differ from activate / derivative FAILED\n";
+        failures++;
+    }
+
+    double error = 0;
+    for(long i = 0; i < z.size(); i++){
+        long double difference = (reference(z(i) + h) - reference(z(i) - h)) / (2 * h);
+        error = std::max(error, double(std::abs(d(i) - difference)) / std::pow(1 + std::abs(z(i)), power));
+    }
+    return error;
+}
+
+void derivatives(){
+    auto relu = [](long double z) {return std::max(z, 0.0L);};
+    auto leaky = [](long double z) {return z > 0 ? z : 0.01L * z;};
+
+    // exact: limited by the finite difference, O(h^2)
+    check("Linear derivative", derivative_error("Linear", Linear(), [](long double z) {return z;}), 1e-9);
+    check("ReLU derivative", derivative_error("ReLU", ReLU(), relu), 1e-9);
+    check("LeakyReLU derivative", derivative_error("LeakyReLU", LeakyReLU(), leaky), 1e-9);
+    check("Sigmoid derivative", derivative_error("Sigmoid", Sigmoid(), sigmoid_ref), 1e-9);
+    check("Tanh derivative", derivative_error("Tanh", Tanh(), tanh_ref), 1e-9);
+    check("GELU derivative", derivative_error("GELU", GELU(), gelu_ref), 1e-9);
+    check("SiLU derivative", derivative_error("SiLU", SiLU(), silu_ref), 1e-9);
+
+    // fast: the derivative of the exact function at the approximate output, a few times the activation error
+    check("FastSigmoid derivative", derivative_error("FastSigmoid", FastSigmoid(), sigmoid_ref), 2.2e-7);
+    check("FastTanh derivative", derivative_error("FastTanh", FastTanh(), tanh_ref), 4.4e-7);
+    check("FastSiLU derivative", derivative_error("FastSiLU", FastSiLU(), silu_ref), 2.2e-7);
+    // the sigmoid error is multiplied by z du/dz, cubic in z (see BasicFastGELU)
+    check("FastGELU derivative (tanh form), / (1 + |x|)^3", derivative_error("FastGELU", FastGELU(), gelu_tanh_ref, 3), 1.1e-7);
+}
+
+int main(){
+    approximation_bounds();
+    derivatives();
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,80 @@
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <eigen3/Eigen/Dense>
+
+#include "../includes/allocation_counter.hpp"
+#include "../includes/mlp.hpp"
+
+// subclasses of the built-ins are Custom activations: their layers take the generic (virtual) path
+class CustomReLU : public ReLU {};
+class CustomTanh : public Tanh {};
+class CustomLinear : public Linear {};
+
+/**
+ * @brief Heap allocations of the training steps of a model, after warm-up.
+ * 
+ * The steps are not timed one by one: the difference between an epoch of 2k minibatches and one of k minibatches
+ * (same batch size, test set and evaluation) cancels the per-epoch work, leaving k training steps.
+ * 
+ * @param warm_up Allocations of the first epoch, which sizes the workspaces: 0 means nothing is counted
+ */
+double step_allocations(MLP& mlp, bool shuffle, long& warm_up){
+    int features = 16, outputs = 4, batch = 32, k = 8;
+    Eigen::MatrixXd x = Eigen::MatrixXd::Random(2 * k * batch, features);
+    Eigen::MatrixXd y = Eigen::MatrixXd::Random(2 * k * batch, outputs);
+    Eigen::MatrixXd x_test = Eigen::MatrixXd::Random(64, features), y_test = Eigen::MatrixXd::Random(64, outputs);
+    MSE mse;
+
+    mlp.set_evaluation(EvaluationOptions{.async = false});
+    MinibatchOptions batching{batch, shuffle};
+    auto epoch = [&](long rows){
+        long before = process_allocations();
+        mlp.fit(x.topRows(rows), y.topRows(rows), x_test, y_test, 1, batching, 1e-3, 0, 0.9, &mse);
+        return process_allocations() - before;
+    };
+
+    warm_up = epoch(2 * k * batch); // workspaces, optimizer state
+    epoch(k * batch);
+    long half = epoch(k * batch), full = epoch(2 * k * batch);
+    return double(full - half) / k;
+}
+
+std::unique_ptr<MLP> make_model(bool generic){
+    std::vector<std::pair<int, ActivationFunction*>> layers;
+    if(generic){
+        layers.push_back(std::make_pair(32, new CustomReLU()));
+        layers.push_back(std::make_pair(32, new CustomTanh()));
+        layers.push_back(std::make_pair(4, new CustomLinear()));
+    }else{
+        layers.push_back(std::make_pair(32, new ReLU()));
+        layers.push_back(std::make_pair(32, new GELU()));
+        layers.push_back(std::make_pair(32, new Sigmoid()));
+        layers.push_back(std::make_pair(4, new Linear()));
+    }
+    return std::make_unique<MLP>(16, layers);
+}
+
+int main(){
+    if(!counts_allocations()){
+        std::cout << "allocations: skipped, malloc cannot be counted on this platform\n";
+        return 0;
+    }
+
+    int failures = 0;
+    for(bool generic : {false, true}){
+        for(bool shuffle : {false, true}){
+            std::unique_ptr<MLP> mlp = make_model(generic);
+            long warm_up = 0;
+            double per_step = step_allocations(*mlp, shuffle, warm_up);
+            std::string name = std::string(generic ? "generic" : "fused") + " layers, " + (shuffle ? "shuffled" : "in order");
+            // a counter that misses the allocations of training would pass trivially
+            std::cout << name << ": " << warm_up << " allocations to warm up " << (warm_up > 0 ? "ok" : "FAILED") << "\n";
+            std::cout << name << ": " << per_step << " allocations per training step " << (per_step == 0 ? "ok" : "FAILED") << "\n";
+            failures += warm_up <= 0 || per_step != 0;
+        }
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,118 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <eigen3/Eigen/Dense>
+
+#include <unistd.h>
+
+#include "../includes/checkpoint.hpp"
+#include "../includes/mlp.hpp"
+
+int failures = 0;
+
+void check(const std::string& name, bool ok){
+    std::cout << name << ": " << (ok ? "ok" : "FAILED") << "\n";
+    failures += !ok;
+}
+
+const std::string PATH = "/tmp/mlp_test_checkpoint_" + std::to_string(getpid()) + ".ckpt";
+
+template <typename T>
+BasicMLP<T> build(){
+    std::vector<std::pair<int, BasicActivationFunction<T>*>> layers;
+    layers.push_back(std::make_pair(16, new BasicReLU<T>()));
+    layers.push_back(std::make_pair(16, new BasicTanh<T>()));
+    layers.push_back(std::make_pair(3, new BasicLinear<T>()));
+    return BasicMLP<T>(5, layers);
+}
+
+// ---------------------------------------- resume ----------------------------------------
+/**
+ * @brief Training saved with its momentum and loaded resumes exactly: the next epoch of the loaded model is
+ * bit-identical to the one of the model that was saved. Without the momentum it is not.
+ */
+template <typename T>
+void resume(const std::string& name){
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+    Matrix x = Matrix::Random(256, 5), y = Matrix::Random(256, 3);
+    BasicMSE<T> mse;
+    auto epoch = [&](BasicMLP<T>& mlp){
+        mlp.set_evaluation(EvaluationOptions{.async = false});
+        mlp.fit(x, y, x, y, 1, MinibatchOptions{32, false}, 0.01, 1e-4, 0.9, &mse);
+    };
+
+    BasicMLP<T> mlp = build<T>();
+    epoch(mlp);
+    epoch(mlp);
+    mlp.save(PATH);
+
+    BasicMappedMLP<T> mapped(PATH);
+    check(name + ", mapped checkpoint has the momentum", mapped.has_momentum());
+    T difference = (mapped.predict(x) - mlp.predict(x)).cwiseAbs().maxCoeff();
+    check(name + ", mapped checkpoint predicts as the model", difference <= 16 * Eigen::NumTraits<T>::epsilon());
+
+    BasicMLP<T> loaded(PATH);
+    check(name + ", loaded model predicts as the model", loaded.predict(x) == mlp.predict(x));
+    epoch(mlp);
+    epoch(loaded);
+    check(name + ", training resumes exactly", loaded.predict(x) == mlp.predict(x));
+
+    mlp.save(PATH, false);
+    BasicMLP<T> restarted(PATH);
+    epoch(mlp);
+    epoch(restarted);
+    check(name + ", without the momentum it does not", restarted.predict(x) != mlp.predict(x));
+    std::remove(PATH.c_str());
+}
+
+// ---------------------------------------- validation ----------------------------------------
+template <typename T>
+bool rejected(const std::vector<char>& bytes){
+    std::ofstream(PATH, std::ios::binary | std::ios::trunc).write(bytes.data(), bytes.size());
+    try{
+        BasicMappedMLP<T> mapped(PATH);
+    }catch(const std::runtime_error&){
+        return true;
+    }
+    return false;
+}
+
+void corrupted(){
+    build<double>().save(PATH);
+    std::vector<char> bytes;
+    {
+        std::ifstream file(PATH, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    std::vector<char> truncated(bytes.begin(), bytes.end() - 8);
+    check("truncated checkpoint is rejected", rejected<double>(truncated));
+
+    // 2^31 x 2^30 weights: their size in bytes, 2^64, wraps to 0 in uint64
+    std::vector<char> huge = bytes;
+    CheckpointHeader header;
+    CheckpointLayer layer;
+    std::memcpy(&header, huge.data(), sizeof(header));
+    std::memcpy(&layer, huge.data() + sizeof(header), sizeof(layer));
+    header.input_size = layer.input_size = 1u << 30;
+    layer.output_size = 1u << 31;
+    std::memcpy(huge.data(), &header, sizeof(header));
+    std::memcpy(huge.data() + sizeof(header), &layer, sizeof(layer));
+    check("weights larger than the file are rejected", rejected<double>(huge));
+
+    check("float checkpoint of a double model is rejected", rejected<float>(bytes));
+    std::remove(PATH.c_str());
+}
+
+int main(){
+    resume<double>("double");
+    resume<float>("float");
+    corrupted();
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,146 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <eigen3/Eigen/Dense>
+
+#include <unistd.h>
+
+#include "../includes/communicator.hpp"
+#include "../includes/mlp.hpp"
+
+int failures = 0;
+
+void check(const std::string& name, bool ok){
+    std::cout << name << ": " << (ok ? "ok" : "FAILED") << "\n";
+    failures += !ok;
+}
+
+/**
+ * @brief Run body on ranks processes, false if a rank failed (its reason is printed by launch_local)
+ */
+template <typename T>
+bool runs(int ranks, LaunchOptions::Transport transport, const std::function<void(BasicCommunicator<T>&)>& body){
+    LaunchOptions options;
+    options.transport = transport;
+    options.pin_cpus = false;
+    options.capacity = 1000; // all-reduces of several pieces
+    try{
+        launch_local<T>(ranks, body, options);
+        return true;
+    }catch(const std::runtime_error&){
+        return false;
+    }
+}
+
+// ---------------------------------------- all-reduce ----------------------------------------
+// integers below 2^20, so that the sums of up to 4 ranks are exact in float as in double
+template <typename T>
+void all_reduce_exact(LaunchOptions::Transport transport, const std::string& name){
+    const long count = 4099; // not a multiple of the pieces nor of the ranks
+    auto values = [](int rank){
+        std::mt19937 rng(rank);
+        std::vector<T> data(count);
+        for(T& v : data) v = T(long(rng() % (1 << 20)) - (1 << 19));
+        return data;
+    };
+
+    for(int ranks = 1; ranks <= 4; ranks++){
+        bool ok = runs<T>(ranks, transport, [&](BasicCommunicator<T>& communicator){
+            std::vector<T> data = values(communicator.get_rank()), expected(count, 0);
+            for(int r = 0; r < communicator.get_size(); r++){
+                std::vector<T> other = values(r);
+                for(long i = 0; i < count; i++) expected[i] += other[i];
+            }
+            communicator.all_reduce(data.data(), count);
+            if(data != expected) throw std::runtime_error("all_reduce: inexact sum");
+
+            data = values(communicator.get_rank());
+            communicator.broadcast(data.data(), count, communicator.get_size() - 1);
+            if(data != values(communicator.get_size() - 1)) throw std::runtime_error("broadcast: not the values of root");
+        });
+        check(name + ", all-reduce and broadcast exact on " + std::to_string(ranks) + " ranks", ok);
+    }
+}
+
+// ---------------------------------------- training ----------------------------------------
+MLP build(bool tanh = false){
+    std::vector<std::pair<int, ActivationFunction*>> layers;
+    layers.push_back(std::make_pair(16, tanh ? (ActivationFunction*)new Tanh() : new ReLU()));
+    layers.push_back(std::make_pair(2, new Linear()));
+    return MLP(4, layers);
+}
+
+/**
+ * @brief fit on 2 ranks with minibatches of B rows is fit on 1 process with minibatches of 2B rows, the minibatch i
+ * of rank 0 followed by the one of rank 1
+ */
+void two_ranks_match_one_process(){
+    const int batch = 16, epochs = 3;
+    Eigen::MatrixXd x = Eigen::MatrixXd::Random(512, 4);
+    Eigen::MatrixXd y = (x.leftCols(2).array().sin() * 2).matrix();
+    MSE mse;
+
+    std::string start = "/tmp/mlp_test_communicator_" + std::to_string(getpid()) + ".ckpt";
+    std::string trained = start + ".trained";
+    build().save(start);
+
+    bool ok = runs<double>(2, LaunchOptions::Transport::SharedMemory, [&](Communicator& communicator){
+        auto [begin, rows] = shard_range(x.rows(), communicator.get_rank(), communicator.get_size());
+        MLP mlp(start);
+        mlp.set_evaluation(EvaluationOptions{.async = false});
+        mlp.set_communicator(&communicator);
+        mlp.fit(x.middleRows(begin, rows), y.middleRows(begin, rows), x, y, epochs, MinibatchOptions{batch, false}, 0.01, 0, 0.9, &mse);
+        if(communicator.get_rank() == 0) mlp.save(trained);
+    });
+    check("two ranks train", ok);
+    if(!ok) return;
+
+    Eigen::MatrixXd xi(x.rows(), x.cols()), yi(y.rows(), y.cols());
+    long half = x.rows() / 2;
+    for(long i = 0; i < half / batch; i++){
+        xi.middleRows(2 * i * batch, batch) = x.middleRows(i * batch, batch);
+        xi.middleRows((2 * i + 1) * batch, batch) = x.middleRows(half + i * batch, batch);
+        yi.middleRows(2 * i * batch, batch) = y.middleRows(i * batch, batch);
+        yi.middleRows((2 * i + 1) * batch, batch) = y.middleRows(half + i * batch, batch);
+    }
+    MLP alone(start);
+    alone.set_evaluation(EvaluationOptions{.async = false});
+    alone.fit(xi, yi, x, y, epochs, MinibatchOptions{2 * batch, false}, 0.01, 0, 0.9, &mse);
+
+    // the same updates, up to the order of the sums of the gradients
+    double difference = (MLP(trained).predict(x) - alone.predict(x)).cwiseAbs().maxCoeff();
+    std::cout << "max difference to one process: " << difference << "\n";
+    check("two ranks match one process", difference < 1e-10);
+    std::remove(start.c_str());
+    std::remove(trained.c_str());
+}
+
+// same number of parameters, another activation: every rank must refuse it, rank 0 included
+void mismatch_fails_on_every_rank(){
+    bool ok = runs<double>(2, LaunchOptions::Transport::SharedMemory, [](Communicator& communicator){
+        MLP mlp = build(communicator.get_rank() == 1);
+        try{
+            mlp.set_communicator(&communicator);
+        }catch(const std::invalid_argument&){
+            return;
+        }
+        throw std::runtime_error("set_communicator accepted another model");
+    });
+    check("another activation on one rank throws on every rank", ok);
+}
+
+int main(){
+    all_reduce_exact<double>(LaunchOptions::Transport::SharedMemory, "shared memory, double");
+    all_reduce_exact<float>(LaunchOptions::Transport::SharedMemory, "shared memory, float");
+    all_reduce_exact<double>(LaunchOptions::Transport::Socket, "socket, double");
+    all_reduce_exact<float>(LaunchOptions::Transport::Socket, "socket, float");
+    two_ranks_match_one_process();
+    mismatch_fails_on_every_rank();
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,76 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <eigen3/Eigen/Dense>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../includes/inference_server.hpp"
+
+int failures = 0;
+
+void check(const std::string& name, bool ok){
+    std::cout << name << ": " << (ok ? "ok" : "FAILED") << "\n";
+    failures += !ok;
+}
+
+/**
+ * @brief Raw connection that sends prediction requests and never reads the answers
+ */
+int stalled_client(const std::string& path, int input_size, int requests){
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    std::snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) return -1;
+
+    std::vector<char> frame(sizeof(uint32_t) + input_size * sizeof(double), 0);
+    std::memcpy(frame.data(), &INFERENCE_PREDICT, sizeof(uint32_t));
+    for(int i = 0; i < requests; i++){
+        if(send(fd, frame.data(), frame.size(), MSG_NOSIGNAL) != (ssize_t)frame.size()) break; // dropped by the server
+    }
+    return fd;
+}
+
+int main(){
+    std::vector<std::pair<int, ActivationFunction*>> layers;
+    layers.push_back(std::make_pair(16, new ReLU()));
+    layers.push_back(std::make_pair(256, new Linear())); // large answers fill the socket buffers quickly
+    MLP mlp(8, layers);
+
+    BatchingOptions options;
+    options.max_unread_answers = 1024;
+    std::string path = "/tmp/mlp_test_inference_server_" + std::to_string(getpid()) + ".sock";
+    InferenceServer server(mlp, options);
+    server.listen_unix(path);
+
+    // a client pipelining requests without reading its answers must not stall the batching thread, nor get_stats
+    int stalled = stalled_client(path, mlp.get_input_size(), 20000);
+
+    Eigen::RowVectorXd x = Eigen::RowVectorXd::Random(mlp.get_input_size()), y(mlp.get_output_size());
+    std::string stats;
+    auto other = std::async(std::launch::async, [&]{
+        InferenceClient client(path);
+        for(int i = 0; i < 100; i++) client.predict(x, y);
+        stats = client.get_stats();
+        server.get_stats();
+    });
+    bool answered = other.wait_for(std::chrono::seconds(5)) == std::future_status::ready;
+    close(stalled); // unblocks a stalled server, so that a failure does not hang the test
+    other.wait();
+
+    check("other clients are answered while one does not read", answered);
+    check("answers are the model's", (y - mlp.predict(x)).cwiseAbs().maxCoeff() < 1e-12);
+    check("stats are served", stats.find("\"requests\"") != std::string::npos);
+
+    server.stop(); // must not hang on the dropped client
+    check("stop", true);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,198 @@
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <eigen3/Eigen/Dense>
+
+#include "../includes/lbfgs.hpp"
+#include "../includes/mlp.hpp"
+
+int failures = 0;
+
+void check(const std::string& name, double measured, double bound){
+    bool ok = measured <= bound;
+    std::cout << name << ": " << measured << " (bound " << bound << ") " << (ok ? "ok" : "FAILED") << "\n";
+    failures += !ok;
+}
+
+void check(const std::string& name, bool ok){
+    std::cout << name << ": " << (ok ? "ok" : "FAILED") << "\n";
+    failures += !ok;
+}
+
+using Vector = LBFGS::Vector;
+
+/**
+ * @brief Objective recording the point, loss and gradient of every evaluation
+ */
+struct Recorder {
+    std::vector<Vector> points, gradients;
+    std::vector<double> losses;
+
+    LBFGS::Objective wrap(const LBFGS::Objective& f){
+        return [this, f](const Vector& x, Vector& g){
+            double loss = f(x, g);
+            points.push_back(x);
+            gradients.push_back(g);
+            losses.push_back(loss);
+            return loss;
+        };
+    }
+};
+
+/**
+ * @brief Minimize f from x, and count the iterations whose accepted point violates the strong Wolfe conditions
+ * with respect to the previous one: loss decrease of at least c1 times the initial slope, slope reduced by c2
+ */
+int wolfe_violations(const LBFGS::Objective& f, Vector& x, int max_iterations, const LBFGSOptions& options, int& iterations){
+    LBFGS lbfgs(options);
+    Recorder recorder;
+    std::vector<int> accepted = {0}; // evaluation of the starting point, then of the point of every iteration
+    iterations = lbfgs.minimize(recorder.wrap(f), x, max_iterations, [&](int, double){
+        accepted.push_back(recorder.losses.size() - 1);
+    });
+
+    int violations = 0;
+    for(int k = 1; k < (int)accepted.size(); k++){
+        int a = accepted[k - 1], b = accepted[k];
+        Vector step = recorder.points[b] - recorder.points[a];
+        double slope0 = recorder.gradients[a].dot(step), slope = recorder.gradients[b].dot(step);
+        bool decrease = recorder.losses[b] <= recorder.losses[a] + options.c1 * slope0;
+        bool curvature = std::abs(slope) <= options.c2 * std::abs(slope0);
+        violations += !(slope0 < 0 && decrease && curvature);
+    }
+    return violations;
+}
+
+// ---------------------------------------- line search ----------------------------------------
+// convex quadratic 1/2 x'Ax - b'x, eigenvalues of A from 1 to 100
+void quadratic(){
+    const int n = 20;
+    Eigen::HouseholderQR<Eigen::MatrixXd> qr(Eigen::MatrixXd::Random(n, n));
+    Eigen::MatrixXd q = qr.householderQ();
+    Eigen::MatrixXd a = q * Eigen::VectorXd::LinSpaced(n, 1, 100).asDiagonal() * q.transpose();
+    Vector b = Vector::Random(n);
+    auto f = [&](const Vector& x, Vector& g){
+        g = a * x - b;
+        return 0.5 * x.dot(a * x) - b.dot(x);
+    };
+
+    Vector x = Vector::Zero(n);
+    int iterations;
+    int violations = wolfe_violations(f, x, 100, LBFGSOptions(), iterations);
+    check("quadratic: every step meets the strong Wolfe conditions", violations == 0);
+    check("quadratic: iterations", iterations, 2 * n);
+
+    // on to the rounding level of the loss, where a step may only settle for the lowest loss
+    LBFGSOptions options;
+    options.loss_tolerance = 0;
+    options.gradient_tolerance = 1e-10;
+    LBFGS(options).minimize(f, x, 100, nullptr);
+    check("quadratic: distance to the minimizer", (x - a.ldlt().solve(b)).cwiseAbs().maxCoeff(), 1e-9);
+}
+
+// Rosenbrock function, curved valley to (1, 1)
+void rosenbrock(){
+    auto f = [](const Vector& x, Vector& g){
+        double u = 1 - x(0), v = x(1) - x(0) * x(0);
+        g(0) = -2 * u - 400 * x(0) * v;
+        g(1) = 200 * v;
+        return u * u + 100 * v * v;
+    };
+
+    Vector x(2);
+    x << -1.2, 1;
+    int iterations;
+    int violations = wolfe_violations(f, x, 200, LBFGSOptions(), iterations);
+    check("Rosenbrock: every step meets the strong Wolfe conditions", violations == 0);
+    check("Rosenbrock: distance to (1, 1)", (x - Vector::Ones(2)).cwiseAbs().maxCoeff(), 1e-6);
+}
+
+// ---------------------------------------- fallback and best point ----------------------------------------
+/**
+ * @brief From some evaluation on, the objective reports the opposite of its gradient: the next direction goes
+ * uphill, the line search fails, the steepest descent is tried and fails as well, and the minimization stops at
+ * the last accepted point, where the objective is evaluated last.
+ */
+void fallback(){
+    const int n = 10, turn = 3; // the gradient of the point accepted at this iteration is already wrong
+    LBFGSOptions options;
+    options.max_line_search = 5;
+    Vector scale = Vector::LinSpaced(n, 1, 10);
+    auto honest = [&](const Vector& x, Vector& g){
+        g = scale.cwiseProduct(x);
+        return 0.5 * x.dot(g);
+    };
+
+    // the run without lies gives the evaluation of the point accepted at iteration turn
+    Vector start = Vector::Ones(n), x = start;
+    LBFGS reference(options);
+    long lie_from = 0;
+    Vector accepted;
+    reference.minimize(honest, x, 100, [&](int iteration, double){
+        if(iteration == turn){
+            lie_from = reference.get_evaluations() - 1;
+        }
+    });
+
+    long evaluations = 0;
+    auto lying = [&](const Vector& x, Vector& g){
+        double loss = honest(x, g);
+        if(evaluations++ >= lie_from) g = -g;
+        return loss;
+    };
+    LBFGS lbfgs(options);
+    Recorder recorder;
+    x = start;
+    long evaluations_at_turn = 0;
+    int iterations = lbfgs.minimize(recorder.wrap(lying), x, 100, [&](int iteration, double){
+        if(iteration == turn){
+            accepted = recorder.points.back();
+            evaluations_at_turn = recorder.points.size();
+        }
+    });
+
+    check("fallback: stops after the iteration of the first wrong gradient", iterations == turn + 1);
+    // a failed line search along the stored pairs, one along the steepest descent, and the best point again
+    long after = recorder.points.size() - evaluations_at_turn;
+    check("fallback: the steepest descent is tried after the stored pairs", after == 2 * options.max_line_search + 1);
+    check("fallback: returns the best point", x == accepted);
+    check("fallback: the objective was last evaluated at the best point", recorder.points.back() == accepted);
+}
+
+// ---------------------------------------- training ----------------------------------------
+// fit_lbfgs on a small smooth regression goes further than SGD with as many passes, and is deterministic
+void training(){
+    Eigen::MatrixXd x = Eigen::MatrixXd::Random(256, 2);
+    Eigen::MatrixXd y = (x.col(0).array() * 3).sin().matrix() + x.col(1).cwiseAbs2();
+    MSE mse;
+    auto build = [](){
+        std::srand(7);
+        std::vector<std::pair<int, ActivationFunction*>> layers;
+        layers.push_back(std::make_pair(16, new Tanh()));
+        layers.push_back(std::make_pair(1, new Linear()));
+        return MLP(2, layers);
+    };
+
+    MLP lbfgs = build(), again = build(), sgd = build();
+    auto history = lbfgs.fit_lbfgs(x, y, x, y, 300, LBFGSOptions(), &mse);
+    auto repeated = again.fit_lbfgs(x, y, x, y, 300, LBFGSOptions(), &mse);
+    auto sgd_history = sgd.fit(x, y, x, y, 300, MinibatchOptions{256, false}, 0.05, 0, 0.9, &mse);
+
+    bool decreasing = true;
+    for(std::size_t i = 1; i < history.size(); i++) decreasing = decreasing && history[i].first <= history[i - 1].first;
+    check("training: the train loss never increases", decreasing);
+    check("training: deterministic", history == repeated && lbfgs.predict(x) == again.predict(x));
+    check("training: the history ends at the loss of the model", std::abs(history.back().first - lbfgs.evaluate(x, y, &mse)), 1e-12);
+    std::cout << "train loss after 300 full-batch passes: L-BFGS " << history.back().first << ", SGD " << sgd_history.back().first << "\n";
+    check("training: L-BFGS below a tenth of the loss of SGD", history.back().first, 0.1 * sgd_history.back().first);
+}
+
+int main(){
+    quadratic();
+    rosenbrock();
+    fallback();
+    training();
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
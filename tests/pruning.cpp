@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <eigen3/Eigen/Dense>
+
+#include "../includes/mlp.hpp"
+
+int failures = 0;
+
+void check(const std::string& name, double measured, double bound){
+    bool ok = measured <= bound;
+    std::cout << name << ": " << measured << " (bound " << bound << ") " << (ok ? "ok" : "FAILED") << "\n";
+    failures += !ok;
+}
+
+void check(const std::string& name, bool ok){
+    std::cout << name << ": " << (ok ? "ok" : "FAILED") << "\n";
+    failures += !ok;
+}
+
+MLP build(){
+    std::vector<std::pair<int, ActivationFunction*>> layers;
+    layers.push_back(std::make_pair(128, new ReLU()));
+    layers.push_back(std::make_pair(64, new Tanh()));
+    layers.push_back(std::make_pair(4, new Linear()));
+    return MLP(32, layers);
+}
+
+/**
+ * @brief Dense forward pass with the weights of the model, the outputs of the neurons in dropped[l] of layer l
+ * set to zero
+ */
+Eigen::MatrixXd reference(const MLP& mlp, const Eigen::MatrixXd& x, const std::vector<std::vector<int>>& dropped = {}){
+    Eigen::MatrixXd a = x;
+    for(int l = 0; l < mlp.get_num_layers(); l++){
+        const FCLayer& layer = mlp.get_layer(l);
+        Eigen::MatrixXd z = a * layer.get_weights().transpose();
+        z.rowwise() += layer.get_bias().col(0).transpose();
+        a = layer.get_activation().activate(z);
+        if(l < (int)dropped.size()){
+            for(int neuron : dropped[l]) a.col(neuron).setZero();
+        }
+    }
+    return a;
+}
+
+// ---------------------------------------- magnitude pruning ----------------------------------------
+// pruned inference, through the CSR weights from SPARSE_MIN_ROWS rows and the dense ones below, is the dense product
+// of the zeroed weights, before and after fine-tuning
+void magnitude(){
+    MLP mlp = build();
+    mlp.prune_magnitude(0.9);
+
+    bool sparse = true;
+    long extra = 0; // weights kept beyond the 10% of every layer, rounded up
+    for(int l = 0; l < mlp.get_num_layers(); l++){
+        sparse = sparse && mlp.get_layer(l).has_sparse_weights();
+        const Eigen::MatrixXd& w = mlp.get_layer(l).get_weights();
+        extra = std::max(extra, long((w.array() != 0).count()) - long(std::ceil(0.1 * w.size())));
+    }
+    check("every layer keeps CSR weights", sparse);
+    check("weights kept beyond 10% of a layer", extra, 0);
+
+    for(int rows : {1, 3, 4, 64}){
+        Eigen::MatrixXd x = Eigen::MatrixXd::Random(rows, 32);
+        double difference = (mlp.predict(x) - reference(mlp, x)).cwiseAbs().maxCoeff();
+        check("pruned inference of " + std::to_string(rows) + " rows vs dense product", difference, 1e-12);
+    }
+
+    Eigen::MatrixXd x = Eigen::MatrixXd::Random(256, 32), y = Eigen::MatrixXd::Random(256, 4);
+    MSE mse;
+    std::vector<Eigen::MatrixXd> masks;
+    for(int l = 0; l < mlp.get_num_layers(); l++) masks.push_back((mlp.get_layer(l).get_weights().array() == 0).cast<double>());
+    mlp.fit(x, y, x, y, 2, MinibatchOptions{32, true}, 0.01, 1e-4, 0.9, &mse);
+
+    double revived = 0;
+    for(int l = 0; l < mlp.get_num_layers(); l++){
+        revived = std::max(revived, (mlp.get_layer(l).get_weights().array() * masks[l].array()).abs().maxCoeff());
+    }
+    check("fine-tuning keeps the pruned weights at zero", revived, 0);
+    check("fine-tuned inference vs dense product", (mlp.predict(x) - reference(mlp, x)).cwiseAbs().maxCoeff(), 1e-12);
+}
+
+// ---------------------------------------- structured pruning ----------------------------------------
+// removing neurons gives the predictions of the model with the outputs of those neurons set to zero
+void structured(){
+    MLP mlp = build();
+    Eigen::MatrixXd x = Eigen::MatrixXd::Random(64, 32);
+
+    std::vector<int> neurons = {0, 5, 17, 100, 127};
+    Eigen::MatrixXd expected = reference(mlp, x, {neurons});
+    mlp.remove_neurons(0, neurons);
+    check("remove_neurons shrinks the layer and the next one",
+          mlp.get_layer(0).get_output_size() == 123 && mlp.get_layer(1).get_input_size() == 123);
+    check("remove_neurons: predictions without the removed neurons", (mlp.predict(x) - expected).cwiseAbs().maxCoeff(), 1e-12);
+
+    // prune_neurons drops the neurons of smallest incoming L2 norm
+    Eigen::VectorXd norms = mlp.get_layer(1).get_weights().rowwise().norm();
+    std::vector<int> order(norms.size());
+    for(int i = 0; i < (int)order.size(); i++) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](int a, int b){return norms(a) < norms(b);});
+    std::vector<int> smallest(order.begin(), order.begin() + 16);
+
+    expected = reference(mlp, x, {{}, smallest});
+    mlp.prune_neurons(1, 0.25);
+    check("prune_neurons keeps 48 of 64 neurons", mlp.get_layer(1).get_output_size() == 48);
+    check("prune_neurons: predictions without the smallest neurons", (mlp.predict(x) - expected).cwiseAbs().maxCoeff(), 1e-12);
+
+    Eigen::MatrixXd y = Eigen::MatrixXd::Random(64, 4);
+    MSE mse;
+    double before = mlp.evaluate(x, y, &mse);
+    mlp.fit(x, y, x, y, 5, MinibatchOptions{16, false}, 0.01, 0, 0.9, &mse);
+    check("the shrunk model fine-tunes", mlp.evaluate(x, y, &mse) < before);
+}
+
+int main(){
+    magnitude();
+    structured();
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}